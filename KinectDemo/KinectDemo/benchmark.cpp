@@ -0,0 +1,357 @@
+// Headless pipeline benchmark.
+//
+// Replays a recording as fast as possible through the stages of the Qt
+// CKinectReader: update, depth colorization, skeleton snapshot, per-user
+// swipe gesture, plus the point cloud. Prints frames per second and the p50 /
+// p99 latency of every stage.
+//
+//     benchmark <recording.oni|dump.raw> [-frames n] [-dump out.raw] [-threads n]
+//
+// "-dump" writes the replayed frames as a raw dump (see rawframefile.h),
+// which replays without OpenNI decoding and so isolates the processing.
+//
+// Every depth map also goes through the lossless depth codec (see
+// depthcodec.h) outside the measured frame, to compare its size and speed
+// with storing the map raw.
+//
+// The depth filter (see depthfilter.h) also runs outside the measured
+// frame, on "-threads" threads, 2 by default. At 30 fps its p99 has to
+// stay below 33 ms.
+//
+// The skeletons go through the One Euro and the Holt joint filters (see
+// jointfilter.h), which report jitter before and after and the offset
+// from the raw joints they cost. The joint predictor (see jointpredictor.h)
+// reports how far its prediction of each frame is from the observed joints.
+//
+// The gesture recognizer (see dtwrecognizer.h) compares 6 users with 50
+// made up gestures every frame, thresholds so high that no group is
+// abandoned. Its p99 has to stay below 2 ms.
+//
+// The frame synchronizer (see framesync.h) pairs the depth and image
+// frames of the recording, to show how far apart they were taken.
+//
+// The software registration (see depthregistration.h) aligns every depth
+// map to the image, outside the measured frame. Its p99 has to stay below
+// 3 ms.
+//
+// The depth is also colorized only around the tracked users (see
+// userroi.h), into three images used in turn like the Qt capture thread
+// does, to compare with colorizing the whole frame.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "sensorsource.h"
+#include "rawframefile.h"
+#include "depthcodec.h"
+#include "depthfilter.h"
+#include "jointfilter.h"
+#include "jointpredictor.h"
+#include "dtwrecognizer.h"
+#include "depthcolorizer.h"
+#include "skeletonsnapshot.h"
+#include "gesturetracker.h"
+#include "pointcloud.h"
+#include "framestats.h"
+#include "framesync.h"
+#include "depthregistration.h"
+#include "userroi.h"
+
+using namespace std;
+
+/* Latency samples of one pipeline stage */
+class CStageTimer
+{
+public:
+	/* Constructor */
+	CStageTimer( const char* sName ) : m_sName( sName ), m_nStart( 0 )
+	{}
+
+	/* Start timing a frame */
+	void Begin()
+	{
+		m_nStart = CFrameStats::Now();
+	}
+
+	/* Stop timing a frame and keep the sample */
+	void End()
+	{
+		m_vSample.push_back( CFrameStats::Now() - m_nStart );
+	}
+
+	/* Latency at fRank ( 0 - 1 ) in milliseconds */
+	double Percentile( double fRank ) const
+	{
+		if( m_vSample.empty() )
+			return 0.0;
+		vector<XnUInt64> vSorted( m_vSample );
+		size_t i = (size_t)( fRank * ( vSorted.size() - 1 ) + 0.5 );
+		nth_element( vSorted.begin(), vSorted.begin() + i, vSorted.end() );
+		return vSorted[i] / 1000.0;
+	}
+
+	/* Throughput in MB/s of nBytes per frame at the median latency */
+	double Throughput( size_t nBytes ) const
+	{
+		double dMilliSec = Percentile( 0.5 );
+		return dMilliSec > 0 ? nBytes / 1000.0 / dMilliSec : 0.0;
+	}
+
+	/* Print a one line summary */
+	void Report( ostream& rOut ) const
+	{
+		rOut << m_sName << ": " << m_vSample.size() << " frames, p50 " << Percentile( 0.5 )
+			<< " ms, p99 " << Percentile( 0.99 ) << " ms" << endl;
+	}
+
+private:
+	const char*			m_sName;
+	XnUInt64			m_nStart;
+	vector<XnUInt64>	m_vSample;
+};
+
+int main( int argc, char** argv )
+{
+	if( argc < 2 )
+	{
+		cerr << "Usage: " << argv[0] << " <recording.oni|dump.raw> [-frames n] [-dump out.raw] [-threads n]" << endl;
+		return 1;
+	}
+
+	unsigned int nMaxFrames = 0;
+	const char* sDump = NULL;
+	unsigned int nThreads = 2;
+	for( int i = 2; i + 1 < argc; i += 2 )
+	{
+		if( strcmp( argv[i], "-frames" ) == 0 )
+			nMaxFrames = atoi( argv[i + 1] );
+		else if( strcmp( argv[i], "-dump" ) == 0 )
+			sDump = argv[i + 1];
+		else if( strcmp( argv[i], "-threads" ) == 0 )
+			nThreads = atoi( argv[i + 1] );
+	}
+
+	// 1. open the recording and replay it without waiting for the recorded frame rate
+	COpenNI mOpenNI;
+	if( !mOpenNI.Initial( argv[1] ) || !mOpenNI.SetPlaybackFastest() || !mOpenNI.Start() )
+		return 1;
+
+	XnFieldOfView mFOV = { 0, 0 };
+	CPointCloud mCloud;
+	if( mOpenNI.GetFieldOfView( mFOV ) )
+		mCloud.SetFieldOfView( mFOV );
+
+	// 2. the stages of the Qt reader
+	CDepthColorizer		mColorizer;
+	CSkeletonSnapshot	mSkeleton;
+	CGestureTracker		mGesture;
+	vector<unsigned char>	vDepthARGB;
+	CRawFrameWriter		mDump;
+	vector<unsigned char>	vEncoded;
+	vector<XnDepthPixel>	vDecoded, vRawCopy;
+	XnUInt64			nRawBytes = 0, nEncodedBytes = 0;
+	unsigned int		nCodecErrors = 0;
+	CDepthFilter		mFilter( nThreads > 0 ? nThreads : 1 );
+	CJointFilter		mOneEuro( CJointFilter::FILTER_ONE_EURO ), mHolt( CJointFilter::FILTER_HOLT );
+	CSkeletonSnapshot	mSmoothed;
+	CJointPredictor		mPredictor;
+	CDtwRecognizer		mRecognizer;
+	CFrameSync			mSync;
+	CDepthRegistration	mRegistration;
+	vector<XnDepthPixel>	vRegistered;
+	CUserROI			mROI;
+	vector<unsigned char>	aROIARGB[3];
+	CFrameSync::SPair	mPair;
+	vector<float>		vGesture( CDtwRecognizer::LENGTH * mRecognizer.GetFeatureCount() ), vQuery( vGesture.size() * 6 );
+	for( unsigned int k = 0; k < 50; ++ k )
+	{
+		// hands on circles of different speed and size
+		for( unsigned int i = 0; i < vGesture.size(); ++ i )
+			vGesture[i] = (float)( ( 0.1 + 0.01 * k ) * sin( 0.05 * ( k + 1 ) * i + i % 3 ) );
+		mRecognizer.AddTemplate( "bench", &vGesture[0], 1000 );
+	}
+
+	CStageTimer	mUpdateTime( "Update" ),
+				mColorizeTime( "Colorize" ),
+				mSkeletonTime( "Skeleton" ),
+				mGestureTime( "Gesture" ),
+				mCloudTime( "PointCloud" ),
+				mFrameTime( "Frame" ),
+				mRawTime( "Raw copy" ),
+				mEncodeTime( "Depth encode" ),
+				mDecodeTime( "Depth decode" ),
+				mFilterTime( "Depth filter" ),
+				mJointTime( "Joint filter" ),
+				mMatchTime( "DTW match" ),
+				mSyncTime( "Frame sync" ),
+				mRegisterTime( "Registration" ),
+				mROITime( "Colorize ROI" );
+	CFrameStats	mStats( "Replay" );
+
+	// 3. run every frame through all stages
+	XnUInt64 nBegin = CFrameStats::Now();
+	unsigned int nFrames = 0;
+	while( nMaxFrames == 0 || nFrames < nMaxFrames )
+	{
+		mFrameTime.Begin();
+		mUpdateTime.Begin();
+		if( !mOpenNI.UpdateData( true ) )
+		{
+			if( !mOpenNI.IsEndOfFile() )
+				cerr << "Replay stopped before the end of " << argv[1] << endl;
+			break;
+		}
+		mUpdateTime.End();
+
+		const xn::DepthMetaData& rDepthMD = mOpenNI.m_DepthMD;
+		unsigned int iSize = rDepthMD.XRes() * rDepthMD.YRes();
+		mStats.OnFrame( rDepthMD.FrameID() );
+
+		mColorizeTime.Begin();
+		vDepthARGB.resize( 4 * iSize );
+		mColorizer.Colorize( rDepthMD.Data(), iSize, &vDepthARGB[0] );
+		mColorizeTime.End();
+
+		// a raw dump has no user generator, the skeleton stays empty
+		mSkeletonTime.Begin();
+		if( mOpenNI.HasUserGenerator() )
+			mSkeleton.Update( mOpenNI.GetUserGenerator(), mOpenNI.GetDepthGenerator() );
+		mSkeletonTime.End();
+
+		mGestureTime.Begin();
+		mGesture.Update( mSkeleton, XN_SKEL_RIGHT_HAND, rDepthMD.Timestamp() );
+		mGestureTime.End();
+
+		mCloudTime.Begin();
+		mCloud.Compute( rDepthMD );
+		mCloudTime.End();
+		mFrameTime.End();
+
+		// the codec is not part of the measured frame, a raw copy is what storing the map costs without it
+		vEncoded.resize( CDepthCodec::MaxEncodedSize( iSize ) );
+		vDecoded.resize( iSize );
+		vRawCopy.resize( iSize );
+		mRawTime.Begin();
+		memcpy( &vRawCopy[0], rDepthMD.Data(), iSize * sizeof( XnDepthPixel ) );
+		mRawTime.End();
+
+		mEncodeTime.Begin();
+		size_t nEncoded = CDepthCodec::Encode( rDepthMD.Data(), iSize, &vEncoded[0] );
+		mEncodeTime.End();
+
+		mDecodeTime.Begin();
+		bool bDecoded = CDepthCodec::Decode( &vEncoded[0], nEncoded, &vDecoded[0], iSize );
+		mDecodeTime.End();
+
+		if( !bDecoded || memcmp( &vDecoded[0], rDepthMD.Data(), iSize * sizeof( XnDepthPixel ) ) != 0 )
+			++nCodecErrors;
+		nRawBytes += iSize * sizeof( XnDepthPixel );
+		nEncodedBytes += nEncoded;
+
+		mFilterTime.Begin();
+		mFilter.Process( rDepthMD.Data(), rDepthMD.XRes(), rDepthMD.YRes() );
+		mFilterTime.End();
+
+		// both joint filters on copies of the same skeletons
+		mJointTime.Begin();
+		mSmoothed = mSkeleton;
+		mOneEuro.Filter( mSmoothed, rDepthMD.Timestamp() );
+		mJointTime.End();
+		mSmoothed = mSkeleton;
+		mHolt.Filter( mSmoothed, rDepthMD.Timestamp() );
+		mPredictor.Update( mSkeleton, rDepthMD.Timestamp() );
+
+		// 6 users, a different path every frame
+		for( unsigned int i = 0; i < vQuery.size(); ++ i )
+			vQuery[i] = (float)( 0.2 * sin( 0.03 * ( nFrames % 50 + 1 ) * i ) );
+		mMatchTime.Begin();
+		for( unsigned int u = 0; u < 6; ++ u )
+			mRecognizer.Match( &vQuery[ u * vGesture.size() ], NULL );
+		mMatchTime.End();
+
+		mSyncTime.Begin();
+		mSync.PushDepth( rDepthMD );
+		mSync.PushImage( mOpenNI.m_ImageMD );
+		mSync.GetPair( mPair );
+		mSyncTime.End();
+
+		vRegistered.resize( iSize );
+		mRegisterTime.Begin();
+		mRegistration.Register( rDepthMD.Data(), rDepthMD.XRes(), rDepthMD.YRes(), &vRegistered[0], rDepthMD.XRes(), rDepthMD.YRes() );
+		mRegisterTime.End();
+
+		vector<unsigned char>& rROIARGB = aROIARGB[ nFrames % 3 ];
+		rROIARGB.resize( 4 * iSize );
+		mROITime.Begin();
+		mROI.Begin( rDepthMD.XRes(), rDepthMD.YRes() );
+		mROI.AddSkeleton( mSkeleton );
+		mROI.End();
+		mROI.Colorize( mColorizer, rDepthMD.Data(), &rROIARGB[0] );
+		mROITime.End();
+
+		// the dump is not part of the measured frame
+		if( sDump != NULL )
+		{
+			if( nFrames == 0 && !mDump.Open( sDump, rDepthMD, mOpenNI.m_ImageMD, mFOV ) )
+			{
+				cerr << "Can't create " << sDump << endl;
+				return 1;
+			}
+			mDump.Write( rDepthMD, mOpenNI.m_ImageMD );
+		}
+		++nFrames;
+	}
+	double dSeconds = ( CFrameStats::Now() - nBegin ) / 1000000.0;
+	mDump.Close();
+
+	// 4. report
+	cout << nFrames << " frames in " << dSeconds << " s, "
+		<< ( dSeconds > 0 ? nFrames / dSeconds : 0.0 ) << " fps" << endl;
+	mStats.Report( cout );
+	mUpdateTime.Report( cout );
+	mColorizeTime.Report( cout );
+	mSkeletonTime.Report( cout );
+	mGestureTime.Report( cout );
+	mCloudTime.Report( cout );
+	mFrameTime.Report( cout );
+
+	size_t nFrameBytes = nFrames ? (size_t)( nRawBytes / nFrames ) : 0;
+	mRawTime.Report( cout );
+	mEncodeTime.Report( cout );
+	mDecodeTime.Report( cout );
+	cout << "Depth codec: ratio " << ( nEncodedBytes ? (double)nRawBytes / nEncodedBytes : 0.0 )
+		<< ", encode " << mEncodeTime.Throughput( nFrameBytes ) << " MB/s, decode " << mDecodeTime.Throughput( nFrameBytes )
+		<< " MB/s, raw copy " << mRawTime.Throughput( nFrameBytes ) << " MB/s" << endl;
+
+	mFilterTime.Report( cout );
+	cout << "Depth filter: " << mFilter.GetThreadCount() << " threads, " << CSimdSupport::Name( mFilter.GetLevel() )
+		<< ( mFilterTime.Percentile( 0.99 ) < 1000.0 / 30 ? ", keeps up with 30 fps" : ", too slow for 30 fps" ) << endl;
+	mJointTime.Report( cout );
+	mOneEuro.Report( cout );
+	mHolt.Report( cout );
+	mPredictor.Report( cout );
+	mMatchTime.Report( cout );
+	cout << "DTW match: " << mRecognizer.GetTemplateCount() << " gestures x 6 users, " << CSimdSupport::Name( mRecognizer.GetLevel() )
+		<< ( mMatchTime.Percentile( 0.99 ) < 2.0 ? ", within 2 ms" : ", over 2 ms" ) << endl;
+	mSyncTime.Report( cout );
+	mSync.Report( cout );
+	mRegisterTime.Report( cout );
+	cout << "Registration: " << CSimdSupport::Name( mRegistration.GetLevel() )
+		<< ( mRegisterTime.Percentile( 0.99 ) < 3.0 ? ", within 3 ms" : ", over 3 ms" ) << endl;
+	mROITime.Report( cout );
+	mROI.Report( cout );
+	cout << "Colorize ROI: " << ( mROITime.Percentile( 0.5 ) > 0 ? mColorizeTime.Percentile( 0.5 ) / mROITime.Percentile( 0.5 ) : 0.0 )
+		<< " times as fast as the whole frame" << endl;
+	if( nCodecErrors > 0 )
+	{
+		cerr << nCodecErrors << " depth maps did not decode to the original" << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef CAPTUREPROFILE_H
+#define CAPTUREPROFILE_H
+
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+/* Resolution and frame rate of the map generators.
+ *
+ * A profile is a wish: Apply() looks through the modes the generator
+ * supports ( GetSupportedMapOutputModes ) and sets the profile if it is
+ * there, else the same resolution at the nearest frame rate, else the
+ * nearest resolution. Depth and image may end up in different modes, all
+ * buffers are sized from the meta data.
+ *
+ * QVGA at 60 fps halves the time a frame waits in the sensor, for
+ * gesture control which doesn't need the detail. */
+struct SCaptureProfile
+{
+	const char*	m_sName;
+	XnUInt32	m_nXRes;
+	XnUInt32	m_nYRes;
+	XnUInt32	m_nFPS;
+
+	/* The known profiles, "qvga60", "vga30" and "sxga15", NULL if sName is none of them */
+	static const SCaptureProfile* Find( const char* sName )
+	{
+		static const SCaptureProfile aProfile[] = {
+			{ "qvga60", 320, 240, 60 },
+			{ "vga30", 640, 480, 30 },
+			{ "sxga15", 1280, 1024, 15 } };
+		for( unsigned int i = 0; i < sizeof( aProfile ) / sizeof( aProfile[0] ); ++ i )
+		{
+			if( strcmp( aProfile[i].m_sName, sName ) == 0 )
+				return &aProfile[i];
+		}
+		return NULL;
+	}
+
+	/* Set the supported mode closest to the profile on rGenerator, and return it in rMode */
+	XnStatus Apply( xn::MapGenerator& rGenerator, XnMapOutputMode& rMode ) const
+	{
+		XnUInt32 nModes = rGenerator.GetSupportedMapOutputModesCount();
+		std::vector<XnMapOutputMode> vMode( nModes );
+		XnStatus eResult = XN_STATUS_OK;
+		if( nModes > 0 )
+			eResult = rGenerator.GetSupportedMapOutputModes( &vMode[0], nModes );
+		if( eResult != XN_STATUS_OK )
+			return eResult;
+
+		// a generator which lists nothing gets the profile as it is
+		rMode.nXRes = m_nXRes;
+		rMode.nYRes = m_nYRes;
+		rMode.nFPS = m_nFPS;
+		unsigned long long nBest = ~0ull;
+		for( XnUInt32 i = 0; i < nModes; ++ i )
+		{
+			// the resolution first, the frame rate only between equal resolutions
+			long long nPixels = (long long)vMode[i].nXRes * vMode[i].nYRes - (long long)m_nXRes * m_nYRes;
+			long long nFPS = (long long)vMode[i].nFPS - m_nFPS;
+			unsigned long long nCost = (unsigned long long)( nPixels < 0 ? -nPixels : nPixels ) * 1024 + ( nFPS < 0 ? -nFPS : nFPS );
+			if( nCost < nBest )
+			{
+				nBest = nCost;
+				rMode = vMode[i];
+			}
+		}
+		if( nBest != 0 && nModes > 0 )
+		{
+			std::cerr << rGenerator.GetName() << " has no " << m_sName << ", using " << rMode.nXRes << "x" << rMode.nYRes
+				<< " at " << rMode.nFPS << " fps" << std::endl;
+		}
+		return rGenerator.SetMapOutputMode( rMode );
+	}
+};
+
+#endif // CAPTUREPROFILE_H
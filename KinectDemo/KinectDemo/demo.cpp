@@ -6,6 +6,11 @@
 #include "opencv/cv.h"
 #include "opencv/highgui.h"
 
+#include "framestats.h"
+#include "rawframefile.h"
+#include "frameadapter.h"
+#include "captureprofile.h"
+
 using namespace std;
 using namespace cv;
 
@@ -22,20 +27,49 @@ int main(int argc, char *argv[])
 	xn::DepthMetaData depthMD;
 	xn::ImageMetaData imageMD;
 
-	IplImage* imgDepth16u = cvCreateImage(cvSize(640, 480), IPL_DEPTH_16U, 1);
-	IplImage* imgRGB8u = cvCreateImage(cvSize(640, 480), IPL_DEPTH_8U, 3);
-	IplImage* depthShow = cvCreateImage(cvSize(640, 480), IPL_DEPTH_8U, 1);
-	IplImage* imageShow = cvCreateImage(cvSize(640, 480), IPL_DEPTH_8U, 3);
+	// sized from the meta data by the adapter
+	CFrameAdapter adapter;
+	Mat depthShow;
+	Mat imageShow;
 
 	cvNamedWindow("depth", 1);
 	cvNamedWindow("image", 1);
 
 	char key = 0;
+	CFrameStats depthStats("Depth");
 
 	xn::Context context;
 	result = context.Init();
 	CheckOpenNIError(result, "initialize context");
 
+	// "demo [file.oni] [-record out.raw] [-profile qvga60|vga30|sxga15]", a recording's nodes are picked up by Create()
+	xn::Player player;	// keeps the recording alive
+	const char* recordFile = NULL;
+	const SCaptureProfile* profile = SCaptureProfile::Find("vga30");
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "-record") == 0 && i + 1 < argc)
+		{
+			recordFile = argv[++i];
+		}
+		else if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc)
+		{
+			profile = SCaptureProfile::Find(argv[++i]);
+			if(profile == NULL)
+			{
+				cerr << "Unknown profile " << argv[i] << endl;
+				return 1;
+			}
+		}
+		else
+		{
+			result = context.OpenFileRecording(argv[i], player);
+			CheckOpenNIError(result, "open recording");
+		}
+	}
+	CRawFrameWriter recorder;
+	bool recording = false;
+
 	xn::DepthGenerator depthGenerator;
 	result = depthGenerator.Create(context);
 	CheckOpenNIError(result, "Create depth generator");
@@ -43,41 +77,61 @@ int main(int argc, char *argv[])
 	result = imageGenerator.Create(context);
 	CheckOpenNIError(result, "Create image generator");
 
-	XnMapOutputMode mapMode;
-	mapMode.nXRes = 640;
-	mapMode.nYRes = 480;
-	mapMode.nFPS = 30;
-	result = depthGenerator.SetMapOutputMode(mapMode);
-	result = imageGenerator.SetMapOutputMode(mapMode);
+	// the nearest modes the sensor has, depth and image may differ; a recording keeps its modes
+	if(!player.IsValid())
+	{
+		XnMapOutputMode depthMode, imageMode;
+		result = profile->Apply(depthGenerator, depthMode);
+		CheckOpenNIError(result, "Set depth mode");
+		result = profile->Apply(imageGenerator, imageMode);
+		CheckOpenNIError(result, "Set image mode");
+	}
 
 	depthGenerator.GetAlternativeViewPointCap().SetViewPoint(imageGenerator);
 
 	result = context.StartGeneratingAll();
 	result = context.WaitNoneUpdateAll();
 
-	while((key != 27) && !(result = context.WaitNoneUpdateAll()))
+	// block until the depth generator has a new frame instead of polling
+	while((key != 27) && !(result = context.WaitOneUpdateAll(depthGenerator)))
 	{
+		XnUInt64 nReadyTime = CFrameStats::Now();
 		depthGenerator.GetMetaData(depthMD);
 		imageGenerator.GetMetaData(imageMD);
 
-		memcpy(imgDepth16u->imageData, depthMD.Data(), 640 * 480 * 2);
-		cvConvertScale(imgDepth16u, depthShow, 255 / 4096.0, 0);
-
-		memcpy(imgRGB8u->imageData, imageMD.Data(), 640 * 480 * 3);
-		cvCvtColor(imgRGB8u, imageShow, CV_RGB2BGR);
-		cvShowImage("depth", depthShow);
-		cvShowImage("image", imageShow);
-
-		key = waitKey(20);
+		// the sizes are known with the first frame, reserve a minute
+		if(recordFile != NULL)
+		{
+			XnFieldOfView fov;
+			depthGenerator.GetFieldOfView(fov);
+			recording = recorder.Open(recordFile, depthMD, imageMD, fov, depthMD.FPS() * 60);
+			if(!recording)
+				cerr << "Can't create " << recordFile << endl;
+			recordFile = NULL;
+		}
+		if(recording && !recorder.Write(depthMD, imageMD))
+		{
+			cerr << "Recording stopped after " << recorder.GetFrameCount() << " frames" << endl;
+			recording = false;
+		}
+
+		// one pass from the OpenNI buffers to the shown images
+		adapter.ToGray(depthMD, depthShow, 255 / 4096.0);
+		adapter.ToBGR(imageMD, imageShow);
+		imshow("depth", depthShow);
+		imshow("image", imageShow);
+		depthStats.OnFrame(depthMD.FrameID(), nReadyTime);
+
+		// only handle window events, the sensor paces the loop
+		key = waitKey(1);
 	}
+	depthStats.Report(cout);
+	if(!recorder.Close())
+		cerr << "Can't finish the recording" << endl;
 
 	cvDestroyWindow("depth");
 	cvDestroyWindow("image");
 
-	cvReleaseImage(&imgDepth16u);
-	cvReleaseImage(&imgRGB8u);
-	cvReleaseImage(&depthShow);
-	cvReleaseImage(&imageShow);
 	context.StopGeneratingAll();
 	context.Shutdown();
 
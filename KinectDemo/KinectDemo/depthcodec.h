@@ -0,0 +1,272 @@
+#ifndef DEPTHCODEC_H
+#define DEPTHCODEC_H
+
+#include <stddef.h>
+#include <string.h>
+#if defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+#include <XnTypes.h>
+
+/* Lossless depth map codec, run length / variable length ( RVL ).
+ *
+ * The map is a sequence of ( zero run, non-zero run ) pairs. Both run
+ * lengths and every non-zero pixel are written as variable length codes of
+ * 4 bit nibbles, 3 value bits and a continuation bit, lowest bits first.
+ * A non-zero pixel is stored as the zigzag difference to the previous
+ * non-zero pixel, so smooth surfaces cost one or two nibbles per pixel and
+ * holes two nibbles per run. Nibbles are packed into 32-bit words in host
+ * byte order, lowest nibble first; the last word is padded with zeros.
+ *
+ * Codes of one or two nibbles, differences up to +-31 mm, take a branch
+ * free path in both directions, which covers nearly every pixel of a real
+ * scene. Longer codes only appear at depth edges.
+ *
+ * The encoded block has no header, the caller keeps the pixel count and
+ * the encoded size. Decode() checks the block against both, so a broken
+ * block fails instead of writing past the output. */
+class CDepthCodec
+{
+public:
+	/* Bytes Encode() may write at most for nPixels pixels */
+	static size_t MaxEncodedSize( size_t nPixels )
+	{
+		// a value is at most 6 nibbles, the run lengths add less than one more per pixel on average
+		return ( ( nPixels * 6 + nPixels / 1024 + 32 ) / 8 + 2 ) * 4;
+	}
+
+	/* Encode nPixels depth pixels into pOut, which has MaxEncodedSize() bytes. Return the bytes written */
+	static size_t Encode( const XnDepthPixel* pDepth, size_t nPixels, unsigned char* pOut )
+	{
+		SWriter mWriter = { pOut, 0, 0 };
+		const XnDepthPixel* pEnd = pDepth + nPixels;
+		int iPrevious = 0;
+		while( pDepth < pEnd )
+		{
+			const XnDepthPixel* pRun = pDepth;
+			while( pDepth < pEnd && *pDepth == 0 )
+				++pDepth;
+			PutRun( mWriter, (XnUInt32)( pDepth - pRun ) );
+
+			pRun = pDepth;
+			while( pDepth < pEnd && *pDepth != 0 )
+				++pDepth;
+			PutRun( mWriter, (XnUInt32)( pDepth - pRun ) );
+
+			for( ; pRun < pDepth; ++pRun )
+			{
+				int iDelta = (int)*pRun - iPrevious;
+				iPrevious = *pRun;
+				XnUInt32 nValue = ( (XnUInt32)iDelta << 1 ) ^ (XnUInt32)( iDelta >> 31 );
+				if( nValue < 64 )
+				{
+					XnUInt32 nLong = nValue >= 8;
+					PutBits( mWriter, ( nValue & 7 ) | ( ( nValue & 0x38 ) << 1 ) | ( nLong << 3 ), 4 + 4 * nLong );
+				}
+				else
+				{
+					PutLong( mWriter, nValue );
+				}
+			}
+		}
+		if( mWriter.m_nBits > 0 )
+		{
+			Store( mWriter.m_pOut, (XnUInt32)mWriter.m_nWord );
+			mWriter.m_pOut += 4;
+		}
+		return mWriter.m_pOut - pOut;
+	}
+
+	/* Decode a block of nSize bytes into nPixels pixels at pDepth.
+	 * Return false if the block is broken or doesn't hold exactly nPixels pixels */
+	static bool Decode( const unsigned char* pIn, size_t nSize, XnDepthPixel* pDepth, size_t nPixels )
+	{
+		if( nSize % 4 != 0 )
+			return false;
+		CReader mReader( pIn, nSize );
+		XnDepthPixel* pEnd = pDepth + nPixels;
+		int iPrevious = 0;
+		while( pDepth < pEnd )
+		{
+			XnUInt32 nZeros, nValues;
+			if( !GetRun( mReader, nZeros ) || nZeros > (size_t)( pEnd - pDepth ) )
+				return false;
+			memset( pDepth, 0, nZeros * sizeof( XnDepthPixel ) );
+			pDepth += nZeros;
+
+			if( !GetRun( mReader, nValues ) || nValues > (size_t)( pEnd - pDepth ) )
+				return false;
+			for( XnDepthPixel* pRunEnd = pDepth + nValues; pDepth < pRunEnd; ++pDepth )
+			{
+				mReader.Fill();
+				XnUInt32 nBits = (XnUInt32)mReader.m_nBuffer;
+				XnUInt32 nValue;
+				if( ( nBits & 0x88 ) != 0x88 )
+				{
+					// the first nibble tells if the second one belongs to the code
+					XnUInt32 nLong = nBits & 8;
+					nValue = ( nBits & 7 ) | ( ( nBits >> 1 ) & ( nLong * 7 ) );
+					mReader.Skip( 4 + ( nLong >> 1 ) );
+				}
+				else if( !GetLong( mReader, nValue ) )
+				{
+					return false;
+				}
+				iPrevious += (int)( nValue >> 1 ) ^ -(int)( nValue & 1 );
+				*pDepth = (XnDepthPixel)iPrevious;
+			}
+			if( mReader.IsPastEnd() )
+				return false;
+		}
+		// nothing but the zero padding of the last word may be left
+		return mReader.IsAtEnd();
+	}
+
+private:
+	struct SWriter
+	{
+		unsigned char*	m_pOut;
+		XnUInt64		m_nWord;		// pending nibbles, the first at the low end
+		unsigned int	m_nBits;		// used bits of m_nWord, below 32
+	};
+
+	/* Bit buffer over the 32-bit words of a block, after Fill() it has at least 32 bits.
+	 * Words after the end read as zero, IsPastEnd() tells if any were used */
+	class CReader
+	{
+	public:
+		CReader( const unsigned char* pIn, size_t nSize ) : m_nBuffer( 0 ), m_nBits( 0 ), m_pIn( pIn ), m_pEnd( pIn + nSize ), m_nExtra( 0 )
+		{}
+
+		void Fill()
+		{
+			if( m_nBits < 32 )
+			{
+				XnUInt32 nWord = 0;
+				if( m_pIn < m_pEnd )
+				{
+					memcpy( &nWord, m_pIn, sizeof( nWord ) );
+					m_pIn += 4;
+				}
+				else
+				{
+					m_nExtra += 32;
+				}
+				m_nBuffer |= (XnUInt64)nWord << m_nBits;
+				m_nBits += 32;
+			}
+		}
+
+		void Skip( unsigned int nBits )
+		{
+			m_nBuffer >>= nBits;
+			m_nBits -= nBits;
+		}
+
+		bool IsPastEnd() const
+		{
+			return m_nBits < m_nExtra;
+		}
+
+		bool IsAtEnd() const
+		{
+			// less than a word of zero padding may be left
+			unsigned int nLeft = m_nBits - m_nExtra;
+			return m_nBits >= m_nExtra && m_pIn == m_pEnd && nLeft < 32 && ( m_nBuffer & ( ( (XnUInt64)1 << nLeft ) - 1 ) ) == 0;
+		}
+
+		XnUInt64				m_nBuffer;	// bits not read yet, the next at the low end
+		unsigned int			m_nBits;	// bits in m_nBuffer
+
+	private:
+		const unsigned char*	m_pIn;
+		const unsigned char*	m_pEnd;
+		unsigned int			m_nExtra;	// zero bits in m_nBuffer from after the end
+	};
+
+	static void Store( unsigned char* p, XnUInt32 nWord )
+	{
+		memcpy( p, &nWord, sizeof( nWord ) );
+	}
+
+	static unsigned int LowestBit( XnUInt32 n )
+	{
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward( &i, n );
+		return i;
+#elif defined(__GNUC__)
+		return __builtin_ctz( n );
+#else
+		unsigned int i = 0;
+		for( ; ( n & 1 ) == 0; n >>= 1 )
+			++i;
+		return i;
+#endif
+	}
+
+	/* Append nBits ( up to 32 ) bits of nCode */
+	static void PutBits( SWriter& rWriter, XnUInt32 nCode, unsigned int nBits )
+	{
+		rWriter.m_nWord |= (XnUInt64)nCode << rWriter.m_nBits;
+		rWriter.m_nBits += nBits;
+
+		// store every time and move on by a full word only, which doesn't branch
+		Store( rWriter.m_pOut, (XnUInt32)rWriter.m_nWord );
+		unsigned int nFull = rWriter.m_nBits >= 32;
+		rWriter.m_pOut += 4 * nFull;
+		rWriter.m_nWord >>= 32 * nFull;
+		rWriter.m_nBits -= 32 * nFull;
+	}
+
+	/* Append the code of a zigzag pixel difference of 3 to 6 nibbles, below 2^18 */
+	static void PutLong( SWriter& rWriter, XnUInt32 nValue )
+	{
+		unsigned int nNibbles = 3 + ( nValue >= 512 ) + ( nValue >= 4096 ) + ( nValue >= 32768 );
+		XnUInt32 nCode = ( nValue & 7 ) | ( ( nValue & 0x38 ) << 1 ) | ( ( nValue & 0x1C0 ) << 2 ) | ( ( nValue & 0xE00 ) << 3 )
+			| ( ( nValue & 0x7000 ) << 4 ) | ( ( nValue & 0x38000 ) << 5 );
+		XnUInt32 nContinue = ( ( 1u << ( 4 * nNibbles - 4 ) ) - 1 ) & 0x88888;
+		PutBits( rWriter, nCode | nContinue, 4 * nNibbles );
+	}
+
+	/* Append the code of a run length, any 32-bit value */
+	static void PutRun( SWriter& rWriter, XnUInt32 nValue )
+	{
+		for( ; nValue >= 8; nValue >>= 3 )
+			PutBits( rWriter, ( nValue & 7 ) | 8, 4 );
+		PutBits( rWriter, nValue, 4 );
+	}
+
+	/* Read a pixel code of up to 6 nibbles, the buffer is filled */
+	static bool GetLong( CReader& rReader, XnUInt32& rValue )
+	{
+		XnUInt32 nBits = (XnUInt32)rReader.m_nBuffer;
+		XnUInt32 nStop = ~nBits & 0x888888;
+		if( nStop == 0 )
+			return false;
+		unsigned int nLength = LowestBit( nStop ) + 1;
+		rValue = ( ( nBits & 7 ) | ( ( nBits >> 1 ) & 0x38 ) | ( ( nBits >> 2 ) & 0x1C0 ) | ( ( nBits >> 3 ) & 0xE00 )
+			| ( ( nBits >> 4 ) & 0x7000 ) | ( ( nBits >> 5 ) & 0x38000 ) ) & ( ( 1u << ( nLength / 4 * 3 ) ) - 1 );
+		rReader.Skip( nLength );
+		return true;
+	}
+
+	static bool GetRun( CReader& rReader, XnUInt32& rValue )
+	{
+		rValue = 0;
+		// longer than any 32-bit value is a broken block
+		for( unsigned int nShift = 0; nShift <= 30; nShift += 3 )
+		{
+			rReader.Fill();
+			unsigned int nNibble = (unsigned int)( rReader.m_nBuffer & 15 );
+			rReader.Skip( 4 );
+			rValue |= ( nNibble & 7 ) << nShift;
+			if( ( nNibble & 8 ) == 0 )
+				return !rReader.IsPastEnd();
+		}
+		return false;
+	}
+};
+
+#endif // DEPTHCODEC_H
@@ -0,0 +1,271 @@
+#ifndef DEPTHCOLORIZER_H
+#define DEPTHCOLORIZER_H
+
+#include <XnTypes.h>
+
+#include "simdsupport.h"
+#include "pixelrect.h"
+
+/* Class for converting a depth map to an ARGB32 image.
+ *
+ * Every non-zero pixel d becomes
+ *     Blue  = 0
+ *     Green = 255 * ( tMax - d ) / tMax
+ *     Red   = 255 * d / tMax
+ *     Alpha = Green
+ * with integer (truncating) division, tMax being the largest depth in the
+ * frame. Zero (unknown) pixels become fully transparent black.
+ *
+ * No kernel divides per pixel. The SIMD kernels divide in float and then
+ * correct the quotient by one. Every product stays below 2^24, so the
+ * float math is exact. The scalar kernel multiplies by a 64-bit
+ * fixed-point reciprocal.
+ *
+ * The overloads with rectangles only touch the pixels inside them, row by
+ * row, and leave the rest of the image as it is (see userroi.h). */
+class CDepthColorizer
+{
+public:
+	/* Constructor, use the best kernel of this machine */
+	CDepthColorizer() : m_eLevel( CSimdSupport::Best() )
+	{}
+
+	/* Force a kernel, return false if the CPU can't run it */
+	bool SetLevel( ESimdLevel eLevel )
+	{
+		if( !CSimdSupport::IsSupported( eLevel ) )
+			return false;
+		m_eLevel = eLevel;
+		return true;
+	}
+
+	/* Get the kernel in use */
+	ESimdLevel GetLevel() const
+	{
+		return m_eLevel;
+	}
+
+	/* Find the max value and convert the whole map, return the max value */
+	XnDepthPixel Colorize( const XnDepthPixel* pDepth, unsigned int iSize, unsigned char* pARGB ) const
+	{
+		XnDepthPixel tMax = FindMax( pDepth, iSize );
+		Expand( pDepth, iSize, tMax, pARGB );
+		return tMax;
+	}
+
+	/* Find the max value of the depth map */
+	XnDepthPixel FindMax( const XnDepthPixel* pDepth, unsigned int iSize ) const
+	{
+		if( iSize == 0 )
+			return 0;
+#if SIMD_X86
+		if( m_eLevel == SIMD_AVX2 )
+			return FindMaxAVX2( pDepth, iSize );
+		if( m_eLevel == SIMD_SSE2 )
+			return FindMaxSSE2( pDepth, iSize );
+#endif
+		return FindMaxScalar( pDepth, iSize, 0 );
+	}
+
+	/* Redistribute the depth map to ARGB32 (B,G,R,A byte order) with a known max value */
+	void Expand( const XnDepthPixel* pDepth, unsigned int iSize, XnDepthPixel tMax, unsigned char* pARGB ) const
+	{
+		unsigned int* pOut = reinterpret_cast<unsigned int*>( pARGB );
+		if( tMax == 0 )
+		{
+			for( unsigned int i = 0; i < iSize; ++ i )
+				pOut[i] = 0;
+			return;
+		}
+#if SIMD_X86
+		if( m_eLevel == SIMD_AVX2 )
+			return ExpandAVX2( pDepth, iSize, tMax, pOut );
+		if( m_eLevel == SIMD_SSE2 )
+			return ExpandSSE2( pDepth, iSize, tMax, pOut );
+#endif
+		ExpandScalar( pDepth, 0, iSize, tMax, pOut );
+	}
+
+	/* Find the max value inside nRects rectangles of a map iXRes pixels wide */
+	XnDepthPixel FindMax( const XnDepthPixel* pDepth, unsigned int iXRes, const SPixelRect* pRect, unsigned int nRects ) const
+	{
+		XnDepthPixel tMax = 0;
+		for( unsigned int i = 0; i < nRects; ++ i )
+		{
+			for( unsigned int y = pRect[i].m_iY; y < pRect[i].m_iY + pRect[i].m_iHeight; ++ y )
+			{
+				XnDepthPixel tRow = FindMax( pDepth + (size_t)y * iXRes + pRect[i].m_iX, pRect[i].m_iWidth );
+				tMax = ( tRow > tMax ) ? tRow : tMax;
+			}
+		}
+		return tMax;
+	}
+
+	/* Convert only the pixels inside nRects rectangles of a map iXRes pixels wide */
+	void Expand( const XnDepthPixel* pDepth, unsigned int iXRes, const SPixelRect* pRect, unsigned int nRects, XnDepthPixel tMax, unsigned char* pARGB ) const
+	{
+		for( unsigned int i = 0; i < nRects; ++ i )
+		{
+			for( unsigned int y = pRect[i].m_iY; y < pRect[i].m_iY + pRect[i].m_iHeight; ++ y )
+			{
+				size_t iOffset = (size_t)y * iXRes + pRect[i].m_iX;
+				Expand( pDepth + iOffset, pRect[i].m_iWidth, tMax, pARGB + 4 * iOffset );
+			}
+		}
+	}
+
+private:
+	ESimdLevel	m_eLevel;
+
+private:
+	static XnDepthPixel FindMaxScalar( const XnDepthPixel* pDepth, unsigned int iSize, XnDepthPixel tMax )
+	{
+		for( unsigned int i = 0; i < iSize; ++ i )
+		{
+			if( pDepth[i] > tMax )
+				tMax = pDepth[i];
+		}
+		return tMax;
+	}
+
+	/* Convert pixels [iBegin, iEnd) with a fixed-point reciprocal of tMax.
+	 * 255 * d < 2^24 and the reciprocal is rounded up with 40 fraction
+	 * bits, so the error stays below 1 / tMax and the quotient is exact. */
+	static void ExpandScalar( const XnDepthPixel* pDepth, unsigned int iBegin, unsigned int iEnd, XnDepthPixel tMax, unsigned int* pOut )
+	{
+		const unsigned long long nRecip = ( 1ull << 40 ) / tMax + 1;
+		for( unsigned int i = iBegin; i < iEnd; ++ i )
+		{
+			unsigned int d = pDepth[i];
+			if( d == 0 )
+			{
+				pOut[i] = 0;
+				continue;
+			}
+			unsigned int iNum = 255 * d;
+			unsigned int iRed = (unsigned int)( ( iNum * nRecip ) >> 40 );
+			unsigned int iGreen = 255 - iRed - ( iNum != iRed * tMax ? 1 : 0 );
+			pOut[i] = ( iGreen << 24 ) | ( iRed << 16 ) | ( iGreen << 8 );
+		}
+	}
+
+#if SIMD_X86
+	static XnDepthPixel FindMaxSSE2( const XnDepthPixel* pDepth, unsigned int iSize )
+	{
+		// SSE2 only has a signed 16 bit max, flip the sign bit around it
+		const __m128i vBias = _mm_set1_epi16( (short)0x8000 );
+		__m128i vMax = _mm_set1_epi16( (short)0x8000 );
+		unsigned int i = 0;
+		for( ; i + 8 <= iSize; i += 8 )
+		{
+			__m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pDepth + i ) );
+			vMax = _mm_max_epi16( vMax, _mm_xor_si128( v, vBias ) );
+		}
+		vMax = _mm_max_epi16( vMax, _mm_shuffle_epi32( vMax, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+		vMax = _mm_max_epi16( vMax, _mm_shuffle_epi32( vMax, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+		vMax = _mm_max_epi16( vMax, _mm_shufflelo_epi16( vMax, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+		XnDepthPixel tMax = (XnDepthPixel)( _mm_cvtsi128_si32( vMax ) ^ 0x8000 );
+		return FindMaxScalar( pDepth + i, iSize - i, tMax );
+	}
+
+	/* Convert 4 depth values in 32 bit lanes to 4 ARGB pixels */
+	static __m128i ExpandFourSSE2( __m128i vDepth, __m128 fMax, __m128 fInvMax )
+	{
+		const __m128 f255 = _mm_set1_ps( 255.0f );
+		const __m128 fOne = _mm_set1_ps( 1.0f );
+		const __m128 fZero = _mm_setzero_ps();
+
+		// quotient estimate, off by at most one
+		__m128 fNum = _mm_mul_ps( _mm_cvtepi32_ps( vDepth ), f255 );
+		__m128 fQ = _mm_cvtepi32_ps( _mm_cvttps_epi32( _mm_mul_ps( fNum, fInvMax ) ) );
+		__m128 fRem = _mm_sub_ps( fNum, _mm_mul_ps( fQ, fMax ) );
+
+		// correct the estimate with the remainder
+		__m128 mLow = _mm_cmplt_ps( fRem, fZero );
+		fQ = _mm_sub_ps( fQ, _mm_and_ps( mLow, fOne ) );
+		fRem = _mm_add_ps( fRem, _mm_and_ps( mLow, fMax ) );
+		__m128 mHigh = _mm_cmpge_ps( fRem, fMax );
+		fQ = _mm_add_ps( fQ, _mm_and_ps( mHigh, fOne ) );
+		fRem = _mm_sub_ps( fRem, _mm_and_ps( mHigh, fMax ) );
+
+		// floor( 255 * ( tMax - d ) / tMax ) = 255 - ceil( 255 * d / tMax )
+		__m128 fG = _mm_sub_ps( _mm_sub_ps( f255, fQ ), _mm_and_ps( _mm_cmpneq_ps( fRem, fZero ), fOne ) );
+
+		__m128i vRed = _mm_cvttps_epi32( fQ );
+		__m128i vGreen = _mm_cvttps_epi32( fG );
+		__m128i vPixel = _mm_or_si128( _mm_or_si128( _mm_slli_epi32( vGreen, 24 ), _mm_slli_epi32( vRed, 16 ) ), _mm_slli_epi32( vGreen, 8 ) );
+		return _mm_andnot_si128( _mm_cmpeq_epi32( vDepth, _mm_setzero_si128() ), vPixel );
+	}
+
+	static void ExpandSSE2( const XnDepthPixel* pDepth, unsigned int iSize, XnDepthPixel tMax, unsigned int* pOut )
+	{
+		const __m128 fMax = _mm_set1_ps( (float)tMax );
+		const __m128 fInvMax = _mm_set1_ps( 1.0f / tMax );
+		const __m128i vZero = _mm_setzero_si128();
+		unsigned int i = 0;
+		for( ; i + 8 <= iSize; i += 8 )
+		{
+			__m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pDepth + i ) );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + i ), ExpandFourSSE2( _mm_unpacklo_epi16( v, vZero ), fMax, fInvMax ) );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + i + 4 ), ExpandFourSSE2( _mm_unpackhi_epi16( v, vZero ), fMax, fInvMax ) );
+		}
+		ExpandScalar( pDepth, i, iSize, tMax, pOut );
+	}
+
+	SIMD_TARGET_AVX2 static XnDepthPixel FindMaxAVX2( const XnDepthPixel* pDepth, unsigned int iSize )
+	{
+		__m256i vMax = _mm256_setzero_si256();
+		unsigned int i = 0;
+		for( ; i + 16 <= iSize; i += 16 )
+			vMax = _mm256_max_epu16( vMax, _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pDepth + i ) ) );
+
+		XnDepthPixel aLane[16];
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( aLane ), vMax );
+		XnDepthPixel tMax = FindMaxScalar( aLane, 16, 0 );
+		return FindMaxScalar( pDepth + i, iSize - i, tMax );
+	}
+
+	/* Same math as ExpandFourSSE2, 8 lanes wide */
+	SIMD_TARGET_AVX2 static __m256i ExpandEightAVX2( __m256i vDepth, __m256 fMax, __m256 fInvMax )
+	{
+		const __m256 f255 = _mm256_set1_ps( 255.0f );
+		const __m256 fOne = _mm256_set1_ps( 1.0f );
+		const __m256 fZero = _mm256_setzero_ps();
+
+		__m256 fNum = _mm256_mul_ps( _mm256_cvtepi32_ps( vDepth ), f255 );
+		__m256 fQ = _mm256_cvtepi32_ps( _mm256_cvttps_epi32( _mm256_mul_ps( fNum, fInvMax ) ) );
+		__m256 fRem = _mm256_sub_ps( fNum, _mm256_mul_ps( fQ, fMax ) );
+
+		__m256 mLow = _mm256_cmp_ps( fRem, fZero, _CMP_LT_OQ );
+		fQ = _mm256_sub_ps( fQ, _mm256_and_ps( mLow, fOne ) );
+		fRem = _mm256_add_ps( fRem, _mm256_and_ps( mLow, fMax ) );
+		__m256 mHigh = _mm256_cmp_ps( fRem, fMax, _CMP_GE_OQ );
+		fQ = _mm256_add_ps( fQ, _mm256_and_ps( mHigh, fOne ) );
+		fRem = _mm256_sub_ps( fRem, _mm256_and_ps( mHigh, fMax ) );
+
+		__m256 fG = _mm256_sub_ps( _mm256_sub_ps( f255, fQ ), _mm256_and_ps( _mm256_cmp_ps( fRem, fZero, _CMP_NEQ_OQ ), fOne ) );
+
+		__m256i vRed = _mm256_cvttps_epi32( fQ );
+		__m256i vGreen = _mm256_cvttps_epi32( fG );
+		__m256i vPixel = _mm256_or_si256( _mm256_or_si256( _mm256_slli_epi32( vGreen, 24 ), _mm256_slli_epi32( vRed, 16 ) ), _mm256_slli_epi32( vGreen, 8 ) );
+		return _mm256_andnot_si256( _mm256_cmpeq_epi32( vDepth, _mm256_setzero_si256() ), vPixel );
+	}
+
+	SIMD_TARGET_AVX2 static void ExpandAVX2( const XnDepthPixel* pDepth, unsigned int iSize, XnDepthPixel tMax, unsigned int* pOut )
+	{
+		const __m256 fMax = _mm256_set1_ps( (float)tMax );
+		const __m256 fInvMax = _mm256_set1_ps( 1.0f / tMax );
+		unsigned int i = 0;
+		for( ; i + 16 <= iSize; i += 16 )
+		{
+			__m128i vLow = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pDepth + i ) );
+			__m128i vHigh = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pDepth + i + 8 ) );
+			_mm256_storeu_si256( reinterpret_cast<__m256i*>( pOut + i ), ExpandEightAVX2( _mm256_cvtepu16_epi32( vLow ), fMax, fInvMax ) );
+			_mm256_storeu_si256( reinterpret_cast<__m256i*>( pOut + i + 8 ), ExpandEightAVX2( _mm256_cvtepu16_epi32( vHigh ), fMax, fInvMax ) );
+		}
+		ExpandScalar( pDepth, i, iSize, tMax, pOut );
+	}
+#endif
+};
+
+#endif // DEPTHCOLORIZER_H
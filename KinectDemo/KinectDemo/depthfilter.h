@@ -0,0 +1,387 @@
+#ifndef DEPTHFILTER_H
+#define DEPTHFILTER_H
+
+#include <string.h>
+#include <vector>
+
+#include <XnTypes.h>
+
+#include "simdsupport.h"
+#include "threadpool.h"
+
+/* Class for cleaning up depth maps, frame by frame.
+ *
+ * Process() runs three steps:
+ *  1. Hole filling. A run of zero pixels in a row, not longer than the
+ *     hole size and with depth on both sides, takes the farther of the two
+ *     sides. Small holes are mostly the shadow of an edge, which belongs
+ *     to the background.
+ *  2. Edge preserving smoothing. A pixel becomes the rounded mean of
+ *     itself and those of its 8 neighbours within the edge threshold, so
+ *     noise is smoothed and depth edges are kept. Border pixels are left
+ *     as they are.
+ *  3. Temporal smoothing. Every pixel keeps an exponential average,
+ *     h += ( d - h ) * alpha. A change beyond the motion threshold resets
+ *     it to the new depth, moving objects don't leave a trail. A pixel
+ *     which drops out keeps its last depth for a few frames.
+ *
+ * Each step is split into tiles of TILE_ROWS rows on a thread pool, the
+ * second one after all tiles of the first are done. The result and the
+ * history are the same buffer, allocated once per resolution. All kernels
+ * give the same result. */
+class CDepthFilter
+{
+public:
+	enum
+	{
+		TILE_ROWS	= 32,
+		MAX_EDGE	= 2000		// mm, keeps the sums of step 2 in 16 bits
+	};
+
+	/* Constructor, nThreads counts the calling thread, 0 is one per core */
+	CDepthFilter( unsigned int nThreads = 0 )
+		: m_Pool( nThreads ), m_eLevel( CSimdSupport::Best() ), m_nHoleSize( 8 ), m_nEdge( 40 ), m_nAlpha( 102 ),
+		  m_nMotion( 150 ), m_nPersist( 3 ), m_iXRes( 0 ), m_iYRes( 0 )
+	{}
+
+	/* Force a kernel, return false if the CPU can't run it */
+	bool SetLevel( ESimdLevel eLevel )
+	{
+		if( !CSimdSupport::IsSupported( eLevel ) )
+			return false;
+		m_eLevel = eLevel;
+		return true;
+	}
+
+	/* Get the kernel in use */
+	ESimdLevel GetLevel() const
+	{
+		return m_eLevel;
+	}
+
+	/* Threads working on a frame */
+	unsigned int GetThreadCount() const
+	{
+		return m_Pool.GetThreadCount();
+	}
+
+	/* Longest run of zero pixels to fill, 0 fills none */
+	void SetHoleSize( unsigned int nPixels )
+	{
+		m_nHoleSize = nPixels;
+	}
+
+	/* Largest depth difference in mm of a neighbour to smooth with, 0 doesn't smooth */
+	void SetEdgeThreshold( unsigned int nMM )
+	{
+		m_nEdge = ( nMM < MAX_EDGE ) ? nMM : (unsigned int)MAX_EDGE;
+	}
+
+	/* Weight of a new frame, 0 - 1. 1 turns temporal smoothing off */
+	void SetSmoothing( float fAlpha )
+	{
+		m_nAlpha = (unsigned int)( ( fAlpha < 0 ? 0 : ( fAlpha > 1 ? 1 : fAlpha ) ) * 256 + 0.5f );
+	}
+
+	/* Depth change in mm which resets the average of a pixel */
+	void SetMotionThreshold( unsigned int nMM )
+	{
+		m_nMotion = ( nMM < 0x7FFF ) ? nMM : 0x7FFF;
+	}
+
+	/* Frames a pixel keeps its depth after it dropped out */
+	void SetPersistence( unsigned int nFrames )
+	{
+		m_nPersist = ( nFrames < 255 ) ? nFrames : 255;
+	}
+
+	/* Forget the history, the next frame starts over */
+	void Reset()
+	{
+		m_iXRes = m_iYRes = 0;
+	}
+
+	/* Filter a depth map of iXRes x iYRes. The result is valid until the next call */
+	const XnDepthPixel* Process( const XnDepthPixel* pDepth, unsigned int iXRes, unsigned int iYRes )
+	{
+		if( iXRes != m_iXRes || iYRes != m_iYRes )
+		{
+			m_iXRes = iXRes;
+			m_iYRes = iYRes;
+			m_vFilled.assign( iXRes * iYRes, 0 );
+			m_vHistory.assign( iXRes * iYRes, 0 );
+			m_vAge.assign( iXRes * iYRes, 0 );
+		}
+		if( m_vHistory.empty() )
+			return NULL;
+
+		unsigned int nTiles = ( iYRes + TILE_ROWS - 1 ) / TILE_ROWS;
+		m_Pool.Run( nTiles, [this, pDepth]( unsigned int iTile )
+		{
+			for( unsigned int y = iTile * TILE_ROWS; y < m_iYRes && y < ( iTile + 1 ) * TILE_ROWS; ++ y )
+				FillRow( pDepth + y * m_iXRes, &m_vFilled[ y * m_iXRes ] );
+		} );
+		m_Pool.Run( nTiles, [this]( unsigned int iTile )
+		{
+			for( unsigned int y = iTile * TILE_ROWS; y < m_iYRes && y < ( iTile + 1 ) * TILE_ROWS; ++ y )
+				SmoothRow( y );
+		} );
+		return &m_vHistory[0];
+	}
+
+private:
+	/* Copy a row and fill its holes */
+	void FillRow( const XnDepthPixel* pIn, XnDepthPixel* pOut ) const
+	{
+		memcpy( pOut, pIn, m_iXRes * sizeof( XnDepthPixel ) );
+		if( m_nHoleSize == 0 )
+			return;
+
+		unsigned int x = 0;
+		while( x < m_iXRes )
+		{
+			x = NextZero( pIn, x );
+			unsigned int iStart = x;
+			while( x < m_iXRes && pIn[x] == 0 )
+				++x;
+			if( iStart > 0 && x < m_iXRes && x - iStart <= m_nHoleSize )
+			{
+				XnDepthPixel nFar = ( pIn[ iStart - 1 ] > pIn[x] ) ? pIn[ iStart - 1 ] : pIn[x];
+				for( unsigned int i = iStart; i < x; ++ i )
+					pOut[i] = nFar;
+			}
+		}
+	}
+
+	/* First zero pixel from x on, m_iXRes if none */
+	unsigned int NextZero( const XnDepthPixel* pRow, unsigned int x ) const
+	{
+#if SIMD_X86
+		if( m_eLevel != SIMD_SCALAR )
+		{
+			// skip blocks without holes, most of a row
+			for( ; x + 8 <= m_iXRes; x += 8 )
+			{
+				__m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow + x ) );
+				if( _mm_movemask_epi8( _mm_cmpeq_epi16( v, _mm_setzero_si128() ) ) != 0 )
+					break;
+			}
+		}
+#endif
+		while( x < m_iXRes && pRow[x] != 0 )
+			++x;
+		return x;
+	}
+
+	/* Smooth row y of the filled map and update its history */
+	void SmoothRow( unsigned int y )
+	{
+		const XnDepthPixel* pRow = &m_vFilled[ y * m_iXRes ];
+		XnDepthPixel* pHistory = &m_vHistory[ y * m_iXRes ];
+		XnUInt16* pAge = &m_vAge[ y * m_iXRes ];
+		if( y == 0 || y + 1 == m_iYRes || m_iXRes < 3 )
+		{
+			for( unsigned int x = 0; x < m_iXRes; ++ x )
+				Average( pRow[x], pHistory[x], pAge[x] );
+			return;
+		}
+
+		Average( pRow[0], pHistory[0], pAge[0] );
+		Average( pRow[ m_iXRes - 1 ], pHistory[ m_iXRes - 1 ], pAge[ m_iXRes - 1 ] );
+		unsigned int x = 1;
+#if SIMD_X86
+		if( m_eLevel == SIMD_AVX2 )
+			x = SmoothAVX2( pRow, pHistory, pAge );
+		else if( m_eLevel == SIMD_SSE2 )
+			x = SmoothSSE2( pRow, pHistory, pAge );
+#endif
+		for( ; x + 1 < m_iXRes; ++ x )
+			Average( Smooth( pRow + x ), pHistory[x], pAge[x] );
+	}
+
+	/* Step 2 of an inner pixel, c + round( mean( n - c ) ) of the close neighbours n */
+	XnDepthPixel Smooth( const XnDepthPixel* p ) const
+	{
+		int c = *p;
+		if( c == 0 )
+			return 0;
+		const XnDepthPixel* aNeighbour[8] = { p - m_iXRes - 1, p - m_iXRes, p - m_iXRes + 1, p - 1, p + 1, p + m_iXRes - 1, p + m_iXRes, p + m_iXRes + 1 };
+		int iSum = 0, nCount = 1, iEdge = (int)m_nEdge;
+		for( int i = 0; i < 8; ++ i )
+		{
+			int iDiff = (int)*aNeighbour[i] - c;
+			if( *aNeighbour[i] != 0 && iDiff <= iEdge && iDiff >= -iEdge )
+			{
+				iSum += iDiff;
+				++nCount;
+			}
+		}
+		// shifted by the edge to divide positive numbers, the same as the SIMD kernels
+		return (XnDepthPixel)( c - iEdge + ( 2 * ( iSum + iEdge * nCount ) + nCount ) / ( 2 * nCount ) );
+	}
+
+	/* Step 3 of a pixel */
+	void Average( XnDepthPixel nDepth, XnDepthPixel& rHistory, XnUInt16& rAge ) const
+	{
+		if( nDepth == 0 )
+		{
+			if( rHistory != 0 && rAge < m_nPersist )
+			{
+				++rAge;
+			}
+			else
+			{
+				rHistory = 0;
+				rAge = 0;
+			}
+			return;
+		}
+
+		int iDiff = (int)nDepth - rHistory;
+		if( rHistory == 0 || iDiff > (int)m_nMotion || iDiff < -(int)m_nMotion )
+			rHistory = nDepth;
+		else
+			rHistory = (XnDepthPixel)( rHistory + ( ( iDiff * (int)m_nAlpha + 128 ) >> 8 ) );
+		rAge = 0;
+	}
+
+#if SIMD_X86
+	/* Steps 2 and 3 of 8 pixels at x of an inner row */
+	void SmoothEightSSE2( const XnDepthPixel* pRow, unsigned int x, XnDepthPixel* pHistory, XnUInt16* pAge ) const
+	{
+		const __m128i vZero = _mm_setzero_si128();
+		const __m128i vEdge = _mm_set1_epi16( (short)m_nEdge );
+		const XnDepthPixel* p = pRow + x;
+		__m128i c = _mm_loadu_si128( reinterpret_cast<const __m128i*>( p ) );
+
+		// sum of n - c and count of the close neighbours, the pixel itself counts once
+		__m128i vSum = vZero, vCount = _mm_set1_epi16( 1 );
+		const XnDepthPixel* aNeighbour[8] = { p - m_iXRes - 1, p - m_iXRes, p - m_iXRes + 1, p - 1, p + 1, p + m_iXRes - 1, p + m_iXRes, p + m_iXRes + 1 };
+		for( int i = 0; i < 8; ++ i )
+		{
+			__m128i n = _mm_loadu_si128( reinterpret_cast<const __m128i*>( aNeighbour[i] ) );
+			__m128i vAbs = _mm_or_si128( _mm_subs_epu16( n, c ), _mm_subs_epu16( c, n ) );
+			__m128i vClose = _mm_andnot_si128( _mm_cmpeq_epi16( n, vZero ), _mm_cmpeq_epi16( _mm_subs_epu16( vAbs, vEdge ), vZero ) );
+			vSum = _mm_add_epi16( vSum, _mm_and_si128( _mm_sub_epi16( n, c ), vClose ) );
+			vCount = _mm_sub_epi16( vCount, vClose );
+		}
+
+		// ( 2 * ( sum + edge * count ) + count ) / ( 2 * count ), exact in float
+		__m128i vShifted = _mm_add_epi16( vSum, _mm_mullo_epi16( vEdge, vCount ) );
+		__m128 fNumLow = _mm_cvtepi32_ps( _mm_add_epi32( _mm_slli_epi32( _mm_unpacklo_epi16( vShifted, vZero ), 1 ), _mm_unpacklo_epi16( vCount, vZero ) ) );
+		__m128 fNumHigh = _mm_cvtepi32_ps( _mm_add_epi32( _mm_slli_epi32( _mm_unpackhi_epi16( vShifted, vZero ), 1 ), _mm_unpackhi_epi16( vCount, vZero ) ) );
+		__m128 fDenLow = _mm_cvtepi32_ps( _mm_slli_epi32( _mm_unpacklo_epi16( vCount, vZero ), 1 ) );
+		__m128 fDenHigh = _mm_cvtepi32_ps( _mm_slli_epi32( _mm_unpackhi_epi16( vCount, vZero ), 1 ) );
+		__m128i vMean = _mm_packs_epi32( _mm_cvttps_epi32( _mm_div_ps( fNumLow, fDenLow ) ), _mm_cvttps_epi32( _mm_div_ps( fNumHigh, fDenHigh ) ) );
+		__m128i d = _mm_andnot_si128( _mm_cmpeq_epi16( c, vZero ), _mm_add_epi16( _mm_sub_epi16( c, vEdge ), vMean ) );
+
+		// temporal average, h + ( ( d - h ) * alpha + 128 ) >> 8 in 32 bits
+		__m128i* pH = reinterpret_cast<__m128i*>( pHistory + x );
+		__m128i* pA = reinterpret_cast<__m128i*>( pAge + x );
+		__m128i h = _mm_loadu_si128( pH );
+		__m128i vAge = _mm_loadu_si128( pA );
+		__m128i vAlpha = _mm_set1_epi16( (short)m_nAlpha );
+		__m128i vDiff = _mm_sub_epi16( d, h );
+		__m128i vLow = _mm_mullo_epi16( vDiff, vAlpha ), vHigh = _mm_mulhi_epi16( vDiff, vAlpha );
+		__m128i vRound = _mm_set1_epi32( 128 );
+		__m128i vStep = _mm_packs_epi32( _mm_srai_epi32( _mm_add_epi32( _mm_unpacklo_epi16( vLow, vHigh ), vRound ), 8 ),
+			_mm_srai_epi32( _mm_add_epi32( _mm_unpackhi_epi16( vLow, vHigh ), vRound ), 8 ) );
+
+		__m128i vNoDepth = _mm_cmpeq_epi16( d, vZero );
+		__m128i vNoHistory = _mm_cmpeq_epi16( h, vZero );
+		__m128i vAbs = _mm_or_si128( _mm_subs_epu16( d, h ), _mm_subs_epu16( h, d ) );
+		__m128i vMoved = _mm_or_si128( vNoHistory, _mm_xor_si128( _mm_cmpeq_epi16( _mm_subs_epu16( vAbs, _mm_set1_epi16( (short)m_nMotion ) ), vZero ), _mm_set1_epi16( -1 ) ) );
+		__m128i vNew = Select( vMoved, d, _mm_add_epi16( h, vStep ) );
+		__m128i vKeep = _mm_and_si128( vNoDepth, _mm_andnot_si128( vNoHistory, _mm_cmplt_epi16( vAge, _mm_set1_epi16( (short)m_nPersist ) ) ) );
+		_mm_storeu_si128( pH, Select( vNoDepth, _mm_and_si128( h, vKeep ), vNew ) );
+		_mm_storeu_si128( pA, _mm_and_si128( _mm_sub_epi16( vAge, _mm_set1_epi16( -1 ) ), vKeep ) );
+	}
+
+	static __m128i Select( __m128i vMask, __m128i vTrue, __m128i vFalse )
+	{
+		return _mm_or_si128( _mm_and_si128( vMask, vTrue ), _mm_andnot_si128( vMask, vFalse ) );
+	}
+
+	/* Inner pixels of a row, return the first one left */
+	unsigned int SmoothSSE2( const XnDepthPixel* pRow, XnDepthPixel* pHistory, XnUInt16* pAge ) const
+	{
+		unsigned int x = 1;
+		for( ; x + 9 <= m_iXRes; x += 8 )
+			SmoothEightSSE2( pRow, x, pHistory, pAge );
+		return x;
+	}
+
+	/* Same math as SmoothEightSSE2, 16 pixels at a time */
+	SIMD_TARGET_AVX2 unsigned int SmoothAVX2( const XnDepthPixel* pRow, XnDepthPixel* pHistory, XnUInt16* pAge ) const
+	{
+		const __m256i vZero = _mm256_setzero_si256();
+		const __m256i vOnes = _mm256_set1_epi16( -1 );
+		const __m256i vEdge = _mm256_set1_epi16( (short)m_nEdge );
+		const __m256i vAlpha = _mm256_set1_epi16( (short)m_nAlpha );
+		const __m256i vMotion = _mm256_set1_epi16( (short)m_nMotion );
+		const __m256i vPersist = _mm256_set1_epi16( (short)m_nPersist );
+		const __m256i vRound = _mm256_set1_epi32( 128 );
+		const ptrdiff_t aOffset[8] = { -(ptrdiff_t)m_iXRes - 1, -(ptrdiff_t)m_iXRes, -(ptrdiff_t)m_iXRes + 1, -1, 1, (ptrdiff_t)m_iXRes - 1, (ptrdiff_t)m_iXRes, (ptrdiff_t)m_iXRes + 1 };
+
+		unsigned int x = 1;
+		for( ; x + 17 <= m_iXRes; x += 16 )
+		{
+			const XnDepthPixel* p = pRow + x;
+			__m256i c = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( p ) );
+			__m256i vSum = vZero, vCount = _mm256_set1_epi16( 1 );
+			for( int i = 0; i < 8; ++ i )
+			{
+				__m256i n = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( p + aOffset[i] ) );
+				__m256i vAbs = _mm256_or_si256( _mm256_subs_epu16( n, c ), _mm256_subs_epu16( c, n ) );
+				__m256i vClose = _mm256_andnot_si256( _mm256_cmpeq_epi16( n, vZero ), _mm256_cmpeq_epi16( _mm256_subs_epu16( vAbs, vEdge ), vZero ) );
+				vSum = _mm256_add_epi16( vSum, _mm256_and_si256( _mm256_sub_epi16( n, c ), vClose ) );
+				vCount = _mm256_sub_epi16( vCount, vClose );
+			}
+
+			// unpack and pack work within 128 bit lanes, the order comes back the same
+			__m256i vShifted = _mm256_add_epi16( vSum, _mm256_mullo_epi16( vEdge, vCount ) );
+			__m256 fNumLow = _mm256_cvtepi32_ps( _mm256_add_epi32( _mm256_slli_epi32( _mm256_unpacklo_epi16( vShifted, vZero ), 1 ), _mm256_unpacklo_epi16( vCount, vZero ) ) );
+			__m256 fNumHigh = _mm256_cvtepi32_ps( _mm256_add_epi32( _mm256_slli_epi32( _mm256_unpackhi_epi16( vShifted, vZero ), 1 ), _mm256_unpackhi_epi16( vCount, vZero ) ) );
+			__m256 fDenLow = _mm256_cvtepi32_ps( _mm256_slli_epi32( _mm256_unpacklo_epi16( vCount, vZero ), 1 ) );
+			__m256 fDenHigh = _mm256_cvtepi32_ps( _mm256_slli_epi32( _mm256_unpackhi_epi16( vCount, vZero ), 1 ) );
+			__m256i vMean = _mm256_packs_epi32( _mm256_cvttps_epi32( _mm256_div_ps( fNumLow, fDenLow ) ), _mm256_cvttps_epi32( _mm256_div_ps( fNumHigh, fDenHigh ) ) );
+			__m256i d = _mm256_andnot_si256( _mm256_cmpeq_epi16( c, vZero ), _mm256_add_epi16( _mm256_sub_epi16( c, vEdge ), vMean ) );
+
+			__m256i* pH = reinterpret_cast<__m256i*>( pHistory + x );
+			__m256i* pA = reinterpret_cast<__m256i*>( pAge + x );
+			__m256i h = _mm256_loadu_si256( pH );
+			__m256i vAge = _mm256_loadu_si256( pA );
+			__m256i vDiff = _mm256_sub_epi16( d, h );
+			__m256i vLow = _mm256_mullo_epi16( vDiff, vAlpha ), vHigh = _mm256_mulhi_epi16( vDiff, vAlpha );
+			__m256i vStep = _mm256_packs_epi32( _mm256_srai_epi32( _mm256_add_epi32( _mm256_unpacklo_epi16( vLow, vHigh ), vRound ), 8 ),
+				_mm256_srai_epi32( _mm256_add_epi32( _mm256_unpackhi_epi16( vLow, vHigh ), vRound ), 8 ) );
+
+			__m256i vNoDepth = _mm256_cmpeq_epi16( d, vZero );
+			__m256i vNoHistory = _mm256_cmpeq_epi16( h, vZero );
+			__m256i vAbs = _mm256_or_si256( _mm256_subs_epu16( d, h ), _mm256_subs_epu16( h, d ) );
+			__m256i vMoved = _mm256_or_si256( vNoHistory, _mm256_xor_si256( _mm256_cmpeq_epi16( _mm256_subs_epu16( vAbs, vMotion ), vZero ), vOnes ) );
+			__m256i vNew = _mm256_blendv_epi8( _mm256_add_epi16( h, vStep ), d, vMoved );
+			__m256i vKeep = _mm256_and_si256( vNoDepth, _mm256_andnot_si256( vNoHistory, _mm256_cmpgt_epi16( vPersist, vAge ) ) );
+			_mm256_storeu_si256( pH, _mm256_blendv_epi8( vNew, _mm256_and_si256( h, vKeep ), vNoDepth ) );
+			_mm256_storeu_si256( pA, _mm256_and_si256( _mm256_sub_epi16( vAge, vOnes ), vKeep ) );
+		}
+		return x;
+	}
+#endif
+
+private:
+	CThreadPool					m_Pool;
+	ESimdLevel					m_eLevel;
+	unsigned int				m_nHoleSize;	// pixels
+	unsigned int				m_nEdge;		// mm
+	unsigned int				m_nAlpha;		// weight of a new frame, 0 - 256
+	unsigned int				m_nMotion;		// mm
+	unsigned int				m_nPersist;		// frames
+	unsigned int				m_iXRes;
+	unsigned int				m_iYRes;
+	std::vector<XnDepthPixel>	m_vFilled;		// step 1
+	std::vector<XnDepthPixel>	m_vHistory;		// step 3, the result
+	std::vector<XnUInt16>		m_vAge;			// frames since a pixel had depth
+};
+
+#endif // DEPTHFILTER_H
@@ -0,0 +1,380 @@
+#ifndef DEPTHREGISTRATION_H
+#define DEPTHREGISTRATION_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "simdsupport.h"
+
+/* Class for aligning a depth map to the color camera in software.
+ *
+ * The same as the alternative view point of the depth generator, for the
+ * sources which don't have it, like recordings and raw dumps. A depth
+ * pixel ( u, v, Z ) is a point Z * K( u, v ) + T in the color camera, with
+ *     K = R * ( ( u - cx ) / fx, ( v - cy ) / fy, 1 )
+ * from the depth intrinsics, the rotation R and the translation T, and
+ * lands in the color image at
+ *     u' = cx' + fx' * ( Z * Kx + Tx ) / ( Z * Kz + Tz )
+ * and the same for v'. Written as
+ *     u' = cx' + ( fx' * Kx / Kz + fx' * Tx / Z / Kz ) * Z / ( Z + Tz )
+ * the terms of the pixel and the terms of the depth are apart: three
+ * values per pixel and three per depth bin are computed once into tables,
+ * and a pixel costs three lookups, four multiplies and three adds. Only
+ * Kz in front of Tz is taken as 1, which for the small rotation between
+ * the two cameras of a sensor is far below a pixel.
+ *
+ * Every depth pixel is written to the nearest color pixel. Where two
+ * land on the same pixel the nearer one stays (z-buffer), so the
+ * background doesn't show through. Pixels nobody lands on are 0. The
+ * depth values are kept as they are, like the hardware registration.
+ *
+ * The calibration is for 640x480 and scaled to the actual resolutions.
+ * It describes the cameras unmirrored; for mirrored images, as COpenNI
+ * delivers them, SetMirrored() flips the x axis of both cameras: the
+ * centers go to the other side of the images and the translation and
+ * rotation change sign in x. The default is a typical Kinect. All kernels
+ * give the same result. */
+class CDepthRegistration
+{
+public:
+	enum
+	{
+		CALIB_XRES	= 640,
+		CALIB_YRES	= 480,
+		DEPTH_BINS	= 65536		// every XnDepthPixel value
+	};
+
+	/* Focal length and center of a camera in pixels, at 640x480 */
+	struct SIntrinsics
+	{
+		float	m_fFx;
+		float	m_fFy;
+		float	m_fCx;
+		float	m_fCy;
+	};
+
+	/* Constructor */
+	CDepthRegistration() : m_eLevel( CSimdSupport::Best() ), m_bMirrored( false ), m_iXRes( 0 ), m_iYRes( 0 ), m_iOutXRes( 0 ), m_iOutYRes( 0 )
+	{
+		SIntrinsics mDepth = { 594.2f, 591.0f, 339.3f, 242.7f };
+		SIntrinsics mColor = { 529.2f, 525.6f, 328.9f, 267.5f };
+		const float aRotation[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+		const float aTranslation[3] = { 25, 0, 0 };
+		SetCalibration( mDepth, mColor, aRotation, aTranslation );
+	}
+
+	/* Set the calibration, the translation in millimeters from the depth to the color camera */
+	void SetCalibration( const SIntrinsics& rDepth, const SIntrinsics& rColor, const float aRotation[9], const float aTranslation[3] )
+	{
+		m_Depth = rDepth;
+		m_Color = rColor;
+		memcpy( m_aRotation, aRotation, sizeof( m_aRotation ) );
+		memcpy( m_aTranslation, aTranslation, sizeof( m_aTranslation ) );
+		m_iXRes = m_iYRes = 0;
+	}
+
+	/* Read the calibration from a text file: fx fy cx cy of depth and of color,
+	 * 9 rotation and 3 translation values */
+	bool Load( const char* sFile )
+	{
+		FILE* pFile = fopen( sFile, "r" );
+		if( pFile == NULL )
+			return false;
+		float aValue[20];
+		bool bOK = true;
+		for( unsigned int i = 0; bOK && i < 20; ++ i )
+			bOK = fscanf( pFile, "%f", &aValue[i] ) == 1;
+		fclose( pFile );
+		if( !bOK )
+			return false;
+
+		SIntrinsics mDepth = { aValue[0], aValue[1], aValue[2], aValue[3] };
+		SIntrinsics mColor = { aValue[4], aValue[5], aValue[6], aValue[7] };
+		SetCalibration( mDepth, mColor, aValue + 8, aValue + 17 );
+		return true;
+	}
+
+	/* Set if the depth and the image are mirrored */
+	void SetMirrored( bool bMirrored )
+	{
+		m_bMirrored = bMirrored;
+		m_iXRes = m_iYRes = 0;
+	}
+
+	/* Force a kernel, return false if the CPU can't run it */
+	bool SetLevel( ESimdLevel eLevel )
+	{
+		if( !CSimdSupport::IsSupported( eLevel ) )
+			return false;
+		m_eLevel = eLevel;
+		return true;
+	}
+
+	/* Get the kernel in use */
+	ESimdLevel GetLevel() const
+	{
+		return m_eLevel;
+	}
+
+	/* Align a depth map of iXRes x iYRes to a color image of iOutXRes x iOutYRes, pOut must not be pDepth */
+	void Register( const XnDepthPixel* pDepth, unsigned int iXRes, unsigned int iYRes, XnDepthPixel* pOut, unsigned int iOutXRes, unsigned int iOutYRes )
+	{
+		if( iXRes != m_iXRes || iYRes != m_iYRes || iOutXRes != m_iOutXRes || iOutYRes != m_iOutYRes )
+			BuildTable( iXRes, iYRes, iOutXRes, iOutYRes );
+
+		// 0xFFFF is farther than anything, the z-buffer test needs no special case for empty
+		memset( pOut, 0xFF, (size_t)iOutXRes * iOutYRes * sizeof( XnDepthPixel ) );
+		for( unsigned int v = 0; v < iYRes; ++ v )
+		{
+			size_t iRow = (size_t)v * iXRes;
+#if SIMD_X86
+			if( m_eLevel == SIMD_AVX2 )
+			{
+				WarpRowAVX2( pDepth + iRow, iRow, iXRes, pOut );
+				continue;
+			}
+			if( m_eLevel == SIMD_SSE2 )
+			{
+				WarpRowSSE2( pDepth + iRow, iRow, iXRes, pOut );
+				continue;
+			}
+#endif
+			WarpRowScalar( pDepth + iRow, iRow, 0, iXRes, pOut );
+		}
+		ClearEmpty( pOut, (size_t)iOutXRes * iOutYRes );
+	}
+
+	/* Align the depth of rMD in place, to a color image of iOutXRes x iOutYRes */
+	void Register( xn::DepthMetaData& rMD, unsigned int iOutXRes, unsigned int iOutYRes )
+	{
+		// the meta data points to the buffer of the generator, the result goes to ours
+		m_vOut.resize( (size_t)iOutXRes * iOutYRes );
+		Register( rMD.Data(), rMD.XRes(), rMD.YRes(), &m_vOut[0], iOutXRes, iOutYRes );
+
+		XnUInt32 nFrameID = rMD.FrameID();
+		XnUInt64 nTimestamp = rMD.Timestamp();
+		rMD.ReAdjust( iOutXRes, iOutYRes, &m_vOut[0] );
+		rMD.FrameID() = nFrameID;
+		rMD.Timestamp() = nTimestamp;
+	}
+
+private:
+	/* Terms of every depth pixel and every depth bin */
+	void BuildTable( unsigned int iXRes, unsigned int iYRes, unsigned int iOutXRes, unsigned int iOutYRes )
+	{
+		double dSX = (double)iXRes / CALIB_XRES, dSY = (double)iYRes / CALIB_YRES;
+		double dFx = m_Depth.m_fFx * dSX, dFy = m_Depth.m_fFy * dSY, dCx = m_Depth.m_fCx * dSX, dCy = m_Depth.m_fCy * dSY;
+		double dOutSX = (double)iOutXRes / CALIB_XRES, dOutSY = (double)iOutYRes / CALIB_YRES;
+		double dOutFx = m_Color.m_fFx * dOutSX, dOutFy = m_Color.m_fFy * dOutSY;
+		double dOutCx = m_Color.m_fCx * dOutSX, dOutCy = m_Color.m_fCy * dOutSY;
+
+		// mirrored, x is -x in both cameras: R becomes M * R * M and T becomes M * T, M = diag( -1, 1, 1 )
+		float R[9], T[3];
+		memcpy( R, m_aRotation, sizeof( R ) );
+		memcpy( T, m_aTranslation, sizeof( T ) );
+		if( m_bMirrored )
+		{
+			dCx = iXRes - 1 - dCx;
+			dOutCx = iOutXRes - 1 - dOutCx;
+			R[1] = -R[1];
+			R[2] = -R[2];
+			R[3] = -R[3];
+			R[6] = -R[6];
+			T[0] = -T[0];
+		}
+
+		size_t nPixels = (size_t)iXRes * iYRes;
+		m_vMapX.resize( nPixels );
+		m_vMapY.resize( nPixels );
+		m_vInvKz.resize( nPixels );
+		for( unsigned int v = 0; v < iYRes; ++ v )
+		{
+			double dB = ( v - dCy ) / dFy;
+			for( unsigned int u = 0; u < iXRes; ++ u )
+			{
+				double dA = ( u - dCx ) / dFx;
+				double dKx = R[0] * dA + R[1] * dB + R[2];
+				double dKy = R[3] * dA + R[4] * dB + R[5];
+				double dKz = R[6] * dA + R[7] * dB + R[8];
+				size_t i = (size_t)v * iXRes + u;
+				m_vMapX[i] = (float)( dOutFx * dKx / dKz );
+				m_vMapY[i] = (float)( dOutFy * dKy / dKz );
+				m_vInvKz[i] = (float)( 1 / dKz );
+			}
+		}
+
+		// a bin behind the color camera gets a scale which throws the pixel out of the image
+		m_vShiftX.resize( DEPTH_BINS );
+		m_vShiftY.resize( DEPTH_BINS );
+		m_vScale.resize( DEPTH_BINS );
+		m_vShiftX[0] = m_vShiftY[0] = m_vScale[0] = 0;
+		for( unsigned int z = 1; z < DEPTH_BINS; ++ z )
+		{
+			m_vShiftX[z] = (float)( dOutFx * T[0] / z );
+			m_vShiftY[z] = (float)( dOutFy * T[1] / z );
+			m_vScale[z] = ( z + T[2] > 0 ) ? (float)( z / ( z + T[2] ) ) : -1e6f;
+		}
+
+		// + 0.5, so the truncation in the kernels rounds to the nearest pixel
+		m_fOffX = (float)( dOutCx + 0.5 );
+		m_fOffY = (float)( dOutCy + 0.5 );
+		m_fOutXRes = (float)iOutXRes;
+		m_fOutYRes = (float)iOutYRes;
+		m_iXRes = iXRes;
+		m_iYRes = iYRes;
+		m_iOutXRes = iOutXRes;
+		m_iOutYRes = iOutYRes;
+	}
+
+	/* Keep the nearer depth on a color pixel */
+	void Splat( unsigned int iU, unsigned int iV, XnDepthPixel nZ, XnDepthPixel* pOut ) const
+	{
+		XnDepthPixel& rOut = pOut[ (size_t)iV * m_iOutXRes + iU ];
+		if( nZ < rOut )
+			rOut = nZ;
+	}
+
+	/* Pixels iBegin - iEnd of a row, iRow is the index of its first pixel */
+	void WarpRowScalar( const XnDepthPixel* pDepth, size_t iRow, unsigned int iBegin, unsigned int iEnd, XnDepthPixel* pOut ) const
+	{
+		for( unsigned int i = iBegin; i < iEnd; ++ i )
+		{
+			XnDepthPixel nZ = pDepth[i];
+			if( nZ == 0 )
+				continue;
+			float fInvKz = m_vInvKz[ iRow + i ];
+			float fScale = m_vScale[nZ];
+			float fU = m_fOffX + ( m_vMapX[ iRow + i ] + m_vShiftX[nZ] * fInvKz ) * fScale;
+			float fV = m_fOffY + ( m_vMapY[ iRow + i ] + m_vShiftY[nZ] * fInvKz ) * fScale;
+			if( fU >= 0 && fU < m_fOutXRes && fV >= 0 && fV < m_fOutYRes )
+				Splat( (unsigned int)fU, (unsigned int)fV, nZ, pOut );
+		}
+	}
+
+	/* Color pixels left empty back to 0 */
+	static void ClearEmpty( XnDepthPixel* pOut, size_t nSize )
+	{
+		size_t i = 0;
+#if SIMD_X86
+		const __m128i vEmpty = _mm_set1_epi16( -1 );
+		for( ; i + 8 <= nSize; i += 8 )
+		{
+			__m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pOut + i ) );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + i ), _mm_andnot_si128( _mm_cmpeq_epi16( v, vEmpty ), v ) );
+		}
+#endif
+		for( ; i < nSize; ++ i )
+		{
+			if( pOut[i] == 0xFFFF )
+				pOut[i] = 0;
+		}
+	}
+
+#if SIMD_X86
+	/* No gather in SSE2, the bins are loaded one by one and the rest runs 4 wide */
+	void WarpRowSSE2( const XnDepthPixel* pDepth, size_t iRow, unsigned int nCount, XnDepthPixel* pOut ) const
+	{
+		const __m128 fZero = _mm_setzero_ps();
+		const __m128 fOffX = _mm_set1_ps( m_fOffX ), fOffY = _mm_set1_ps( m_fOffY );
+		const __m128 fXRes = _mm_set1_ps( m_fOutXRes ), fYRes = _mm_set1_ps( m_fOutYRes );
+		int aU[4], aV[4];
+		unsigned int i = 0;
+		for( ; i + 4 <= nCount; i += 4 )
+		{
+			const XnDepthPixel* pZ = pDepth + i;
+			if( ( pZ[0] | pZ[1] | pZ[2] | pZ[3] ) == 0 )
+				continue;
+			__m128 fShiftX = _mm_setr_ps( m_vShiftX[ pZ[0] ], m_vShiftX[ pZ[1] ], m_vShiftX[ pZ[2] ], m_vShiftX[ pZ[3] ] );
+			__m128 fShiftY = _mm_setr_ps( m_vShiftY[ pZ[0] ], m_vShiftY[ pZ[1] ], m_vShiftY[ pZ[2] ], m_vShiftY[ pZ[3] ] );
+			__m128 fScale = _mm_setr_ps( m_vScale[ pZ[0] ], m_vScale[ pZ[1] ], m_vScale[ pZ[2] ], m_vScale[ pZ[3] ] );
+			__m128 fInvKz = _mm_loadu_ps( &m_vInvKz[ iRow + i ] );
+			__m128 fU = _mm_add_ps( fOffX, _mm_mul_ps( _mm_add_ps( _mm_loadu_ps( &m_vMapX[ iRow + i ] ), _mm_mul_ps( fShiftX, fInvKz ) ), fScale ) );
+			__m128 fV = _mm_add_ps( fOffY, _mm_mul_ps( _mm_add_ps( _mm_loadu_ps( &m_vMapY[ iRow + i ] ), _mm_mul_ps( fShiftY, fInvKz ) ), fScale ) );
+
+			__m128 fIn = _mm_and_ps( _mm_and_ps( _mm_cmpge_ps( fU, fZero ), _mm_cmplt_ps( fU, fXRes ) ),
+									 _mm_and_ps( _mm_cmpge_ps( fV, fZero ), _mm_cmplt_ps( fV, fYRes ) ) );
+			int iMask = _mm_movemask_ps( fIn );
+			if( iMask == 0 )
+				continue;
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( aU ), _mm_cvttps_epi32( fU ) );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( aV ), _mm_cvttps_epi32( fV ) );
+			for( unsigned int k = 0; k < 4; ++ k )
+			{
+				if( ( iMask >> k & 1 ) && pZ[k] != 0 )
+					Splat( aU[k], aV[k], pZ[k], pOut );
+			}
+		}
+		WarpRowScalar( pDepth, iRow, i, nCount, pOut );
+	}
+
+	/* The bins are gathered, 8 pixels at a time; the scatter stays scalar for the z-buffer test */
+	SIMD_TARGET_AVX2 void WarpRowAVX2( const XnDepthPixel* pDepth, size_t iRow, unsigned int nCount, XnDepthPixel* pOut ) const
+	{
+		const __m256 fZero = _mm256_setzero_ps();
+		const __m256 fOffX = _mm256_set1_ps( m_fOffX ), fOffY = _mm256_set1_ps( m_fOffY );
+		const __m256 fXRes = _mm256_set1_ps( m_fOutXRes ), fYRes = _mm256_set1_ps( m_fOutYRes );
+		const __m256i vZero = _mm256_setzero_si256();
+		int aU[8], aV[8];
+		unsigned int i = 0;
+		for( ; i + 8 <= nCount; i += 8 )
+		{
+			__m256i vZ = _mm256_cvtepu16_epi32( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pDepth + i ) ) );
+			int iValid = ~_mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( vZ, vZero ) ) ) & 0xFF;
+			if( iValid == 0 )
+				continue;
+			__m256 fShiftX = _mm256_i32gather_ps( &m_vShiftX[0], vZ, 4 );
+			__m256 fShiftY = _mm256_i32gather_ps( &m_vShiftY[0], vZ, 4 );
+			__m256 fScale = _mm256_i32gather_ps( &m_vScale[0], vZ, 4 );
+			__m256 fInvKz = _mm256_loadu_ps( &m_vInvKz[ iRow + i ] );
+			__m256 fU = _mm256_add_ps( fOffX, _mm256_mul_ps( _mm256_add_ps( _mm256_loadu_ps( &m_vMapX[ iRow + i ] ), _mm256_mul_ps( fShiftX, fInvKz ) ), fScale ) );
+			__m256 fV = _mm256_add_ps( fOffY, _mm256_mul_ps( _mm256_add_ps( _mm256_loadu_ps( &m_vMapY[ iRow + i ] ), _mm256_mul_ps( fShiftY, fInvKz ) ), fScale ) );
+
+			__m256 fIn = _mm256_and_ps( _mm256_and_ps( _mm256_cmp_ps( fU, fZero, _CMP_GE_OQ ), _mm256_cmp_ps( fU, fXRes, _CMP_LT_OQ ) ),
+										_mm256_and_ps( _mm256_cmp_ps( fV, fZero, _CMP_GE_OQ ), _mm256_cmp_ps( fV, fYRes, _CMP_LT_OQ ) ) );
+			int iMask = _mm256_movemask_ps( fIn ) & iValid;
+			if( iMask == 0 )
+				continue;
+			_mm256_storeu_si256( reinterpret_cast<__m256i*>( aU ), _mm256_cvttps_epi32( fU ) );
+			_mm256_storeu_si256( reinterpret_cast<__m256i*>( aV ), _mm256_cvttps_epi32( fV ) );
+			const XnDepthPixel* pZ = pDepth + i;
+			for( unsigned int k = 0; k < 8; ++ k )
+			{
+				if( iMask >> k & 1 )
+					Splat( aU[k], aV[k], pZ[k], pOut );
+			}
+		}
+		WarpRowScalar( pDepth, iRow, i, nCount, pOut );
+	}
+#endif
+
+private:
+	SIntrinsics			m_Depth;
+	SIntrinsics			m_Color;
+	float				m_aRotation[9];
+	float				m_aTranslation[3];		// mm
+	ESimdLevel			m_eLevel;
+	bool				m_bMirrored;
+
+	// tables of the current resolutions
+	unsigned int		m_iXRes;
+	unsigned int		m_iYRes;
+	unsigned int		m_iOutXRes;
+	unsigned int		m_iOutYRes;
+	float				m_fOutXRes;
+	float				m_fOutYRes;
+	float				m_fOffX;
+	float				m_fOffY;
+	std::vector<float>	m_vMapX;			// per depth pixel
+	std::vector<float>	m_vMapY;
+	std::vector<float>	m_vInvKz;
+	std::vector<float>	m_vShiftX;			// per depth bin
+	std::vector<float>	m_vShiftY;
+	std::vector<float>	m_vScale;
+
+	std::vector<XnDepthPixel>	m_vOut;		// result of Register( rMD )
+};
+
+#endif // DEPTHREGISTRATION_H
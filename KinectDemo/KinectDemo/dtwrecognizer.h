@@ -0,0 +1,564 @@
+#ifndef DTWRECOGNIZER_H
+#define DTWRECOGNIZER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "simdsupport.h"
+#include "skeletonsnapshot.h"
+
+/* Class for recognizing recorded gestures of skeleton joints.
+ *
+ * A gesture is the path of a few joints, relative to a reference joint and
+ * in meters, over a time window. Every user keeps a short history of these
+ * features. Each frame the last window is resampled to LENGTH points and
+ * compared with every template by dynamic time warping: the cost of the
+ * cheapest alignment of the two sequences, no point shifted by more than
+ * the band, divided by LENGTH. A template matches under its threshold;
+ * the best match wins and the user's history starts over.
+ *
+ * Templates are stored in groups of LANES, interleaved point by point, so
+ * the kernels warp LANES templates against one query with one vector per
+ * cell. A group is abandoned as soon as every template of it has passed
+ * its threshold in a whole row, the cost along a path never goes down.
+ * All kernels give the same costs, and infinity above the threshold. */
+class CDtwRecognizer
+{
+public:
+	enum
+	{
+		MAX_USERS		= CSkeletonSnapshot::MAX_USERS,
+		MAX_JOINTS		= 4,
+		MAX_FEATURES	= MAX_JOINTS * 3,
+		LENGTH			= 32,		// points of a sequence
+		LANES			= 8,		// templates per group
+		HISTORY			= 128,		// samples per user, power of 2
+		NAME_SIZE		= 32
+	};
+
+	/* Constructor, both hands relative to the torso over 1.2 s */
+	CDtwRecognizer() : m_eLevel( CSimdSupport::Best() ), m_nWindow( 1200000 ), m_nBand( LENGTH / 8 )
+	{
+		static const XnSkeletonJoint aDefault[2] = { XN_SKEL_RIGHT_HAND, XN_SKEL_LEFT_HAND };
+		SetJoints( aDefault, 2, XN_SKEL_TORSO );
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+			m_aUser[i].m_UserID = 0;
+	}
+
+	/* Force a kernel, return false if the CPU can't run it */
+	bool SetLevel( ESimdLevel eLevel )
+	{
+		if( !CSimdSupport::IsSupported( eLevel ) )
+			return false;
+		m_eLevel = eLevel;
+		return true;
+	}
+
+	/* Get the kernel in use */
+	ESimdLevel GetLevel() const
+	{
+		return m_eLevel;
+	}
+
+	/* Joints of a gesture and the joint they are relative to. Removes all templates */
+	bool SetJoints( const XnSkeletonJoint* aJoint, unsigned int nJoints, XnSkeletonJoint eReference )
+	{
+		if( nJoints == 0 || nJoints > MAX_JOINTS )
+			return false;
+		for( unsigned int i = 0; i < nJoints; ++ i )
+			m_aJoint[i] = aJoint[i];
+		m_nJoints = nJoints;
+		m_eReference = eReference;
+		m_vTemplate.clear();
+		m_vPacked.clear();
+		m_vLimit.clear();
+		return true;
+	}
+
+	/* Floats per point of a sequence */
+	unsigned int GetFeatureCount() const
+	{
+		return m_nJoints * 3;
+	}
+
+	/* Length of a gesture in microseconds */
+	void SetWindow( XnUInt64 nMicroSec )
+	{
+		m_nWindow = nMicroSec;
+	}
+
+	/* Get the length of a gesture in microseconds */
+	XnUInt64 GetWindow() const
+	{
+		return m_nWindow;
+	}
+
+	/* Largest shift of a point in the alignment, in points */
+	void SetBand( unsigned int nPoints )
+	{
+		m_nBand = ( nPoints < LENGTH ) ? nPoints : LENGTH - 1;
+	}
+
+	/* Add a template of LENGTH x GetFeatureCount() floats, return its index.
+	 * fThreshold is the largest mean squared distance of a point, in m^2 */
+	unsigned int AddTemplate( const char* sName, const float* pSequence, float fThreshold )
+	{
+		unsigned int iTemplate = (unsigned int)m_vTemplate.size();
+		STemplate mTemplate;
+		mTemplate.m_sName = sName;
+		mTemplate.m_fThreshold = fThreshold;
+		mTemplate.m_vSequence.assign( pSequence, pSequence + LENGTH * GetFeatureCount() );
+		m_vTemplate.push_back( mTemplate );
+
+		// a new group starts with every lane unmatchable
+		unsigned int nFeatures = GetFeatureCount(), nGroupSize = LENGTH * nFeatures * LANES;
+		if( iTemplate % LANES == 0 )
+		{
+			m_vPacked.resize( m_vPacked.size() + nGroupSize, 0 );
+			m_vLimit.resize( m_vLimit.size() + LANES, -1 );
+		}
+		float* pGroup = &m_vPacked[ iTemplate / LANES * nGroupSize ];
+		for( unsigned int i = 0; i < LENGTH * nFeatures; ++ i )
+			pGroup[ i * LANES + iTemplate % LANES ] = pSequence[i];
+		m_vLimit[ iTemplate ] = fThreshold * LENGTH;
+		return iTemplate;
+	}
+
+	/* Add the last window of a user as a template, return its index or -1 without a full window */
+	int RecordTemplate( XnUserID uid, const char* sName, float fThreshold = 0.02f )
+	{
+		const SUser* pUser = FindUser( uid );
+		float aQuery[ LENGTH * MAX_FEATURES ];
+		if( pUser == NULL || !Resample( *pUser, aQuery ) )
+			return -1;
+		return (int)AddTemplate( sName, aQuery, fThreshold );
+	}
+
+	/* Number of templates */
+	unsigned int GetTemplateCount() const
+	{
+		return (unsigned int)m_vTemplate.size();
+	}
+
+	/* Name of a template */
+	const char* GetTemplateName( unsigned int iTemplate ) const
+	{
+		return m_vTemplate[ iTemplate ].m_sName.c_str();
+	}
+
+	/* Write the joints and all templates */
+	bool Save( const char* sFile ) const
+	{
+		FILE* pFile = fopen( sFile, "wb" );
+		if( pFile == NULL )
+			return false;
+		SFileHeader mHeader;
+		memcpy( mHeader.m_aMagic, "KDGT", 4 );
+		mHeader.m_nVersion = 1;
+		mHeader.m_nLength = LENGTH;
+		mHeader.m_nJoints = m_nJoints;
+		mHeader.m_nReference = m_eReference;
+		for( unsigned int i = 0; i < MAX_JOINTS; ++ i )
+			mHeader.m_aJoint[i] = ( i < m_nJoints ) ? m_aJoint[i] : 0;
+		mHeader.m_nTemplates = GetTemplateCount();
+		bool bOK = fwrite( &mHeader, sizeof( mHeader ), 1, pFile ) == 1;
+		for( unsigned int i = 0; bOK && i < GetTemplateCount(); ++ i )
+		{
+			const STemplate& rTemplate = m_vTemplate[i];
+			char aName[NAME_SIZE] = { 0 };
+			strncpy( aName, rTemplate.m_sName.c_str(), NAME_SIZE - 1 );
+			bOK = fwrite( aName, NAME_SIZE, 1, pFile ) == 1
+				&& fwrite( &rTemplate.m_fThreshold, sizeof( float ), 1, pFile ) == 1
+				&& fwrite( &rTemplate.m_vSequence[0], sizeof( float ), rTemplate.m_vSequence.size(), pFile ) == rTemplate.m_vSequence.size();
+		}
+		return ( fclose( pFile ) == 0 ) && bOK;
+	}
+
+	/* Read joints and templates written by Save(), the old ones are replaced */
+	bool Load( const char* sFile )
+	{
+		FILE* pFile = fopen( sFile, "rb" );
+		if( pFile == NULL )
+			return false;
+		SFileHeader mHeader;
+		XnSkeletonJoint aJoint[MAX_JOINTS];
+		bool bOK = fread( &mHeader, sizeof( mHeader ), 1, pFile ) == 1 && memcmp( mHeader.m_aMagic, "KDGT", 4 ) == 0
+			&& mHeader.m_nVersion == 1 && mHeader.m_nLength == LENGTH && mHeader.m_nJoints <= MAX_JOINTS;
+		if( bOK )
+		{
+			for( unsigned int i = 0; i < mHeader.m_nJoints; ++ i )
+				aJoint[i] = (XnSkeletonJoint)mHeader.m_aJoint[i];
+			bOK = SetJoints( aJoint, mHeader.m_nJoints, (XnSkeletonJoint)mHeader.m_nReference );
+		}
+
+		std::vector<float> vSequence( LENGTH * GetFeatureCount() );
+		for( unsigned int i = 0; bOK && i < mHeader.m_nTemplates; ++ i )
+		{
+			char aName[NAME_SIZE];
+			float fThreshold;
+			bOK = fread( aName, NAME_SIZE, 1, pFile ) == 1 && fread( &fThreshold, sizeof( float ), 1, pFile ) == 1
+				&& fread( &vSequence[0], sizeof( float ), vSequence.size(), pFile ) == vSequence.size();
+			aName[ NAME_SIZE - 1 ] = 0;
+			if( bOK )
+				AddTemplate( aName, &vSequence[0], fThreshold );
+		}
+		fclose( pFile );
+		return bOK;
+	}
+
+	/* Add the joints of every user of a snapshot, nTime in microseconds, and look for gestures.
+	 * Users missing from the snapshot lose their history */
+	void Update( const CSkeletonSnapshot& rSkeleton, XnUInt64 nTime )
+	{
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+		{
+			m_aUser[i].m_bSeen = false;
+			m_aUser[i].m_iMatch = -1;
+		}
+
+		int aIndex[MAX_JOINTS];
+		int iReference = rSkeleton.FindJoint( m_eReference );
+		for( unsigned int i = 0; i < m_nJoints; ++ i )
+		{
+			aIndex[i] = rSkeleton.FindJoint( m_aJoint[i] );
+			if( aIndex[i] < 0 )
+				iReference = -1;
+		}
+
+		unsigned int nJoints = rSkeleton.GetJointCount();
+		for( unsigned int iUser = 0; iReference >= 0 && iUser < rSkeleton.GetUserCount(); ++ iUser )
+		{
+			SUser* pUser = FindUser( rSkeleton.GetUserID( iUser ) );
+			if( pUser == NULL )
+			{
+				pUser = FindUser( 0 );
+				if( pUser == NULL )
+					continue;
+				pUser->m_UserID = rSkeleton.GetUserID( iUser );
+				pUser->m_nSamples = 0;
+			}
+			pUser->m_bSeen = true;
+
+			// a joint without confidence has no position, the sample is left out
+			const XnFloat* pConfidence = rSkeleton.Confidence() + iUser * nJoints;
+			bool bComplete = pConfidence[ iReference ] > 0;
+			for( unsigned int i = 0; i < m_nJoints; ++ i )
+				bComplete = bComplete && pConfidence[ aIndex[i] ] > 0;
+			if( !bComplete )
+				continue;
+
+			SSample& rSample = pUser->m_aSample[ pUser->m_nSamples & ( HISTORY - 1 ) ];
+			XnPoint3D mReference = rSkeleton.GetRealWorld( iUser, iReference );
+			for( unsigned int i = 0; i < m_nJoints; ++ i )
+			{
+				XnPoint3D mJoint = rSkeleton.GetRealWorld( iUser, aIndex[i] );
+				rSample.m_aFeature[ 3 * i ] = ( mJoint.X - mReference.X ) * 0.001f;
+				rSample.m_aFeature[ 3 * i + 1 ] = ( mJoint.Y - mReference.Y ) * 0.001f;
+				rSample.m_aFeature[ 3 * i + 2 ] = ( mJoint.Z - mReference.Z ) * 0.001f;
+			}
+			rSample.m_nTime = nTime;
+			++pUser->m_nSamples;
+
+			float aQuery[ LENGTH * MAX_FEATURES ];
+			if( m_vTemplate.empty() || !Resample( *pUser, aQuery ) )
+				continue;
+			pUser->m_iMatch = Match( aQuery, &pUser->m_fDistance );
+
+			// a gesture is found once, the next needs a new window
+			if( pUser->m_iMatch >= 0 )
+				pUser->m_nSamples = 0;
+		}
+
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+		{
+			if( !m_aUser[i].m_bSeen )
+				m_aUser[i].m_UserID = 0;
+		}
+	}
+
+	/* Template found for a user in the last Update(), -1 if none */
+	int GetMatch( XnUserID uid ) const
+	{
+		const SUser* pUser = FindUser( uid );
+		return pUser ? pUser->m_iMatch : -1;
+	}
+
+	/* Distance of the last match of a user */
+	float GetMatchDistance( XnUserID uid ) const
+	{
+		const SUser* pUser = FindUser( uid );
+		return ( pUser && pUser->m_iMatch >= 0 ) ? pUser->m_fDistance : 0;
+	}
+
+	/* Compare a query of LENGTH x GetFeatureCount() floats with all templates.
+	 * Return the template matched best under its threshold and its distance, -1 if none */
+	int Match( const float* pQuery, float* pDistance ) const
+	{
+		unsigned int nFeatures = GetFeatureCount(), nGroupSize = LENGTH * nFeatures * LANES;
+		int iBest = -1;
+		float fBestRatio = 1;
+		for( unsigned int g = 0; g * LANES < m_vTemplate.size(); ++ g )
+		{
+			float aCost[LANES];
+			const float* pGroup = &m_vPacked[ g * nGroupSize ];
+			const float* pLimit = &m_vLimit[ g * LANES ];
+#if SIMD_X86
+			if( m_eLevel == SIMD_AVX2 )
+				WarpAVX2( pQuery, pGroup, pLimit, aCost );
+			else if( m_eLevel == SIMD_SSE2 )
+				WarpSSE2( pQuery, pGroup, pLimit, aCost );
+			else
+#endif
+				WarpScalar( pQuery, pGroup, pLimit, aCost );
+
+			// the template furthest below its threshold wins
+			for( unsigned int k = 0; k < LANES && g * LANES + k < m_vTemplate.size(); ++ k )
+			{
+				if( aCost[k] > pLimit[k] )
+					continue;
+				float fRatio = aCost[k] / pLimit[k];
+				if( iBest < 0 || fRatio < fBestRatio )
+				{
+					iBest = (int)( g * LANES + k );
+					fBestRatio = fRatio;
+					if( pDistance != NULL )
+						*pDistance = aCost[k] / LENGTH;
+				}
+			}
+		}
+		return iBest;
+	}
+
+private:
+	struct STemplate
+	{
+		std::string			m_sName;
+		float				m_fThreshold;	// mean squared distance per point, m^2
+		std::vector<float>	m_vSequence;
+	};
+
+	struct SSample
+	{
+		float		m_aFeature[MAX_FEATURES];
+		XnUInt64	m_nTime;
+	};
+
+	struct SUser
+	{
+		XnUserID	m_UserID;		// 0 for a free slot
+		bool		m_bSeen;
+		XnUInt32	m_nSamples;		// since the last match, the newest is at ( m_nSamples - 1 ) % HISTORY
+		int			m_iMatch;
+		float		m_fDistance;
+		SSample		m_aSample[HISTORY];
+	};
+
+	struct SFileHeader
+	{
+		char		m_aMagic[4];	// "KDGT"
+		XnUInt32	m_nVersion;
+		XnUInt32	m_nLength;
+		XnUInt32	m_nJoints;
+		XnUInt32	m_nReference;
+		XnUInt32	m_aJoint[MAX_JOINTS];
+		XnUInt32	m_nTemplates;
+	};
+
+	SUser* FindUser( XnUserID uid )
+	{
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+		{
+			if( m_aUser[i].m_UserID == uid )
+				return &m_aUser[i];
+		}
+		return NULL;
+	}
+
+	const SUser* FindUser( XnUserID uid ) const
+	{
+		return const_cast<CDtwRecognizer*>( this )->FindUser( uid );
+	}
+
+	/* The last window of a user at LENGTH evenly spaced times, false if the history is shorter */
+	bool Resample( const SUser& rUser, float* pQuery ) const
+	{
+		unsigned int nCount = ( rUser.m_nSamples < HISTORY ) ? rUser.m_nSamples : (unsigned int)HISTORY;
+		if( nCount < 2 )
+			return false;
+		XnUInt32 iNewest = rUser.m_nSamples - 1;
+		XnUInt64 nEnd = rUser.m_aSample[ iNewest & ( HISTORY - 1 ) ].m_nTime;
+		if( nEnd < m_nWindow || rUser.m_aSample[ ( iNewest - nCount + 1 ) & ( HISTORY - 1 ) ].m_nTime > nEnd - m_nWindow )
+			return false;
+
+		// walk from the oldest sample in the window to the newest
+		unsigned int nFeatures = GetFeatureCount();
+		XnUInt32 i = iNewest - nCount + 1;
+		for( unsigned int k = 0; k < LENGTH; ++ k )
+		{
+			XnUInt64 nTime = nEnd - m_nWindow + m_nWindow * k / ( LENGTH - 1 );
+			while( i + 1 < iNewest + 1 && rUser.m_aSample[ ( i + 1 ) & ( HISTORY - 1 ) ].m_nTime <= nTime )
+				++i;
+			const SSample& rA = rUser.m_aSample[ i & ( HISTORY - 1 ) ];
+			const SSample& rB = rUser.m_aSample[ ( i == iNewest ? i : i + 1 ) & ( HISTORY - 1 ) ];
+			float fT = ( rB.m_nTime > rA.m_nTime ) ? (float)( nTime - rA.m_nTime ) / ( rB.m_nTime - rA.m_nTime ) : 0;
+			for( unsigned int f = 0; f < nFeatures; ++ f )
+				pQuery[ k * nFeatures + f ] = rA.m_aFeature[f] + fT * ( rB.m_aFeature[f] - rA.m_aFeature[f] );
+		}
+		return true;
+	}
+
+	/* Band of row i, [ iLow, iHigh ] */
+	void GetBand( unsigned int i, unsigned int& iLow, unsigned int& iHigh ) const
+	{
+		iLow = ( i > m_nBand ) ? i - m_nBand : 0;
+		iHigh = ( i + m_nBand < LENGTH ) ? i + m_nBand : LENGTH - 1;
+	}
+
+	/* Lanes one by one. Rows are stored one cell to the right, cell 0 is the
+	 * column before the first, 0 before the first row and infinite after */
+	void WarpScalar( const float* pQuery, const float* pGroup, const float* pLimit, float* aCost ) const
+	{
+		const float fInfinite = 1e30f;
+		unsigned int nFeatures = GetFeatureCount();
+		for( unsigned int k = 0; k < LANES; ++ k )
+		{
+			float aRow[2][ LENGTH + 2 ];
+			for( unsigned int j = 0; j < LENGTH + 2; ++ j )
+				aRow[0][j] = aRow[1][j] = fInfinite;
+			aRow[0][0] = 0;
+
+			bool bAbandon = false;
+			for( unsigned int i = 0; i < LENGTH && !bAbandon; ++ i )
+			{
+				const float* pPrevious = aRow[ i & 1 ];
+				float* pRow = aRow[ ( i + 1 ) & 1 ];
+				unsigned int iLow, iHigh;
+				GetBand( i, iLow, iHigh );
+				pRow[ iLow ] = fInfinite;
+				float fRowMin = fInfinite;
+				for( unsigned int j = iLow; j <= iHigh; ++ j )
+				{
+					float fDistance = 0;
+					for( unsigned int f = 0; f < nFeatures; ++ f )
+					{
+						float fDiff = pQuery[ i * nFeatures + f ] - pGroup[ ( j * nFeatures + f ) * LANES + k ];
+						fDistance += fDiff * fDiff;
+					}
+					float fMin = Min( Min( pPrevious[ j + 1 ], pRow[j] ), pPrevious[j] );
+					pRow[ j + 1 ] = fDistance + fMin;
+					fRowMin = Min( fRowMin, pRow[ j + 1 ] );
+				}
+				pRow[ iHigh + 2 ] = fInfinite;
+				bAbandon = fRowMin > pLimit[k];
+			}
+			aCost[k] = ( bAbandon || aRow[ LENGTH & 1 ][ LENGTH ] > pLimit[k] ) ? fInfinite : aRow[ LENGTH & 1 ][ LENGTH ];
+		}
+	}
+
+	static float Min( float a, float b )
+	{
+		return ( b < a ) ? b : a;
+	}
+
+#if SIMD_X86
+	/* Same as WarpScalar, 4 lanes at a time */
+	void WarpSSE2( const float* pQuery, const float* pGroup, const float* pLimit, float* aCost ) const
+	{
+		const __m128 vInfinite = _mm_set1_ps( 1e30f );
+		unsigned int nFeatures = GetFeatureCount();
+		for( unsigned int k = 0; k < LANES; k += 4 )
+		{
+			__m128 aRow[2][ LENGTH + 2 ];
+			for( unsigned int j = 0; j < LENGTH + 2; ++ j )
+				aRow[0][j] = aRow[1][j] = vInfinite;
+			aRow[0][0] = _mm_setzero_ps();
+			const __m128 vLimit = _mm_loadu_ps( pLimit + k );
+
+			bool bAbandon = false;
+			for( unsigned int i = 0; i < LENGTH && !bAbandon; ++ i )
+			{
+				const __m128* pPrevious = aRow[ i & 1 ];
+				__m128* pRow = aRow[ ( i + 1 ) & 1 ];
+				unsigned int iLow, iHigh;
+				GetBand( i, iLow, iHigh );
+				pRow[ iLow ] = vInfinite;
+				__m128 vRowMin = vInfinite;
+				for( unsigned int j = iLow; j <= iHigh; ++ j )
+				{
+					__m128 vDistance = _mm_setzero_ps();
+					for( unsigned int f = 0; f < nFeatures; ++ f )
+					{
+						__m128 vDiff = _mm_sub_ps( _mm_set1_ps( pQuery[ i * nFeatures + f ] ), _mm_loadu_ps( pGroup + ( j * nFeatures + f ) * LANES + k ) );
+						vDistance = _mm_add_ps( vDistance, _mm_mul_ps( vDiff, vDiff ) );
+					}
+					__m128 vMin = _mm_min_ps( _mm_min_ps( pPrevious[ j + 1 ], pRow[j] ), pPrevious[j] );
+					pRow[ j + 1 ] = _mm_add_ps( vDistance, vMin );
+					vRowMin = _mm_min_ps( vRowMin, pRow[ j + 1 ] );
+				}
+				pRow[ iHigh + 2 ] = vInfinite;
+				bAbandon = _mm_movemask_ps( _mm_cmpgt_ps( vRowMin, vLimit ) ) == 0xF;
+			}
+			__m128 vCost = bAbandon ? vInfinite : aRow[ LENGTH & 1 ][ LENGTH ];
+			__m128 vOver = _mm_cmpgt_ps( vCost, vLimit );
+			_mm_storeu_ps( aCost + k, _mm_or_ps( _mm_and_ps( vOver, vInfinite ), _mm_andnot_ps( vOver, vCost ) ) );
+		}
+	}
+
+	/* Same as WarpScalar, all 8 lanes at a time */
+	SIMD_TARGET_AVX2 void WarpAVX2( const float* pQuery, const float* pGroup, const float* pLimit, float* aCost ) const
+	{
+		const __m256 vInfinite = _mm256_set1_ps( 1e30f );
+		unsigned int nFeatures = GetFeatureCount();
+		__m256 aRow[2][ LENGTH + 2 ];
+		for( unsigned int j = 0; j < LENGTH + 2; ++ j )
+			aRow[0][j] = aRow[1][j] = vInfinite;
+		aRow[0][0] = _mm256_setzero_ps();
+		const __m256 vLimit = _mm256_loadu_ps( pLimit );
+
+		bool bAbandon = false;
+		for( unsigned int i = 0; i < LENGTH && !bAbandon; ++ i )
+		{
+			const __m256* pPrevious = aRow[ i & 1 ];
+			__m256* pRow = aRow[ ( i + 1 ) & 1 ];
+			unsigned int iLow, iHigh;
+			GetBand( i, iLow, iHigh );
+			pRow[ iLow ] = vInfinite;
+			__m256 vRowMin = vInfinite;
+			for( unsigned int j = iLow; j <= iHigh; ++ j )
+			{
+				__m256 vDistance = _mm256_setzero_ps();
+				for( unsigned int f = 0; f < nFeatures; ++ f )
+				{
+					__m256 vDiff = _mm256_sub_ps( _mm256_set1_ps( pQuery[ i * nFeatures + f ] ), _mm256_loadu_ps( pGroup + ( j * nFeatures + f ) * LANES ) );
+					vDistance = _mm256_add_ps( vDistance, _mm256_mul_ps( vDiff, vDiff ) );
+				}
+				__m256 vMin = _mm256_min_ps( _mm256_min_ps( pPrevious[ j + 1 ], pRow[j] ), pPrevious[j] );
+				pRow[ j + 1 ] = _mm256_add_ps( vDistance, vMin );
+				vRowMin = _mm256_min_ps( vRowMin, pRow[ j + 1 ] );
+			}
+			pRow[ iHigh + 2 ] = vInfinite;
+			bAbandon = _mm256_movemask_ps( _mm256_cmp_ps( vRowMin, vLimit, _CMP_GT_OQ ) ) == 0xFF;
+		}
+		__m256 vCost = bAbandon ? vInfinite : aRow[ LENGTH & 1 ][ LENGTH ];
+		_mm256_storeu_ps( aCost, _mm256_blendv_ps( vCost, vInfinite, _mm256_cmp_ps( vCost, vLimit, _CMP_GT_OQ ) ) );
+	}
+#endif
+
+private:
+	ESimdLevel				m_eLevel;
+	XnSkeletonJoint			m_aJoint[MAX_JOINTS];
+	unsigned int			m_nJoints;
+	XnSkeletonJoint			m_eReference;
+	XnUInt64				m_nWindow;		// microseconds
+	unsigned int			m_nBand;		// points
+	std::vector<STemplate>	m_vTemplate;
+	std::vector<float>		m_vPacked;		// groups of LENGTH x features x LANES
+	std::vector<float>		m_vLimit;		// threshold * LENGTH per lane, -1 for no template
+	SUser					m_aUser[MAX_USERS];
+};
+
+#endif // DTWRECOGNIZER_H
@@ -0,0 +1,195 @@
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+/* Bounded lock-free queue of events from OpenNI callbacks to a thread of
+ * the application.
+ *
+ * Push() may be called from any thread, it copies the event into a slot
+ * reserved by a compare and swap and never waits; when all slots are taken the
+ * event is counted as dropped instead. One consumer takes the events out,
+ * either by Pop() or by the thread of Start(), which calls the handler for
+ * every event. The producer touches the mutex only to wake a sleeping
+ * consumer.
+ *
+ * T must be a plain struct, N a power of 2. */
+template< typename T, unsigned int N >
+class CEventQueue
+{
+public:
+	/* Constructor */
+	CEventQueue( const char* sName ) : m_sName( sName ), m_iPush( 0 ), m_iPop( 0 ), m_bSleeping( false ), m_bStop( false ),
+		m_nPushed( 0 ), m_nDropped( 0 ), m_nMaxDepth( 0 )
+	{
+		static_assert( ( N & ( N - 1 ) ) == 0, "N must be a power of 2" );
+		for( unsigned int i = 0; i < N; ++ i )
+			m_aSlot[i].m_nSequence.store( i, std::memory_order_relaxed );
+	}
+
+	/* Destructor, stops the consumer thread */
+	~CEventQueue()
+	{
+		Stop();
+	}
+
+	/* Producer: add an event, return false if the queue is full */
+	bool Push( const T& rEvent )
+	{
+		// a slot is free when its sequence is the push index of this lap
+		size_t iPush = m_iPush.load( std::memory_order_relaxed );
+		SSlot* pSlot;
+		while( true )
+		{
+			pSlot = &m_aSlot[ iPush & ( N - 1 ) ];
+			ptrdiff_t iDiff = (ptrdiff_t)pSlot->m_nSequence.load( std::memory_order_acquire ) - (ptrdiff_t)iPush;
+			if( iDiff == 0 )
+			{
+				if( m_iPush.compare_exchange_weak( iPush, iPush + 1, std::memory_order_relaxed ) )
+					break;
+			}
+			else if( iDiff < 0 )
+			{
+				m_nDropped.fetch_add( 1, std::memory_order_relaxed );
+				return false;
+			}
+			else
+				iPush = m_iPush.load( std::memory_order_relaxed );
+		}
+		pSlot->m_Event = rEvent;
+		pSlot->m_nSequence.store( iPush + 1, std::memory_order_release );
+		m_nPushed.fetch_add( 1, std::memory_order_relaxed );
+
+		unsigned int nDepth = (unsigned int)( iPush + 1 - m_iPop.load( std::memory_order_relaxed ) );
+		unsigned int nMax = m_nMaxDepth.load( std::memory_order_relaxed );
+		while( nDepth > nMax && !m_nMaxDepth.compare_exchange_weak( nMax, nDepth, std::memory_order_relaxed ) )
+			;
+
+		// pairs with the fence in Wait(), either the consumer sees the event or we see it sleep
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		if( m_bSleeping.load( std::memory_order_relaxed ) )
+		{
+			std::lock_guard<std::mutex> mLock( m_Mutex );
+			m_Wake.notify_one();
+		}
+		return true;
+	}
+
+	/* Consumer: take the oldest event, return false if there is none */
+	bool Pop( T& rEvent )
+	{
+		size_t iPop = m_iPop.load( std::memory_order_relaxed );
+		SSlot& rSlot = m_aSlot[ iPop & ( N - 1 ) ];
+		if( rSlot.m_nSequence.load( std::memory_order_acquire ) != iPop + 1 )
+			return false;
+		rEvent = rSlot.m_Event;
+
+		// free for the push of the next lap
+		rSlot.m_nSequence.store( iPop + N, std::memory_order_release );
+		m_iPop.store( iPop + 1, std::memory_order_relaxed );
+		return true;
+	}
+
+	/* Consumer: sleep until there is an event, return false when stopped and empty */
+	bool Wait()
+	{
+		std::unique_lock<std::mutex> mLock( m_Mutex );
+		m_bSleeping.store( true, std::memory_order_relaxed );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		while( IsEmpty() && !m_bStop )
+			m_Wake.wait( mLock );
+		m_bSleeping.store( false, std::memory_order_relaxed );
+		return !IsEmpty();
+	}
+
+	/* Start a thread calling fHandle for every event in order */
+	void Start( const std::function<void( const T& )>& fHandle )
+	{
+		m_fHandle = fHandle;
+		m_bStop = false;
+		m_Thread = std::thread( &CEventQueue::Run, this );
+	}
+
+	/* Stop the thread of Start() after it handled all events pushed so far */
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> mLock( m_Mutex );
+			m_bStop = true;
+		}
+		m_Wake.notify_all();
+		if( m_Thread.joinable() )
+			m_Thread.join();
+	}
+
+	/* Events added so far */
+	unsigned int Pushed() const
+	{
+		return m_nPushed.load( std::memory_order_relaxed );
+	}
+
+	/* Events lost to a full queue */
+	unsigned int Dropped() const
+	{
+		return m_nDropped.load( std::memory_order_relaxed );
+	}
+
+	/* Most events waiting at once */
+	unsigned int MaxDepth() const
+	{
+		return m_nMaxDepth.load( std::memory_order_relaxed );
+	}
+
+	/* Print counts and the deepest the queue got */
+	void Report( std::ostream& rOut ) const
+	{
+		rOut << m_sName << ": " << Pushed() << " events, max depth " << MaxDepth() << " of " << N
+			<< ", " << Dropped() << " dropped" << std::endl;
+	}
+
+private:
+	struct SSlot
+	{
+		std::atomic<size_t>	m_nSequence;	// index + 1 when full, index of the next lap when free
+		T					m_Event;
+	};
+
+	bool IsEmpty() const
+	{
+		size_t iPop = m_iPop.load( std::memory_order_relaxed );
+		return m_aSlot[ iPop & ( N - 1 ) ].m_nSequence.load( std::memory_order_acquire ) != iPop + 1;
+	}
+
+	void Run()
+	{
+		T mEvent;
+		while( Wait() )
+		{
+			while( Pop( mEvent ) )
+				m_fHandle( mEvent );
+		}
+	}
+
+private:
+	const char*							m_sName;
+	SSlot								m_aSlot[N];
+	std::atomic<size_t>					m_iPush;
+	std::atomic<size_t>					m_iPop;		// written by the consumer only
+	std::atomic<bool>					m_bSleeping;
+	bool								m_bStop;
+	std::mutex							m_Mutex;
+	std::condition_variable				m_Wake;
+	std::thread							m_Thread;
+	std::function<void( const T& )>		m_fHandle;
+	std::atomic<unsigned int>			m_nPushed;
+	std::atomic<unsigned int>			m_nDropped;
+	std::atomic<unsigned int>			m_nMaxDepth;
+};
+
+#endif // EVENTQUEUE_H
@@ -0,0 +1,191 @@
+#ifndef FRAMEADAPTER_H
+#define FRAMEADAPTER_H
+
+#include <opencv2/core/core.hpp>
+
+#include <XnCppWrapper.h>
+
+#include "simdsupport.h"
+
+/* Class for handing OpenNI frames to OpenCV.
+ *
+ * Wrap*() put a cv::Mat header on the OpenNI buffer, no pixel is copied.
+ * The Mat is valid until the next update of the generator and must not be
+ * written, OpenNI owns the memory.
+ *
+ * ToBGR() and ToGray() convert in a single pass from the OpenNI buffer
+ * into a Mat sized from the meta data, instead of a copy into an image and
+ * a second pass with cvCvtColor / cvConvertScale. The output is only
+ * reallocated when the resolution changes. */
+class CFrameAdapter
+{
+public:
+	/* Constructor, use the best kernels of this machine */
+	CFrameAdapter() : m_eLevel( CSimdSupport::Best() )
+	{}
+
+	/* Force a kernel, return false if the CPU can't run it */
+	bool SetLevel( ESimdLevel eLevel )
+	{
+		if( !CSimdSupport::IsSupported( eLevel ) )
+			return false;
+		m_eLevel = eLevel;
+		return true;
+	}
+
+	/* Get the kernel in use */
+	ESimdLevel GetLevel() const
+	{
+		return m_eLevel;
+	}
+
+	/* The depth map as CV_16UC1, no copy */
+	static cv::Mat WrapDepth( const xn::DepthMetaData& rDepthMD )
+	{
+		return cv::Mat( rDepthMD.YRes(), rDepthMD.XRes(), CV_16UC1, const_cast<XnDepthPixel*>( rDepthMD.Data() ) );
+	}
+
+	/* The RGB24 image as CV_8UC3 in R, G, B order, no copy */
+	static cv::Mat WrapImage( const xn::ImageMetaData& rImageMD )
+	{
+		return cv::Mat( rImageMD.YRes(), rImageMD.XRes(), CV_8UC3, const_cast<XnUInt8*>( rImageMD.Data() ) );
+	}
+
+	/* Swap the RGB24 image into a CV_8UC3 BGR image for OpenCV */
+	void ToBGR( const xn::ImageMetaData& rImageMD, cv::Mat& rBGR ) const
+	{
+		rBGR.create( rImageMD.YRes(), rImageMD.XRes(), CV_8UC3 );
+		unsigned int iRowSize = rImageMD.XRes() * 3;
+		for( unsigned int y = 0; y < rImageMD.YRes(); ++ y )
+		{
+			const unsigned char* pIn = rImageMD.Data() + y * iRowSize;
+			unsigned char* pOut = rBGR.ptr<unsigned char>( y );
+#if SIMD_X86
+			if( m_eLevel == SIMD_AVX2 )
+			{
+				SwapAVX2( pIn, iRowSize, pOut );
+				continue;
+			}
+#endif
+			SwapScalar( pIn, 0, iRowSize, pOut );
+		}
+	}
+
+	/* Scale the depth map into a CV_8UC1 image, min( 255, d * fScale ) rounded to nearest.
+	 * fScale must be below 1, 255 / 4096.0 shows the whole range of the sensor */
+	void ToGray( const xn::DepthMetaData& rDepthMD, cv::Mat& rGray, double fScale ) const
+	{
+		rGray.create( rDepthMD.YRes(), rDepthMD.XRes(), CV_8UC1 );
+		unsigned int nScale = (unsigned int)( fScale * 65536 + 0.5 );
+		if( nScale > 0xFFFF )
+			nScale = 0xFFFF;
+		for( unsigned int y = 0; y < rDepthMD.YRes(); ++ y )
+		{
+			const XnDepthPixel* pIn = rDepthMD.Data() + y * rDepthMD.XRes();
+			unsigned char* pOut = rGray.ptr<unsigned char>( y );
+#if SIMD_X86
+			if( m_eLevel == SIMD_AVX2 )
+			{
+				ScaleAVX2( pIn, rDepthMD.XRes(), nScale, pOut );
+				continue;
+			}
+			if( m_eLevel == SIMD_SSE2 )
+			{
+				ScaleSSE2( pIn, rDepthMD.XRes(), nScale, pOut );
+				continue;
+			}
+#endif
+			ScaleScalar( pIn, 0, rDepthMD.XRes(), nScale, pOut );
+		}
+	}
+
+private:
+	ESimdLevel	m_eLevel;
+
+private:
+	/* Swap bytes [iBegin, iEnd) of a row, both multiples of 3 */
+	static void SwapScalar( const unsigned char* pIn, unsigned int iBegin, unsigned int iEnd, unsigned char* pOut )
+	{
+		for( unsigned int i = iBegin; i < iEnd; i += 3 )
+		{
+			unsigned char r = pIn[i];
+			pOut[i] = pIn[i + 2];
+			pOut[i + 1] = pIn[i + 1];
+			pOut[i + 2] = r;
+		}
+	}
+
+	/* Pixels [iBegin, iEnd) of a row, ( d * nScale + 0.5 ) / 2^16 in fixed point */
+	static void ScaleScalar( const XnDepthPixel* pIn, unsigned int iBegin, unsigned int iEnd, unsigned int nScale, unsigned char* pOut )
+	{
+		for( unsigned int i = iBegin; i < iEnd; ++ i )
+		{
+			unsigned int v = ( pIn[i] * nScale + 0x8000 ) >> 16;
+			pOut[i] = (unsigned char)( v < 255 ? v : 255 );
+		}
+	}
+
+#if SIMD_X86
+	/* Scale 8 pixels in 16 bit lanes, saturated to 255 */
+	static __m128i ScaleEightSSE2( __m128i vDepth, __m128i vScale )
+	{
+		// the low half of the product carries the rounding into the high half
+		__m128i vHigh = _mm_mulhi_epu16( vDepth, vScale );
+		__m128i vRound = _mm_srli_epi16( _mm_mullo_epi16( vDepth, vScale ), 15 );
+		__m128i v = _mm_add_epi16( vHigh, vRound );
+		return _mm_subs_epu16( v, _mm_subs_epu16( v, _mm_set1_epi16( 255 ) ) );
+	}
+
+	static void ScaleSSE2( const XnDepthPixel* pIn, unsigned int iSize, unsigned int nScale, unsigned char* pOut )
+	{
+		const __m128i vScale = _mm_set1_epi16( (short)nScale );
+		unsigned int i = 0;
+		for( ; i + 16 <= iSize; i += 16 )
+		{
+			__m128i vLow = ScaleEightSSE2( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pIn + i ) ), vScale );
+			__m128i vHigh = ScaleEightSSE2( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pIn + i + 8 ) ), vScale );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + i ), _mm_packus_epi16( vLow, vHigh ) );
+		}
+		ScaleScalar( pIn, i, iSize, nScale, pOut );
+	}
+
+	/* Same math as ScaleEightSSE2, 16 lanes wide */
+	SIMD_TARGET_AVX2 static void ScaleAVX2( const XnDepthPixel* pIn, unsigned int iSize, unsigned int nScale, unsigned char* pOut )
+	{
+		const __m256i vScale = _mm256_set1_epi16( (short)nScale );
+		const __m256i v255 = _mm256_set1_epi16( 255 );
+		unsigned int i = 0;
+		for( ; i + 16 <= iSize; i += 16 )
+		{
+			__m256i vDepth = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( pIn + i ) );
+			__m256i v = _mm256_add_epi16( _mm256_mulhi_epu16( vDepth, vScale ), _mm256_srli_epi16( _mm256_mullo_epi16( vDepth, vScale ), 15 ) );
+			v = _mm256_min_epu16( v, v255 );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + i ),
+				_mm_packus_epi16( _mm256_castsi256_si128( v ), _mm256_extracti128_si256( v, 1 ) ) );
+		}
+		ScaleScalar( pIn, i, iSize, nScale, pOut );
+	}
+
+	/* Swap a row 8 pixels at a time. Each 128 bit lane loads 16 bytes and
+	 * swaps the 4 whole pixels in them, the 4 bytes after those are stored
+	 * as they are and overwritten by the next store */
+	SIMD_TARGET_AVX2 static void SwapAVX2( const unsigned char* pIn, unsigned int iRowSize, unsigned char* pOut )
+	{
+		const __m256i vSwap = _mm256_setr_epi8(
+			2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15,
+			2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15 );
+		unsigned int i = 0;
+		for( ; i + 28 <= iRowSize; i += 24 )
+		{
+			__m256i v = _mm256_castsi128_si256( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pIn + i ) ) );
+			v = _mm256_inserti128_si256( v, _mm_loadu_si128( reinterpret_cast<const __m128i*>( pIn + i + 12 ) ), 1 );
+			v = _mm256_shuffle_epi8( v, vSwap );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + i ), _mm256_castsi256_si128( v ) );
+			_mm_storeu_si128( reinterpret_cast<__m128i*>( pOut + i + 12 ), _mm256_extracti128_si256( v, 1 ) );
+		}
+		SwapScalar( pIn, i, iRowSize, pOut );
+	}
+#endif
+};
+
+#endif // FRAMEADAPTER_H
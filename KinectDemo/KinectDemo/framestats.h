@@ -0,0 +1,115 @@
+#ifndef FRAMESTATS_H
+#define FRAMESTATS_H
+
+#include <chrono>
+#include <ostream>
+
+#include <XnTypes.h>
+
+/* Count delivered, duplicated and missed frames of one stream.
+ *
+ * Frames are identified by the OpenNI FrameID. Seeing the same ID twice
+ * in a row is a duplicate: the consumer polled before the sensor
+ * produced a new frame. A gap in the IDs means frames were missed: the
+ * consumer came too late and the sensor had already moved on. If the
+ * caller also passes the time the frame became ready, the latency up to
+ * OnFrame() is recorded too.
+ *
+ * Not thread safe. Each consumer owns its own instance. */
+class CFrameStats
+{
+public:
+	/* Constructor */
+	CFrameStats( const char* sName ) : m_sName( sName )
+	{
+		Reset();
+	}
+
+	/* Clear all counters */
+	void Reset()
+	{
+		m_bFirst = true;
+		m_nLastID = 0;
+		m_nFrames = 0;
+		m_nDuplicated = 0;
+		m_nMissed = 0;
+		m_nLatencyCount = 0;
+		m_nLatencySum = 0;
+		m_nLatencyMax = 0;
+	}
+
+	/* Current time in microseconds, from a steady clock */
+	static XnUInt64 Now()
+	{
+		return (XnUInt64)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+	}
+
+	/* Count a frame, nReadyTime is Now() when the data became available, 0 if unknown */
+	void OnFrame( XnUInt32 nFrameID, XnUInt64 nReadyTime = 0 )
+	{
+		if( !m_bFirst && nFrameID == m_nLastID )
+		{
+			++m_nDuplicated;
+			return;
+		}
+		if( !m_bFirst && nFrameID > m_nLastID + 1 )
+			m_nMissed += nFrameID - m_nLastID - 1;
+
+		m_bFirst = false;
+		m_nLastID = nFrameID;
+		++m_nFrames;
+
+		if( nReadyTime != 0 )
+		{
+			XnUInt64 nLatency = Now() - nReadyTime;
+			++m_nLatencyCount;
+			m_nLatencySum += nLatency;
+			if( nLatency > m_nLatencyMax )
+				m_nLatencyMax = nLatency;
+		}
+	}
+
+	/* Distinct frames seen */
+	XnUInt32 Frames() const			{ return m_nFrames; }
+
+	/* Frames seen again with the same ID */
+	XnUInt32 Duplicated() const		{ return m_nDuplicated; }
+
+	/* Frames skipped in the ID sequence */
+	XnUInt32 Missed() const			{ return m_nMissed; }
+
+	/* Mean latency in milliseconds */
+	double MeanLatency() const
+	{
+		return m_nLatencyCount ? m_nLatencySum / 1000.0 / m_nLatencyCount : 0.0;
+	}
+
+	/* Max latency in milliseconds */
+	double MaxLatency() const
+	{
+		return m_nLatencyMax / 1000.0;
+	}
+
+	/* Print a one line summary */
+	void Report( std::ostream& rOut ) const
+	{
+		rOut << m_sName << ": " << m_nFrames << " frames, "
+			<< m_nDuplicated << " duplicated, " << m_nMissed << " missed";
+		if( m_nLatencyCount )
+			rOut << ", latency mean " << MeanLatency() << " ms, max " << MaxLatency() << " ms";
+		rOut << std::endl;
+	}
+
+private:
+	const char*	m_sName;
+	bool		m_bFirst;
+	XnUInt32	m_nLastID;
+	XnUInt32	m_nFrames;
+	XnUInt32	m_nDuplicated;
+	XnUInt32	m_nMissed;
+	XnUInt32	m_nLatencyCount;
+	XnUInt64	m_nLatencySum;
+	XnUInt64	m_nLatencyMax;
+};
+
+#endif // FRAMESTATS_H
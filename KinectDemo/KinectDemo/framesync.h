@@ -0,0 +1,236 @@
+#ifndef FRAMESYNC_H
+#define FRAMESYNC_H
+
+#include <string.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+/* Class for pairing depth and image frames taken at the same time.
+ *
+ * The depth and image streams of a sensor run on their own clocks, after
+ * an update the two meta data may be a frame apart. Every new depth or
+ * image frame is copied once into a pooled buffer and kept in a short ring
+ * with its Timestamp() and FrameID(). After each push the newest depth
+ * frame with an image within the tolerance becomes the current pair; the
+ * frames before it, of both streams, are counted as unmatched and let go.
+ *
+ * Pairs hand out the buffers by reference count, not by copy. A buffer goes
+ * back to the pool when no pair holds it any more, so the pool stops
+ * growing after the first frames. All calls, and the copies and releases
+ * of the pairs, belong on one thread. */
+class CFrameSync
+{
+public:
+	enum
+	{
+		RING_SIZE	= 4		// frames per stream waiting for a partner
+	};
+
+	/* One frame of either stream */
+	struct SBuffer
+	{
+		XnUInt32				m_nFrameID;
+		XnUInt64				m_nTimestamp;
+		unsigned int			m_iXRes;
+		unsigned int			m_iYRes;
+		std::vector<XnUInt8>	m_vData;
+
+		const XnDepthPixel* Depth() const	{ return (const XnDepthPixel*)&m_vData[0]; }
+		const XnUInt8* Image() const		{ return &m_vData[0]; }
+	};
+
+	/* A depth frame and the image taken closest to it */
+	struct SPair
+	{
+		std::shared_ptr<const SBuffer>	m_pDepth;
+		std::shared_ptr<const SBuffer>	m_pImage;
+		XnInt64							m_nSkew;	// image - depth timestamp, microseconds
+	};
+
+	/* Constructor, nTolerance is the largest skew of a pair in microseconds */
+	CFrameSync( XnUInt64 nTolerance = 17000 ) : m_nTolerance( nTolerance ), m_bNewPair( false ),
+		m_nPairs( 0 ), m_nUnmatchedDepth( 0 ), m_nUnmatchedImage( 0 ), m_nSkewSum( 0 ), m_nSkewMax( 0 )
+	{
+		for( unsigned int i = 0; i < 2; ++ i )
+		{
+			m_aRing[i].m_nCount = 0;
+			m_aRing[i].m_bPushed = false;
+		}
+	}
+
+	/* Set the largest skew of a pair in microseconds */
+	void SetTolerance( XnUInt64 nTolerance )
+	{
+		m_nTolerance = nTolerance;
+	}
+
+	/* Add the depth frame of the last update, return false if it was already added */
+	bool PushDepth( const xn::DepthMetaData& rMD )
+	{
+		return Push( STREAM_DEPTH, rMD.FrameID(), rMD.Timestamp(), rMD.XRes(), rMD.YRes(), rMD.Data(), rMD.XRes() * rMD.YRes() * sizeof( XnDepthPixel ) );
+	}
+
+	/* Add the image frame of the last update, return false if it was already added */
+	bool PushImage( const xn::ImageMetaData& rMD )
+	{
+		return Push( STREAM_IMAGE, rMD.FrameID(), rMD.Timestamp(), rMD.XRes(), rMD.YRes(), rMD.Data(), rMD.XRes() * rMD.YRes() * 3 );
+	}
+
+	/* Get the newest pair, return false if there is none since the last call */
+	bool GetPair( SPair& rPair )
+	{
+		if( !m_bNewPair )
+			return false;
+		rPair = m_Pair;
+		m_bNewPair = false;
+		return true;
+	}
+
+	/* Number of pairs */
+	XnUInt64 Pairs() const				{ return m_nPairs; }
+
+	/* Frames let go without a partner */
+	XnUInt64 UnmatchedDepth() const		{ return m_nUnmatchedDepth; }
+	XnUInt64 UnmatchedImage() const		{ return m_nUnmatchedImage; }
+
+	/* Buffers made, in use or in the pool */
+	unsigned int BufferCount() const	{ return (unsigned int)m_vPool.size(); }
+
+	/* Print pairs, skew and unmatched frames */
+	void Report( std::ostream& rOut ) const
+	{
+		rOut << "Sync: " << m_nPairs << " pairs, skew mean " << ( m_nPairs ? m_nSkewSum / 1000.0 / m_nPairs : 0.0 )
+			<< " ms max " << m_nSkewMax / 1000.0 << " ms, unmatched " << m_nUnmatchedDepth << " depth " << m_nUnmatchedImage
+			<< " image, " << m_vPool.size() << " buffers" << std::endl;
+	}
+
+private:
+	enum EStream
+	{
+		STREAM_DEPTH,
+		STREAM_IMAGE
+	};
+
+	struct SRing
+	{
+		std::shared_ptr<const SBuffer>	m_aFrame[RING_SIZE];	// oldest first
+		unsigned int					m_nCount;
+		bool							m_bPushed;				// the last frame pushed, paired or not
+		XnUInt32						m_nLastFrameID;
+		XnUInt64						m_nLastTimestamp;
+	};
+
+	bool Push( EStream eStream, XnUInt32 nFrameID, XnUInt64 nTimestamp, unsigned int iXRes, unsigned int iYRes, const void* pData, size_t nSize )
+	{
+		// an update without new data of this stream leaves the same frame, also
+		// when it was already paired and is no longer in the ring
+		SRing& rRing = m_aRing[ eStream ];
+		if( rRing.m_bPushed && rRing.m_nLastFrameID == nFrameID && rRing.m_nLastTimestamp == nTimestamp )
+			return false;
+		if( pData == NULL || nSize == 0 )
+			return false;
+		rRing.m_bPushed = true;
+		rRing.m_nLastFrameID = nFrameID;
+		rRing.m_nLastTimestamp = nTimestamp;
+
+		// OpenNI reuses its buffer at the next update, this is the one copy
+		std::shared_ptr<SBuffer> pBuffer = Acquire();
+		pBuffer->m_nFrameID = nFrameID;
+		pBuffer->m_nTimestamp = nTimestamp;
+		pBuffer->m_iXRes = iXRes;
+		pBuffer->m_iYRes = iYRes;
+		pBuffer->m_vData.resize( nSize );
+		memcpy( &pBuffer->m_vData[0], pData, nSize );
+
+		// a frame pushed out of a full ring has no partner
+		if( rRing.m_nCount == RING_SIZE )
+		{
+			++( eStream == STREAM_DEPTH ? m_nUnmatchedDepth : m_nUnmatchedImage );
+			Drop( eStream, 1 );
+		}
+		rRing.m_aFrame[ rRing.m_nCount++ ] = pBuffer;
+		Match();
+		return true;
+	}
+
+	/* A pool buffer held by nobody else, or a new one */
+	std::shared_ptr<SBuffer> Acquire()
+	{
+		for( size_t i = 0; i < m_vPool.size(); ++ i )
+		{
+			if( m_vPool[i].use_count() == 1 )
+				return m_vPool[i];
+		}
+		m_vPool.push_back( std::make_shared<SBuffer>() );
+		return m_vPool.back();
+	}
+
+	/* Let go of the n oldest frames of a stream */
+	void Drop( EStream eStream, unsigned int n )
+	{
+		SRing& rRing = m_aRing[ eStream ];
+		for( unsigned int i = 0; i + n < rRing.m_nCount; ++ i )
+			rRing.m_aFrame[i] = rRing.m_aFrame[ i + n ];
+		for( unsigned int i = rRing.m_nCount - n; i < rRing.m_nCount; ++ i )
+			rRing.m_aFrame[i].reset();
+		rRing.m_nCount -= n;
+	}
+
+	/* The newest depth frame with an image close enough becomes the pair */
+	void Match()
+	{
+		SRing& rDepth = m_aRing[ STREAM_DEPTH ];
+		SRing& rImage = m_aRing[ STREAM_IMAGE ];
+		for( unsigned int d = rDepth.m_nCount; d -- > 0; )
+		{
+			XnUInt64 nTime = rDepth.m_aFrame[d]->m_nTimestamp;
+			unsigned int iBest = RING_SIZE;
+			XnUInt64 nBest = m_nTolerance;
+			for( unsigned int i = 0; i < rImage.m_nCount; ++ i )
+			{
+				XnUInt64 nImageTime = rImage.m_aFrame[i]->m_nTimestamp;
+				XnUInt64 nSkew = ( nImageTime > nTime ) ? nImageTime - nTime : nTime - nImageTime;
+				if( nSkew <= nBest )
+				{
+					nBest = nSkew;
+					iBest = i;
+				}
+			}
+			if( iBest == RING_SIZE )
+				continue;
+
+			m_Pair.m_pDepth = rDepth.m_aFrame[d];
+			m_Pair.m_pImage = rImage.m_aFrame[ iBest ];
+			m_Pair.m_nSkew = (XnInt64)m_Pair.m_pImage->m_nTimestamp - (XnInt64)nTime;
+			m_bNewPair = true;
+			++m_nPairs;
+			m_nSkewSum += nBest;
+			if( nBest > m_nSkewMax )
+				m_nSkewMax = nBest;
+
+			// the older frames will never be paired
+			m_nUnmatchedDepth += d;
+			m_nUnmatchedImage += iBest;
+			Drop( STREAM_DEPTH, d + 1 );
+			Drop( STREAM_IMAGE, iBest + 1 );
+			return;
+		}
+	}
+
+private:
+	XnUInt64								m_nTolerance;		// microseconds
+	SRing									m_aRing[2];
+	std::vector< std::shared_ptr<SBuffer> >	m_vPool;
+	SPair									m_Pair;
+	bool									m_bNewPair;
+	XnUInt64								m_nPairs;
+	XnUInt64								m_nUnmatchedDepth;
+	XnUInt64								m_nUnmatchedImage;
+	XnUInt64								m_nSkewSum;
+	XnUInt64								m_nSkewMax;
+};
+
+#endif // FRAMESYNC_H
@@ -1,19 +1,52 @@
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
+#include <mutex>
 
 #include "opencv/cv.h"
 #include "opencv/highgui.h"
 
 #include <XnCppWrapper.h>
 
+#include "framestats.h"
+#include "frameadapter.h"
+#include "eventqueue.h"
+#include "logger.h"
+
 
 using namespace std;
 using namespace cv;
 
-ostream& operator<<(ostream &out, const XnPoint3D &rPoint)
+// what the gesture callbacks saw, copied into the event queue as is
+struct SGestureEvent {
+	bool bRecognized;			// or in progress
+	char sGesture[32];
+	XnPoint3D mStart;			// the position of a gesture in progress
+	XnPoint3D mEnd;
+	XnFloat fProgress;
+};
+
+// the gesture canvas, drawn by the handler thread and shown by the main loop
+struct SCanvas {
+	Mat drawImg;
+	mutex drawLock;
+	CEventQueue<SGestureEvent, 64> events;
+
+	SCanvas() : drawImg(480, 640, CV_8UC3), events("Gesture events") {}
+};
+
+// the callbacks run inside WaitOneUpdateAll, they only queue what they saw
+void pushGesture(void *pCookie, bool bRecognized, const XnChar *strGesture,
+				const XnPoint3D *pStart, const XnPoint3D *pEnd, XnFloat fProgress)
 {
-	out << "(" << rPoint.X << "," << rPoint.Y << "," << rPoint.Z << ")";
-	return out;
+	SGestureEvent event;
+	event.bRecognized = bRecognized;
+	strncpy(event.sGesture, strGesture, sizeof(event.sGesture) - 1);
+	event.sGesture[sizeof(event.sGesture) - 1] = 0;
+	event.mStart = *pStart;
+	event.mEnd = *pEnd;
+	event.fProgress = fProgress;
+	((SCanvas *)pCookie)->events.Push(event);
 }
 
 void XN_CALLBACK_TYPE gestureRecog(xn::GestureGenerator &generator,
@@ -22,7 +55,15 @@ void XN_CALLBACK_TYPE gestureRecog(xn::GestureGenerator &generator,
 						const XnPoint3D *pEndPosition,
 						void *pCookie)
 {
-	cout << strGesture << " from " << *pIDPosition << " to " << *pEndPosition << endl;
+	pushGesture(pCookie, true, strGesture, pIDPosition, pEndPosition, 1);
+}
+
+// runs on the handler thread
+void drawGesture(SCanvas &canvas, const XnChar *strGesture,
+				const XnPoint3D *pIDPosition, const XnPoint3D *pEndPosition)
+{
+	CLogger::Get().Log("%s from (%g,%g,%g) to (%g,%g,%g)", strGesture, pIDPosition->X, pIDPosition->Y, pIDPosition->Z,
+		pEndPosition->X, pEndPosition->Y, pEndPosition->Z);
 
 	int imgStartX = 0;
 	int imgStartY = 0;
@@ -36,42 +77,39 @@ void XN_CALLBACK_TYPE gestureRecog(xn::GestureGenerator &generator,
 	imgEndX = (int)(640 / 2 - (pEndPosition->X));
 	imgEndY = (int)(640 / 2 - (pEndPosition->Y));
 
-	IplImage * refImage = (IplImage *)pCookie;
+	lock_guard<mutex> lock(canvas.drawLock);
+	Mat &refImage = canvas.drawImg;
 
 	if(strcmp(strGesture, "RaiseHand") == 0)
 	{
-		cvCircle(refImage, cvPoint(imgStartX, imgStartY), 1, CV_RGB(255, 0, 0), 2);
+		circle(refImage, Point(imgStartX, imgStartY), 1, CV_RGB(255, 0, 0), 2);
 	}
 	else if(strcmp(strGesture, "Wave") == 0)
 	{
-		cvLine(refImage, cvPoint(imgStartX, imgStartY), cvPoint(imgEndX, imgEndY),
+		line(refImage, Point(imgStartX, imgStartY), Point(imgEndX, imgEndY),
 			CV_RGB(255, 255, 0), 6);
 	}
 	else if(strcmp(strGesture, "Click") == 0)
 	{
-		cvCircle(refImage, cvPoint(imgStartX, imgStartY), 6, CV_RGB(0, 0, 255), 12);
+		circle(refImage, Point(imgStartX, imgStartY), 6, CV_RGB(0, 0, 255), 12);
 	}
 
-	cvSetImageROI(refImage, cvRect(40, 450, 640, 30));
-	CvFont font;
-	cvInitFont(&font, CV_FONT_VECTOR0, 1, 1, 0, 3, 5);
-	cvSet(refImage, cvScalar(255, 255, 255));
+	// the status line, clipped to the image like cvSetImageROI did
+	Mat statusImg = refImage(Rect(40, 450, 640, 30) & Rect(0, 0, refImage.cols, refImage.rows));
+	statusImg.setTo(Scalar(255, 255, 255));
 	sprintf(locationInfo, "From: %d,%d to %d,%d", (int)pIDPosition->X, (int)pIDPosition->Y,
 		(int)(pEndPosition->X), (int)(pEndPosition->Y));
-	cvPutText(refImage, locationInfo, cvPoint(30, 30), &font, CV_RGB(0, 0, 0));
-	cvResetImageROI(refImage);
+	putText(statusImg, locationInfo, Point(30, 30), FONT_HERSHEY_SIMPLEX, 1, CV_RGB(0, 0, 0), 3);
 
 }
 
 
-void clearImg(IplImage *inputImg)
+void clearImg(Mat &inputImg)
 {
-	CvFont font;
-	cvInitFont(&font, CV_FONT_VECTOR0, 1, 1, 0, 3, 5);
-	memset(inputImg->imageData, 255, 640 * 480 * 3);
-	cvPutText(inputImg, "Hand Raise!", cvPoint(20, 20), &font, CV_RGB(255, 0, 0));
-	cvPutText(inputImg, "Hand Wave!", cvPoint(20, 50), &font, CV_RGB(255, 255, 0));
-	cvPutText(inputImg, "Hand Push!", cvPoint(20, 80), &font, CV_RGB(0, 0, 255));
+	inputImg.setTo(Scalar(255, 255, 255));
+	putText(inputImg, "Hand Raise!", Point(20, 20), FONT_HERSHEY_SIMPLEX, 1, CV_RGB(255, 0, 0), 3);
+	putText(inputImg, "Hand Wave!", Point(20, 50), FONT_HERSHEY_SIMPLEX, 1, CV_RGB(255, 255, 0), 3);
+	putText(inputImg, "Hand Push!", Point(20, 80), FONT_HERSHEY_SIMPLEX, 1, CV_RGB(0, 0, 255), 3);
 }
 
 void XN_CALLBACK_TYPE gestureProcess(xn::GestureGenerator &generator,
@@ -80,21 +118,32 @@ void XN_CALLBACK_TYPE gestureProcess(xn::GestureGenerator &generator,
 								XnFloat fProgress,
 								void *PCookie)
 {
-	cout << strGesture << ":" << fProgress << " at " << *pPosition << endl;
+	pushGesture(PCookie, false, strGesture, pPosition, pPosition, fProgress);
+}
+
+void handleGesture(SCanvas &canvas, const SGestureEvent &event)
+{
+	if(event.bRecognized)
+		drawGesture(canvas, event.sGesture, &event.mStart, &event.mEnd);
+	else
+		CLogger::Get().Log("%s:%g at (%g,%g,%g)", event.sGesture, event.fProgress, event.mStart.X, event.mStart.Y, event.mStart.Z);
 }
 
 int main(int argc, char *argv[])
 {
-	IplImage *drawImg = cvCreateImage(cvSize(640, 480), IPL_DEPTH_8U, 3);
-	IplImage *cameraImg = cvCreateImage(cvSize(640, 480), IPL_DEPTH_8U, 3);
+	// the gestures are drawn on a fixed canvas, the camera image is sized from the meta data
+	SCanvas canvas;
+	Mat cameraImg;
+	CFrameAdapter adapter;
 
 	cvNamedWindow("Gesture", 1);
 	cvNamedWindow("Camera", 1);
 
-	clearImg(drawImg);
+	clearImg(canvas.drawImg);
 
 	XnStatus res;
 	char key = 0;
+	CFrameStats imageStats("Image");
 
 	xn::Context context;
 	res = context.Init();
@@ -113,32 +162,42 @@ int main(int argc, char *argv[])
 
 	XnCallbackHandle handle;
 	gestureGenerator.RegisterGestureCallbacks(gestureRecog, 
-		gestureProcess, (void *)drawImg, handle);
+		gestureProcess, (void *)&canvas, handle);
+	SCanvas *pCanvas = &canvas;
+	canvas.events.Start([pCanvas](const SGestureEvent &event) { handleGesture(*pCanvas, event); });
 
 	context.StartGeneratingAll();
 	res = context.WaitAndUpdateAll();
 
-	while((key != 27) && !(res = context.WaitAndUpdateAll()))
+	// block until the image generator has a new frame
+	while((key != 27) && !(res = context.WaitOneUpdateAll(imageGenerator)))
 	{
-		if(key == 'c')
-		{
-			clearImg(drawImg);
-		}
-
+		XnUInt64 nReadyTime = CFrameStats::Now();
 		imageGenerator.GetMetaData(imageMD);
-		memcpy(cameraImg->imageData, imageMD.Data(), 640 * 480 * 3);
-		cvCvtColor(cameraImg, cameraImg, CV_RGB2BGR);
+		adapter.ToBGR(imageMD, cameraImg);
 
-		cvShowImage("Gesture", drawImg);
-		cvShowImage("Camera", cameraImg);
+		{
+			lock_guard<mutex> lock(canvas.drawLock);
+			if(key == 'c')
+			{
+				clearImg(canvas.drawImg);
+			}
+			imshow("Gesture", canvas.drawImg);
+		}
+		imshow("Camera", cameraImg);
+		imageStats.OnFrame(imageMD.FrameID(), nReadyTime);
 
-		key = waitKey(20);
+		// only handle window events, the sensor paces the loop
+		key = waitKey(1);
 	}
+	canvas.events.Stop();
+	CLogger::Get().Flush();
+	imageStats.Report(cout);
+	canvas.events.Report(cout);
+	CLogger::Get().Report(cout);
 
 	cvDestroyWindow("Gesture");
 	cvDestroyWindow("Camera");
-	cvReleaseImage(&drawImg);
-	cvReleaseImage(&cameraImg);
 
 	context.StopGeneratingAll();
 	context.Shutdown();
@@ -0,0 +1,247 @@
+#ifndef GESTURETRACKER_H
+#define GESTURETRACKER_H
+
+#include <XnCppWrapper.h>
+
+#include "skeletonsnapshot.h"
+
+/* Class for detecting hand swipes of every tracked user.
+ *
+ * Each user gets a slot in a fixed table with a ring buffer of the last
+ * HISTORY hand positions and their timestamps. The hand velocity is the
+ * least squares slope over the samples of the last window, so one noisy
+ * frame doesn't make a swipe. A speed over the threshold ( mm/s ) toward
+ * the sensor is "Stop", else the first axis over the threshold gives
+ * "Right", "Left", "Up" or "Down".
+ *
+ * Slots of users who are no longer tracked are freed on Update(), nothing
+ * is allocated after construction. */
+class CGestureTracker
+{
+public:
+	enum
+	{
+		MAX_USERS	= CSkeletonSnapshot::MAX_USERS,
+		HISTORY		= 8		// power of 2
+	};
+
+	enum EAction
+	{
+		ACTION_NONE,
+		ACTION_STOP,
+		ACTION_RIGHT,
+		ACTION_LEFT,
+		ACTION_UP,
+		ACTION_DOWN
+	};
+
+	/* Constructor, nWindow is the fit window in microseconds */
+	CGestureTracker( float fSpeed = 600, XnUInt64 nWindow = 200000 ) : m_fSpeed( fSpeed ), m_nWindow( nWindow )
+	{
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+			m_aUser[i].m_UserID = 0;
+	}
+
+	/* Add the hand of every user of a snapshot, nTime in microseconds.
+	 * Users missing from the snapshot lose their history */
+	void Update( const CSkeletonSnapshot& rSkeleton, XnSkeletonJoint eHand, XnUInt64 nTime )
+	{
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+			m_aUser[i].m_bSeen = false;
+
+		int iJoint = rSkeleton.FindJoint( eHand );
+		if( iJoint >= 0 )
+		{
+			for( unsigned int i = 0; i < rSkeleton.GetUserCount(); ++ i )
+			{
+				// a joint with no confidence has no position
+				if( rSkeleton.Confidence()[ i * rSkeleton.GetJointCount() + iJoint ] == 0 )
+				{
+					SUser* pUser = FindUser( rSkeleton.GetUserID( i ) );
+					if( pUser != NULL )
+					{
+						pUser->m_bSeen = true;
+						pUser->m_eNewAction = ACTION_NONE;
+					}
+					continue;
+				}
+				AddSample( rSkeleton.GetUserID( i ), rSkeleton.GetRealWorld( i, iJoint ), nTime );
+			}
+		}
+
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+		{
+			if( !m_aUser[i].m_bSeen )
+				m_aUser[i].m_UserID = 0;
+		}
+	}
+
+	/* Add one hand position of a user, return the action found with it */
+	EAction AddSample( XnUserID uid, const XnPoint3D& rHand, XnUInt64 nTime )
+	{
+		SUser* pUser = FindUser( uid );
+		if( pUser == NULL )
+		{
+			pUser = FindUser( 0 );
+			if( pUser == NULL )
+				return ACTION_NONE;
+			pUser->m_UserID = uid;
+			pUser->m_nSamples = 0;
+			pUser->m_eAction = ACTION_NONE;
+		}
+		pUser->m_bSeen = true;
+
+		SSample& rSample = pUser->m_aSample[ pUser->m_nSamples & ( HISTORY - 1 ) ];
+		rSample.m_Hand = rHand;
+		rSample.m_nTime = nTime;
+		++pUser->m_nSamples;
+
+		pUser->m_eNewAction = Classify( *pUser, nTime );
+		if( pUser->m_eNewAction != ACTION_NONE )
+			pUser->m_eAction = pUser->m_eNewAction;
+		return pUser->m_eNewAction;
+	}
+
+	/* Action found with the last sample of a user */
+	EAction GetNewAction( XnUserID uid ) const
+	{
+		const SUser* pUser = FindUser( uid );
+		return pUser ? pUser->m_eNewAction : ACTION_NONE;
+	}
+
+	/* Last action found for a user */
+	EAction GetAction( XnUserID uid ) const
+	{
+		const SUser* pUser = FindUser( uid );
+		return pUser ? pUser->m_eAction : ACTION_NONE;
+	}
+
+	/* Hand velocity of a user in mm/s, return false without enough samples */
+	bool GetVelocity( XnUserID uid, XnVector3D& rVelocity ) const
+	{
+		const SUser* pUser = FindUser( uid );
+		if( pUser == NULL || pUser->m_nSamples == 0 )
+			return false;
+		const SSample& rLast = pUser->m_aSample[ ( pUser->m_nSamples - 1 ) & ( HISTORY - 1 ) ];
+		return Fit( *pUser, rLast.m_nTime, rVelocity );
+	}
+
+	/* Text of an action */
+	static const char* GetActionName( EAction eAction )
+	{
+		static const char* aName[] = { "", "Stop", "Right", "Left", "Up", "Down" };
+		return aName[ eAction ];
+	}
+
+private:
+	struct SSample
+	{
+		XnPoint3D	m_Hand;
+		XnUInt64	m_nTime;
+	};
+
+	struct SUser
+	{
+		XnUserID	m_UserID;		// 0 for a free slot
+		bool		m_bSeen;
+		XnUInt32	m_nSamples;		// ever added, the newest is at ( m_nSamples - 1 ) % HISTORY
+		EAction		m_eAction;
+		EAction		m_eNewAction;
+		SSample		m_aSample[HISTORY];
+	};
+
+	SUser* FindUser( XnUserID uid )
+	{
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+		{
+			if( m_aUser[i].m_UserID == uid )
+				return &m_aUser[i];
+		}
+		return NULL;
+	}
+
+	const SUser* FindUser( XnUserID uid ) const
+	{
+		return const_cast<CGestureTracker*>( this )->FindUser( uid );
+	}
+
+	/* Least squares slope of position over time of the samples in the window */
+	bool Fit( const SUser& rUser, XnUInt64 nNow, XnVector3D& rVelocity ) const
+	{
+		unsigned int nCount = ( rUser.m_nSamples < HISTORY ) ? rUser.m_nSamples : (unsigned int)HISTORY;
+
+		// time in seconds relative to the newest sample keeps the sums small
+		float aT[HISTORY];
+		const XnPoint3D* aP[HISTORY];
+		unsigned int n = 0;
+		for( unsigned int i = 0; i < nCount; ++ i )
+		{
+			const SSample& rSample = rUser.m_aSample[ ( rUser.m_nSamples - 1 - i ) & ( HISTORY - 1 ) ];
+			if( nNow - rSample.m_nTime > m_nWindow )
+				break;
+			aT[n] = -(float)( nNow - rSample.m_nTime ) * 1e-6f;
+			aP[n] = &rSample.m_Hand;
+			++n;
+		}
+		if( n < 3 )
+			return false;
+
+		float fT = 0;
+		XnVector3D mMean = { 0, 0, 0 };
+		for( unsigned int i = 0; i < n; ++ i )
+		{
+			fT += aT[i];
+			mMean.X += aP[i]->X;
+			mMean.Y += aP[i]->Y;
+			mMean.Z += aP[i]->Z;
+		}
+		fT /= n;
+		mMean.X /= n;
+		mMean.Y /= n;
+		mMean.Z /= n;
+
+		float fTT = 0;
+		XnVector3D mTP = { 0, 0, 0 };
+		for( unsigned int i = 0; i < n; ++ i )
+		{
+			float dt = aT[i] - fT;
+			fTT += dt * dt;
+			mTP.X += dt * ( aP[i]->X - mMean.X );
+			mTP.Y += dt * ( aP[i]->Y - mMean.Y );
+			mTP.Z += dt * ( aP[i]->Z - mMean.Z );
+		}
+		if( fTT <= 0 )
+			return false;
+
+		rVelocity.X = mTP.X / fTT;
+		rVelocity.Y = mTP.Y / fTT;
+		rVelocity.Z = mTP.Z / fTT;
+		return true;
+	}
+
+	EAction Classify( const SUser& rUser, XnUInt64 nNow ) const
+	{
+		XnVector3D mV;
+		if( !Fit( rUser, nNow, mV ) )
+			return ACTION_NONE;
+
+		if( mV.Z < -m_fSpeed )
+			return ACTION_STOP;
+		if( mV.X > m_fSpeed )
+			return ACTION_RIGHT;
+		if( mV.X < -m_fSpeed )
+			return ACTION_LEFT;
+		if( mV.Y > m_fSpeed )
+			return ACTION_UP;
+		if( mV.Y < -m_fSpeed )
+			return ACTION_DOWN;
+		return ACTION_NONE;
+	}
+
+private:
+	float		m_fSpeed;
+	XnUInt64	m_nWindow;
+	SUser		m_aUser[MAX_USERS];
+};
+
+#endif // GESTURETRACKER_H
@@ -1,66 +1,162 @@
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
 #include <string>
 #include <iostream>
 
 #include <XnCppWrapper.h>
 
+#include "eventqueue.h"
+#include "logger.h"
+
 
 using namespace std;
 
 
+// what the callbacks saw, copied into the event queue as is
+struct SHandEvent {
+	enum EType { GESTURE, HAND_CREATE, HAND_UPDATE, HAND_DESTROY } eType;
+	XnUserID nId;
+	XnPoint3D mPosition;
+	XnFloat fTime;
+	char sGesture[32];
+};
+
+typedef CEventQueue<SHandEvent, 256> CHandEvents;
+
 struct SNode {
-	char *sGestureToUse;
-	char *sGestureToPress;
+	const char *sGestureToUse;
+	const char *sGestureToPress;
 	xn::DepthGenerator mDepth;
 	xn::HandsGenerator mHand;
 	xn::GestureGenerator mGesture;
+	XnFieldOfView mFOV;
+	XnMapOutputMode mMode;
+	CHandEvents mEvents;		// callbacks to the handler thread
+	CHandEvents mCommands;		// handler thread back to the sensor loop
+
+	SNode() : mEvents("Hand events"), mCommands("Hand commands") {}
 };
 
+static volatile sig_atomic_t s_bInterrupted = 0;
+
+void OnInterrupt(int)
+{
+	s_bInterrupted = 1;
+}
+
+// the callbacks run inside WaitAndUpdateAll, they only queue what they saw
+void PushEvent(SNode *pNodes, SHandEvent::EType eType, XnUserID nId, const XnPoint3D *pPosition, XnFloat fTime, const XnChar *strGesture)
+{
+	SHandEvent mEvent;
+	mEvent.eType = eType;
+	mEvent.nId = nId;
+	mEvent.mPosition = *pPosition;
+	mEvent.fTime = fTime;
+	strncpy(mEvent.sGesture, strGesture, sizeof(mEvent.sGesture) - 1);
+	mEvent.sGesture[sizeof(mEvent.sGesture) - 1] = 0;
+	pNodes->mEvents.Push(mEvent);
+}
+
 void XN_CALLBACK_TYPE GestureRecognized(xn::GestureGenerator &generator,
 				const XnChar *strGesture,
 				const XnPoint3D *pIDPostion,
 				const XnPoint3D *pEndPosition,
 				void *pCookie)
 {
-	SNode *pNodes = ((SNode *)pCookie);
-	if(strcmp(strGesture, pNodes->sGestureToPress) == 0)
-	{
-		cout << "Left Button" << endl;
-	} 
-	else if(strcmp(strGesture, pNodes->sGestureToUse) == 0)
-	{
-		cout << "Start moving" << endl;
-		generator.RemoveGesture(strGesture);
-		pNodes->mHand.StartTracking(*pEndPosition);
-	}
+	PushEvent((SNode *)pCookie, SHandEvent::GESTURE, 0, pEndPosition, 0, strGesture);
 }
 
 void XN_CALLBACK_TYPE HandCreate(xn::HandsGenerator &generator,
 		XnUserID nId, const XnPoint3D *pPosition, XnFloat fTime, void *pCookie)
 {
-	SNode *pNodes = ((SNode *)pCookie);
-	cout << "New Hand: " << nId << " detected!" << endl;
-	cout << pPosition->X << "/" << pPosition->Y << "/" << pPosition->Z << endl;
-	pNodes->mGesture.AddGesture(pNodes->sGestureToPress, NULL);
+	PushEvent((SNode *)pCookie, SHandEvent::HAND_CREATE, nId, pPosition, fTime, "");
 }
 
 void XN_CALLBACK_TYPE HandUpdate(xn::HandsGenerator &generator,
 	XnUserID nId, const XnPoint3D *pPosition, XnFloat fTime, void *pCookie)
 {
-	SNode *pNodes = ((SNode *)pCookie);
-	XnPoint3D wPos;
-	pNodes->mDepth.ConvertRealWorldToProjective(1, pPosition, &wPos);
-	cout << wPos.X << "/" << wPos.Y << endl;
+	PushEvent((SNode *)pCookie, SHandEvent::HAND_UPDATE, nId, pPosition, fTime, "");
 }
 
 
 void XN_CALLBACK_TYPE HandDestroy(xn::HandsGenerator &generator,
 	XnUserID nId, XnFloat fTime, void *pCookie)
 {
-	SNode *pNodes = ((SNode *)pCookie);
-	cout << "Lost Hand: " << nId << endl;
-	pNodes->mGesture.AddGesture(pNodes->sGestureToUse, NULL);
-	pNodes->mGesture.RemoveGesture(pNodes->sGestureToPress);
+	XnPoint3D mNone = { 0, 0, 0 };
+	PushEvent((SNode *)pCookie, SHandEvent::HAND_DESTROY, nId, &mNone, fTime, "");
+}
+
+// the same math as ConvertRealWorldToProjective, without calling the generator from this thread
+XnPoint3D ToProjective(const SNode &rNodes, const XnPoint3D &rPoint)
+{
+	XnPoint3D wPos = { 0, 0, rPoint.Z };
+	if(rPoint.Z != 0)
+	{
+		wPos.X = rNodes.mMode.nXRes * (0.5f + rPoint.X / rPoint.Z / (float)(2 * tan(rNodes.mFOV.fHFOV / 2)));
+		wPos.Y = rNodes.mMode.nYRes * (0.5f - rPoint.Y / rPoint.Z / (float)(2 * tan(rNodes.mFOV.fVFOV / 2)));
+	}
+	return wPos;
+}
+
+// runs on the handler thread, the generators are changed by the sensor loop
+void HandleEvent(SNode *pNodes, const SHandEvent &rEvent)
+{
+	switch(rEvent.eType)
+	{
+	case SHandEvent::GESTURE:
+		if(strcmp(rEvent.sGesture, pNodes->sGestureToPress) == 0)
+		{
+			CLogger::Get().Log("Left Button");
+		}
+		else if(strcmp(rEvent.sGesture, pNodes->sGestureToUse) == 0)
+		{
+			CLogger::Get().Log("Start moving");
+			pNodes->mCommands.Push(rEvent);
+		}
+		break;
+
+	case SHandEvent::HAND_CREATE:
+		CLogger::Get().Log("New Hand: %u detected at %g/%g/%g", rEvent.nId, rEvent.mPosition.X, rEvent.mPosition.Y, rEvent.mPosition.Z);
+		pNodes->mCommands.Push(rEvent);
+		break;
+
+	case SHandEvent::HAND_UPDATE:
+	{
+		XnPoint3D wPos = ToProjective(*pNodes, rEvent.mPosition);
+		CLogger::Get().Log("Hand %u at %g/%g", rEvent.nId, wPos.X, wPos.Y);
+		break;
+	}
+
+	case SHandEvent::HAND_DESTROY:
+		CLogger::Get().Log("Lost Hand: %u", rEvent.nId);
+		pNodes->mCommands.Push(rEvent);
+		break;
+	}
+}
+
+// between two updates, on the thread that owns the generators
+void RunCommands(SNode &rNodes)
+{
+	SHandEvent mEvent;
+	while(rNodes.mCommands.Pop(mEvent))
+	{
+		if(mEvent.eType == SHandEvent::GESTURE)
+		{
+			rNodes.mGesture.RemoveGesture(mEvent.sGesture);
+			rNodes.mHand.StartTracking(mEvent.mPosition);
+		}
+		else if(mEvent.eType == SHandEvent::HAND_CREATE)
+		{
+			rNodes.mGesture.AddGesture(rNodes.sGestureToPress, NULL);
+		}
+		else if(mEvent.eType == SHandEvent::HAND_DESTROY)
+		{
+			rNodes.mGesture.AddGesture(rNodes.sGestureToUse, NULL);
+			rNodes.mGesture.RemoveGesture(rNodes.sGestureToPress);
+		}
+	}
 }
 
 int main(int argc, char *argv[])
@@ -72,6 +168,8 @@ int main(int argc, char *argv[])
 	mNodes.mDepth.Create(mContext);
 	mNodes.mGesture.Create(mContext);
 	mNodes.mHand.Create(mContext);
+	mNodes.mDepth.GetFieldOfView(mNodes.mFOV);
+	mNodes.mDepth.GetMapOutputMode(mNodes.mMode);
 
 	mNodes.mHand.SetSmoothing(0.5f);
 	mNodes.sGestureToPress = "Click";
@@ -86,14 +184,25 @@ int main(int argc, char *argv[])
 	mNodes.mHand.RegisterHandCallbacks(HandCreate, HandUpdate, HandDestroy,
 				&mNodes, hHandle);
 
+	SNode *pNodes = &mNodes;
+	mNodes.mEvents.Start([pNodes](const SHandEvent &rEvent) { HandleEvent(pNodes, rEvent); });
+
+	// Ctrl+C ends the loop, so the queues get reported
+	signal(SIGINT, OnInterrupt);
 	mContext.StartGeneratingAll();
-	while(true)
+	while(!s_bInterrupted)
 	{
 		mContext.WaitAndUpdateAll();
+		RunCommands(mNodes);
 	}
 
 	mContext.StopGeneratingAll();
+	mNodes.mEvents.Stop();
+	CLogger::Get().Flush();
+	mNodes.mEvents.Report(cout);
+	mNodes.mCommands.Report(cout);
+	CLogger::Get().Report(cout);
 	mContext.Release();
 
 	return 0;
-}
\ No newline at end of file
+}
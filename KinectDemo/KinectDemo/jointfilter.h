@@ -0,0 +1,313 @@
+#ifndef JOINTFILTER_H
+#define JOINTFILTER_H
+
+#include <math.h>
+#include <ostream>
+
+#include <XnTypes.h>
+
+#include "skeletonsnapshot.h"
+
+/* Class for smoothing the joints of a skeleton snapshot over time.
+ *
+ * Two filters, applied to every axis of every joint:
+ *  - One Euro ( Casiez et al. 2012 ), a low pass whose cutoff rises with
+ *    the speed of the joint, fc = min cutoff + beta * | speed |. A joint
+ *    at rest is smoothed hard, a moving joint follows with little lag.
+ *  - Holt double exponential, a level and a trend in mm/s. The trend
+ *    makes up for the lag of the level on steady motion.
+ * Both use the real time between frames, a dropped frame is no jump.
+ *
+ * The weight of a new position is multiplied by its confidence: a joint
+ * at 0.5 moves half as fast toward it, a joint at 0 holds its filtered
+ * position. The state is kept per user slot as a structure of arrays,
+ * [ iSlot * MAX_JOINTS + iJoint ], like CSkeletonSnapshot. Slots of users
+ * missing from a snapshot are freed, nothing is allocated.
+ *
+ * Filter() also measures what the filter does: the jitter, the mean
+ * distance a joint moves from one frame to the next, before and after,
+ * and the mean distance of the filtered from the raw position, which is
+ * what the smoothing costs in lag. */
+class CJointFilter
+{
+public:
+	enum
+	{
+		MAX_USERS	= CSkeletonSnapshot::MAX_USERS,
+		MAX_JOINTS	= CSkeletonSnapshot::MAX_JOINTS
+	};
+
+	enum EMode
+	{
+		FILTER_NONE,
+		FILTER_ONE_EURO,
+		FILTER_HOLT
+	};
+
+	/* Constructor, the default parameters suit NITE skeletons at 30 fps */
+	CJointFilter( EMode eMode = FILTER_ONE_EURO ) : m_eMode( eMode )
+	{
+		SetOneEuro( 1.0f, 0.007f, 1.0f );
+		SetHolt( 0.5f, 0.3f );
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+			m_aSlot[i].m_UserID = 0;
+		ResetStats();
+	}
+
+	/* Select the filter, the state starts over */
+	void SetMode( EMode eMode )
+	{
+		m_eMode = eMode;
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+			m_aSlot[i].m_UserID = 0;
+	}
+
+	/* Get the filter in use */
+	EMode GetMode() const
+	{
+		return m_eMode;
+	}
+
+	/* One Euro parameters, the cutoffs in Hz and beta in Hz per mm/s.
+	 * A lower min cutoff removes more jitter at rest, a higher beta removes more lag in motion */
+	void SetOneEuro( float fMinCutoff, float fBeta, float fDerivativeCutoff )
+	{
+		m_fMinCutoff = fMinCutoff;
+		m_fBeta = fBeta;
+		m_fDerivativeCutoff = fDerivativeCutoff;
+	}
+
+	/* Holt parameters, 0 - 1. Alpha weights new positions, gamma new trends */
+	void SetHolt( float fAlpha, float fGamma )
+	{
+		m_fAlpha = fAlpha;
+		m_fGamma = fGamma;
+	}
+
+	/* Filter the real world positions of a snapshot in place, nTime in microseconds.
+	 * Call between CSkeletonSnapshot::Read() and Project() */
+	void Filter( CSkeletonSnapshot& rSkeleton, XnUInt64 nTime )
+	{
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+			m_aSlot[i].m_bSeen = false;
+
+		unsigned int nJoints = rSkeleton.GetJointCount();
+		for( unsigned int iUser = 0; iUser < rSkeleton.GetUserCount(); ++ iUser )
+		{
+			unsigned int iBase = iUser * nJoints;
+			XnFloat* aAxis[3] = { rSkeleton.X() + iBase, rSkeleton.Y() + iBase, rSkeleton.Z() + iBase };
+			const XnFloat* pConfidence = rSkeleton.Confidence() + iBase;
+
+			int iSlot = FindSlot( rSkeleton.GetUserID( iUser ) );
+			bool bNew = iSlot < 0;
+			if( bNew )
+			{
+				iSlot = FindSlot( 0 );
+				if( iSlot < 0 )
+					continue;
+				m_aSlot[ iSlot ].m_UserID = rSkeleton.GetUserID( iUser );
+			}
+			SSlot& rSlot = m_aSlot[ iSlot ];
+			rSlot.m_bSeen = true;
+
+			// a new user or a new joint set starts over
+			unsigned int iState = iSlot * MAX_JOINTS;
+			if( bNew || rSlot.m_nJoints != nJoints )
+			{
+				rSlot.m_nJoints = nJoints;
+				rSlot.m_nTime = nTime;
+				for( unsigned int j = 0; j < nJoints; ++ j )
+					m_abValid[ iState + j ] = false;
+			}
+
+			// 1/30 s if the clock didn't move, a replay may repeat a timestamp
+			float fDT = ( nTime > rSlot.m_nTime ) ? ( nTime - rSlot.m_nTime ) * 1e-6f : 1.0f / 30;
+			rSlot.m_nTime = nTime;
+
+			// joints never seen start at the raw position, the filters leave it there.
+			// Only joints seen before and now count in the statistics
+			bool abCount[MAX_JOINTS];
+			XnFloat aRaw[3][MAX_JOINTS], aLast[3][MAX_JOINTS];
+			for( unsigned int j = 0; j < nJoints; ++ j )
+			{
+				abCount[j] = m_abValid[ iState + j ] && pConfidence[j] > 0;
+				for( int a = 0; a < 3; ++ a )
+				{
+					if( !m_abValid[ iState + j ] )
+					{
+						m_aValue[a][ iState + j ] = aAxis[a][j];
+						m_aTrend[a][ iState + j ] = 0;
+						m_aRaw[a][ iState + j ] = aAxis[a][j];
+					}
+					aRaw[a][j] = aAxis[a][j];
+					aLast[a][j] = m_aValue[a][ iState + j ];
+				}
+				m_abValid[ iState + j ] = m_abValid[ iState + j ] || pConfidence[j] > 0;
+			}
+
+			for( int a = 0; a < 3; ++ a )
+			{
+				XnFloat* pValue = m_aValue[a] + iState;
+				XnFloat* pTrend = m_aTrend[a] + iState;
+				if( m_eMode == FILTER_ONE_EURO )
+					OneEuro( aAxis[a], pValue, pTrend, pConfidence, nJoints, fDT );
+				else if( m_eMode == FILTER_HOLT )
+					Holt( aAxis[a], pValue, pTrend, pConfidence, nJoints, fDT );
+				else
+					Hold( aAxis[a], pValue, pConfidence, nJoints );
+			}
+
+			for( unsigned int j = 0; j < nJoints; ++ j )
+			{
+				if( abCount[j] )
+				{
+					m_fRawJitter += Distance( aRaw, j, m_aRaw, iState + j );
+					m_fJitter += Distance( aLast, j, m_aValue, iState + j );
+					m_fOffset += Distance( aRaw, j, m_aValue, iState + j );
+					++m_nSamples;
+				}
+				if( pConfidence[j] > 0 )
+				{
+					for( int a = 0; a < 3; ++ a )
+						m_aRaw[a][ iState + j ] = aRaw[a][j];
+				}
+			}
+		}
+
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+		{
+			if( !m_aSlot[i].m_bSeen )
+				m_aSlot[i].m_UserID = 0;
+		}
+	}
+
+	/* Mean movement of a joint between two frames, raw and filtered, in mm */
+	double GetRawJitter() const
+	{
+		return m_nSamples ? m_fRawJitter / m_nSamples : 0.0;
+	}
+
+	double GetJitter() const
+	{
+		return m_nSamples ? m_fJitter / m_nSamples : 0.0;
+	}
+
+	/* Mean distance of the filtered from the raw position, in mm */
+	double GetOffset() const
+	{
+		return m_nSamples ? m_fOffset / m_nSamples : 0.0;
+	}
+
+	/* Start the measurement over */
+	void ResetStats()
+	{
+		m_fRawJitter = m_fJitter = m_fOffset = 0;
+		m_nSamples = 0;
+	}
+
+	/* Print a one line summary */
+	void Report( std::ostream& rOut ) const
+	{
+		static const char* aName[] = { "None", "One Euro", "Holt" };
+		rOut << "Joint filter " << aName[ m_eMode ] << ": " << m_nSamples << " joints, jitter " << GetRawJitter()
+			<< " -> " << GetJitter() << " mm/frame, offset " << GetOffset() << " mm" << std::endl;
+	}
+
+private:
+	struct SSlot
+	{
+		XnUserID		m_UserID;		// 0 for a free slot
+		bool			m_bSeen;
+		unsigned int	m_nJoints;
+		XnUInt64		m_nTime;		// of the last filtered frame
+	};
+
+	int FindSlot( XnUserID uid ) const
+	{
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+		{
+			if( m_aSlot[i].m_UserID == uid )
+				return (int)i;
+		}
+		return -1;
+	}
+
+	/* Smoothing factor of a first order low pass at fCutoff Hz over fDT seconds */
+	static float LowPassAlpha( float fCutoff, float fDT )
+	{
+		float fTau = 1.0f / ( 2 * 3.14159265f * fCutoff );
+		return fDT / ( fDT + fTau );
+	}
+
+	/* Speed is filtered in the trend array, position in the value array */
+	void OneEuro( XnFloat* pAxis, XnFloat* pValue, XnFloat* pTrend, const XnFloat* pConfidence, unsigned int nJoints, float fDT ) const
+	{
+		float fSpeedAlpha = LowPassAlpha( m_fDerivativeCutoff, fDT );
+		float fTwoPiDT = 2 * 3.14159265f * fDT;
+		for( unsigned int j = 0; j < nJoints; ++ j )
+		{
+			float fSpeed = pTrend[j] + fSpeedAlpha * pConfidence[j] * ( ( pAxis[j] - pValue[j] ) / fDT - pTrend[j] );
+			float fCutoff = m_fMinCutoff + m_fBeta * fabsf( fSpeed );
+
+			// fDT / ( fDT + 1 / ( 2 pi fc ) ) without a second division
+			float fAlpha = fTwoPiDT * fCutoff / ( fTwoPiDT * fCutoff + 1 );
+			pTrend[j] = fSpeed;
+			pValue[j] += fAlpha * pConfidence[j] * ( pAxis[j] - pValue[j] );
+			pAxis[j] = pValue[j];
+		}
+	}
+
+	void Holt( XnFloat* pAxis, XnFloat* pValue, XnFloat* pTrend, const XnFloat* pConfidence, unsigned int nJoints, float fDT ) const
+	{
+		for( unsigned int j = 0; j < nJoints; ++ j )
+		{
+			float fPredicted = pValue[j] + pTrend[j] * fDT;
+			float fLevel = fPredicted + m_fAlpha * pConfidence[j] * ( pAxis[j] - fPredicted );
+			pTrend[j] += m_fGamma * pConfidence[j] * ( ( fLevel - pValue[j] ) / fDT - pTrend[j] );
+			pValue[j] = fLevel;
+			pAxis[j] = fLevel;
+		}
+	}
+
+	/* No smoothing, joints without confidence keep their last position */
+	static void Hold( XnFloat* pAxis, XnFloat* pValue, const XnFloat* pConfidence, unsigned int nJoints )
+	{
+		for( unsigned int j = 0; j < nJoints; ++ j )
+		{
+			if( pConfidence[j] > 0 )
+				pValue[j] = pAxis[j];
+			pAxis[j] = pValue[j];
+		}
+	}
+
+	/* Distance of point i of aA and point j of aB */
+	template< unsigned int N, unsigned int M >
+	static double Distance( const XnFloat ( &aA )[3][N], unsigned int i, const XnFloat ( &aB )[3][M], unsigned int j )
+	{
+		float fX = aA[0][i] - aB[0][j], fY = aA[1][i] - aB[1][j], fZ = aA[2][i] - aB[2][j];
+		return sqrtf( fX * fX + fY * fY + fZ * fZ );
+	}
+
+private:
+	EMode		m_eMode;
+	float		m_fMinCutoff;
+	float		m_fBeta;
+	float		m_fDerivativeCutoff;
+	float		m_fAlpha;
+	float		m_fGamma;
+
+	SSlot		m_aSlot[MAX_USERS];
+
+	// structure of arrays, per axis
+	XnFloat		m_aValue[3][MAX_USERS * MAX_JOINTS];
+	XnFloat		m_aTrend[3][MAX_USERS * MAX_JOINTS];
+	XnFloat		m_aRaw[3][MAX_USERS * MAX_JOINTS];		// last raw position with confidence
+	bool		m_abValid[MAX_USERS * MAX_JOINTS];		// the joint had confidence since the slot started
+
+	double		m_fRawJitter;
+	double		m_fJitter;
+	double		m_fOffset;
+	XnUInt64	m_nSamples;
+};
+
+#endif // JOINTFILTER_H
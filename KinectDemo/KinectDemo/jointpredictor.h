@@ -0,0 +1,356 @@
+#ifndef JOINTPREDICTOR_H
+#define JOINTPREDICTOR_H
+
+#include <math.h>
+#include <ostream>
+
+#include <XnTypes.h>
+
+#include "skeletonsnapshot.h"
+
+/* Class for predicting where the joints of a skeleton will be.
+ *
+ * Every axis of every joint has a Kalman filter with the state position,
+ * velocity and acceleration. MODEL_ACCELERATION treats the jerk as white
+ * noise, MODEL_VELOCITY pins the acceleration to 0 and treats it as white
+ * noise instead. The measurement noise of a joint is divided by its
+ * confidence, a joint at 0 is only predicted.
+ *
+ * Update() moves the filters to the time of a new snapshot and corrects
+ * them with its joints. Predict() then extrapolates the joints of a
+ * snapshot by a horizon, the time until they are shown, limited to
+ * SetMaxHorizon() so a stall doesn't throw the skeleton away.
+ *
+ * Before each correction the filter has predicted the joint for exactly
+ * the time of the new frame. Its distance to the observed joint is the
+ * prediction error; the distance of the last observed joint is the error
+ * of showing the skeleton without prediction. Both are averaged. */
+class CJointPredictor
+{
+public:
+	enum
+	{
+		MAX_USERS	= CSkeletonSnapshot::MAX_USERS,
+		MAX_JOINTS	= CSkeletonSnapshot::MAX_JOINTS
+	};
+
+	enum EModel
+	{
+		MODEL_VELOCITY,
+		MODEL_ACCELERATION
+	};
+
+	/* Constructor, the default noise suits NITE skeletons of walking and waving people */
+	CJointPredictor( EModel eModel = MODEL_ACCELERATION ) : m_nMaxHorizon( 100000 )
+	{
+		SetModel( eModel );
+		SetMeasurementNoise( 10 );
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+			m_aSlot[i].m_UserID = 0;
+		ResetStats();
+	}
+
+	/* Select the motion model and its default process noise, the state starts over */
+	void SetModel( EModel eModel )
+	{
+		m_eModel = eModel;
+		m_fProcess = ( eModel == MODEL_ACCELERATION ) ? 1e8f : 5e6f;
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+			m_aSlot[i].m_UserID = 0;
+	}
+
+	/* Get the motion model */
+	EModel GetModel() const
+	{
+		return m_eModel;
+	}
+
+	/* Standard deviation of a joint at confidence 1, in mm */
+	void SetMeasurementNoise( float fMM )
+	{
+		m_fMeasurement = fMM * fMM;
+	}
+
+	/* Spectral density of the white noise, jerk in mm^2/s^5 or acceleration in mm^2/s^3.
+	 * Higher follows quick moves sooner and jitters more */
+	void SetProcessNoise( float fDensity )
+	{
+		m_fProcess = fDensity;
+	}
+
+	/* Longest extrapolation in microseconds */
+	void SetMaxHorizon( XnUInt64 nMicroSec )
+	{
+		m_nMaxHorizon = nMicroSec;
+	}
+
+	/* Correct the filters with the joints of a snapshot taken at nTime, in microseconds.
+	 * Users missing from the snapshot are dropped */
+	void Update( const CSkeletonSnapshot& rSkeleton, XnUInt64 nTime )
+	{
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+			m_aSlot[i].m_bSeen = false;
+
+		unsigned int nJoints = rSkeleton.GetJointCount();
+		for( unsigned int iUser = 0; iUser < rSkeleton.GetUserCount(); ++ iUser )
+		{
+			unsigned int iBase = iUser * nJoints;
+			const XnFloat* aAxis[3] = { rSkeleton.X() + iBase, rSkeleton.Y() + iBase, rSkeleton.Z() + iBase };
+			const XnFloat* pConfidence = rSkeleton.Confidence() + iBase;
+
+			int iSlot = FindSlot( rSkeleton.GetUserID( iUser ) );
+			bool bNew = iSlot < 0;
+			if( bNew )
+			{
+				iSlot = FindSlot( 0 );
+				if( iSlot < 0 )
+					continue;
+				m_aSlot[ iSlot ].m_UserID = rSkeleton.GetUserID( iUser );
+			}
+			SSlot& rSlot = m_aSlot[ iSlot ];
+			rSlot.m_bSeen = true;
+
+			unsigned int iState = iSlot * MAX_JOINTS;
+			if( bNew || rSlot.m_nJoints != nJoints )
+			{
+				rSlot.m_nJoints = nJoints;
+				rSlot.m_nTime = nTime;
+				for( unsigned int j = 0; j < nJoints; ++ j )
+					m_abValid[ iState + j ] = false;
+			}
+			float fDT = ( nTime > rSlot.m_nTime ) ? ( nTime - rSlot.m_nTime ) * 1e-6f : 0;
+			rSlot.m_nTime = nTime;
+
+			for( int a = 0; a < 3; ++ a )
+				Propagate( a, iState, nJoints, fDT );
+
+			// the filters now predict this frame, measure before they see it
+			for( unsigned int j = 0; j < nJoints; ++ j )
+			{
+				if( !m_abValid[ iState + j ] || pConfidence[j] <= 0 )
+					continue;
+				float aPredicted[3], aHeld[3];
+				for( int a = 0; a < 3; ++ a )
+				{
+					aPredicted[a] = m_aPos[a][ iState + j ] - aAxis[a][j];
+					aHeld[a] = m_aLast[a][ iState + j ] - aAxis[a][j];
+				}
+				m_fError += Length( aPredicted );
+				m_fHoldError += Length( aHeld );
+				++m_nSamples;
+			}
+
+			for( int a = 0; a < 3; ++ a )
+				Correct( a, iState, aAxis[a], pConfidence, nJoints );
+			for( unsigned int j = 0; j < nJoints; ++ j )
+				m_abValid[ iState + j ] = m_abValid[ iState + j ] || pConfidence[j] > 0;
+		}
+
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+		{
+			if( !m_aSlot[i].m_bSeen )
+				m_aSlot[i].m_UserID = 0;
+		}
+	}
+
+	/* Move the real world joints of a snapshot nHorizon microseconds ahead of the last
+	 * Update(). Joints without a filter stay where they are. Call Project() afterwards */
+	void Predict( CSkeletonSnapshot& rSkeleton, XnUInt64 nHorizon ) const
+	{
+		float fH = ( ( nHorizon < m_nMaxHorizon ) ? nHorizon : m_nMaxHorizon ) * 1e-6f;
+		float fHalfSquare = ( m_eModel == MODEL_ACCELERATION ) ? fH * fH / 2 : 0;
+		unsigned int nJoints = rSkeleton.GetJointCount();
+		for( unsigned int iUser = 0; iUser < rSkeleton.GetUserCount(); ++ iUser )
+		{
+			int iSlot = FindSlot( rSkeleton.GetUserID( iUser ) );
+			if( iSlot < 0 || m_aSlot[ iSlot ].m_nJoints != nJoints )
+				continue;
+			unsigned int iBase = iUser * nJoints, iState = iSlot * MAX_JOINTS;
+			XnFloat* aAxis[3] = { rSkeleton.X() + iBase, rSkeleton.Y() + iBase, rSkeleton.Z() + iBase };
+			for( int a = 0; a < 3; ++ a )
+			{
+				for( unsigned int j = 0; j < nJoints; ++ j )
+				{
+					unsigned int i = iState + j;
+					if( m_abValid[i] )
+						aAxis[a][j] = m_aPos[a][i] + m_aVel[a][i] * fH + m_aAcc[a][i] * fHalfSquare;
+				}
+			}
+		}
+	}
+
+	/* Mean distance of the predicted to the next observed joint, in mm */
+	double GetPredictionError() const
+	{
+		return m_nSamples ? m_fError / m_nSamples : 0.0;
+	}
+
+	/* Mean distance of the last to the next observed joint, in mm */
+	double GetHoldError() const
+	{
+		return m_nSamples ? m_fHoldError / m_nSamples : 0.0;
+	}
+
+	/* Start the measurement over */
+	void ResetStats()
+	{
+		m_fError = m_fHoldError = 0;
+		m_nSamples = 0;
+	}
+
+	/* Print a one line summary */
+	void Report( std::ostream& rOut ) const
+	{
+		rOut << "Joint prediction " << ( m_eModel == MODEL_ACCELERATION ? "acceleration" : "velocity" ) << ": "
+			<< m_nSamples << " joints, error " << GetPredictionError() << " mm, without prediction " << GetHoldError() << " mm" << std::endl;
+	}
+
+private:
+	/* Unique entries of the symmetric covariance of ( position, velocity, acceleration ) */
+	enum
+	{
+		PP, PV, PA, VV, VA, AA,
+		COVARIANCE
+	};
+
+	struct SSlot
+	{
+		XnUserID		m_UserID;		// 0 for a free slot
+		bool			m_bSeen;
+		unsigned int	m_nJoints;
+		XnUInt64		m_nTime;		// of the last update
+	};
+
+	int FindSlot( XnUserID uid ) const
+	{
+		for( unsigned int i = 0; i < MAX_USERS; ++ i )
+		{
+			if( m_aSlot[i].m_UserID == uid )
+				return (int)i;
+		}
+		return -1;
+	}
+
+	static double Length( const float* aV )
+	{
+		return sqrt( aV[0] * aV[0] + aV[1] * aV[1] + aV[2] * aV[2] );
+	}
+
+	/* Move the state of one axis fDT seconds ahead, x = F x and P = F P F' + Q */
+	void Propagate( int a, unsigned int iState, unsigned int nJoints, float fDT )
+	{
+		if( fDT <= 0 )
+			return;
+		float t = fDT, h = fDT * fDT / 2;
+		float q = m_fProcess;
+		float aQ[COVARIANCE];
+		if( m_eModel == MODEL_ACCELERATION )
+		{
+			float t3 = t * t * t;
+			aQ[PP] = q * t3 * t * t / 20;
+			aQ[PV] = q * t3 * t / 8;
+			aQ[PA] = q * t3 / 6;
+			aQ[VV] = q * t3 / 3;
+			aQ[VA] = q * t * t / 2;
+			aQ[AA] = q * t;
+		}
+		else
+		{
+			aQ[PP] = q * t * t * t / 3;
+			aQ[PV] = q * t * t / 2;
+			aQ[VV] = q * t;
+			aQ[PA] = aQ[VA] = aQ[AA] = 0;
+		}
+
+		XnFloat* pPos = m_aPos[a] + iState;
+		XnFloat* pVel = m_aVel[a] + iState;
+		XnFloat* pAcc = m_aAcc[a] + iState;
+		XnFloat* aCov[COVARIANCE];
+		for( int k = 0; k < COVARIANCE; ++ k )
+			aCov[k] = m_aCov[a][k] + iState;
+		for( unsigned int j = 0; j < nJoints; ++ j )
+		{
+			pPos[j] += pVel[j] * t + pAcc[j] * h;
+			pVel[j] += pAcc[j] * t;
+
+			float fPP = aCov[PP][j], fPV = aCov[PV][j], fPA = aCov[PA][j], fVV = aCov[VV][j], fVA = aCov[VA][j], fAA = aCov[AA][j];
+			// rows of F P
+			float f00 = fPP + t * fPV + h * fPA, f01 = fPV + t * fVV + h * fVA, f02 = fPA + t * fVA + h * fAA;
+			float f11 = fVV + t * fVA, f12 = fVA + t * fAA;
+			aCov[PP][j] = f00 + t * f01 + h * f02 + aQ[PP];
+			aCov[PV][j] = f01 + t * f02 + aQ[PV];
+			aCov[PA][j] = f02 + aQ[PA];
+			aCov[VV][j] = f11 + t * f12 + aQ[VV];
+			aCov[VA][j] = f12 + aQ[VA];
+			aCov[AA][j] = fAA + aQ[AA];
+		}
+	}
+
+	/* Correct one axis with the observed positions, or start the filters of new joints */
+	void Correct( int a, unsigned int iState, const XnFloat* pAxis, const XnFloat* pConfidence, unsigned int nJoints )
+	{
+		XnFloat* pPos = m_aPos[a] + iState;
+		XnFloat* pVel = m_aVel[a] + iState;
+		XnFloat* pAcc = m_aAcc[a] + iState;
+		XnFloat* pLast = m_aLast[a] + iState;
+		const bool* pValid = m_abValid + iState;
+		XnFloat* aCov[COVARIANCE];
+		for( int k = 0; k < COVARIANCE; ++ k )
+			aCov[k] = m_aCov[a][k] + iState;
+
+		// a new joint starts at rest, unsure of its speed
+		float fStartAcc = ( m_eModel == MODEL_ACCELERATION ) ? 1e8f : 0;
+		for( unsigned int j = 0; j < nJoints; ++ j )
+		{
+			if( pConfidence[j] <= 0 )
+				continue;
+			pLast[j] = pAxis[j];
+			if( !pValid[j] )
+			{
+				pPos[j] = pAxis[j];
+				pVel[j] = pAcc[j] = 0;
+				aCov[PP][j] = m_fMeasurement;
+				aCov[VV][j] = 1e6f;
+				aCov[AA][j] = fStartAcc;
+				aCov[PV][j] = aCov[PA][j] = aCov[VA][j] = 0;
+				continue;
+			}
+
+			float fPP = aCov[PP][j], fPV = aCov[PV][j], fPA = aCov[PA][j];
+			float fS = fPP + m_fMeasurement / pConfidence[j];
+			float k0 = fPP / fS, k1 = fPV / fS, k2 = fPA / fS;
+			float y = pAxis[j] - pPos[j];
+			pPos[j] += k0 * y;
+			pVel[j] += k1 * y;
+			pAcc[j] += k2 * y;
+			aCov[PP][j] -= k0 * fPP;
+			aCov[PV][j] -= k0 * fPV;
+			aCov[PA][j] -= k0 * fPA;
+			aCov[VV][j] -= k1 * fPV;
+			aCov[VA][j] -= k1 * fPA;
+			aCov[AA][j] -= k2 * fPA;
+		}
+	}
+
+private:
+	EModel		m_eModel;
+	float		m_fMeasurement;		// variance at confidence 1, mm^2
+	float		m_fProcess;
+	XnUInt64	m_nMaxHorizon;		// microseconds
+
+	SSlot		m_aSlot[MAX_USERS];
+
+	// structure of arrays, per axis
+	XnFloat		m_aPos[3][MAX_USERS * MAX_JOINTS];
+	XnFloat		m_aVel[3][MAX_USERS * MAX_JOINTS];
+	XnFloat		m_aAcc[3][MAX_USERS * MAX_JOINTS];
+	XnFloat		m_aCov[3][COVARIANCE][MAX_USERS * MAX_JOINTS];
+	XnFloat		m_aLast[3][MAX_USERS * MAX_JOINTS];		// last observed position
+	bool		m_abValid[MAX_USERS * MAX_JOINTS];		// the joint has a filter
+
+	double		m_fError;
+	double		m_fHoldError;
+	XnUInt64	m_nSamples;
+};
+
+#endif // JOINTPREDICTOR_H
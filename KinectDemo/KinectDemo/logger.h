@@ -0,0 +1,416 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "framestats.h"
+
+/* Process wide log for callbacks and per-frame messages.
+ *
+ * Log() takes a printf format and up to MAX_ARGS numbers or strings. It
+ * doesn't format anything: the calling thread copies the format pointer, the
+ * values and the time into its own ring of records, no lock and no system
+ * call. A background thread collects the rings about every 10 ms, in time
+ * order, and either prints the lines to stdout or writes the records to a
+ * binary file for Decode(). When a ring is full the record is dropped and
+ * counted.
+ *
+ * The format must live as long as the program, a string literal. Strings
+ * among the values are copied, up to TEXT_SIZE bytes per record. */
+class CLogger
+{
+public:
+	enum
+	{
+		MAX_ARGS	= 8,
+		TEXT_SIZE	= 64,
+		RING_SIZE	= 1024,		// records per thread, power of 2
+		LINE_SIZE	= 512
+	};
+
+	/* The log of the process, started by the first Log() */
+	static CLogger& Get()
+	{
+		static CLogger s_Logger;
+		return s_Logger;
+	}
+
+	/* Write records to a binary file instead of printing them, call before the first Log() */
+	bool SetBinary( const char* sFile )
+	{
+		std::lock_guard<std::mutex> mLock( m_Mutex );
+		if( m_Thread.joinable() || m_pFile != NULL )
+			return false;
+		m_pFile = fopen( sFile, "wb" );
+		if( m_pFile == NULL )
+			return false;
+		fwrite( "KDLG", 4, 1, m_pFile );
+		return true;
+	}
+
+	/* Add a record, sFormat is a string literal in printf style */
+	template< typename... TArgs >
+	void Log( const char* sFormat, const TArgs&... rArgs )
+	{
+		static_assert( sizeof...( TArgs ) <= MAX_ARGS, "too many values" );
+		SRing* pRing = GetRing();
+		unsigned int iWrite = pRing->m_iWrite.load( std::memory_order_relaxed );
+		if( iWrite - pRing->m_iRead.load( std::memory_order_acquire ) >= RING_SIZE )
+		{
+			pRing->m_nDropped.fetch_add( 1, std::memory_order_relaxed );
+			return;
+		}
+		SRecord& rRecord = pRing->m_aRecord[ iWrite & ( RING_SIZE - 1 ) ];
+		rRecord.m_nTime = CFrameStats::Now();
+		rRecord.m_sFormat = sFormat;
+		rRecord.m_nArgs = 0;
+		rRecord.m_nText = 0;
+		Add( rRecord, rArgs... );
+		pRing->m_iWrite.store( iWrite + 1, std::memory_order_release );
+	}
+
+	/* Write all records logged so far */
+	void Flush()
+	{
+		std::lock_guard<std::mutex> mLock( m_Mutex );
+		Drain();
+	}
+
+	/* Records written and dropped so far */
+	void Report( std::ostream& rOut )
+	{
+		std::lock_guard<std::mutex> mLock( m_Mutex );
+		XnUInt64 nDropped = 0;
+		for( size_t i = 0; i < m_vRing.size(); ++ i )
+			nDropped += m_vRing[i]->m_nDropped.load( std::memory_order_relaxed );
+		rOut << "Log: " << m_nWritten << " records from " << m_vRing.size() << " threads, " << nDropped << " dropped" << std::endl;
+	}
+
+	/* Print a binary log written with SetBinary() */
+	static bool Decode( const char* sFile, FILE* pOut )
+	{
+		FILE* pFile = fopen( sFile, "rb" );
+		if( pFile == NULL )
+			return false;
+		char aMagic[4];
+		bool bOK = fread( aMagic, 4, 1, pFile ) == 1 && memcmp( aMagic, "KDLG", 4 ) == 0;
+
+		// formats are written once, before the first record using them
+		std::vector<std::string> vFormat;
+		char cTag;
+		while( bOK && fread( &cTag, 1, 1, pFile ) == 1 )
+		{
+			if( cTag == 'F' )
+			{
+				XnUInt16 nLength;
+				bOK = fread( &nLength, sizeof( nLength ), 1, pFile ) == 1;
+				std::string sFormat( nLength, 0 );
+				bOK = bOK && ( nLength == 0 || fread( &sFormat[0], nLength, 1, pFile ) == 1 );
+				vFormat.push_back( sFormat );
+				continue;
+			}
+			XnUInt32 iFormat;
+			SRecord mRecord;
+			bOK = cTag == 'R' && fread( &iFormat, sizeof( iFormat ), 1, pFile ) == 1 && iFormat < vFormat.size()
+				&& fread( &mRecord.m_nTime, sizeof( mRecord.m_nTime ), 1, pFile ) == 1
+				&& fread( &mRecord.m_nThread, sizeof( mRecord.m_nThread ), 1, pFile ) == 1
+				&& fread( &mRecord.m_nArgs, sizeof( mRecord.m_nArgs ), 1, pFile ) == 1 && mRecord.m_nArgs <= MAX_ARGS
+				&& ( mRecord.m_nArgs == 0 || fread( mRecord.m_aArg, sizeof( SArg ) * mRecord.m_nArgs, 1, pFile ) == 1 )
+				&& fread( &mRecord.m_nText, sizeof( mRecord.m_nText ), 1, pFile ) == 1 && mRecord.m_nText <= TEXT_SIZE
+				&& ( mRecord.m_nText == 0 || fread( mRecord.m_aText, mRecord.m_nText, 1, pFile ) == 1 );
+			if( !bOK )
+				break;
+			char aLine[LINE_SIZE];
+			fwrite( aLine, Print( vFormat[ iFormat ].c_str(), mRecord, aLine ), 1, pOut );
+		}
+		fclose( pFile );
+		return bOK;
+	}
+
+private:
+	struct SArg
+	{
+		union
+		{
+			long long	m_iValue;
+			double		m_dValue;
+		};
+		XnUInt32		m_eType;	// 'i', 'd' or 's', then m_iValue is the offset in the text
+		XnUInt32		m_nPadding;
+	};
+
+	struct SRecord
+	{
+		XnUInt64		m_nTime;
+		const char*		m_sFormat;
+		XnUInt32		m_nThread;
+		XnUInt8			m_nArgs;
+		XnUInt8			m_nText;
+		SArg			m_aArg[MAX_ARGS];
+		char			m_aText[TEXT_SIZE];
+	};
+
+	struct SRing
+	{
+		SRecord						m_aRecord[RING_SIZE];
+		std::atomic<unsigned int>	m_iWrite;
+		std::atomic<unsigned int>	m_iRead;
+		std::atomic<unsigned int>	m_nDropped;
+	};
+
+	CLogger() : m_pFile( NULL ), m_bStop( false ), m_nStart( CFrameStats::Now() ), m_nWritten( 0 )
+	{}
+
+	~CLogger()
+	{
+		{
+			std::lock_guard<std::mutex> mLock( m_Mutex );
+			m_bStop = true;
+		}
+		m_Wake.notify_all();
+		if( m_Thread.joinable() )
+			m_Thread.join();
+		Drain();
+		if( m_pFile != NULL )
+			fclose( m_pFile );
+	}
+
+	/* The ring of the calling thread, made by its first record */
+	SRing* GetRing()
+	{
+		static thread_local SRing* s_pRing = NULL;
+		if( s_pRing != NULL )
+			return s_pRing;
+
+		std::lock_guard<std::mutex> mLock( m_Mutex );
+		std::unique_ptr<SRing> pRing( new SRing );
+		pRing->m_iWrite.store( 0, std::memory_order_relaxed );
+		pRing->m_iRead.store( 0, std::memory_order_relaxed );
+		pRing->m_nDropped.store( 0, std::memory_order_relaxed );
+		for( unsigned int i = 0; i < RING_SIZE; ++ i )
+			pRing->m_aRecord[i].m_nThread = (XnUInt32)m_vRing.size();
+		s_pRing = pRing.get();
+		m_vRing.push_back( std::move( pRing ) );
+		if( !m_Thread.joinable() )
+			m_Thread = std::thread( &CLogger::Run, this );
+		return s_pRing;
+	}
+
+	void Add( SRecord& )
+	{}
+
+	template< typename T, typename... TRest >
+	void Add( SRecord& rRecord, const T& rValue, const TRest&... rRest )
+	{
+		SArg& rArg = rRecord.m_aArg[ rRecord.m_nArgs++ ];
+		SetArg( rRecord, rArg, rValue, std::is_floating_point<T>() );
+		Add( rRecord, rRest... );
+	}
+
+	template< typename T >
+	static void SetArg( SRecord&, SArg& rArg, const T& rValue, std::true_type )
+	{
+		rArg.m_eType = 'd';
+		rArg.m_dValue = (double)rValue;
+	}
+
+	template< typename T >
+	static void SetArg( SRecord&, SArg& rArg, const T& rValue, std::false_type )
+	{
+		rArg.m_eType = 'i';
+		rArg.m_iValue = (long long)rValue;
+	}
+
+	static void SetArg( SRecord& rRecord, SArg& rArg, const char* sValue, std::false_type )
+	{
+		// copied with its terminator, cut when the text is full
+		rArg.m_eType = 's';
+		if( rRecord.m_nText == TEXT_SIZE )
+		{
+			rArg.m_iValue = TEXT_SIZE - 1;
+			return;
+		}
+		rArg.m_iValue = rRecord.m_nText;
+		size_t nLength = strlen( sValue );
+		if( nLength > TEXT_SIZE - 1u - rRecord.m_nText )
+			nLength = TEXT_SIZE - 1u - rRecord.m_nText;
+		memcpy( rRecord.m_aText + rRecord.m_nText, sValue, nLength );
+		rRecord.m_aText[ rRecord.m_nText + nLength ] = 0;
+		rRecord.m_nText += (XnUInt8)( nLength + 1 );
+	}
+
+	template< unsigned int N >
+	static void SetArg( SRecord& rRecord, SArg& rArg, const char ( &sValue )[N], std::false_type )
+	{
+		SetArg( rRecord, rArg, (const char*)sValue, std::false_type() );
+	}
+
+	static void SetArg( SRecord& rRecord, SArg& rArg, char* sValue, std::false_type )
+	{
+		SetArg( rRecord, rArg, (const char*)sValue, std::false_type() );
+	}
+
+	/* Format one line, with the time, and return its length */
+	static size_t Print( const char* sFormat, const SRecord& rRecord, char* pLine )
+	{
+		int n = snprintf( pLine, LINE_SIZE, "[%10.6f] ", rRecord.m_nTime / 1000000.0 );
+		unsigned int iArg = 0;
+		for( const char* p = sFormat; *p && n < LINE_SIZE - 2; ++ p )
+		{
+			if( *p != '%' )
+			{
+				pLine[ n++ ] = *p;
+				continue;
+			}
+			if( p[1] == '%' )
+			{
+				pLine[ n++ ] = '%';
+				++p;
+				continue;
+			}
+
+			// the flags, width and precision are kept, the length comes from the value
+			char aSpec[16] = "%";
+			size_t nSpec = 1;
+			for( ++p; *p && strchr( "-+ #0123456789.", *p ) && nSpec < 10; ++ p )
+				aSpec[ nSpec++ ] = *p;
+			while( *p && strchr( "hlLqjzt", *p ) )
+				++p;
+			if( *p == 0 )
+				break;
+			char cConversion = *p;
+			if( iArg >= rRecord.m_nArgs )
+				continue;
+
+			const SArg& rArg = rRecord.m_aArg[ iArg++ ];
+			bool bFloat = strchr( "fFeEgGaA", cConversion ) != NULL;
+			int nLeft = LINE_SIZE - 1 - n;
+			if( rArg.m_eType == 's' )
+			{
+				strcpy( aSpec + nSpec, "s" );
+				n += snprintf( pLine + n, nLeft, aSpec, rRecord.m_aText + rArg.m_iValue );
+			}
+			else if( bFloat )
+			{
+				aSpec[ nSpec ] = cConversion;
+				aSpec[ nSpec + 1 ] = 0;
+				n += snprintf( pLine + n, nLeft, aSpec, rArg.m_eType == 'd' ? rArg.m_dValue : (double)rArg.m_iValue );
+			}
+			else if( cConversion == 'c' )
+			{
+				strcpy( aSpec + nSpec, "c" );
+				n += snprintf( pLine + n, nLeft, aSpec, (int)rArg.m_iValue );
+			}
+			else
+			{
+				aSpec[ nSpec ] = 'l';
+				aSpec[ nSpec + 1 ] = 'l';
+				aSpec[ nSpec + 2 ] = strchr( "diouxX", cConversion ) ? cConversion : 'd';
+				aSpec[ nSpec + 3 ] = 0;
+				n += snprintf( pLine + n, nLeft, aSpec, rArg.m_eType == 'd' ? (long long)rArg.m_dValue : rArg.m_iValue );
+			}
+			if( n > LINE_SIZE - 2 )
+				n = LINE_SIZE - 2;
+		}
+		pLine[ n++ ] = '\n';
+		return (size_t)n;
+	}
+
+	void Run()
+	{
+		std::unique_lock<std::mutex> mLock( m_Mutex );
+		while( !m_bStop )
+		{
+			Drain();
+			m_Wake.wait_for( mLock, std::chrono::milliseconds( 10 ) );
+		}
+	}
+
+	/* Write the records of all rings in time order, with m_Mutex held */
+	void Drain()
+	{
+		std::vector<unsigned int> vEnd( m_vRing.size() );
+		for( size_t i = 0; i < m_vRing.size(); ++ i )
+			vEnd[i] = m_vRing[i]->m_iWrite.load( std::memory_order_acquire );
+
+		while( true )
+		{
+			// the oldest of the first records of every ring
+			SRing* pOldest = NULL;
+			for( size_t i = 0; i < m_vRing.size(); ++ i )
+			{
+				SRing* pRing = m_vRing[i].get();
+				unsigned int iRead = pRing->m_iRead.load( std::memory_order_relaxed );
+				if( iRead != vEnd[i] && ( pOldest == NULL
+					|| pRing->m_aRecord[ iRead & ( RING_SIZE - 1 ) ].m_nTime < pOldest->m_aRecord[ pOldest->m_iRead.load( std::memory_order_relaxed ) & ( RING_SIZE - 1 ) ].m_nTime ) )
+					pOldest = pRing;
+			}
+			if( pOldest == NULL )
+				break;
+
+			unsigned int iRead = pOldest->m_iRead.load( std::memory_order_relaxed );
+			Write( pOldest->m_aRecord[ iRead & ( RING_SIZE - 1 ) ] );
+			pOldest->m_iRead.store( iRead + 1, std::memory_order_release );
+			++m_nWritten;
+		}
+		fflush( m_pFile ? m_pFile : stdout );
+	}
+
+	void Write( const SRecord& rRecord )
+	{
+		if( m_pFile == NULL )
+		{
+			char aLine[LINE_SIZE];
+			SRecord mRecord = rRecord;
+			mRecord.m_nTime -= m_nStart;
+			fwrite( aLine, Print( rRecord.m_sFormat, mRecord, aLine ), 1, stdout );
+			return;
+		}
+
+		// a format gets its number the first time it is written
+		std::map<const char*, XnUInt32>::iterator itFormat = m_mFormat.find( rRecord.m_sFormat );
+		if( itFormat == m_mFormat.end() )
+		{
+			itFormat = m_mFormat.insert( std::make_pair( rRecord.m_sFormat, (XnUInt32)m_mFormat.size() ) ).first;
+			XnUInt16 nLength = (XnUInt16)strlen( rRecord.m_sFormat );
+			fwrite( "F", 1, 1, m_pFile );
+			fwrite( &nLength, sizeof( nLength ), 1, m_pFile );
+			fwrite( rRecord.m_sFormat, nLength, 1, m_pFile );
+		}
+		XnUInt64 nTime = rRecord.m_nTime - m_nStart;
+		fwrite( "R", 1, 1, m_pFile );
+		fwrite( &itFormat->second, sizeof( XnUInt32 ), 1, m_pFile );
+		fwrite( &nTime, sizeof( nTime ), 1, m_pFile );
+		fwrite( &rRecord.m_nThread, sizeof( rRecord.m_nThread ), 1, m_pFile );
+		fwrite( &rRecord.m_nArgs, sizeof( rRecord.m_nArgs ), 1, m_pFile );
+		fwrite( rRecord.m_aArg, sizeof( SArg ), rRecord.m_nArgs, m_pFile );
+		fwrite( &rRecord.m_nText, sizeof( rRecord.m_nText ), 1, m_pFile );
+		fwrite( rRecord.m_aText, 1, rRecord.m_nText, m_pFile );
+	}
+
+private:
+	std::mutex								m_Mutex;		// the rings list, the output
+	std::condition_variable					m_Wake;
+	std::thread								m_Thread;
+	std::vector< std::unique_ptr<SRing> >	m_vRing;
+	std::map<const char*, XnUInt32>			m_mFormat;
+	FILE*									m_pFile;		// NULL prints to stdout
+	bool									m_bStop;
+	XnUInt64								m_nStart;
+	XnUInt64								m_nWritten;
+};
+
+#endif // LOGGER_H
@@ -0,0 +1,309 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <stddef.h>
+
+#include <XnTypes.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Class for mapping a whole file read-only into memory.
+ * Reading is plain pointer access, the OS pages the file in on demand and
+ * keeps it in its cache, so scanning a large file costs no read calls. */
+class CMappedFile
+{
+public:
+	/* Constructor */
+	CMappedFile() : m_pData( NULL ), m_nSize( 0 )
+	{
+#ifdef _WIN32
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+#endif
+	}
+
+	/* Destructor */
+	~CMappedFile()
+	{
+		Close();
+	}
+
+	/* Map the file, return false if it can't be opened or is empty */
+	bool Open( const char* sFile )
+	{
+		Close();
+#ifdef _WIN32
+		m_hFile = CreateFileA( sFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+		if( m_hFile == INVALID_HANDLE_VALUE )
+			return false;
+
+		LARGE_INTEGER mSize;
+		if( !GetFileSizeEx( m_hFile, &mSize ) || mSize.QuadPart == 0 )
+		{
+			Close();
+			return false;
+		}
+		m_nSize = (size_t)mSize.QuadPart;
+
+		m_hMapping = CreateFileMappingA( m_hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+		if( m_hMapping != NULL )
+			m_pData = (const unsigned char*)MapViewOfFile( m_hMapping, FILE_MAP_READ, 0, 0, 0 );
+#else
+		int iFile = open( sFile, O_RDONLY );
+		if( iFile < 0 )
+			return false;
+
+		struct stat mStat;
+		if( fstat( iFile, &mStat ) == 0 && mStat.st_size > 0 )
+		{
+			m_nSize = (size_t)mStat.st_size;
+			void* pData = mmap( NULL, m_nSize, PROT_READ, MAP_PRIVATE, iFile, 0 );
+			if( pData != MAP_FAILED )
+			{
+				m_pData = (const unsigned char*)pData;
+				madvise( pData, m_nSize, MADV_SEQUENTIAL );
+			}
+		}
+		// the mapping stays valid without the descriptor
+		close( iFile );
+#endif
+		if( m_pData == NULL )
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	/* Unmap the file */
+	void Close()
+	{
+#ifdef _WIN32
+		if( m_pData != NULL )
+			UnmapViewOfFile( m_pData );
+		if( m_hMapping != NULL )
+			CloseHandle( m_hMapping );
+		if( m_hFile != INVALID_HANDLE_VALUE )
+			CloseHandle( m_hFile );
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+#else
+		if( m_pData != NULL )
+			munmap( (void*)m_pData, m_nSize );
+#endif
+		m_pData = NULL;
+		m_nSize = 0;
+	}
+
+	/* First byte of the file, NULL if not mapped */
+	const unsigned char* Data() const
+	{
+		return m_pData;
+	}
+
+	/* File size in bytes */
+	size_t Size() const
+	{
+		return m_nSize;
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE					m_hFile;
+	HANDLE					m_hMapping;
+#endif
+	const unsigned char*	m_pData;
+	size_t					m_nSize;
+};
+
+/* Class for writing a file through a mapped window.
+ *
+ * Reserve() allocates the disk space ahead, Map() moves a read / write
+ * window over it. Stores into the window are memory writes, the OS
+ * writes the pages back in the background. Window offsets must be
+ * multiples of GRANULARITY, the mapping granularity of Windows, which is
+ * also a multiple of the page size elsewhere. */
+class CMappedFileWriter
+{
+public:
+	enum { GRANULARITY = 65536 };
+
+	/* Constructor */
+	CMappedFileWriter() : m_pWindow( NULL ), m_nWindowSize( 0 ), m_nFileSize( 0 )
+	{
+#ifdef _WIN32
+		m_hFile = INVALID_HANDLE_VALUE;
+		m_hMapping = NULL;
+#else
+		m_iFile = -1;
+#endif
+	}
+
+	/* Destructor */
+	~CMappedFileWriter()
+	{
+		Close( m_nFileSize );
+	}
+
+	/* Create or truncate the file */
+	bool Open( const char* sFile )
+	{
+		Close( m_nFileSize );
+		m_nFileSize = 0;
+#ifdef _WIN32
+		m_hFile = CreateFileA( sFile, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+		return m_hFile != INVALID_HANDLE_VALUE;
+#else
+		m_iFile = open( sFile, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+		return m_iFile >= 0;
+#endif
+	}
+
+	/* Grow the file to at least nSize bytes with allocated blocks */
+	bool Reserve( XnUInt64 nSize )
+	{
+		if( nSize <= m_nFileSize )
+			return true;
+#ifdef _WIN32
+		// the mapping object has the old size, the next Map() creates a new one
+		if( m_hMapping != NULL )
+		{
+			CloseHandle( m_hMapping );
+			m_hMapping = NULL;
+		}
+		if( !SetSize( nSize ) )
+			return false;
+#else
+#ifdef __linux__
+		if( posix_fallocate( m_iFile, (off_t)m_nFileSize, (off_t)( nSize - m_nFileSize ) ) != 0 && ftruncate( m_iFile, (off_t)nSize ) != 0 )
+			return false;
+#else
+		if( ftruncate( m_iFile, (off_t)nSize ) != 0 )
+			return false;
+#endif
+#endif
+		m_nFileSize = nSize;
+		return true;
+	}
+
+	/* Map nSize bytes at nOffset, the last window is unmapped. Return NULL on error */
+	unsigned char* Map( XnUInt64 nOffset, size_t nSize )
+	{
+		Unmap();
+		if( nOffset % GRANULARITY != 0 || !Reserve( nOffset + nSize ) )
+			return NULL;
+#ifdef _WIN32
+		if( m_hMapping == NULL )
+			m_hMapping = CreateFileMappingA( m_hFile, NULL, PAGE_READWRITE, 0, 0, NULL );
+		if( m_hMapping != NULL )
+			m_pWindow = (unsigned char*)MapViewOfFile( m_hMapping, FILE_MAP_WRITE, (DWORD)( nOffset >> 32 ), (DWORD)nOffset, nSize );
+#else
+		void* pData = mmap( NULL, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_iFile, (off_t)nOffset );
+		m_pWindow = ( pData != MAP_FAILED ) ? (unsigned char*)pData : NULL;
+#endif
+		m_nWindowSize = ( m_pWindow != NULL ) ? nSize : 0;
+		return m_pWindow;
+	}
+
+	/* Write a small block without mapping, for headers and indexes */
+	bool WriteAt( XnUInt64 nOffset, const void* pData, size_t nSize )
+	{
+		if( !Reserve( nOffset + nSize ) )
+			return false;
+#ifdef _WIN32
+		OVERLAPPED mOverlapped = { 0 };
+		mOverlapped.Offset = (DWORD)nOffset;
+		mOverlapped.OffsetHigh = (DWORD)( nOffset >> 32 );
+		DWORD nWritten = 0;
+		return WriteFile( m_hFile, pData, (DWORD)nSize, &nWritten, &mOverlapped ) && nWritten == nSize;
+#else
+		const char* p = (const char*)pData;
+		while( nSize > 0 )
+		{
+			ssize_t nWritten = pwrite( m_iFile, p, nSize, (off_t)nOffset );
+			if( nWritten <= 0 )
+				return false;
+			p += nWritten;
+			nOffset += nWritten;
+			nSize -= nWritten;
+		}
+		return true;
+#endif
+	}
+
+	/* Unmap, cut the file to nSize bytes and close it */
+	bool Close( XnUInt64 nSize )
+	{
+		Unmap();
+		bool bOK = true;
+#ifdef _WIN32
+		if( m_hMapping != NULL )
+			CloseHandle( m_hMapping );
+		m_hMapping = NULL;
+		if( m_hFile != INVALID_HANDLE_VALUE )
+		{
+			bOK = SetSize( nSize );
+			bOK = CloseHandle( m_hFile ) && bOK;
+		}
+		m_hFile = INVALID_HANDLE_VALUE;
+#else
+		if( m_iFile >= 0 )
+		{
+			bOK = ftruncate( m_iFile, (off_t)nSize ) == 0;
+			bOK = ( close( m_iFile ) == 0 ) && bOK;
+		}
+		m_iFile = -1;
+#endif
+		m_nFileSize = 0;
+		return bOK;
+	}
+
+private:
+	void Unmap()
+	{
+		if( m_pWindow == NULL )
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile( m_pWindow );
+#else
+		munmap( m_pWindow, m_nWindowSize );
+#endif
+		m_pWindow = NULL;
+		m_nWindowSize = 0;
+	}
+
+#ifdef _WIN32
+	bool SetSize( XnUInt64 nSize )
+	{
+		LARGE_INTEGER mSize;
+		mSize.QuadPart = (LONGLONG)nSize;
+		return SetFilePointerEx( m_hFile, mSize, NULL, FILE_BEGIN ) && SetEndOfFile( m_hFile );
+	}
+#endif
+
+private:
+#ifdef _WIN32
+	HANDLE			m_hFile;
+	HANDLE			m_hMapping;
+#else
+	int				m_iFile;
+#endif
+	unsigned char*	m_pWindow;
+	size_t			m_nWindowSize;
+	XnUInt64		m_nFileSize;
+};
+
+#endif // MAPPEDFILE_H
@@ -0,0 +1,96 @@
+// Multi-sensor tracking.
+//
+// Opens several sensors, or recordings in their place, tracks the users of
+// each on a capture thread of its own and merges them into one user list in
+// a shared world frame (see sensorarray.h).
+//
+//     multisensor [-devices n] [recording.oni ...] [-extrinsics file] [-seconds s] [-fastest]
+//
+// "-devices" opens n connected sensors, 0 for all, the default without
+// recordings. "-extrinsics" places the sensors in the world, a line of 9
+// rotation and 3 translation values per sensor. "-fastest" replays the
+// recordings as fast as possible, to see how the capture scales with the
+// number of sensors.
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "sensorarray.h"
+#include "skeletonsnapshot.h"
+#include "framestats.h"
+#include "logger.h"
+
+using namespace std;
+
+int main( int argc, char** argv )
+{
+	unsigned int nDevices = 0;
+	const char* sExtrinsics = NULL;
+	double dSeconds = 0;
+	bool bFastest = false;
+	vector<const char*> vRecording;
+	for( int i = 1; i < argc; ++ i )
+	{
+		if( strcmp( argv[i], "-devices" ) == 0 && i + 1 < argc )
+			nDevices = atoi( argv[++i] );
+		else if( strcmp( argv[i], "-extrinsics" ) == 0 && i + 1 < argc )
+			sExtrinsics = argv[++i];
+		else if( strcmp( argv[i], "-seconds" ) == 0 && i + 1 < argc )
+			dSeconds = atof( argv[++i] );
+		else if( strcmp( argv[i], "-fastest" ) == 0 )
+			bFastest = true;
+		else
+			vRecording.push_back( argv[i] );
+	}
+
+	// 1. open the sensors, recordings stand in for sensors
+	CSensorArray mSensors;
+	if( !vRecording.empty() ? !mSensors.OpenRecordings( &vRecording[0], (unsigned int)vRecording.size(), bFastest )
+		: !mSensors.OpenDevices( nDevices ) )
+	{
+		cerr << "Can't open the sensors" << endl;
+		return 1;
+	}
+	if( sExtrinsics != NULL && !mSensors.LoadExtrinsics( sExtrinsics ) )
+	{
+		cerr << "Can't read the extrinsics of " << mSensors.GetSensorCount() << " sensors from " << sExtrinsics << endl;
+		return 1;
+	}
+
+	// 2. merge the users of all sensors until the recordings end or the time is up
+	if( !mSensors.Start() )
+		return 1;
+	CSkeletonSnapshot mMerged;
+	CFrameStats mMergeStats( "Merged" );
+	XnUInt64 nBegin = CFrameStats::Now();
+	unsigned int nUsers = 0, nMerged = 0;
+	while( !mSensors.IsEndOfFile() && ( dSeconds <= 0 || CFrameStats::Now() - nBegin < dSeconds * 1000000 ) )
+	{
+		if( !mSensors.Update( mMerged ) )
+		{
+			// the capture threads run at the sensor rate, the merge needn't spin
+			this_thread::sleep_for( chrono::milliseconds( 1 ) );
+			continue;
+		}
+		mMergeStats.OnFrame( ++nMerged );
+		if( mMerged.GetUserCount() != nUsers )
+		{
+			nUsers = mMerged.GetUserCount();
+			CLogger::Get().Log( "%u users in the world", nUsers );
+		}
+	}
+	double dElapsed = ( CFrameStats::Now() - nBegin ) / 1000000.0;
+	mSensors.Stop();
+
+	// 3. report
+	CLogger::Get().Flush();
+	mSensors.Report( cout, dElapsed );
+	mMergeStats.Report( cout );
+	return 0;
+}
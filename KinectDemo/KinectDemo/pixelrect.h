@@ -0,0 +1,40 @@
+#ifndef PIXELRECT_H
+#define PIXELRECT_H
+
+/* Axis aligned rectangle in map pixels, [ m_iX, m_iX + m_iWidth ) x [ m_iY, m_iY + m_iHeight ) */
+struct SPixelRect
+{
+	unsigned int	m_iX;
+	unsigned int	m_iY;
+	unsigned int	m_iWidth;
+	unsigned int	m_iHeight;
+
+	/* Check if the rectangle has no pixel */
+	bool IsEmpty() const
+	{
+		return m_iWidth == 0 || m_iHeight == 0;
+	}
+
+	/* Clip to a map of iXRes x iYRes pixels */
+	SPixelRect Clip( unsigned int iXRes, unsigned int iYRes ) const
+	{
+		SPixelRect mRect = { 0, 0, 0, 0 };
+		if( m_iX >= iXRes || m_iY >= iYRes )
+			return mRect;
+
+		mRect.m_iX = m_iX;
+		mRect.m_iY = m_iY;
+		mRect.m_iWidth = ( m_iWidth < iXRes - m_iX ) ? m_iWidth : iXRes - m_iX;
+		mRect.m_iHeight = ( m_iHeight < iYRes - m_iY ) ? m_iHeight : iYRes - m_iY;
+		return mRect;
+	}
+
+	/* Make a rectangle */
+	static SPixelRect Make( unsigned int iX, unsigned int iY, unsigned int iWidth, unsigned int iHeight )
+	{
+		SPixelRect mRect = { iX, iY, iWidth, iHeight };
+		return mRect;
+	}
+};
+
+#endif // PIXELRECT_H
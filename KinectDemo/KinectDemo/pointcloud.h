@@ -0,0 +1,267 @@
+#ifndef POINTCLOUD_H
+#define POINTCLOUD_H
+
+#include <math.h>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "simdsupport.h"
+#include "pixelrect.h"
+
+/* Class for converting a whole depth map to real world points.
+ *
+ * OpenNI maps a projective point ( u, v, Z ) to real world with
+ *     X = ( u / XRes - 0.5 ) * tan( HFOV / 2 ) * 2 * Z
+ *     Y = ( 0.5 - v / YRes ) * tan( VFOV / 2 ) * 2 * Z
+ * The ray factors only depend on the column and the row. They are
+ * computed once per resolution into two small tables, and every pixel
+ * costs two multiplies. Rows are converted with SSE2 or AVX2 when the
+ * stride is 1.
+ *
+ * The output is a grid of GetCols() x GetRows() points in three float
+ * arrays (structure of arrays). Pixels without depth get Z = 0, so the
+ * grid keeps the image layout. */
+class CPointCloud
+{
+public:
+	/* Constructor */
+	CPointCloud()
+		: m_iStride( 1 ), m_bFullFrame( true ), m_iTableXRes( 0 ), m_iTableYRes( 0 ),
+		  m_iCols( 0 ), m_iRows( 0 ), m_nValid( 0 ), m_eLevel( CSimdSupport::Best() )
+	{
+		m_FOV.fHFOV = 0;
+		m_FOV.fVFOV = 0;
+		m_ROI = SPixelRect::Make( 0, 0, 0, 0 );
+	}
+
+	/* Read the field of view from the depth generator */
+	bool Initial( xn::DepthGenerator& rDepth )
+	{
+		XnFieldOfView mFOV;
+		if( rDepth.GetFieldOfView( mFOV ) != XN_STATUS_OK )
+			return false;
+		SetFieldOfView( mFOV );
+		return true;
+	}
+
+	/* Set the field of view, the ray table is rebuilt on next Compute() */
+	void SetFieldOfView( const XnFieldOfView& rFOV )
+	{
+		m_FOV = rFOV;
+		m_iTableXRes = 0;
+		m_iTableYRes = 0;
+	}
+
+	/* Use every iStride-th pixel in both directions */
+	void SetStride( unsigned int iStride )
+	{
+		m_iStride = ( iStride > 0 ) ? iStride : 1;
+	}
+
+	/* Only convert pixels inside the rectangle */
+	void SetROI( const SPixelRect& rROI )
+	{
+		m_ROI = rROI;
+		m_bFullFrame = false;
+	}
+
+	/* Convert the whole map again */
+	void ClearROI()
+	{
+		m_bFullFrame = true;
+	}
+
+	/* Force a kernel, return false if the CPU can't run it */
+	bool SetLevel( ESimdLevel eLevel )
+	{
+		if( !CSimdSupport::IsSupported( eLevel ) )
+			return false;
+		m_eLevel = eLevel;
+		return true;
+	}
+
+	/* Convert a depth frame, return the number of points with depth */
+	unsigned int Compute( const xn::DepthMetaData& rMD )
+	{
+		return Compute( rMD.Data(), rMD.XRes(), rMD.YRes() );
+	}
+
+	/* Convert a depth map of iXRes x iYRes, return the number of points with depth */
+	unsigned int Compute( const XnDepthPixel* pDepth, unsigned int iXRes, unsigned int iYRes )
+	{
+		if( iXRes != m_iTableXRes || iYRes != m_iTableYRes )
+			BuildTable( iXRes, iYRes );
+
+		SPixelRect mRect = m_bFullFrame ? SPixelRect::Make( 0, 0, iXRes, iYRes ) : m_ROI.Clip( iXRes, iYRes );
+		m_iCols = ( mRect.m_iWidth + m_iStride - 1 ) / m_iStride;
+		m_iRows = ( mRect.m_iHeight + m_iStride - 1 ) / m_iStride;
+		m_nValid = 0;
+
+		// an empty ROI, or one outside the map, is an empty cloud
+		if( m_iCols == 0 || m_iRows == 0 )
+			return 0;
+
+		// only grows, the buffers are reused frame after frame
+		size_t nPoints = (size_t)m_iCols * m_iRows;
+		if( m_vX.size() < nPoints )
+		{
+			m_vX.resize( nPoints );
+			m_vY.resize( nPoints );
+			m_vZ.resize( nPoints );
+		}
+
+		for( unsigned int r = 0; r < m_iRows; ++ r )
+		{
+			unsigned int v = mRect.m_iY + r * m_iStride;
+			const XnDepthPixel* pRow = pDepth + (size_t)v * iXRes + mRect.m_iX;
+			const float* pRayX = &m_vRayX[ mRect.m_iX ];
+			size_t iOut = (size_t)r * m_iCols;
+
+			if( m_iStride == 1 )
+				m_nValid += ConvertRow( pRow, pRayX, m_vRayY[v], m_iCols, &m_vX[iOut], &m_vY[iOut], &m_vZ[iOut] );
+			else
+				m_nValid += ConvertRowStrided( pRow, pRayX, m_vRayY[v], m_iCols, m_iStride, &m_vX[iOut], &m_vY[iOut], &m_vZ[iOut] );
+		}
+		return m_nValid;
+	}
+
+	/* Points per row of the output grid */
+	unsigned int GetCols() const		{ return m_iCols; }
+
+	/* Rows of the output grid */
+	unsigned int GetRows() const		{ return m_iRows; }
+
+	/* Points with depth in the last frame */
+	unsigned int GetValidCount() const	{ return m_nValid; }
+
+	/* Real world components in millimetre, GetCols() * GetRows() values each */
+	const float* X() const				{ return m_vX.empty() ? NULL : &m_vX[0]; }
+	const float* Y() const				{ return m_vY.empty() ? NULL : &m_vY[0]; }
+	const float* Z() const				{ return m_vZ.empty() ? NULL : &m_vZ[0]; }
+
+private:
+	/* Ray factor of every column and every row */
+	void BuildTable( unsigned int iXRes, unsigned int iYRes )
+	{
+		double dXtoZ = tan( m_FOV.fHFOV / 2 ) * 2;
+		double dYtoZ = tan( m_FOV.fVFOV / 2 ) * 2;
+
+		m_vRayX.resize( iXRes );
+		for( unsigned int u = 0; u < iXRes; ++ u )
+			m_vRayX[u] = (float)( ( (double)u / iXRes - 0.5 ) * dXtoZ );
+
+		m_vRayY.resize( iYRes );
+		for( unsigned int v = 0; v < iYRes; ++ v )
+			m_vRayY[v] = (float)( ( 0.5 - (double)v / iYRes ) * dYtoZ );
+
+		m_iTableXRes = iXRes;
+		m_iTableYRes = iYRes;
+	}
+
+	unsigned int ConvertRow( const XnDepthPixel* pDepth, const float* pRayX, float fRayY, unsigned int nCount, float* pX, float* pY, float* pZ ) const
+	{
+#if SIMD_X86
+		if( m_eLevel == SIMD_AVX2 )
+			return ConvertRowAVX2( pDepth, pRayX, fRayY, nCount, pX, pY, pZ );
+		if( m_eLevel == SIMD_SSE2 )
+			return ConvertRowSSE2( pDepth, pRayX, fRayY, nCount, pX, pY, pZ );
+#endif
+		return ConvertRowStrided( pDepth, pRayX, fRayY, nCount, 1, pX, pY, pZ );
+	}
+
+	static unsigned int ConvertRowStrided( const XnDepthPixel* pDepth, const float* pRayX, float fRayY, unsigned int nCount, unsigned int iStride, float* pX, float* pY, float* pZ )
+	{
+		unsigned int nValid = 0;
+		for( unsigned int i = 0; i < nCount; ++ i )
+		{
+			float fZ = pDepth[ i * iStride ];
+			pX[i] = fZ * pRayX[ i * iStride ];
+			pY[i] = fZ * fRayY;
+			pZ[i] = fZ;
+			if( fZ != 0 )
+				++nValid;
+		}
+		return nValid;
+	}
+
+#if SIMD_X86
+	/* Number of set bits in a 4 bit movemask */
+	static unsigned int CountBits4( int iMask )
+	{
+		static const unsigned char aBits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+		return aBits[ iMask & 0xF ];
+	}
+
+	static unsigned int ConvertRowSSE2( const XnDepthPixel* pDepth, const float* pRayX, float fRayY, unsigned int nCount, float* pX, float* pY, float* pZ )
+	{
+		const __m128i vZero = _mm_setzero_si128();
+		const __m128 fZero = _mm_setzero_ps();
+		const __m128 fRay = _mm_set1_ps( fRayY );
+		unsigned int nValid = 0;
+		unsigned int i = 0;
+		for( ; i + 8 <= nCount; i += 8 )
+		{
+			__m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pDepth + i ) );
+			__m128 fZ0 = _mm_cvtepi32_ps( _mm_unpacklo_epi16( v, vZero ) );
+			__m128 fZ1 = _mm_cvtepi32_ps( _mm_unpackhi_epi16( v, vZero ) );
+
+			_mm_storeu_ps( pX + i, _mm_mul_ps( fZ0, _mm_loadu_ps( pRayX + i ) ) );
+			_mm_storeu_ps( pX + i + 4, _mm_mul_ps( fZ1, _mm_loadu_ps( pRayX + i + 4 ) ) );
+			_mm_storeu_ps( pY + i, _mm_mul_ps( fZ0, fRay ) );
+			_mm_storeu_ps( pY + i + 4, _mm_mul_ps( fZ1, fRay ) );
+			_mm_storeu_ps( pZ + i, fZ0 );
+			_mm_storeu_ps( pZ + i + 4, fZ1 );
+
+			nValid += CountBits4( _mm_movemask_ps( _mm_cmpneq_ps( fZ0, fZero ) ) );
+			nValid += CountBits4( _mm_movemask_ps( _mm_cmpneq_ps( fZ1, fZero ) ) );
+		}
+		return nValid + ConvertRowStrided( pDepth + i, pRayX + i, fRayY, nCount - i, 1, pX + i, pY + i, pZ + i );
+	}
+
+	SIMD_TARGET_AVX2 static unsigned int ConvertRowAVX2( const XnDepthPixel* pDepth, const float* pRayX, float fRayY, unsigned int nCount, float* pX, float* pY, float* pZ )
+	{
+		const __m256 fZero = _mm256_setzero_ps();
+		const __m256 fRay = _mm256_set1_ps( fRayY );
+		unsigned int nValid = 0;
+		unsigned int i = 0;
+		for( ; i + 8 <= nCount; i += 8 )
+		{
+			__m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pDepth + i ) );
+			__m256 fZ = _mm256_cvtepi32_ps( _mm256_cvtepu16_epi32( v ) );
+
+			_mm256_storeu_ps( pX + i, _mm256_mul_ps( fZ, _mm256_loadu_ps( pRayX + i ) ) );
+			_mm256_storeu_ps( pY + i, _mm256_mul_ps( fZ, fRay ) );
+			_mm256_storeu_ps( pZ + i, fZ );
+
+			int iMask = _mm256_movemask_ps( _mm256_cmp_ps( fZ, fZero, _CMP_NEQ_OQ ) );
+			nValid += CountBits4( iMask ) + CountBits4( iMask >> 4 );
+		}
+		return nValid + ConvertRowStrided( pDepth + i, pRayX + i, fRayY, nCount - i, 1, pX + i, pY + i, pZ + i );
+	}
+#endif
+
+private:
+	XnFieldOfView		m_FOV;
+	unsigned int		m_iStride;
+	bool				m_bFullFrame;
+	SPixelRect			m_ROI;
+
+	// ray table of the current resolution
+	unsigned int		m_iTableXRes;
+	unsigned int		m_iTableYRes;
+	std::vector<float>	m_vRayX;
+	std::vector<float>	m_vRayY;
+
+	// output grid
+	unsigned int		m_iCols;
+	unsigned int		m_iRows;
+	unsigned int		m_nValid;
+	std::vector<float>	m_vX;
+	std::vector<float>	m_vY;
+	std::vector<float>	m_vZ;
+
+	ESimdLevel			m_eLevel;
+};
+
+#endif // POINTCLOUD_H
@@ -0,0 +1,395 @@
+#ifndef RAWFRAMEFILE_H
+#define RAWFRAMEFILE_H
+
+#include <string.h>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "mappedfile.h"
+
+/* Raw frame dump, version 2.
+ *
+ * The file header, then from m_nFrameOffset one fixed size slot per frame:
+ * an SRawFrameHeader, the depth map ( XnDepthPixel ) and the RGB24 image.
+ * Slots are page aligned, so frame n is at m_nFrameOffset + n * m_nSlotSize
+ * and the maps can be used in place from a mapping. Close() appends an
+ * index of depth timestamps and slot offsets and fills in the counts. A
+ * file that was not closed is read up to the last slot with a frame magic.
+ * Sizes are fixed for the whole file. Values are stored in host byte order. */
+struct SRawFileHeader
+{
+	char			m_aMagic[4];		// "KDRF"
+	XnUInt32		m_nVersion;
+	XnUInt32		m_iDepthXRes;
+	XnUInt32		m_iDepthYRes;
+	XnUInt32		m_iImageXRes;		// 0 without image
+	XnUInt32		m_iImageYRes;
+	XnFieldOfView	m_FOV;				// of the depth generator
+	XnUInt64		m_nFrameOffset;
+	XnUInt64		m_nSlotSize;
+	XnUInt64		m_nFrames;			// 0 if the file was not closed
+	XnUInt64		m_nIndexOffset;		// 0 if the file was not closed
+};
+
+struct SRawFrameHeader
+{
+	XnUInt32		m_nMagic;			// RAW_FRAME_MAGIC
+	XnUInt32		m_nDepthFrameID;
+	XnUInt32		m_nImageFrameID;
+	XnUInt32		m_nReserved;
+	XnUInt64		m_nDepthTimestamp;
+	XnUInt64		m_nImageTimestamp;
+};
+
+struct SRawFrameIndex
+{
+	XnUInt64		m_nTimestamp;		// depth
+	XnUInt64		m_nOffset;			// of the slot
+};
+
+/* One frame inside a mapped file, valid until the reader is closed */
+struct SRawFrameView
+{
+	const SRawFrameHeader*	m_pHeader;
+	const XnDepthPixel*		m_pDepth;
+	const XnUInt8*			m_pImage;	// NULL without image
+};
+
+enum
+{
+	RAW_FILE_VERSION	= 2,
+	RAW_FRAME_MAGIC		= 0x5246444B	// "KDFR"
+};
+
+/* Class for recording a raw frame dump.
+ *
+ * Frames are copied straight into a mapped window of WINDOW_SLOTS slots
+ * of a preallocated file, the OS writes them back in the background. The
+ * capture loop pays one memcpy per map and a remap every WINDOW_SLOTS
+ * frames, nothing is allocated per frame. */
+class CRawFrameWriter
+{
+public:
+	enum
+	{
+		SLOT_ALIGN		= 4096,
+		WINDOW_SLOTS	= 16		// SLOT_ALIGN * WINDOW_SLOTS is a multiple of the mapping granularity
+	};
+
+	/* Constructor */
+	CRawFrameWriter() : m_pWindow( NULL ), m_nWindowFirst( 0 ), m_bOpen( false )
+	{}
+
+	/* Destructor */
+	~CRawFrameWriter()
+	{
+		Close();
+	}
+
+	/* Create the file, sizes are taken from the first frames. nReserveFrames are preallocated */
+	bool Open( const char* sFile, const xn::DepthMetaData& rDepthMD, const xn::ImageMetaData& rImageMD, const XnFieldOfView& rFOV, XnUInt32 nReserveFrames = 0 )
+	{
+		Close();
+		if( !m_File.Open( sFile ) )
+			return false;
+
+		memset( &m_Header, 0, sizeof( m_Header ) );
+		memcpy( m_Header.m_aMagic, "KDRF", 4 );
+		m_Header.m_nVersion = RAW_FILE_VERSION;
+		m_Header.m_iDepthXRes = rDepthMD.XRes();
+		m_Header.m_iDepthYRes = rDepthMD.YRes();
+		m_Header.m_iImageXRes = rImageMD.Data() ? rImageMD.XRes() : 0;
+		m_Header.m_iImageYRes = rImageMD.Data() ? rImageMD.YRes() : 0;
+		m_Header.m_FOV = rFOV;
+		m_Header.m_nFrameOffset = CMappedFileWriter::GRANULARITY;
+
+		XnUInt64 nSlot = sizeof( SRawFrameHeader ) + DepthSize() + ImageSize();
+		m_Header.m_nSlotSize = ( nSlot + SLOT_ALIGN - 1 ) / SLOT_ALIGN * SLOT_ALIGN;
+
+		m_pWindow = NULL;
+		m_vIndex.clear();
+		m_vIndex.reserve( nReserveFrames );
+		m_bOpen = m_File.Reserve( m_Header.m_nFrameOffset + nReserveFrames * m_Header.m_nSlotSize )
+			&& m_File.WriteAt( 0, &m_Header, sizeof( m_Header ) );
+		return m_bOpen;
+	}
+
+	/* Append one frame, return false if the sizes changed or the disk is full */
+	bool Write( const xn::DepthMetaData& rDepthMD, const xn::ImageMetaData& rImageMD )
+	{
+		if( !m_bOpen
+			|| rDepthMD.XRes() != m_Header.m_iDepthXRes || rDepthMD.YRes() != m_Header.m_iDepthYRes
+			|| ( m_Header.m_iImageXRes != 0
+				&& ( rImageMD.XRes() != m_Header.m_iImageXRes || rImageMD.YRes() != m_Header.m_iImageYRes ) ) )
+			return false;
+
+		// move the window every WINDOW_SLOTS frames
+		XnUInt64 iFrame = m_Header.m_nFrames;
+		if( m_pWindow == NULL || iFrame >= m_nWindowFirst + WINDOW_SLOTS )
+		{
+			m_nWindowFirst = iFrame / WINDOW_SLOTS * WINDOW_SLOTS;
+			m_pWindow = m_File.Map( SlotOffset( m_nWindowFirst ), (size_t)( WINDOW_SLOTS * m_Header.m_nSlotSize ) );
+			if( m_pWindow == NULL )
+				return false;
+
+			// grows geometrically, so the index allocates a few times per session only
+			if( m_vIndex.capacity() < iFrame + WINDOW_SLOTS )
+				m_vIndex.reserve( 2 * m_vIndex.capacity() + WINDOW_SLOTS );
+		}
+		XnUInt8* pSlot = m_pWindow + ( iFrame - m_nWindowFirst ) * m_Header.m_nSlotSize;
+
+		SRawFrameHeader& rFrame = *reinterpret_cast<SRawFrameHeader*>( pSlot );
+		rFrame.m_nMagic = RAW_FRAME_MAGIC;
+		rFrame.m_nDepthFrameID = rDepthMD.FrameID();
+		rFrame.m_nImageFrameID = ImageSize() ? rImageMD.FrameID() : 0;
+		rFrame.m_nReserved = 0;
+		rFrame.m_nDepthTimestamp = rDepthMD.Timestamp();
+		rFrame.m_nImageTimestamp = ImageSize() ? rImageMD.Timestamp() : 0;
+
+		memcpy( pSlot + sizeof( SRawFrameHeader ), rDepthMD.Data(), DepthSize() );
+		if( ImageSize() )
+			memcpy( pSlot + sizeof( SRawFrameHeader ) + DepthSize(), rImageMD.Data(), ImageSize() );
+
+		SRawFrameIndex mEntry = { rFrame.m_nDepthTimestamp, SlotOffset( iFrame ) };
+		m_vIndex.push_back( mEntry );
+		++m_Header.m_nFrames;
+		return true;
+	}
+
+	/* Frames written so far */
+	XnUInt64 GetFrameCount() const
+	{
+		return m_Header.m_nFrames;
+	}
+
+	/* Write the index and the counts, then close. Return false if they could not be written */
+	bool Close()
+	{
+		if( !m_bOpen )
+			return true;
+		m_bOpen = false;
+		m_pWindow = NULL;
+
+		m_Header.m_nIndexOffset = SlotOffset( m_Header.m_nFrames );
+		size_t nIndex = m_vIndex.size() * sizeof( SRawFrameIndex );
+		bool bOK = ( nIndex == 0 || m_File.WriteAt( m_Header.m_nIndexOffset, &m_vIndex[0], nIndex ) )
+			&& m_File.WriteAt( 0, &m_Header, sizeof( m_Header ) );
+		return m_File.Close( m_Header.m_nIndexOffset + nIndex ) && bOK;
+	}
+
+private:
+	size_t DepthSize() const
+	{
+		return (size_t)m_Header.m_iDepthXRes * m_Header.m_iDepthYRes * sizeof( XnDepthPixel );
+	}
+
+	size_t ImageSize() const
+	{
+		return (size_t)m_Header.m_iImageXRes * m_Header.m_iImageYRes * 3;
+	}
+
+	XnUInt64 SlotOffset( XnUInt64 iFrame ) const
+	{
+		return m_Header.m_nFrameOffset + iFrame * m_Header.m_nSlotSize;
+	}
+
+private:
+	CMappedFileWriter			m_File;
+	SRawFileHeader				m_Header;
+	XnUInt8*					m_pWindow;
+	XnUInt64					m_nWindowFirst;		// frame at the start of the window
+	bool						m_bOpen;
+	std::vector<SRawFrameIndex>	m_vIndex;
+};
+
+/* Class for reading a raw frame dump through a memory mapping.
+ * GetFrame() hands the frames out in place, Read() copies them into
+ * OpenNI meta data. Seeking is O(1) by frame number. */
+class CRawFrameReader
+{
+public:
+	/* Constructor */
+	CRawFrameReader() : m_pIndex( NULL ), m_nFrames( 0 ), m_iNext( 0 )
+	{}
+
+	/* Open the file and check the header */
+	bool Open( const char* sFile )
+	{
+		Close();
+		if( !m_File.Open( sFile ) || m_File.Size() < sizeof( m_Header ) )
+		{
+			Close();
+			return false;
+		}
+
+		memcpy( &m_Header, m_File.Data(), sizeof( m_Header ) );
+		XnUInt64 nSlot = sizeof( SRawFrameHeader ) + DepthSize() + ImageSize();
+		if( memcmp( m_Header.m_aMagic, "KDRF", 4 ) != 0 || m_Header.m_nVersion != RAW_FILE_VERSION
+			|| m_Header.m_nSlotSize < nSlot || m_Header.m_nFrameOffset < sizeof( m_Header ) )
+		{
+			Close();
+			return false;
+		}
+
+		XnUInt64 nIndexEnd = m_Header.m_nIndexOffset + m_Header.m_nFrames * sizeof( SRawFrameIndex );
+		if( m_Header.m_nIndexOffset != 0 && m_Header.m_nIndexOffset == SlotOffset( m_Header.m_nFrames ) && nIndexEnd <= m_File.Size() )
+		{
+			m_nFrames = m_Header.m_nFrames;
+			m_pIndex = reinterpret_cast<const SRawFrameIndex*>( m_File.Data() + m_Header.m_nIndexOffset );
+		}
+		else
+		{
+			// not closed: every slot that fits and has a frame magic
+			m_nFrames = 0;
+			while( SlotOffset( m_nFrames + 1 ) <= m_File.Size() && Slot( m_nFrames )->m_nMagic == RAW_FRAME_MAGIC )
+				++m_nFrames;
+		}
+		return true;
+	}
+
+	/* Check if a file name looks like a raw dump */
+	static bool IsRawFile( const char* sFile )
+	{
+		size_t nLen = strlen( sFile );
+		return nLen > 4 && strcmp( sFile + nLen - 4, ".raw" ) == 0;
+	}
+
+	/* Number of frames */
+	XnUInt64 GetFrameCount() const
+	{
+		return m_nFrames;
+	}
+
+	/* View of frame iFrame */
+	bool GetFrame( XnUInt64 iFrame, SRawFrameView& rView ) const
+	{
+		if( iFrame >= m_nFrames )
+			return false;
+		const XnUInt8* pSlot = reinterpret_cast<const XnUInt8*>( Slot( iFrame ) );
+		rView.m_pHeader = reinterpret_cast<const SRawFrameHeader*>( pSlot );
+		rView.m_pDepth = reinterpret_cast<const XnDepthPixel*>( pSlot + sizeof( SRawFrameHeader ) );
+		rView.m_pImage = ImageSize() ? pSlot + sizeof( SRawFrameHeader ) + DepthSize() : NULL;
+		return true;
+	}
+
+	/* First frame with a depth timestamp at or after nTimestamp, GetFrameCount() if none.
+	 * Starts where a steady frame rate puts the time, so it takes a few steps only */
+	XnUInt64 FindFrame( XnUInt64 nTimestamp ) const
+	{
+		if( m_nFrames == 0 || GetTimestamp( m_nFrames - 1 ) < nTimestamp )
+			return m_nFrames;
+		XnUInt64 nFirst = GetTimestamp( 0 ), nLast = GetTimestamp( m_nFrames - 1 );
+		if( nTimestamp <= nFirst )
+			return 0;
+
+		// bracket the frame by growing steps from the guess, then bisect
+		XnUInt64 iGuess = (XnUInt64)( (double)( nTimestamp - nFirst ) / ( nLast - nFirst ) * ( m_nFrames - 1 ) );
+		XnUInt64 iLow = iGuess, iHigh = iGuess + 1;
+		for( XnUInt64 nStep = 1; iLow > 0 && GetTimestamp( iLow ) >= nTimestamp; nStep *= 2 )
+			iLow = ( iLow > nStep ) ? iLow - nStep : 0;
+		for( XnUInt64 nStep = 1; iHigh < m_nFrames && GetTimestamp( iHigh ) < nTimestamp; nStep *= 2 )
+			iHigh = ( m_nFrames - iHigh > nStep ) ? iHigh + nStep : m_nFrames;
+
+		// first frame in ( iLow, iHigh ] at or after the time
+		if( GetTimestamp( iLow ) >= nTimestamp )
+			return iLow;
+		while( iHigh - iLow > 1 )
+		{
+			XnUInt64 iMid = iLow + ( iHigh - iLow ) / 2;
+			if( GetTimestamp( iMid ) < nTimestamp )
+				iLow = iMid;
+			else
+				iHigh = iMid;
+		}
+		return iHigh;
+	}
+
+	/* Make iFrame the next frame of Read() */
+	bool Seek( XnUInt64 iFrame )
+	{
+		if( iFrame > m_nFrames )
+			return false;
+		m_iNext = iFrame;
+		return true;
+	}
+
+	/* Copy the next frame into the meta data. ReAdjust() with an external
+	 * buffer copies it into the meta data's own buffer, so this costs one
+	 * copy of the depth and the image per frame; GetFrame() reads the
+	 * mapping without one */
+	bool Read( xn::DepthMetaData& rDepthMD, xn::ImageMetaData& rImageMD )
+	{
+		SRawFrameView mView;
+		if( !GetFrame( m_iNext, mView ) )
+			return false;
+		++m_iNext;
+
+		rDepthMD.ReAdjust( m_Header.m_iDepthXRes, m_Header.m_iDepthYRes, mView.m_pDepth );
+		rDepthMD.FrameID() = mView.m_pHeader->m_nDepthFrameID;
+		rDepthMD.Timestamp() = mView.m_pHeader->m_nDepthTimestamp;
+		if( mView.m_pImage != NULL )
+		{
+			rImageMD.ReAdjust( m_Header.m_iImageXRes, m_Header.m_iImageYRes, XN_PIXEL_FORMAT_RGB24, mView.m_pImage );
+			rImageMD.FrameID() = mView.m_pHeader->m_nImageFrameID;
+			rImageMD.Timestamp() = mView.m_pHeader->m_nImageTimestamp;
+		}
+		return true;
+	}
+
+	/* Go back to the first frame */
+	void Rewind()
+	{
+		m_iNext = 0;
+	}
+
+	/* Unmap the file */
+	void Close()
+	{
+		m_File.Close();
+		m_pIndex = NULL;
+		m_nFrames = 0;
+		m_iNext = 0;
+	}
+
+	/* File header, valid after Open() */
+	const SRawFileHeader& GetHeader() const
+	{
+		return m_Header;
+	}
+
+private:
+	size_t DepthSize() const
+	{
+		return (size_t)m_Header.m_iDepthXRes * m_Header.m_iDepthYRes * sizeof( XnDepthPixel );
+	}
+
+	size_t ImageSize() const
+	{
+		return (size_t)m_Header.m_iImageXRes * m_Header.m_iImageYRes * 3;
+	}
+
+	XnUInt64 SlotOffset( XnUInt64 iFrame ) const
+	{
+		return m_Header.m_nFrameOffset + iFrame * m_Header.m_nSlotSize;
+	}
+
+	const SRawFrameHeader* Slot( XnUInt64 iFrame ) const
+	{
+		return reinterpret_cast<const SRawFrameHeader*>( m_File.Data() + SlotOffset( iFrame ) );
+	}
+
+	XnUInt64 GetTimestamp( XnUInt64 iFrame ) const
+	{
+		return m_pIndex ? m_pIndex[ iFrame ].m_nTimestamp : Slot( iFrame )->m_nDepthTimestamp;
+	}
+
+private:
+	CMappedFile				m_File;
+	SRawFileHeader			m_Header;
+	const SRawFrameIndex*	m_pIndex;
+	XnUInt64				m_nFrames;
+	XnUInt64				m_iNext;
+};
+
+#endif // RAWFRAMEFILE_H
@@ -0,0 +1,443 @@
+// Self test of the frame processing.
+//
+// Runs the loop CKinectReader::timerEvent used to colorize the depth and
+// every kernel of CDepthColorizer this CPU supports on the same maps:
+// random ones of odd sizes and at odd addresses, all 0, all 65535 and
+// mixes of both. The ARGB images have to be the same byte for byte.
+//
+// Colorizes rectangles of a map with every kernel, and a moving user with
+// CUserROI over its background into three images in turn. Inside the
+// rectangles the result has to be the whole frame colorized, outside them
+// the background.
+//
+// Registers single depth pixels with CDepthRegistration, unmirrored and
+// mirrored. A 3D point has to land on the color pixel the calibration
+// puts it on, and on the mirror image of that pixel when both cameras
+// are mirrored.
+//
+// Feeds CFrameSync a depth stream at 30 Hz and an image stream at 15 Hz,
+// where every other update still has the image of the update before. Each
+// image has to be paired once, with the depth taken at the same time.
+//
+//     selftest
+//
+// Prints every failed check and returns 1 if there was one, 0 otherwise.
+
+#include <math.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+#include <XnTypes.h>
+
+#include "simdsupport.h"
+#include "depthcolorizer.h"
+#include "depthregistration.h"
+#include "framesync.h"
+#include "userroi.h"
+
+using namespace std;
+
+/* Same numbers on every run and every platform */
+class CRandom
+{
+public:
+	/* Constructor */
+	CRandom( unsigned int nSeed ) : m_nState( nSeed )
+	{}
+
+	/* Next value, 0 - 65535 */
+	XnDepthPixel Next()
+	{
+		m_nState = m_nState * 1664525u + 1013904223u;
+		return (XnDepthPixel)( m_nState >> 16 );
+	}
+
+private:
+	unsigned int	m_nState;
+};
+
+/* The old timerEvent loop. It stopped one pixel short and left the last
+ * one as it was; here it converts that one too, like the kernels do */
+void ColorizeReference( const XnDepthPixel* pDepth, unsigned int iSize, unsigned char* pARGB )
+{
+	// find the max value
+	XnDepthPixel tMax = *pDepth;
+	for( unsigned int i = 1; i < iSize; ++ i )
+	{
+		if( pDepth[i] > tMax )
+			tMax = pDepth[i];
+	}
+
+	// redistribute data to 0-255
+	int idx = 0;
+	for( unsigned int i = 0; i < iSize; ++ i )
+	{
+		if( (*pDepth) != 0 )
+		{
+			pARGB[ idx++ ] = 0;									// Blue
+			pARGB[ idx++ ] = 255 * ( tMax - *pDepth ) / tMax;		// Green
+			pARGB[ idx++ ] = 255 * *pDepth / tMax;				// Red
+			pARGB[ idx++ ] = 255 * ( tMax - *pDepth ) / tMax;		// Alpha
+		}
+		else
+		{
+			pARGB[ idx++ ] = 0;
+			pARGB[ idx++ ] = 0;
+			pARGB[ idx++ ] = 0;
+			pARGB[ idx++ ] = 0;
+		}
+		++pDepth;
+	}
+}
+
+/* Colorize a map with every kernel, return the number of kernels which differ from the reference */
+unsigned int CheckColorizer( const char* sName, const XnDepthPixel* pDepth, unsigned int iSize )
+{
+	vector<unsigned char> vExpected( 4 * iSize );
+	ColorizeReference( pDepth, iSize, &vExpected[0] );
+
+	unsigned int nFailed = 0;
+	CDepthColorizer mColorizer;
+	for( int iLevel = SIMD_SCALAR; iLevel <= SIMD_AVX2; ++ iLevel )
+	{
+		if( !mColorizer.SetLevel( (ESimdLevel)iLevel ) )
+			continue;
+
+		// a guard byte after the image catches a kernel writing past the end
+		vector<unsigned char> vARGB( 4 * iSize + 1, 0xA5 );
+		mColorizer.Colorize( pDepth, iSize, &vARGB[0] );
+		for( unsigned int i = 0; i <= 4 * iSize; ++ i )
+		{
+			unsigned char cExpected = ( i < 4 * iSize ) ? vExpected[i] : 0xA5;
+			if( vARGB[i] != cExpected )
+			{
+				cerr << "Colorizer " << CSimdSupport::Name( (ESimdLevel)iLevel ) << ", " << sName << " of " << iSize
+					<< " pixels: byte " << i << " is " << (int)vARGB[i] << ", expected " << (int)cExpected << endl;
+				++nFailed;
+				break;
+			}
+		}
+	}
+	return nFailed;
+}
+
+/* The colorizer on random, empty, saturated and mixed maps */
+unsigned int TestColorizer()
+{
+	// around the 8 and 16 pixel steps of the kernels, and whole frames
+	const unsigned int aSize[] = { 1, 2, 3, 7, 8, 9, 15, 16, 17, 31, 33, 63, 65, 127, 1001, 320 * 240, 640 * 480, 639 * 479 };
+	const unsigned int nSizes = sizeof( aSize ) / sizeof( aSize[0] );
+
+	unsigned int nFailed = 0;
+	CRandom mRandom( 1 );
+	vector<XnDepthPixel> vMap( 640 * 480 + 1 );
+	for( unsigned int s = 0; s < nSizes; ++ s )
+	{
+		unsigned int iSize = aSize[s];
+
+		// the odd offset puts the map off the 16 byte boundary
+		for( unsigned int iOffset = 0; iOffset < 2; ++ iOffset )
+		{
+			XnDepthPixel* pMap = &vMap[ iOffset ];
+
+			for( unsigned int i = 0; i < iSize; ++ i )
+				pMap[i] = mRandom.Next();
+			nFailed += CheckColorizer( "random", pMap, iSize );
+
+			// a sensor range, with holes
+			for( unsigned int i = 0; i < iSize; ++ i )
+				pMap[i] = ( mRandom.Next() % 4 == 0 ) ? 0 : 400 + mRandom.Next() % 3600;
+			nFailed += CheckColorizer( "depth with holes", pMap, iSize );
+
+			for( unsigned int i = 0; i < iSize; ++ i )
+				pMap[i] = 0;
+			nFailed += CheckColorizer( "all 0", pMap, iSize );
+
+			for( unsigned int i = 0; i < iSize; ++ i )
+				pMap[i] = 65535;
+			nFailed += CheckColorizer( "all 65535", pMap, iSize );
+
+			for( unsigned int i = 0; i < iSize; ++ i )
+				pMap[i] = ( mRandom.Next() & 1 ) ? 65535 : 0;
+			nFailed += CheckColorizer( "0 and 65535", pMap, iSize );
+
+			for( unsigned int i = 0; i < iSize; ++ i )
+				pMap[i] = ( mRandom.Next() % 3 == 0 ) ? 0 : 1 + mRandom.Next() % 3;
+			nFailed += CheckColorizer( "max 3", pMap, iSize );
+		}
+	}
+
+	// every depth value, with the largest possible and with a small max
+	vector<XnDepthPixel> vAll( 65536 );
+	for( unsigned int i = 0; i < 65536; ++ i )
+		vAll[i] = (XnDepthPixel)i;
+	nFailed += CheckColorizer( "every value", &vAll[0], 65536 );
+	nFailed += CheckColorizer( "values to 4095", &vAll[0], 4096 );
+	return nFailed;
+}
+
+/* Mark the pixels inside the rectangles */
+vector<bool> RectMask( const SPixelRect* pRect, unsigned int nRects, unsigned int iXRes, unsigned int iYRes )
+{
+	vector<bool> vInside( (size_t)iXRes * iYRes, false );
+	for( unsigned int i = 0; i < nRects; ++ i )
+	{
+		for( unsigned int y = pRect[i].m_iY; y < pRect[i].m_iY + pRect[i].m_iHeight; ++ y )
+		{
+			for( unsigned int x = pRect[i].m_iX; x < pRect[i].m_iX + pRect[i].m_iWidth; ++ x )
+				vInside[ (size_t)y * iXRes + x ] = true;
+		}
+	}
+	return vInside;
+}
+
+/* The rectangle overloads of the colorizer, and CUserROI, against whole frames */
+unsigned int TestUserROI()
+{
+	// odd sizes, the last tiles are partial
+	const unsigned int iXRes = 321, iYRes = 243;
+	const size_t nSize = (size_t)iXRes * iYRes;
+	CRandom mRandom( 2 );
+
+	// a scene with holes; one far pixel gives every frame the same max, so the background stays
+	vector<XnDepthPixel> vScene( nSize );
+	for( size_t i = 0; i < nSize; ++ i )
+		vScene[i] = ( mRandom.Next() % 8 == 0 ) ? 0 : 400 + mRandom.Next() % 3600;
+	vScene[0] = 5000;
+
+	unsigned int nFailed = 0;
+	for( int iLevel = SIMD_SCALAR; iLevel <= SIMD_AVX2; ++ iLevel )
+	{
+		CDepthColorizer mColorizer;
+		if( !mColorizer.SetLevel( (ESimdLevel)iLevel ) )
+			continue;
+		const char* sLevel = CSimdSupport::Name( (ESimdLevel)iLevel );
+
+		// 1. FindMax and Expand over rectangles, which leave the rest of the image alone
+		const SPixelRect aRect[] = { SPixelRect::Make( 0, 0, 5, 3 ), SPixelRect::Make( 17, 40, 100, 1 ), SPixelRect::Make( 64, 64, 64, 64 ), SPixelRect::Make( 300, 200, 21, 43 ) };
+		const unsigned int nRects = sizeof( aRect ) / sizeof( aRect[0] );
+		vector<bool> vInside = RectMask( aRect, nRects, iXRes, iYRes );
+		vector<XnDepthPixel> vDepth( nSize );
+		for( size_t i = 0; i < nSize; ++ i )
+			vDepth[i] = ( mRandom.Next() % 5 == 0 ) ? 0 : mRandom.Next();
+		XnDepthPixel tMax = 0;
+		for( size_t i = 0; i < nSize; ++ i )
+			tMax = ( vInside[i] && vDepth[i] > tMax ) ? vDepth[i] : tMax;
+		if( mColorizer.FindMax( &vDepth[0], iXRes, aRect, nRects ) != tMax )
+		{
+			cerr << "Colorizer " << sLevel << ", rectangles: max " << mColorizer.FindMax( &vDepth[0], iXRes, aRect, nRects ) << ", expected " << tMax << endl;
+			++nFailed;
+		}
+		vector<unsigned char> vWhole( 4 * nSize ), vRects( 4 * nSize, 0xA5 );
+		mColorizer.Expand( &vDepth[0], (unsigned int)nSize, tMax, &vWhole[0] );
+		mColorizer.Expand( &vDepth[0], iXRes, aRect, nRects, tMax, &vRects[0] );
+		for( size_t i = 0; i < 4 * nSize; ++ i )
+		{
+			unsigned char cExpected = vInside[ i / 4 ] ? vWhole[i] : 0xA5;
+			if( vRects[i] != cExpected )
+			{
+				cerr << "Colorizer " << sLevel << ", rectangles: byte " << i << " is " << (int)vRects[i] << ", expected " << (int)cExpected << endl;
+				++nFailed;
+				break;
+			}
+		}
+
+		// 2. a user moving over the scene, colorized into three images in turn
+		CUserROI mROI;
+		mROI.SetRefresh( 1000 );
+		vector<unsigned char> vBackground( 4 * nSize );
+		mColorizer.Colorize( &vScene[0], (unsigned int)nSize, &vBackground[0] );
+		vector< vector<unsigned char> > vOut( 3, vector<unsigned char>( 4 * nSize ) );
+		for( unsigned int f = 0; f < 9; ++ f )
+		{
+			vector<XnDepthPixel> vFrame( vScene );
+			SPixelRect mUser = SPixelRect::Make( 20 + 25 * f, 30 + 10 * f, 60, 120 ).Clip( iXRes, iYRes );
+			// the first frame has no user and makes the background
+			mROI.Begin( iXRes, iYRes );
+			if( f > 0 )
+			{
+				for( unsigned int y = mUser.m_iY; y < mUser.m_iY + mUser.m_iHeight; ++ y )
+				{
+					for( unsigned int x = mUser.m_iX; x < mUser.m_iX + mUser.m_iWidth; ++ x )
+						vFrame[ (size_t)y * iXRes + x ] = 1000 + mRandom.Next() % 500;
+				}
+				mROI.AddRect( mUser );
+			}
+			mROI.End();
+			unsigned char* pOut = &vOut[ f % 3 ][0];
+			mROI.Colorize( mColorizer, &vFrame[0], pOut );
+
+			mColorizer.Colorize( &vFrame[0], (unsigned int)nSize, &vWhole[0] );
+			vector<bool> vUser = RectMask( mROI.GetRects(), mROI.GetRectCount(), iXRes, iYRes );
+			for( size_t i = 0; i < 4 * nSize; ++ i )
+			{
+				unsigned char cExpected = vUser[ i / 4 ] ? vWhole[i] : vBackground[i];
+				if( pOut[i] != cExpected )
+				{
+					cerr << "User ROI " << sLevel << ", frame " << f << ": byte " << i << " is " << (int)pOut[i] << ", expected " << (int)cExpected
+						<< ( vUser[ i / 4 ] ? " of the frame" : " of the background" ) << endl;
+					++nFailed;
+					break;
+				}
+			}
+		}
+	}
+	return nFailed;
+}
+
+/* Register a depth map with the single pixel ( iU, iV ) at nZ, return false if it lands nowhere */
+bool RegisterPixel( CDepthRegistration& rRegistration, unsigned int iXRes, unsigned int iYRes, unsigned int iU, unsigned int iV, XnDepthPixel nZ,
+	unsigned int iOutXRes, unsigned int iOutYRes, unsigned int& rOutU, unsigned int& rOutV )
+{
+	vector<XnDepthPixel> vDepth( iXRes * iYRes, 0 );
+	vector<XnDepthPixel> vOut( iOutXRes * iOutYRes );
+	vDepth[ iV * iXRes + iU ] = nZ;
+	rRegistration.Register( &vDepth[0], iXRes, iYRes, &vOut[0], iOutXRes, iOutYRes );
+	for( unsigned int i = 0; i < vOut.size(); ++ i )
+	{
+		if( vOut[i] != 0 )
+		{
+			rOutU = i % iOutXRes;
+			rOutV = i / iOutXRes;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Known 3D points through the registration, unmirrored and mirrored */
+unsigned int TestRegistration()
+{
+	// a typical Kinect, turned a little so the rotation counts too
+	CDepthRegistration::SIntrinsics mDepth = { 594.2f, 591.0f, 339.3f, 242.7f };
+	CDepthRegistration::SIntrinsics mColor = { 529.2f, 525.6f, 328.9f, 267.5f };
+	const float fA = 0.01f, fB = 0.02f;
+	const float aRotation[9] = { cosf( fA ), 0, sinf( fA ), sinf( fA ) * sinf( fB ), cosf( fB ), -cosf( fA ) * sinf( fB ), -sinf( fA ) * cosf( fB ), sinf( fB ), cosf( fA ) * cosf( fB ) };
+	const float aTranslation[3] = { 25, 1, -2 };
+
+	// depth pixels at 640x480, points from 0.5 to 4 m
+	const unsigned int aPixel[][2] = { { 320, 240 }, { 100, 50 }, { 600, 420 }, { 17, 333 }, { 451, 9 } };
+	const XnDepthPixel aZ[] = { 500, 1000, 2500, 4000 };
+	const unsigned int aRes[][4] = { { 640, 480, 640, 480 }, { 320, 240, 640, 480 }, { 640, 480, 1280, 1024 } };
+
+	unsigned int nFailed = 0;
+	CDepthRegistration mRegistration;
+	mRegistration.SetCalibration( mDepth, mColor, aRotation, aTranslation );
+	for( unsigned int r = 0; r < sizeof( aRes ) / sizeof( aRes[0] ); ++ r )
+	{
+		unsigned int iXRes = aRes[r][0], iYRes = aRes[r][1], iOutXRes = aRes[r][2], iOutYRes = aRes[r][3];
+		double dSX = iXRes / 640.0, dSY = iYRes / 480.0, dOutSX = iOutXRes / 640.0, dOutSY = iOutYRes / 480.0;
+		for( unsigned int p = 0; p < sizeof( aPixel ) / sizeof( aPixel[0] ); ++ p )
+		{
+			for( unsigned int z = 0; z < sizeof( aZ ) / sizeof( aZ[0] ); ++ z )
+			{
+				unsigned int iU = aPixel[p][0] * iXRes / 640, iV = aPixel[p][1] * iYRes / 480;
+				XnDepthPixel nZ = aZ[z];
+
+				// the 3D point of the depth pixel in the color camera, and its color pixel
+				double dX = ( iU - mDepth.m_fCx * dSX ) / ( mDepth.m_fFx * dSX ) * nZ, dY = ( iV - mDepth.m_fCy * dSY ) / ( mDepth.m_fFy * dSY ) * nZ;
+				double aPoint[3];
+				for( unsigned int k = 0; k < 3; ++ k )
+					aPoint[k] = aRotation[ 3 * k ] * dX + aRotation[ 3 * k + 1 ] * dY + aRotation[ 3 * k + 2 ] * nZ + aTranslation[k];
+				double dU = mColor.m_fCx * dOutSX + mColor.m_fFx * dOutSX * aPoint[0] / aPoint[2];
+				double dV = mColor.m_fCy * dOutSY + mColor.m_fFy * dOutSY * aPoint[1] / aPoint[2];
+				unsigned int iExpectedU = (unsigned int)floor( dU + 0.5 ), iExpectedV = (unsigned int)floor( dV + 0.5 );
+				if( iExpectedU >= iOutXRes || iExpectedV >= iOutYRes )
+					continue;
+
+				unsigned int iOutU = 0, iOutV = 0, iMirrorU = 0, iMirrorV = 0;
+				mRegistration.SetMirrored( false );
+				bool bFound = RegisterPixel( mRegistration, iXRes, iYRes, iU, iV, nZ, iOutXRes, iOutYRes, iOutU, iOutV );
+				mRegistration.SetMirrored( true );
+				bool bMirrorFound = RegisterPixel( mRegistration, iXRes, iYRes, iXRes - 1 - iU, iV, nZ, iOutXRes, iOutYRes, iMirrorU, iMirrorV );
+
+				if( !bFound || iOutU != iExpectedU || iOutV != iExpectedV )
+				{
+					cerr << "Registration " << iXRes << "x" << iYRes << " to " << iOutXRes << "x" << iOutYRes << ": ( " << iU << ", " << iV << " ) at "
+						<< nZ << " mm lands on ( " << iOutU << ", " << iOutV << " ), expected ( " << iExpectedU << ", " << iExpectedV << " )" << endl;
+					++nFailed;
+				}
+				if( !bMirrorFound || iMirrorU != iOutXRes - 1 - iExpectedU || iMirrorV != iExpectedV )
+				{
+					cerr << "Registration " << iXRes << "x" << iYRes << " to " << iOutXRes << "x" << iOutYRes << ", mirrored: ( " << iXRes - 1 - iU << ", " << iV
+						<< " ) at " << nZ << " mm lands on ( " << iMirrorU << ", " << iMirrorV << " ), expected ( " << iOutXRes - 1 - iExpectedU << ", " << iExpectedV << " )" << endl;
+					++nFailed;
+				}
+			}
+		}
+	}
+	return nFailed;
+}
+
+/* Images which stay in the meta data over two depth updates, with a tight and a loose tolerance */
+unsigned int TestFrameSync()
+{
+	const XnUInt64 aTolerance[] = { 17000, 40000 };
+	XnDepthPixel aDepth[4] = { 1000, 1000, 1000, 1000 };
+	XnUInt8 aImage[12] = { 0 };
+
+	unsigned int nFailed = 0;
+	for( unsigned int t = 0; t < sizeof( aTolerance ) / sizeof( aTolerance[0] ); ++ t )
+	{
+		CFrameSync mSync( aTolerance[t] );
+		xn::DepthMetaData mDepthMD;
+		xn::ImageMetaData mImageMD;
+		mDepthMD.ReAdjust( 2, 2, aDepth );
+		mImageMD.ReAdjust( 2, 2, XN_PIXEL_FORMAT_RGB24, aImage );
+
+		// 20 depth frames, 10 images; the odd updates push the image of the even ones again
+		vector<bool> vPaired( 10, false );
+		for( unsigned int f = 0; f < 20; ++ f )
+		{
+			mDepthMD.FrameID() = f + 1;
+			mDepthMD.Timestamp() = f * 33333;
+			mImageMD.FrameID() = f / 2 + 1;
+			mImageMD.Timestamp() = ( f / 2 ) * 66666;
+			mSync.PushDepth( mDepthMD );
+			bool bPushed = mSync.PushImage( mImageMD );
+			if( bPushed != ( f % 2 == 0 ) )
+			{
+				cerr << "Frame sync, tolerance " << aTolerance[t] << " us: image " << f / 2 + 1 << ( bPushed ? " pushed again" : " not pushed" ) << " at depth " << f + 1 << endl;
+				++nFailed;
+			}
+
+			CFrameSync::SPair mPair;
+			if( !mSync.GetPair( mPair ) )
+				continue;
+			unsigned int iImage = mPair.m_pImage->m_nFrameID - 1;
+			if( vPaired[ iImage ] || mPair.m_nSkew != 0 )
+			{
+				cerr << "Frame sync, tolerance " << aTolerance[t] << " us: image " << iImage + 1 << " paired " << ( vPaired[ iImage ] ? "twice" : "off time" )
+					<< ", with depth " << mPair.m_pDepth->m_nFrameID << endl;
+				++nFailed;
+			}
+			vPaired[ iImage ] = true;
+		}
+		if( mSync.Pairs() != 10 || mSync.UnmatchedImage() != 0 )
+		{
+			cerr << "Frame sync, tolerance " << aTolerance[t] << " us: " << mSync.Pairs() << " pairs, " << mSync.UnmatchedImage() << " unmatched images, expected 10 and 0" << endl;
+			++nFailed;
+		}
+	}
+	return nFailed;
+}
+
+int main()
+{
+	cout << "Best kernel: " << CSimdSupport::Name( CSimdSupport::Best() ) << endl;
+
+	unsigned int nFailed = TestColorizer();
+	cout << "Colorizer: " << ( nFailed ? "FAILED" : "OK" ) << endl;
+
+	unsigned int nFailedROI = TestUserROI();
+	cout << "User ROI: " << ( nFailedROI ? "FAILED" : "OK" ) << endl;
+
+	unsigned int nFailedRegistration = TestRegistration();
+	cout << "Registration: " << ( nFailedRegistration ? "FAILED" : "OK" ) << endl;
+
+	unsigned int nFailedSync = TestFrameSync();
+	cout << "Frame sync: " << ( nFailedSync ? "FAILED" : "OK" ) << endl;
+
+	return ( nFailed || nFailedROI || nFailedRegistration || nFailedSync ) ? 1 : 0;
+}
@@ -0,0 +1,395 @@
+#ifndef SENSORARRAY_H
+#define SENSORARRAY_H
+
+#include <stdio.h>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "sensorsource.h"
+#include "skeletonsnapshot.h"
+#include "triplebuffer.h"
+#include "framestats.h"
+
+/* Class for tracking users with several sensors at once.
+ *
+ * Every sensor, live or a recording, is a COpenNI with its own context and
+ * capture thread, so the sensors are updated in parallel and the work
+ * grows with the number of cores, not on one thread. A capture thread
+ * reads the skeletons of its sensor, moves them into the world frame with
+ * the extrinsics of the sensor and publishes them through a triple buffer.
+ *
+ * Update() takes the newest skeletons of every sensor and merges them into
+ * one list: a user seen by several sensors, torsos closer than the merge
+ * distance, becomes one user with every joint averaged by confidence. A
+ * merged user keeps the id of the first sensor that sees it, sensor index
+ * * ID_STRIDE + OpenNI id. Skeletons older than the stale time are left
+ * out, a sensor that stopped doesn't leave ghosts. */
+class CSensorArray
+{
+public:
+	enum
+	{
+		MAX_SENSORS		= 8,
+		ID_STRIDE		= 256
+	};
+
+	/* World = Rotation * sensor + Translation, in millimeters */
+	struct SExtrinsics
+	{
+		float	m_aRotation[9];		// row major
+		float	m_aTranslation[3];
+	};
+
+	/* Constructor */
+	CSensorArray() : m_fMergeDistance( 300 ), m_nStaleTime( 200000 ), m_bStop( false )
+	{}
+
+	/* Destructor, stops the capture threads */
+	~CSensorArray()
+	{
+		Stop();
+	}
+
+	/* Open nDevices of the connected sensors, all with 0 */
+	bool OpenDevices( unsigned int nDevices = 0 )
+	{
+		unsigned int nFound = COpenNI::CountDevices();
+		if( nDevices == 0 || nDevices > nFound )
+			nDevices = nFound;
+		for( unsigned int i = 0; i < nDevices; ++ i )
+		{
+			SSensor* pSensor = AddSensor();
+			if( pSensor == NULL || !pSensor->m_OpenNI.InitialDevice( i ) )
+				return false;
+		}
+		return nDevices > 0;
+	}
+
+	/* Open recordings as sensors, replayed as fast as possible with bFastest */
+	bool OpenRecordings( const char* const* aFile, unsigned int nFiles, bool bFastest )
+	{
+		for( unsigned int i = 0; i < nFiles; ++ i )
+		{
+			SSensor* pSensor = AddSensor();
+			if( pSensor == NULL || !pSensor->m_OpenNI.Initial( aFile[i] ) )
+				return false;
+			if( !pSensor->m_OpenNI.HasUserGenerator() )
+			{
+				std::cerr << aFile[i] << " has no users to track" << std::endl;
+				return false;
+			}
+			if( bFastest && !pSensor->m_OpenNI.SetPlaybackFastest() )
+				return false;
+		}
+		return nFiles > 0;
+	}
+
+	/* Number of opened sensors */
+	unsigned int GetSensorCount() const
+	{
+		return (unsigned int)m_vSensor.size();
+	}
+
+	/* Place a sensor in the world, sensors start at the origin. Call before Start(),
+	 * the capture threads read the extrinsics without a lock */
+	bool SetExtrinsics( unsigned int iSensor, const SExtrinsics& rExtrinsics )
+	{
+		if( m_vSensor[ iSensor ]->m_Thread.joinable() )
+		{
+			std::cerr << "Sensor " << iSensor << " is running, its extrinsics stay" << std::endl;
+			return false;
+		}
+		m_vSensor[ iSensor ]->m_Extrinsics = rExtrinsics;
+		return true;
+	}
+
+	/* Read the extrinsics of the sensors from a text file, per sensor one line
+	 * of the 9 rotation values and the 3 translation values. Call before Start() */
+	bool LoadExtrinsics( const char* sFile )
+	{
+		FILE* pFile = fopen( sFile, "r" );
+		if( pFile == NULL )
+			return false;
+		bool bOK = true;
+		for( unsigned int i = 0; bOK && i < GetSensorCount(); ++ i )
+		{
+			SExtrinsics mExtrinsics;
+			for( unsigned int j = 0; bOK && j < 12; ++ j )
+				bOK = fscanf( pFile, "%f", j < 9 ? &mExtrinsics.m_aRotation[j] : &mExtrinsics.m_aTranslation[ j - 9 ] ) == 1;
+			if( bOK )
+				bOK = SetExtrinsics( i, mExtrinsics );
+		}
+		fclose( pFile );
+		return bOK;
+	}
+
+	/* Torsos closer than fDistance in millimeters are one user */
+	void SetMergeDistance( float fDistance )
+	{
+		m_fMergeDistance = fDistance;
+	}
+
+	/* Leave out skeletons published more than nMicroSec ago */
+	void SetStaleTime( XnUInt64 nMicroSec )
+	{
+		m_nStaleTime = nMicroSec;
+	}
+
+	/* Start the sensors and a capture thread for each */
+	bool Start()
+	{
+		m_bStop = false;
+		for( size_t i = 0; i < m_vSensor.size(); ++ i )
+		{
+			if( !m_vSensor[i]->m_OpenNI.Start() )
+				return false;
+		}
+		for( size_t i = 0; i < m_vSensor.size(); ++ i )
+			m_vSensor[i]->m_Thread = std::thread( &CSensorArray::Capture, this, m_vSensor[i].get() );
+		return true;
+	}
+
+	/* Stop the capture threads */
+	void Stop()
+	{
+		m_bStop = true;
+		for( size_t i = 0; i < m_vSensor.size(); ++ i )
+		{
+			if( m_vSensor[i]->m_Thread.joinable() )
+				m_vSensor[i]->m_Thread.join();
+		}
+	}
+
+	/* Check if every sensor is a recording which has ended */
+	bool IsEndOfFile() const
+	{
+		for( size_t i = 0; i < m_vSensor.size(); ++ i )
+		{
+			if( !m_vSensor[i]->m_bEnd )
+				return false;
+		}
+		return true;
+	}
+
+	/* Merge the newest skeletons of all sensors into rMerged, in the world frame.
+	 * rMerged has the default joints, like the sensors. Return false if no
+	 * sensor had new skeletons since the last call */
+	bool Update( CSkeletonSnapshot& rMerged )
+	{
+		bool bNew = false;
+		for( size_t i = 0; i < m_vSensor.size(); ++ i )
+			bNew = m_vSensor[i]->m_Frames.Update() || bNew;
+		if( !bNew )
+			return false;
+
+		rMerged.Clear();
+		unsigned int nJoints = rMerged.GetJointCount();
+		int iTorso = rMerged.FindJoint( XN_SKEL_TORSO );
+		XnUInt64 nNow = CFrameStats::Now();
+		unsigned int aSensorMask[CSkeletonSnapshot::MAX_USERS];
+		float aWeight[ CSkeletonSnapshot::MAX_USERS * CSkeletonSnapshot::MAX_JOINTS ];
+
+		for( size_t iSensor = 0; iSensor < m_vSensor.size(); ++ iSensor )
+		{
+			const SSensorFrame& rFrame = m_vSensor[ iSensor ]->m_Frames.Front();
+			if( rFrame.m_nReadyTime == 0 || nNow - rFrame.m_nReadyTime > m_nStaleTime )
+				continue;
+
+			const CSkeletonSnapshot& rSkeleton = rFrame.m_Skeleton;
+			for( unsigned int iUser = 0; iUser < rSkeleton.GetUserCount(); ++ iUser )
+			{
+				// the nearest user of the other sensors, by the torso; a user without
+				// any confident joint has no position and would merge with anything
+				XnPoint3D mTorso;
+				if( !Center( rSkeleton, iUser, iTorso, mTorso ) )
+					continue;
+				int iMerged = -1;
+				float fBest = m_fMergeDistance * m_fMergeDistance;
+				for( unsigned int k = 0; k < rMerged.GetUserCount(); ++ k )
+				{
+					if( aSensorMask[k] & ( 1u << iSensor ) )
+						continue;
+					XnPoint3D mOther;
+					if( !Center( rMerged, k, iTorso, mOther, aWeight + k * nJoints ) )
+						continue;
+					float fDX = mOther.X - mTorso.X, fDY = mOther.Y - mTorso.Y, fDZ = mOther.Z - mTorso.Z;
+					float fDistance = fDX * fDX + fDY * fDY + fDZ * fDZ;
+					if( fDistance < fBest )
+					{
+						fBest = fDistance;
+						iMerged = (int)k;
+					}
+				}
+				if( iMerged < 0 )
+				{
+					iMerged = rMerged.AddUser( (XnUserID)( iSensor * ID_STRIDE + rSkeleton.GetUserID( iUser ) ) );
+					if( iMerged < 0 )
+						break;
+					aSensorMask[ iMerged ] = 0;
+					for( unsigned int j = 0; j < nJoints; ++ j )
+						aWeight[ iMerged * nJoints + j ] = 0;
+				}
+				aSensorMask[ iMerged ] |= 1u << iSensor;
+
+				// sums weighted by confidence, divided below
+				const XnFloat* pConfidence = rSkeleton.Confidence() + iUser * nJoints;
+				unsigned int iIn = iUser * nJoints, iOut = iMerged * nJoints;
+				for( unsigned int j = 0; j < nJoints; ++ j )
+				{
+					float fWeight = pConfidence[j];
+					rMerged.X()[ iOut + j ] += fWeight * rSkeleton.X()[ iIn + j ];
+					rMerged.Y()[ iOut + j ] += fWeight * rSkeleton.Y()[ iIn + j ];
+					rMerged.Z()[ iOut + j ] += fWeight * rSkeleton.Z()[ iIn + j ];
+					aWeight[ iOut + j ] += fWeight;
+					if( fWeight > rMerged.Confidence()[ iOut + j ] )
+						rMerged.Confidence()[ iOut + j ] = fWeight;
+				}
+			}
+		}
+
+		for( unsigned int i = 0; i < rMerged.GetUserCount() * nJoints; ++ i )
+		{
+			if( aWeight[i] > 0 )
+			{
+				rMerged.X()[i] /= aWeight[i];
+				rMerged.Y()[i] /= aWeight[i];
+				rMerged.Z()[i] /= aWeight[i];
+			}
+		}
+		return true;
+	}
+
+	/* Frame counts of one sensor */
+	const CFrameStats& GetStats( unsigned int iSensor ) const
+	{
+		return m_vSensor[ iSensor ]->m_Stats;
+	}
+
+	/* Frames of every sensor and all of them together */
+	void Report( std::ostream& rOut, double dSeconds ) const
+	{
+		XnUInt64 nFrames = 0;
+		for( size_t i = 0; i < m_vSensor.size(); ++ i )
+		{
+			m_vSensor[i]->m_Stats.Report( rOut );
+			nFrames += m_vSensor[i]->m_Stats.Frames();
+		}
+		rOut << "Sensors: " << m_vSensor.size() << ", " << nFrames << " frames in " << dSeconds << " s, "
+			<< ( dSeconds > 0 ? nFrames / dSeconds : 0.0 ) << " fps together" << std::endl;
+	}
+
+private:
+	struct SSensorFrame
+	{
+		CSkeletonSnapshot	m_Skeleton;		// in the world frame
+		XnUInt64			m_nTimestamp;
+		XnUInt64			m_nReadyTime;	// CFrameStats::Now() at publishing, 0 before the first
+
+		SSensorFrame() : m_nTimestamp( 0 ), m_nReadyTime( 0 )
+		{}
+	};
+
+	struct SSensor
+	{
+		COpenNI							m_OpenNI;
+		SExtrinsics						m_Extrinsics;
+		CTripleBuffer<SSensorFrame>		m_Frames;
+		CFrameStats						m_Stats;
+		std::thread						m_Thread;
+		std::atomic<bool>				m_bEnd;
+
+		SSensor( const char* sName ) : m_Stats( sName ), m_bEnd( false )
+		{
+			static const SExtrinsics mIdentity = { { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, { 0, 0, 0 } };
+			m_Extrinsics = mIdentity;
+		}
+	};
+
+	SSensor* AddSensor()
+	{
+		static const char* s_aName[MAX_SENSORS] = { "Sensor 0", "Sensor 1", "Sensor 2", "Sensor 3", "Sensor 4", "Sensor 5", "Sensor 6", "Sensor 7" };
+		if( m_vSensor.size() == MAX_SENSORS )
+			return NULL;
+		m_vSensor.push_back( std::unique_ptr<SSensor>( new SSensor( s_aName[ m_vSensor.size() ] ) ) );
+		m_vSensor.back()->m_OpenNI.EnableImage( false );
+		return m_vSensor.back().get();
+	}
+
+	/* Torso of a user into rCenter, or the mean of its confident joints without a
+	 * confident torso. pWeight are the confidence sums of a merged user which isn't
+	 * divided yet. Return false if no joint is confident */
+	static bool Center( const CSkeletonSnapshot& rSkeleton, unsigned int iUser, int iTorso, XnPoint3D& rCenter, const float* pWeight = NULL )
+	{
+		unsigned int nJoints = rSkeleton.GetJointCount();
+		unsigned int iBase = iUser * nJoints;
+		bool bTorso = iTorso >= 0 && ( pWeight ? pWeight[ iTorso ] : rSkeleton.Confidence()[ iBase + iTorso ] ) > 0;
+		XnPoint3D mSum = { 0, 0, 0 };
+		float fSum = 0;
+		for( unsigned int j = 0; j < nJoints; ++ j )
+		{
+			if( bTorso && j != (unsigned int)iTorso )
+				continue;
+			float fWeight = pWeight ? pWeight[j] : rSkeleton.Confidence()[ iBase + j ];
+			if( fWeight <= 0 )
+				continue;
+			mSum.X += rSkeleton.X()[ iBase + j ];
+			mSum.Y += rSkeleton.Y()[ iBase + j ];
+			mSum.Z += rSkeleton.Z()[ iBase + j ];
+			fSum += pWeight ? pWeight[j] : 1;
+		}
+		if( fSum <= 0 )
+			return false;
+		rCenter.X = mSum.X / fSum;
+		rCenter.Y = mSum.Y / fSum;
+		rCenter.Z = mSum.Z / fSum;
+		return true;
+	}
+
+	/* Capture thread of one sensor */
+	void Capture( SSensor* pSensor )
+	{
+		COpenNI& rOpenNI = pSensor->m_OpenNI;
+		while( !m_bStop )
+		{
+			// a lost sensor ends its thread after a few retries
+			if( !rOpenNI.UpdateData( true ) )
+			{
+				if( !rOpenNI.RetryUpdate() )
+					break;
+				continue;
+			}
+
+			SSensorFrame& rFrame = pSensor->m_Frames.Back();
+			rFrame.m_Skeleton.Read( rOpenNI.GetUserGenerator() );
+			rFrame.m_nTimestamp = rOpenNI.m_DepthMD.Timestamp();
+
+			// into the world frame, in place
+			const SExtrinsics& rE = pSensor->m_Extrinsics;
+			CSkeletonSnapshot& rSkeleton = rFrame.m_Skeleton;
+			for( unsigned int i = 0; i < rSkeleton.GetUserCount() * rSkeleton.GetJointCount(); ++ i )
+			{
+				float fX = rSkeleton.X()[i], fY = rSkeleton.Y()[i], fZ = rSkeleton.Z()[i];
+				rSkeleton.X()[i] = rE.m_aRotation[0] * fX + rE.m_aRotation[1] * fY + rE.m_aRotation[2] * fZ + rE.m_aTranslation[0];
+				rSkeleton.Y()[i] = rE.m_aRotation[3] * fX + rE.m_aRotation[4] * fY + rE.m_aRotation[5] * fZ + rE.m_aTranslation[1];
+				rSkeleton.Z()[i] = rE.m_aRotation[6] * fX + rE.m_aRotation[7] * fY + rE.m_aRotation[8] * fZ + rE.m_aTranslation[2];
+			}
+			rFrame.m_nReadyTime = CFrameStats::Now();
+			pSensor->m_Frames.Publish();
+			pSensor->m_Stats.OnFrame( rOpenNI.m_DepthMD.FrameID(), rFrame.m_nReadyTime );
+		}
+		pSensor->m_bEnd = true;
+	}
+
+private:
+	std::vector< std::unique_ptr<SSensor> >	m_vSensor;
+	float									m_fMergeDistance;	// millimeters
+	XnUInt64								m_nStaleTime;		// microseconds
+	std::atomic<bool>						m_bStop;
+};
+
+#endif // SENSORARRAY_H
@@ -0,0 +1,449 @@
+#ifndef SENSORSOURCE_H
+#define SENSORSOURCE_H
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <XnCppWrapper.h>
+
+#include "rawframefile.h"
+#include "depthregistration.h"
+#include "captureprofile.h"
+#include "logger.h"
+
+/* Class for control OpenNI device.
+ *
+ * The data comes from a live sensor, an OpenNI .oni recording or a raw
+ * frame dump (see rawframefile.h). A recording goes through the same
+ * generators as a live sensor, so users are tracked on it too. A raw dump
+ * only fills m_DepthMD / m_ImageMD, it has no generators and
+ * HasUserGenerator() returns false.
+ *
+ * The depth is aligned to the image by the alternative view point of the
+ * depth generator, or with RegisterDepth() in software (see
+ * depthregistration.h), which also works on recordings and raw dumps.
+ *
+ * Every object has its own context, so several sensors opened with
+ * InitialDevice() can be updated on threads of their own. */
+class COpenNI
+{
+public:
+	enum ESource
+	{
+		SOURCE_LIVE,
+		SOURCE_RECORDING,
+		SOURCE_RAW
+	};
+
+	enum
+	{
+		MAX_UPDATE_ERRORS	= 10		// failed updates in a row before RetryUpdate() gives up
+	};
+
+	/* Constructor */
+	COpenNI() : m_eResult( XN_STATUS_OK ), m_eSource( SOURCE_LIVE ), m_bEndOfFile( false ), m_nUpdateErrors( 0 ), m_bImage( true ), m_bRegister( false ), m_pProfile( NULL )
+	{}
+
+	/* Destructor */
+	~COpenNI()
+	{
+		m_Context.Release();
+	}
+
+	/* Create the image node or not, call before Initial(). Skeletons only need depth */
+	void EnableImage( bool bImage )
+	{
+		m_bImage = bImage;
+	}
+
+	/* Resolution and frame rate of a sensor, see captureprofile.h. Recordings keep
+	 * theirs. Call before Initial() */
+	void SetProfile( const SCaptureProfile* pProfile )
+	{
+		m_pProfile = pProfile;
+	}
+
+	/* Align the depth to the image in software instead of by the sensor, with the calibration
+	 * in sCalibration or a typical Kinect for NULL. Users and skeletons stay in the view of
+	 * the depth camera. Call before Initial() */
+	bool RegisterDepth( const char* sCalibration = NULL )
+	{
+		if( sCalibration != NULL && !m_Registration.Load( sCalibration ) )
+		{
+			std::cerr << "Can't read the calibration " << sCalibration << std::endl;
+			return false;
+		}
+		m_bRegister = true;
+		return true;
+	}
+
+	/* Initial OpenNI context and create nodes. */
+	bool Initial()
+	{
+		m_eSource = SOURCE_LIVE;
+
+		// Initial OpenNI Context
+		m_eResult = m_Context.Init();
+		if( CheckError( "Context Initial failed" ) )
+			return false;
+
+		m_eResult = m_Context.SetGlobalMirror( true );
+		if( CheckError( "Set Global Mirror Error" ) )
+			return false;
+
+		return CreateNodes();
+	}
+
+	/* Initial OpenNI context and create nodes on the iDevice-th of the connected sensors */
+	bool InitialDevice( unsigned int iDevice )
+	{
+		m_eSource = SOURCE_LIVE;
+
+		m_eResult = m_Context.Init();
+		if( CheckError( "Context Initial failed" ) )
+			return false;
+
+		m_eResult = m_Context.SetGlobalMirror( true );
+		if( CheckError( "Set Global Mirror Error" ) )
+			return false;
+
+		// the production trees are listed in the same order by every context
+		xn::NodeInfoList mList;
+		m_eResult = m_Context.EnumerateProductionTrees( XN_NODE_TYPE_DEVICE, NULL, mList );
+		if( CheckError( "Enumerate Devices Error" ) )
+			return false;
+		unsigned int i = 0;
+		for( xn::NodeInfoList::Iterator it = mList.Begin(); it != mList.End(); ++ it, ++ i )
+		{
+			if( i != iDevice )
+				continue;
+			xn::NodeInfo mInfo = *it;
+			m_eResult = m_Context.CreateProductionTree( mInfo, m_Device );
+			if( CheckError( "Create Device Error" ) )
+				return false;
+			return CreateNodes( m_Device.GetName() );
+		}
+		std::cerr << "No sensor " << iDevice << ", " << i << " connected" << std::endl;
+		return false;
+	}
+
+	/* Number of connected sensors */
+	static unsigned int CountDevices()
+	{
+		xn::Context mContext;
+		if( mContext.Init() != XN_STATUS_OK )
+			return 0;
+		xn::NodeInfoList mList;
+		unsigned int nDevices = 0;
+		if( mContext.EnumerateProductionTrees( XN_NODE_TYPE_DEVICE, NULL, mList ) == XN_STATUS_OK )
+		{
+			for( xn::NodeInfoList::Iterator it = mList.Begin(); it != mList.End(); ++ it )
+				++nDevices;
+		}
+		mContext.Release();
+		return nDevices;
+	}
+
+	/* Initial from a file, ".raw" is a raw frame dump, anything else an OpenNI recording */
+	bool Initial( const char* sFile )
+	{
+		if( CRawFrameReader::IsRawFile( sFile ) )
+		{
+			m_eSource = SOURCE_RAW;
+			if( !m_RawReader.Open( sFile ) )
+			{
+				std::cerr << "Can't open raw frame file " << sFile << std::endl;
+				return false;
+			}
+
+			// the dumps are written from the mirrored frames of this class
+			m_Registration.SetMirrored( true );
+			return true;
+		}
+
+		m_eSource = SOURCE_RECORDING;
+
+		// Initial OpenNI Context
+		m_eResult = m_Context.Init();
+		if( CheckError( "Context Initial failed" ) )
+			return false;
+
+		// the recording creates its own depth / image nodes, which the generators below pick up
+		m_eResult = m_Context.OpenFileRecording( sFile, m_Player );
+		if( CheckError( "Open Recording Error" ) )
+			return false;
+		m_Player.SetRepeat( FALSE );
+
+		return CreateNodes();
+	}
+
+	/* Replay a recording as fast as possible instead of at the recorded frame rate */
+	bool SetPlaybackFastest()
+	{
+		if( m_eSource != SOURCE_RECORDING )
+			return true;
+		m_eResult = m_Player.SetPlaybackSpeed( XN_PLAYBACK_SPEED_FASTEST );
+		return !CheckError( "Set Playback Speed" );
+	}
+
+	/* Start to get the data from device */
+	bool Start()
+	{
+		if( m_eSource == SOURCE_RAW )
+			return true;
+		m_eResult = m_Context.StartGeneratingAll();
+		return !CheckError( "Start Generating" );
+	}
+
+	/* Update / Get new data, block until the depth node has new data if bWait */
+	bool UpdateData( bool bWait = false )
+	{
+		if( m_eSource == SOURCE_RAW )
+		{
+			if( !m_RawReader.Read( m_DepthMD, m_ImageMD ) )
+				m_bEndOfFile = true;
+			else if( m_bRegister )
+				RegisterData();
+			return !m_bEndOfFile;
+		}
+		if( m_eSource == SOURCE_RECORDING && m_Player.IsEOF() )
+		{
+			m_bEndOfFile = true;
+			return false;
+		}
+
+		// update
+		m_eResult = bWait ? m_Context.WaitOneUpdateAll( m_Depth ) : m_Context.WaitNoneUpdateAll();
+		if( CheckError( "Update Data" ) )
+		{
+			++m_nUpdateErrors;
+			return false;
+		}
+		m_nUpdateErrors = 0;
+
+		// get new data
+		m_Depth.GetMetaData( m_DepthMD );
+		if( m_bImage )
+			m_Image.GetMetaData( m_ImageMD );
+		if( m_bRegister )
+			RegisterData();
+
+		return true;
+	}
+
+	/* After UpdateData() failed: return false if the source won't deliver again, at
+	 * the end of a file or after MAX_UPDATE_ERRORS failures in a row. Else wait a
+	 * little longer each time, an unplugged sensor fails at once and would spin */
+	bool RetryUpdate()
+	{
+		if( m_bEndOfFile )
+			return false;
+		if( m_nUpdateErrors >= MAX_UPDATE_ERRORS )
+		{
+			std::cerr << "Giving up after " << m_nUpdateErrors << " failed updates" << std::endl;
+			return false;
+		}
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 * m_nUpdateErrors ) );
+		return true;
+	}
+
+	/* Check if a recording or a raw dump has no more frames */
+	bool IsEndOfFile() const
+	{
+		return m_bEndOfFile;
+	}
+
+	/* Get where the data comes from */
+	ESource GetSource() const
+	{
+		return m_eSource;
+	}
+
+	/* Check if the depth is aligned to the image in software, away from the view of
+	 * the users and skeletons */
+	bool IsDepthRegistered() const
+	{
+		return m_bRegister;
+	}
+
+	/* Check if users and skeletons can be tracked on this source */
+	bool HasUserGenerator() const
+	{
+		return m_eSource != SOURCE_RAW;
+	}
+
+	/* Get the field of view of the depth map */
+	bool GetFieldOfView( XnFieldOfView& rFOV )
+	{
+		if( m_eSource == SOURCE_RAW )
+		{
+			rFOV = m_RawReader.GetHeader().m_FOV;
+			return true;
+		}
+		m_eResult = m_Depth.GetFieldOfView( rFOV );
+		return !CheckError( "Get Field Of View" );
+	}
+
+	/* Frames per second of the depth, 0 if unknown */
+	XnUInt32 GetFPS()
+	{
+		if( m_eSource == SOURCE_RAW )
+			return 0;
+		XnMapOutputMode mMode;
+		m_eResult = m_Depth.GetMapOutputMode( mMode );
+		return CheckError( "Get Map Output Mode" ) ? 0 : mMode.nFPS;
+	}
+
+	/* Get User generator */
+	xn::UserGenerator& GetUserGenerator()
+	{
+		return m_User;
+	}
+
+	/* Get Depth generator */
+	xn::DepthGenerator& GetDepthGenerator()
+	{
+		return m_Depth;
+	}
+
+public:
+	xn::DepthMetaData		m_DepthMD;
+	xn::ImageMetaData		m_ImageMD;
+
+private:
+	/* Create the generators and register the user tracking callbacks.
+	 * With sDevice the image and depth come from that device node, else from any */
+	bool CreateNodes( const XnChar* sDevice = NULL )
+	{
+		xn::Query mDeviceQuery;
+		if( sDevice != NULL )
+			mDeviceQuery.AddNeededNode( sDevice );
+
+		// create image node
+		if( m_bImage )
+		{
+			m_eResult = m_Image.Create( m_Context, sDevice ? &mDeviceQuery : NULL );
+			if( CheckError( "Create Image Generator Error" ) )
+				return false;
+		}
+
+		// create depth node
+		m_eResult = m_Depth.Create( m_Context, sDevice ? &mDeviceQuery : NULL );
+		if( CheckError( "Create Depth Generator Error" ) )
+			return false;
+
+		// live by the global mirror, a recording as it was recorded
+		m_Registration.SetMirrored( !m_Depth.IsCapabilitySupported( XN_CAPABILITY_MIRROR ) || m_Depth.GetMirrorCap().IsMirrored() );
+
+		// a recording has the modes it was recorded with
+		if( m_pProfile != NULL && m_eSource == SOURCE_LIVE )
+		{
+			XnMapOutputMode mMode;
+			m_eResult = m_pProfile->Apply( m_Depth, mMode );
+			if( CheckError( "Set Depth Output Mode Error" ) )
+				return false;
+			if( m_bImage )
+			{
+				m_eResult = m_pProfile->Apply( m_Image, mMode );
+				if( CheckError( "Set Image Output Mode Error" ) )
+					return false;
+			}
+		}
+
+		// create user node, on this depth
+		xn::Query mDepthQuery;
+		mDepthQuery.AddNeededNode( m_Depth.GetName() );
+		m_eResult = m_User.Create( m_Context, &mDepthQuery );
+		if( CheckError( "Create User Generator Error" ) )
+			return false;
+
+		// set nodes, software registration replaces the one of the sensor
+		if( m_bImage && !m_bRegister )
+		{
+			m_eResult = m_Depth.GetAlternativeViewPointCap().SetViewPoint( m_Image );
+			CheckError( "Can't set the alternative view point on depth generator" );
+		}
+
+		XnCallbackHandle hUserCB;
+		m_User.RegisterUserCallbacks( CB_NewUser, NULL, NULL, hUserCB );
+
+		m_User.GetSkeletonCap().SetSkeletonProfile( XN_SKEL_PROFILE_ALL );
+		//m_User.GetSkeletonCap().SetSkeletonProfile( XN_SKEL_PROFILE_UPPER );
+		XnCallbackHandle hCalibCB;
+		m_User.GetSkeletonCap().RegisterToCalibrationComplete( CB_CalibrationComplete, &m_User, hCalibCB );
+
+		XnCallbackHandle hPoseCB;
+		m_User.GetPoseDetectionCap().RegisterToPoseDetected( CB_PoseDetected, &m_User, hPoseCB );
+
+		return true;
+	}
+
+	/* Align m_DepthMD to the image, to the depth resolution without image */
+	void RegisterData()
+	{
+		bool bImage = m_ImageMD.XRes() > 0 && m_ImageMD.YRes() > 0;
+		m_Registration.Register( m_DepthMD, bImage ? m_ImageMD.XRes() : m_DepthMD.XRes(), bImage ? m_ImageMD.YRes() : m_DepthMD.YRes() );
+	}
+
+	/* Check return status m_eResult.
+	 * return false if the value is XN_STATUS_OK, true for error */
+	bool CheckError( const char* sError )
+	{
+		if( m_eResult != XN_STATUS_OK )
+		{
+			std::cerr << sError << ": " << xnGetStatusString( m_eResult ) << std::endl;
+			return true;
+		}
+		return false;
+	}
+
+private:
+	static void XN_CALLBACK_TYPE CB_NewUser( xn::UserGenerator& generator, XnUserID user, void* pCookie )
+	{
+		(void)pCookie;
+		CLogger::Get().Log( "New user identified: %u", user );
+		generator.GetPoseDetectionCap().StartPoseDetection( "Psi", user );
+	}
+
+	static void XN_CALLBACK_TYPE CB_CalibrationComplete( xn::SkeletonCapability& skeleton, XnUserID user, XnCalibrationStatus calibrationError, void* pCookie )
+	{
+		CLogger::Get().Log( "Calibration complete for user %u, %s", user, calibrationError == XN_CALIBRATION_STATUS_OK ? "Success" : "Failure" );
+		if( calibrationError == XN_CALIBRATION_STATUS_OK )
+		{
+			skeleton.StartTracking( user );
+		}
+		else
+		{
+			xn::UserGenerator* pUser = (xn::UserGenerator*)pCookie;
+			pUser->GetPoseDetectionCap().StartPoseDetection( "Psi", user );
+		}
+	}
+
+	static void XN_CALLBACK_TYPE CB_PoseDetected( xn::PoseDetectionCapability& poseDetection, const XnChar* strPose, XnUserID user, void* pCookie )
+	{
+		CLogger::Get().Log( "Pose %s detected for user %u", strPose, user );
+		xn::UserGenerator* pUser = (xn::UserGenerator*)pCookie;
+		pUser->GetSkeletonCap().RequestCalibration( user, FALSE );
+		poseDetection.StopPoseDetection( user );
+	}
+
+private:
+	XnStatus			m_eResult;
+	ESource				m_eSource;
+	bool				m_bEndOfFile;
+	unsigned int		m_nUpdateErrors;	// failed updates in a row
+	bool				m_bImage;
+	bool				m_bRegister;
+	const SCaptureProfile*	m_pProfile;
+	xn::Context			m_Context;
+	xn::Player			m_Player;
+	xn::Device			m_Device;
+	xn::DepthGenerator	m_Depth;
+	xn::ImageGenerator	m_Image;
+	xn::UserGenerator	m_User;
+	CRawFrameReader		m_RawReader;
+	CDepthRegistration	m_Registration;
+};
+
+#endif // SENSORSOURCE_H
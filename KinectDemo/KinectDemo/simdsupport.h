@@ -0,0 +1,121 @@
+#ifndef SIMDSUPPORT_H
+#define SIMDSUPPORT_H
+
+/* Compile-time and run-time detection of the x86 SIMD instruction sets
+ * used by the pixel kernels. Kernels are always compiled, and the caller
+ * picks one at run time with CSimdSupport, so a single binary runs on
+ * every machine and still uses AVX2 where it exists. */
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+	#define SIMD_X86 1
+#else
+	#define SIMD_X86 0
+#endif
+
+#if SIMD_X86
+	#include <emmintrin.h>
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#else
+		#include <cpuid.h>
+	#endif
+#endif
+
+// GCC and Clang only emit AVX2 code inside functions that ask for it
+#if SIMD_X86 && defined(__GNUC__)
+	#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+	#define SIMD_TARGET_AVX2
+#endif
+
+/* Kernel selection shared by all SIMD stages */
+enum ESimdLevel
+{
+	SIMD_SCALAR = 0,
+	SIMD_SSE2,
+	SIMD_AVX2
+};
+
+/* Query which SIMD level the running CPU and OS support */
+class CSimdSupport
+{
+public:
+	/* Highest level usable on this machine, detected once */
+	static ESimdLevel Best()
+	{
+		static const ESimdLevel eLevel = Detect();
+		return eLevel;
+	}
+
+	/* Check if a level can be used on this machine */
+	static bool IsSupported( ESimdLevel eLevel )
+	{
+		return eLevel <= Best();
+	}
+
+	/* Readable name, for logs and benchmarks */
+	static const char* Name( ESimdLevel eLevel )
+	{
+		switch( eLevel )
+		{
+		case SIMD_AVX2:	return "AVX2";
+		case SIMD_SSE2:	return "SSE2";
+		default:		return "Scalar";
+		}
+	}
+
+private:
+	static ESimdLevel Detect()
+	{
+#if SIMD_X86
+		unsigned int aReg[4] = { 0, 0, 0, 0 };
+		CpuId( 0, aReg );
+		unsigned int nMaxLeaf = aReg[0];
+
+		CpuId( 1, aReg );
+		if( ( aReg[3] & ( 1u << 26 ) ) == 0 )
+			return SIMD_SCALAR;
+
+		// AVX2 needs the CPU flag and the OS saving the YMM registers
+		bool bOSXSave = ( aReg[2] & ( 1u << 27 ) ) != 0;
+		bool bAVX = ( aReg[2] & ( 1u << 28 ) ) != 0;
+		if( nMaxLeaf >= 7 && bOSXSave && bAVX && ( XGetBV() & 0x6 ) == 0x6 )
+		{
+			CpuId( 7, aReg );
+			if( aReg[1] & ( 1u << 5 ) )
+				return SIMD_AVX2;
+		}
+		return SIMD_SSE2;
+#else
+		return SIMD_SCALAR;
+#endif
+	}
+
+#if SIMD_X86
+	static void CpuId( unsigned int nLeaf, unsigned int aReg[4] )
+	{
+	#if defined(_MSC_VER)
+		int aInfo[4];
+		__cpuidex( aInfo, (int)nLeaf, 0 );
+		for( int i = 0; i < 4; ++ i )
+			aReg[i] = (unsigned int)aInfo[i];
+	#else
+		__cpuid_count( nLeaf, 0, aReg[0], aReg[1], aReg[2], aReg[3] );
+	#endif
+	}
+
+	static unsigned long long XGetBV()
+	{
+	#if defined(_MSC_VER)
+		return _xgetbv( 0 );
+	#else
+		unsigned int nLow, nHigh;
+		__asm__ __volatile__( "xgetbv" : "=a"( nLow ), "=d"( nHigh ) : "c"( 0 ) );
+		return ( (unsigned long long)nHigh << 32 ) | nLow;
+	#endif
+	}
+#endif
+};
+
+#endif // SIMDSUPPORT_H
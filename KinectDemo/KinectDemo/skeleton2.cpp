@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -7,6 +8,12 @@
 #include "opencv/cv.h"
 #include "opencv/highgui.h"
 
+#include "framestats.h"
+#include "frameadapter.h"
+#include "skeletonsnapshot.h"
+#include "logger.h"
+#include "captureprofile.h"
+
 using namespace std;
 using namespace cv;
 
@@ -21,7 +28,7 @@ void XN_CALLBACK_TYPE NewUser( xn::UserGenerator& generator,
 	XnUserID user,
 	void* pCookie )
 {
-	cout << "New user identified: " << user << endl;
+	CLogger::Get().Log( "New user identified: %u", user );
 	generator.GetSkeletonCap().RequestCalibration( user, true );
 }
 
@@ -31,29 +38,25 @@ void XN_CALLBACK_TYPE CalibrationEnd( xn::SkeletonCapability& skeleton,
 	XnCalibrationStatus eStatus,
 	void* pCookie )
 {
-	cout << "Calibration complete for user " <<  user << ", ";
+	CLogger::Get().Log( "Calibration complete for user %u, %s", user, eStatus == XN_CALIBRATION_STATUS_OK ? "Success" : "Failure" );
 	if( eStatus == XN_CALIBRATION_STATUS_OK )
 	{
-		cout << "Success" << endl;
 		skeleton.StartTracking( user );
 	}
 	else
 	{
-		cout << "Failure" << endl;
 		skeleton.RequestCalibration( user, true );
 	}
 }
 
 void XN_CALLBACK_TYPE LostUser(xn::UserGenerator &generator, XnUserID user, void *pCookie)
 {
-	cout << "User " << user << " lost" << endl;
+	CLogger::Get().Log("User %u lost", user);
 }
 
-void clearImg(IplImage *inputImg)
+void clearImg(Mat &inputImg)
 {
-	CvFont font;
-	cvInitFont(&font, CV_FONT_VECTOR0, 1, 1, 0, 3, 5);
-	memset(inputImg->imageData, 255, 640 * 480 * 3);
+	inputImg.setTo(Scalar(255, 255, 255));
 }
 
 
@@ -61,29 +64,55 @@ int main( int argc, char** argv )
 {
 	XnStatus result = XN_STATUS_OK;
 
-	// 1. initial context
+	// 1. initial context, "skeleton2 file.oni" replays a recording instead of the sensor,
+	// "skeleton2 -profile qvga60|vga30|sxga15" picks the sensor mode
 	xn::Context mContext;
 	result = mContext.Init();
 	CheckOpenNIError(result, "initialize context");
 
-	mContext.SetGlobalMirror(true);
+	xn::Player mPlayer;	// keeps the recording alive
+	const SCaptureProfile* pProfile = SCaptureProfile::Find( "vga30" );
+	for( int i = 1; i < argc; ++ i )
+	{
+		if( strcmp( argv[i], "-profile" ) == 0 && i + 1 < argc )
+		{
+			pProfile = SCaptureProfile::Find( argv[++i] );
+			if( pProfile == NULL )
+			{
+				cerr << "Unknown profile " << argv[i] << endl;
+				return 1;
+			}
+		}
+		else
+		{
+			result = mContext.OpenFileRecording( argv[i], mPlayer );
+			CheckOpenNIError(result, "open recording");
+		}
+	}
+	if( !mPlayer.IsValid() )
+		mContext.SetGlobalMirror(true);
 
 	xn::ImageMetaData imageMD;
-	IplImage *cameraImg = cvCreateImage(cvSize(640, 480), IPL_DEPTH_8U, 3);
+	CFrameAdapter adapter;
+	Mat cameraImg;	// sized from the meta data by the adapter
 	cvNamedWindow("Camera", 1);
 
-	XnMapOutputMode mapMode;
-	mapMode.nXRes = 640;
-	mapMode.nYRes = 480;
-	mapMode.nFPS = 30;
-
 	xn::DepthGenerator mDepthGenerator;
 	mDepthGenerator.Create(mContext);
-	mDepthGenerator.SetMapOutputMode(mapMode);
 
 	xn::ImageGenerator mImageGenerator;
 	mImageGenerator.Create(mContext);
 
+	// the nearest modes the sensor has, a recording keeps its modes
+	if( !mPlayer.IsValid() )
+	{
+		XnMapOutputMode mDepthMode, mImageMode;
+		result = pProfile->Apply( mDepthGenerator, mDepthMode );
+		CheckOpenNIError(result, "Set depth mode");
+		result = pProfile->Apply( mImageGenerator, mImageMode );
+		CheckOpenNIError(result, "Set image mode");
+	}
+
 	// 2. create user generator
 	xn::UserGenerator mUserGenerator;
 	result = mUserGenerator.Create( mContext );
@@ -101,60 +130,61 @@ int main( int argc, char** argv )
 	XnCallbackHandle hCalibCB;
 	mSC.RegisterToCalibrationComplete( CalibrationEnd, &mUserGenerator, hCalibCB );
 
+	// only the right hand is drawn
+	const XnSkeletonJoint eHand = XN_SKEL_RIGHT_HAND;
+	CSkeletonSnapshot skeleton;
+	skeleton.SetJoints( &eHand, 1 );
+
 
 	// 5. start generate data
 	mContext.StartGeneratingAll();
-	while( true )
+	XnMapOutputMode mDepthMode;
+	mDepthGenerator.GetMapOutputMode( mDepthMode );
+	CFrameStats depthStats( "Depth" );
+	char key = 0;
+	while( key != 27 )
 	{
-		// 6. Update date
-		mContext.WaitAndUpdateAll();
+		// 6. Update date, block until the depth generator has a new frame;
+		// an unplugged sensor or the end of the recording doesn't come back
+		result = mContext.WaitOneUpdateAll( mDepthGenerator );
+		if( result != XN_STATUS_OK )
+		{
+			CheckOpenNIError(result, "update");
+			break;
+		}
+		XnUInt64 nReadyTime = CFrameStats::Now();
 
 		mImageGenerator.GetMetaData(imageMD);
-		memcpy(cameraImg->imageData, imageMD.Data(), 640 * 480 * 3);
-		cvCvtColor(cameraImg, cameraImg, CV_RGB2BGR);
+		adapter.ToBGR(imageMD, cameraImg);
 
-		// 7. get user information
-		XnUInt16 nUsers = mUserGenerator.GetNumberOfUsers();
-		if( nUsers > 0 )
-		{
-			// 8. get users
-			XnUserID* aUserID = new XnUserID[nUsers];
-			mUserGenerator.GetUsers( aUserID, nUsers );
+		// 7. get the right hand of all tracked users, projected in one call
+		skeleton.Update( mUserGenerator, mDepthGenerator );
 
-			// 9. check each user
-			for( int i = 0; i < nUsers; ++i )
-			{
-				// 10. if is tracking skeleton
-				if( mSC.IsTracking( aUserID[i] ) )
-				{
-					// 11. get skeleton joint data
-					XnSkeletonJointTransformation mJointTran;
-					//mSC.GetSkeletonJoint( aUserID[i], XN_SKEL_HEAD, mJointTran);
-					mSC.GetSkeletonJoint( aUserID[i], XN_SKEL_RIGHT_HAND, mJointTran);
-
-					XnPoint3D skelPointIn, skelPointOut;
-					skelPointIn = mJointTran.position.position;
-
-					mDepthGenerator.ConvertRealWorldToProjective(1, &skelPointIn, &skelPointOut);
-					cvCircle(cameraImg, cvPoint(skelPointOut.X, skelPointOut.Y),
-						3, CV_RGB(0, 0, 255), 12);
-
-					#if 0
-// 12. output information
-					cout << "The head of user " << aUserID[i] << " is at (";
-					cout << mJointTran.position.position.X << ", ";
-					cout << mJointTran.position.position.Y << ", ";
-					cout << mJointTran.position.position.Z << ")" << endl;
+		// 8. check each user, the hand is in depth pixels and the image may have another size
+		float fScaleX = (float)cameraImg.cols / mDepthMode.nXRes;
+		float fScaleY = (float)cameraImg.rows / mDepthMode.nYRes;
+		for( unsigned int i = 0; i < skeleton.GetUserCount(); ++i )
+		{
+			XnPoint3D skelPointOut = skeleton.GetProjective( i )[0];
+			circle(cameraImg, Point(skelPointOut.X * fScaleX, skelPointOut.Y * fScaleY),
+				3, CV_RGB(0, 0, 255), 12);
+
+#if 0
+			// 9. output information
+			XnPoint3D skelPointIn = skeleton.GetRealWorld( i, 0 );
+			CLogger::Get().Log( "The hand of user %u is at (%g, %g, %g)", skeleton.GetUserID( i ), skelPointIn.X, skelPointIn.Y, skelPointIn.Z );
 #endif
-				}
-			}
-			delete [] aUserID;
-			cvShowImage("Camera", cameraImg);
-			cvWaitKey(20);
 		}
 
+		imshow("Camera", cameraImg);
+		depthStats.OnFrame( mDepthGenerator.GetFrameID(), nReadyTime );
+
+		// only handle window events, the sensor paces the loop
+		key = cvWaitKey(1);
 	}
-	// 13. stop and shutdown
+	depthStats.Report( cout );
+
+	// 10. stop and shutdown
 	mContext.StopGeneratingAll();
 	mContext.Release();
 
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 #include <vector>
 
@@ -8,6 +9,13 @@
 #include "opencv/cv.h"
 #include "opencv/highgui.h"
 
+#include "framestats.h"
+#include "frameadapter.h"
+#include "skeletonsnapshot.h"
+#include "skeletonstream.h"
+#include "logger.h"
+#include "captureprofile.h"
+
 using namespace std;
 using namespace cv;
 
@@ -20,32 +28,30 @@ int endSkelPoints[14] = {2, 3, 12, 21, 17, 21, 7, 9, 13, 15, 18, 20, 22, 24};
 
 void XN_CALLBACK_TYPE NewUser(xn::UserGenerator &generator, XnUserID user, void *pCookie)
 {
-	cout << "New user identified: " << user << endl;
+	CLogger::Get().Log("New user identified: %u", user);
 	generator.GetPoseDetectionCap().StartPoseDetection("Psi", user);
 }
 
 void XN_CALLBACK_TYPE LostUser(xn::UserGenerator &generator, XnUserID user, void *pCookie)
 {
-	cout << "User " << user << " lost" << endl;
+	CLogger::Get().Log("User %u lost", user);
 }
 
 void XN_CALLBACK_TYPE CalibrationStart(xn::SkeletonCapability &skeleton, XnUserID user, void *pCookie)
 {
-	cout << "Calibration start for user" << user << endl;
+	CLogger::Get().Log("Calibration start for user %u", user);
 }
 
 void XN_CALLBACK_TYPE CalibrationEnd(xn::SkeletonCapability &skeleton, XnUserID user, 
 			XnCalibrationStatus calibrationError, void *pCookie)
 {
-	cout << "Calibration complete for user" << user << ",";
+	CLogger::Get().Log("Calibration complete for user %u, %s", user, calibrationError == XN_CALIBRATION_STATUS_OK ? "Success" : "Failure");
 	if(calibrationError == XN_CALIBRATION_STATUS_OK)
 	{
-		cout << "Success" << endl;
 		skeleton.StartTracking(user);
 	}
 	else
 	{
-		cout << "Failure" << endl;
 		((xn::UserGenerator *)pCookie)->GetPoseDetectionCap().StartPoseDetection("Psi", user);
 	}
 }
@@ -53,20 +59,19 @@ void XN_CALLBACK_TYPE CalibrationEnd(xn::SkeletonCapability &skeleton, XnUserID
 void XN_CALLBACK_TYPE PoseDetected(xn::PoseDetectionCapability &poseDetection, 
 		const XnChar *strPose, XnUserID user, void *pCookie)
 {
-	cout << "Pose " << strPose << " detected for user" << user << endl;
+	CLogger::Get().Log("Pose %s detected for user %u", strPose, user);
 	((xn::UserGenerator *)pCookie)->GetSkeletonCap().RequestCalibration(user, FALSE);
 }
 
-void clearImg(IplImage *inputImg)
+void clearImg(Mat &inputImg)
 {
-	CvFont font;
-	cvInitFont(&font, CV_FONT_VECTOR0, 1, 1, 0, 3, 5);
-	memset(inputImg->imageData, 255, 640 * 480 * 3);
+	inputImg.setTo(Scalar(255, 255, 255));
 }
 
 int main(int argc, char *argv[])
 {
 	char key = 0;
+	CFrameStats depthStats("Depth");
 	int imgPosX = 0;
 	int imgPosY = 0;
 
@@ -74,18 +79,44 @@ int main(int argc, char *argv[])
 	context.Init();
 	xn::ImageMetaData imageMD;
 
-	IplImage *cameraImg = cvCreateImage(cvSize(640, 480), IPL_DEPTH_8U, 3);
+	// sized from the meta data by the adapter
+	CFrameAdapter adapter;
+	Mat cameraImg;
 	cvNamedWindow("Camera", 1);
 
-	XnMapOutputMode mapMode;
-	mapMode.nXRes = 640;
-	mapMode.nYRes = 480;
-	mapMode.nFPS = 30;
-
+	// "skeletondemo [file.skl] [-profile qvga60|vga30|sxga15]"
+	const char *skeletonFileName = NULL;
+	const SCaptureProfile *profile = SCaptureProfile::Find("vga30");
+	for(int i = 1; i < argc; ++i)
+	{
+		if(strcmp(argv[i], "-profile") == 0 && i + 1 < argc)
+		{
+			profile = SCaptureProfile::Find(argv[++i]);
+			if(profile == NULL)
+			{
+				cerr << "Unknown profile " << argv[i] << endl;
+				return 1;
+			}
+		}
+		else
+			skeletonFileName = argv[i];
+	}
 
 	depthGenerator.Create(context);
-	depthGenerator.SetMapOutputMode(mapMode);
 	imageGenerator.Create(context);
+
+	// the nearest modes the sensor has, depth and image may differ
+	// a mode which can't be set leaves the generator as it is, the scaling then uses that mode
+	XnMapOutputMode depthMode, imageMode;
+	XnStatus applyResult = profile->Apply(depthGenerator, depthMode);
+	if(applyResult != XN_STATUS_OK)
+	{
+		cerr << "Set depth mode: " << xnGetStatusString(applyResult) << endl;
+		depthGenerator.GetMapOutputMode(depthMode);
+	}
+	applyResult = profile->Apply(imageGenerator, imageMode);
+	if(applyResult != XN_STATUS_OK)
+		cerr << "Set image mode: " << xnGetStatusString(applyResult) << endl;
 	userGenerator.Create(context);
 
 	XnCallbackHandle userCBHandle;
@@ -100,59 +131,66 @@ int main(int argc, char *argv[])
 	XnCallbackHandle poseCBHandle;
 	userGenerator.GetPoseDetectionCap().RegisterToPoseDetected(PoseDetected, &userGenerator, poseCBHandle);
 
+	// read all 24 joints in OpenNI order, so startSkelPoints / endSkelPoints index them directly
+	XnSkeletonJoint allJoints[24];
+	for(int iter = 0; iter < 24; iter++)
+		allJoints[iter] = XnSkeletonJoint(iter + 1);
+	CSkeletonSnapshot skeleton;
+	skeleton.SetJoints(allJoints, 24);
+
+	// a file.skl argument also records the skeletons, read it back with CSkeletonStreamReader
+	CSkeletonStreamWriter skeletonFile;
+	if(skeletonFileName != NULL && !skeletonFile.Open(skeletonFileName, skeleton))
+		cerr << "Can't create " << skeletonFileName << endl;
+
 	context.StartGeneratingAll();
 	while(key != 27)
 	{
-		context.WaitAndUpdateAll();
+		// block until the depth generator has a new frame; an unplugged sensor doesn't come back
+		XnStatus result = context.WaitOneUpdateAll(depthGenerator);
+		if(result != XN_STATUS_OK)
+		{
+			cerr << "Update Error: " << xnGetStatusString(result) << endl;
+			break;
+		}
+		XnUInt64 nReadyTime = CFrameStats::Now();
 
 		imageGenerator.GetMetaData(imageMD);
-		memcpy(cameraImg->imageData, imageMD.Data(), 640 * 480 * 3);
-		cvCvtColor(cameraImg, cameraImg, CV_RGB2BGR);
-
-		XnUInt16 userCounts = userGenerator.GetNumberOfUsers();
-		if(userCounts > 0)
+		adapter.ToBGR(imageMD, cameraImg);
+
+		// read and project all tracked users at once
+		// the joints are in depth pixels, the image may have another size
+		skeleton.Update(userGenerator, depthGenerator);
+		float scaleX = (float)cameraImg.cols / depthMode.nXRes;
+		float scaleY = (float)cameraImg.rows / depthMode.nYRes;
+		for(unsigned int i = 0; i < skeleton.GetUserCount(); ++i)
 		{
-			XnUserID *userID = new XnUserID(userCounts);
-			userGenerator.GetUsers(userID, userCounts);
-			for(int i = 0; i <userCounts; ++i)
+			const XnPoint3D *skelPointsOut = skeleton.GetProjective(i);
+			for(int j = 0; j < 14; j++)
 			{
-				if(skeletonCap.IsTracking(userID[i]))
-				{
-					XnPoint3D skelPointsIn[24], skelPointsOut[24];
-					XnSkeletonJointTransformation mJointTram;
-					for(int iter = 0; iter < 24; iter++)
-					{
-						skeletonCap.GetSkeletonJoint(userID[i], XnSkeletonJoint(iter + 1), mJointTram);
-						skelPointsIn[iter] = mJointTram.position.position;
-					}
-					depthGenerator.ConvertRealWorldToProjective(24, skelPointsIn, skelPointsOut);
-				
-					for(int j = 0; j < 14; j++)
-					{
-						CvPoint startPoint = cvPoint(skelPointsOut[startSkelPoints[j] - 1].X,
-							skelPointsOut[startSkelPoints[j] - 1].Y);
-						CvPoint endPoint = cvPoint(skelPointsOut[endSkelPoints[j] - 1].X,
-							skelPointsOut[endSkelPoints[j] - 1].Y);
-
-						cvCircle(cameraImg, startPoint, 3, CV_RGB(0, 0, 255), 12);
-						cvCircle(cameraImg, endPoint, 3, CV_RGB(0, 0, 255), 12);
-						cvLine(cameraImg, startPoint, endPoint, CV_RGB(0, 0, 255), 4);
-					}
-							
-				
-				}
-
-								
+				Point startPoint(skelPointsOut[startSkelPoints[j] - 1].X * scaleX,
+					skelPointsOut[startSkelPoints[j] - 1].Y * scaleY);
+				Point endPoint(skelPointsOut[endSkelPoints[j] - 1].X * scaleX,
+					skelPointsOut[endSkelPoints[j] - 1].Y * scaleY);
+
+				circle(cameraImg, startPoint, 3, CV_RGB(0, 0, 255), 12);
+				circle(cameraImg, endPoint, 3, CV_RGB(0, 0, 255), 12);
+				line(cameraImg, startPoint, endPoint, CV_RGB(0, 0, 255), 4);
 			}
-
-			delete [] userID;
-			cvShowImage("Camera", cameraImg);
-			key = cvWaitKey(20);
 		}
+
+		skeletonFile.Write(depthGenerator.GetTimestamp(), depthGenerator.GetFrameID(), skeleton, NULL);
+
+		imshow("Camera", cameraImg);
+		depthStats.OnFrame(depthGenerator.GetFrameID(), nReadyTime);
+
+		// only handle window events, the sensor paces the loop
+		key = cvWaitKey(1);
 	}
+	depthStats.Report(cout);
+	skeletonFile.Close();
 
 	cvDestroyWindow("Camera");
-	cvReleaseImage(&cameraImg);
 	context.StopGeneratingAll();
 	context.Shutdown();
 
@@ -0,0 +1,237 @@
+#ifndef SKELETONSNAPSHOT_H
+#define SKELETONSNAPSHOT_H
+
+#include <math.h>
+
+#include <XnCppWrapper.h>
+
+/* Joints of every tracked user in one frame.
+ *
+ * Real world positions and confidences are kept as a structure of arrays,
+ * one float array per component, indexed [ iUser * GetJointCount() + iJoint ].
+ * All users are projected with a single ConvertRealWorldToProjective call.
+ * Update() is Read() and Project(), a filter can change the real world
+ * positions between the two.
+ * Storage is fixed at MAX_USERS x MAX_JOINTS, so Update() never allocates
+ * and a snapshot can be copied or kept in a frame buffer as it is. */
+class CSkeletonSnapshot
+{
+public:
+	enum
+	{
+		MAX_USERS	= 15,
+		MAX_JOINTS	= 24
+	};
+
+	/* Constructor, use the 15 joints of the full skeleton profile */
+	CSkeletonSnapshot() : m_nJoints( 0 ), m_nUsers( 0 )
+	{
+		static const XnSkeletonJoint aDefault[15] = {
+			XN_SKEL_HEAD, XN_SKEL_NECK, XN_SKEL_TORSO,
+			XN_SKEL_LEFT_SHOULDER, XN_SKEL_LEFT_ELBOW, XN_SKEL_LEFT_HAND,
+			XN_SKEL_RIGHT_SHOULDER, XN_SKEL_RIGHT_ELBOW, XN_SKEL_RIGHT_HAND,
+			XN_SKEL_LEFT_HIP, XN_SKEL_LEFT_KNEE, XN_SKEL_LEFT_FOOT,
+			XN_SKEL_RIGHT_HIP, XN_SKEL_RIGHT_KNEE, XN_SKEL_RIGHT_FOOT };
+		SetJoints( aDefault, 15 );
+	}
+
+	/* Select the joints to read, in this order. Return false if there are too many */
+	bool SetJoints( const XnSkeletonJoint* aJoint, unsigned int nJoints )
+	{
+		if( nJoints == 0 || nJoints > MAX_JOINTS )
+			return false;
+		for( unsigned int i = 0; i < nJoints; ++ i )
+			m_aJointName[i] = aJoint[i];
+		m_nJoints = nJoints;
+		m_nUsers = 0;
+		return true;
+	}
+
+	/* Read all joints of all tracked users and project them */
+	XnStatus Update( xn::UserGenerator& rUser, xn::DepthGenerator& rDepth )
+	{
+		XnStatus eResult = Read( rUser );
+		if( eResult != XN_STATUS_OK )
+			return eResult;
+		return Project( rDepth );
+	}
+
+	/* Read all joints of all tracked users, without projection */
+	XnStatus Read( xn::UserGenerator& rUser )
+	{
+		m_nUsers = 0;
+
+		XnUserID aUserID[MAX_USERS];
+		XnUInt16 nUsers = MAX_USERS;
+		XnStatus eResult = rUser.GetUsers( aUserID, nUsers );
+		if( eResult != XN_STATUS_OK )
+			return eResult;
+
+		xn::SkeletonCapability mSC = rUser.GetSkeletonCap();
+		for( XnUInt16 i = 0; i < nUsers; ++ i )
+		{
+			// if is tracking skeleton
+			if( !mSC.IsTracking( aUserID[i] ) )
+				continue;
+
+			unsigned int iBase = m_nUsers * m_nJoints;
+			m_aUserID[ m_nUsers++ ] = aUserID[i];
+			for( unsigned int j = 0; j < m_nJoints; ++ j )
+			{
+				// joints the tracker doesn't support stay at zero confidence
+				XnSkeletonJointPosition mPos = { { 0, 0, 0 }, 0 };
+				mSC.GetSkeletonJointPosition( aUserID[i], m_aJointName[j], mPos );
+
+				m_aX[ iBase + j ] = mPos.position.X;
+				m_aY[ iBase + j ] = mPos.position.Y;
+				m_aZ[ iBase + j ] = mPos.position.Z;
+				m_aConfidence[ iBase + j ] = mPos.fConfidence;
+			}
+		}
+
+		return XN_STATUS_OK;
+	}
+
+	/* Remove all users, to fill the snapshot with AddUser() */
+	void Clear()
+	{
+		m_nUsers = 0;
+	}
+
+	/* Add a user with all joints at zero confidence, return its index or -1 when full */
+	int AddUser( XnUserID uid )
+	{
+		if( m_nUsers == MAX_USERS )
+			return -1;
+		unsigned int iBase = m_nUsers * m_nJoints;
+		for( unsigned int j = 0; j < m_nJoints; ++ j )
+			m_aX[ iBase + j ] = m_aY[ iBase + j ] = m_aZ[ iBase + j ] = m_aConfidence[ iBase + j ] = 0;
+		m_aUserID[ m_nUsers ] = uid;
+		return (int)m_nUsers++;
+	}
+
+	/* Project the real world positions, all users at once */
+	XnStatus Project( xn::DepthGenerator& rDepth )
+	{
+		unsigned int nPoints = m_nUsers * m_nJoints;
+		if( nPoints == 0 )
+			return XN_STATUS_OK;
+		for( unsigned int i = 0; i < nPoints; ++ i )
+		{
+			m_aReal[i].X = m_aX[i];
+			m_aReal[i].Y = m_aY[i];
+			m_aReal[i].Z = m_aZ[i];
+		}
+		return rDepth.ConvertRealWorldToProjective( nPoints, m_aReal, m_aProjective );
+	}
+
+	/* Project with the field of view of a depth map of iXRes x iYRes, the same math
+	 * as OpenNI without the generator, so any thread can call it */
+	void Project( const XnFieldOfView& rFOV, unsigned int iXRes, unsigned int iYRes )
+	{
+		float fX = (float)( iXRes / ( 2 * tan( rFOV.fHFOV / 2 ) ) );
+		float fY = (float)( iYRes / ( 2 * tan( rFOV.fVFOV / 2 ) ) );
+		for( unsigned int i = 0; i < m_nUsers * m_nJoints; ++ i )
+		{
+			XnPoint3D& rPoint = m_aProjective[i];
+			rPoint.Z = m_aZ[i];
+			if( m_aZ[i] == 0 )
+			{
+				rPoint.X = rPoint.Y = 0;
+				continue;
+			}
+			rPoint.X = iXRes * 0.5f + fX * m_aX[i] / m_aZ[i];
+			rPoint.Y = iYRes * 0.5f - fY * m_aY[i] / m_aZ[i];
+		}
+	}
+
+	/* Number of tracked users */
+	unsigned int GetUserCount() const
+	{
+		return m_nUsers;
+	}
+
+	/* Number of joints per user */
+	unsigned int GetJointCount() const
+	{
+		return m_nJoints;
+	}
+
+	/* OpenNI id of a tracked user */
+	XnUserID GetUserID( unsigned int iUser ) const
+	{
+		return m_aUserID[ iUser ];
+	}
+
+	/* OpenNI name of a joint */
+	XnSkeletonJoint GetJointName( unsigned int iJoint ) const
+	{
+		return m_aJointName[ iJoint ];
+	}
+
+	/* Index of an OpenNI joint, -1 if it is not read */
+	int FindJoint( XnSkeletonJoint eJoint ) const
+	{
+		for( unsigned int i = 0; i < m_nJoints; ++ i )
+		{
+			if( m_aJointName[i] == eJoint )
+				return (int)i;
+		}
+		return -1;
+	}
+
+	/* Index of the user in this snapshot, -1 if the user is not tracked */
+	int FindUser( XnUserID uid ) const
+	{
+		for( unsigned int i = 0; i < m_nUsers; ++ i )
+		{
+			if( m_aUserID[i] == uid )
+				return (int)i;
+		}
+		return -1;
+	}
+
+	/* Real world components, GetUserCount() * GetJointCount() values each */
+	const XnFloat* X() const			{ return m_aX; }
+	const XnFloat* Y() const			{ return m_aY; }
+	const XnFloat* Z() const			{ return m_aZ; }
+	const XnFloat* Confidence() const	{ return m_aConfidence; }
+
+	/* Writable real world components, for filters between Read() and Project() */
+	XnFloat* X()			{ return m_aX; }
+	XnFloat* Y()			{ return m_aY; }
+	XnFloat* Z()			{ return m_aZ; }
+	XnFloat* Confidence()	{ return m_aConfidence; }
+
+	/* Real world position of one joint */
+	XnPoint3D GetRealWorld( unsigned int iUser, unsigned int iJoint ) const
+	{
+		unsigned int i = iUser * m_nJoints + iJoint;
+		XnPoint3D mPoint = { m_aX[i], m_aY[i], m_aZ[i] };
+		return mPoint;
+	}
+
+	/* Projective positions of all joints of one user */
+	const XnPoint3D* GetProjective( unsigned int iUser ) const
+	{
+		return m_aProjective + iUser * m_nJoints;
+	}
+
+private:
+	XnSkeletonJoint	m_aJointName[MAX_JOINTS];
+	unsigned int	m_nJoints;
+	unsigned int	m_nUsers;
+	XnUserID		m_aUserID[MAX_USERS];
+
+	// structure of arrays
+	XnFloat			m_aX[MAX_USERS * MAX_JOINTS];
+	XnFloat			m_aY[MAX_USERS * MAX_JOINTS];
+	XnFloat			m_aZ[MAX_USERS * MAX_JOINTS];
+	XnFloat			m_aConfidence[MAX_USERS * MAX_JOINTS];
+
+	// input and output of the batched projection
+	XnPoint3D		m_aReal[MAX_USERS * MAX_JOINTS];
+	XnPoint3D		m_aProjective[MAX_USERS * MAX_JOINTS];
+};
+
+#endif // SKELETONSNAPSHOT_H
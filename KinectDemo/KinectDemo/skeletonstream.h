@@ -0,0 +1,526 @@
+#ifndef SKELETONSTREAM_H
+#define SKELETONSTREAM_H
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "skeletonsnapshot.h"
+#include "mappedfile.h"
+
+/* Binary skeleton stream, version 2.
+ *
+ * SSkeletonStreamHeader, the frames, then the seek index. Every frame is
+ *     varint payload size, payload
+ * and the payload is
+ *     XnUInt8 flags ( FRAME_KEY )
+ *     varint timestamp ( us ), varint frame id
+ *     varint user count
+ *     per user: varint user id, XnUInt8 action | USER_DELTA
+ *     per joint: zigzag varint X, Y, Z in mm, XnUInt8 confidence * 255
+ * Outside key frames the timestamp and the frame id are differences to the
+ * previous frame, and so are the joints of users who were in the previous
+ * frame ( USER_DELTA ). A steady user costs about one byte per coordinate.
+ *
+ * A key frame codes everything absolute. One is written every KEY_INTERVAL
+ * frames and listed in the index with its timestamp and offset, so a
+ * reader can start decoding there. The index and the counts in the header
+ * are written by Close(), a file that was not closed is still readable
+ * from the start. Values are stored in host byte order. */
+struct SSkeletonStreamHeader
+{
+	char		m_aMagic[4];		// "KDSK"
+	XnUInt32	m_nVersion;
+	XnUInt32	m_nJoints;
+	XnUInt32	m_nKeyFrames;		// entries in the index
+	XnUInt64	m_nIndexOffset;		// 0 if the file was not closed
+	XnUInt64	m_nFrames;
+	XnUInt32	m_aJoint[CSkeletonSnapshot::MAX_JOINTS];
+};
+
+struct SSkeletonStreamIndex
+{
+	XnUInt64	m_nTimestamp;
+	XnUInt64	m_nOffset;			// of the frame size
+};
+
+enum { SKELETON_STREAM_VERSION = 2 };
+
+/* One frame of the stream, positions in mm */
+struct SSkeletonFrame
+{
+	enum
+	{
+		MAX_USERS	= CSkeletonSnapshot::MAX_USERS,
+		MAX_JOINTS	= CSkeletonSnapshot::MAX_JOINTS
+	};
+
+	XnUInt64	m_nTimestamp;
+	XnUInt32	m_nFrameID;
+	XnUInt32	m_nJoints;
+	XnUInt32	m_nUsers;
+	XnUserID	m_aUserID[MAX_USERS];
+	XnUInt8		m_aAction[MAX_USERS];
+	XnInt32		m_aPos[MAX_USERS * MAX_JOINTS][3];
+	XnUInt8		m_aConfidence[MAX_USERS * MAX_JOINTS];
+
+	/* Index of the user in this frame, -1 if the user is not in it */
+	int FindUser( XnUserID uid ) const
+	{
+		for( unsigned int i = 0; i < m_nUsers; ++ i )
+		{
+			if( m_aUserID[i] == uid )
+				return (int)i;
+		}
+		return -1;
+	}
+
+	/* Real world position of one joint */
+	XnPoint3D GetPosition( unsigned int iUser, unsigned int iJoint ) const
+	{
+		const XnInt32* pPos = m_aPos[ iUser * m_nJoints + iJoint ];
+		XnPoint3D mPoint = { (XnFloat)pPos[0], (XnFloat)pPos[1], (XnFloat)pPos[2] };
+		return mPoint;
+	}
+
+	/* Confidence of one joint, 0 - 1 */
+	XnFloat GetConfidence( unsigned int iUser, unsigned int iJoint ) const
+	{
+		return m_aConfidence[ iUser * m_nJoints + iJoint ] / 255.0f;
+	}
+};
+
+/* Encoding and decoding of one frame payload */
+class CSkeletonStreamCodec
+{
+public:
+	enum
+	{
+		FRAME_KEY		= 0x01,
+		USER_DELTA		= 0x80,
+		ACTION_MASK		= 0x7F,
+		MAX_VARINT		= 10,
+		MAX_PAYLOAD		= 1 + 3 * MAX_VARINT + SSkeletonFrame::MAX_USERS * ( MAX_VARINT + 1 + SSkeletonFrame::MAX_JOINTS * ( 3 * 5 + 1 ) )
+	};
+
+	/* Quantize the snapshot into rFrame */
+	static void FromSnapshot( XnUInt64 nTimestamp, XnUInt32 nFrameID, const CSkeletonSnapshot& rSkeleton, const XnUInt8* aAction, SSkeletonFrame& rFrame )
+	{
+		rFrame.m_nTimestamp = nTimestamp;
+		rFrame.m_nFrameID = nFrameID;
+		rFrame.m_nJoints = rSkeleton.GetJointCount();
+		rFrame.m_nUsers = rSkeleton.GetUserCount();
+
+		unsigned int nValues = rFrame.m_nUsers * rFrame.m_nJoints;
+		for( unsigned int i = 0; i < rFrame.m_nUsers; ++ i )
+		{
+			rFrame.m_aUserID[i] = rSkeleton.GetUserID( i );
+			rFrame.m_aAction[i] = aAction ? ( aAction[i] & ACTION_MASK ) : 0;
+		}
+		for( unsigned int k = 0; k < nValues; ++ k )
+		{
+			rFrame.m_aPos[k][0] = (XnInt32)floor( rSkeleton.X()[k] + 0.5f );
+			rFrame.m_aPos[k][1] = (XnInt32)floor( rSkeleton.Y()[k] + 0.5f );
+			rFrame.m_aPos[k][2] = (XnInt32)floor( rSkeleton.Z()[k] + 0.5f );
+
+			XnFloat fConfidence = rSkeleton.Confidence()[k];
+			fConfidence = ( fConfidence < 0 ) ? 0 : ( fConfidence > 1 ) ? 1 : fConfidence;
+			rFrame.m_aConfidence[k] = (XnUInt8)( fConfidence * 255 + 0.5f );
+		}
+	}
+
+	/* Code rFrame against rPrev, pOut needs MAX_PAYLOAD bytes. Return the size */
+	static unsigned int Encode( const SSkeletonFrame& rFrame, const SSkeletonFrame& rPrev, bool bKey, XnUInt8* pOut )
+	{
+		XnUInt8* p = pOut;
+		*p++ = bKey ? FRAME_KEY : 0;
+		PutVarint( p, bKey ? rFrame.m_nTimestamp : rFrame.m_nTimestamp - rPrev.m_nTimestamp );
+		PutVarint( p, bKey ? rFrame.m_nFrameID : rFrame.m_nFrameID - rPrev.m_nFrameID );
+		PutVarint( p, rFrame.m_nUsers );
+
+		for( unsigned int i = 0; i < rFrame.m_nUsers; ++ i )
+		{
+			int iPrev = bKey ? -1 : rPrev.FindUser( rFrame.m_aUserID[i] );
+			PutVarint( p, rFrame.m_aUserID[i] );
+			*p++ = rFrame.m_aAction[i] | ( iPrev >= 0 ? USER_DELTA : 0 );
+
+			for( unsigned int j = 0; j < rFrame.m_nJoints; ++ j )
+			{
+				const XnInt32* pPos = rFrame.m_aPos[ i * rFrame.m_nJoints + j ];
+				const XnInt32* pRef = ( iPrev >= 0 ) ? rPrev.m_aPos[ iPrev * rPrev.m_nJoints + j ] : NULL;
+				for( unsigned int c = 0; c < 3; ++ c )
+					PutVarint( p, ZigZag( pRef ? pPos[c] - pRef[c] : pPos[c] ) );
+				*p++ = rFrame.m_aConfidence[ i * rFrame.m_nJoints + j ];
+			}
+		}
+		return (unsigned int)( p - pOut );
+	}
+
+	/* Decode a payload against rPrev into rFrame, return false if it is broken */
+	static bool Decode( const XnUInt8* p, const XnUInt8* pEnd, unsigned int nJoints, const SSkeletonFrame& rPrev, bool bHasPrev, SSkeletonFrame& rFrame )
+	{
+		if( p >= pEnd )
+			return false;
+		bool bKey = ( *p++ & FRAME_KEY ) != 0;
+		if( !bKey && !bHasPrev )
+			return false;
+
+		XnUInt64 nTimestamp, nFrameID, nUsers;
+		if( !GetVarint( p, pEnd, nTimestamp ) || !GetVarint( p, pEnd, nFrameID ) || !GetVarint( p, pEnd, nUsers )
+			|| nUsers > SSkeletonFrame::MAX_USERS )
+			return false;
+
+		rFrame.m_nTimestamp = bKey ? nTimestamp : rPrev.m_nTimestamp + nTimestamp;
+		rFrame.m_nFrameID = (XnUInt32)( bKey ? nFrameID : rPrev.m_nFrameID + nFrameID );
+		rFrame.m_nJoints = nJoints;
+		rFrame.m_nUsers = (XnUInt32)nUsers;
+
+		for( unsigned int i = 0; i < rFrame.m_nUsers; ++ i )
+		{
+			XnUInt64 nUserID;
+			if( !GetVarint( p, pEnd, nUserID ) || p >= pEnd )
+				return false;
+			XnUInt8 nAction = *p++;
+			rFrame.m_aUserID[i] = (XnUserID)nUserID;
+			rFrame.m_aAction[i] = nAction & ACTION_MASK;
+
+			int iPrev = -1;
+			if( nAction & USER_DELTA )
+			{
+				iPrev = rPrev.FindUser( rFrame.m_aUserID[i] );
+				if( bKey || iPrev < 0 )
+					return false;
+			}
+
+			for( unsigned int j = 0; j < nJoints; ++ j )
+			{
+				XnInt32* pPos = rFrame.m_aPos[ i * nJoints + j ];
+				const XnInt32* pRef = ( iPrev >= 0 ) ? rPrev.m_aPos[ iPrev * nJoints + j ] : NULL;
+				for( unsigned int c = 0; c < 3; ++ c )
+				{
+					XnUInt64 nValue;
+					if( !GetVarint( p, pEnd, nValue ) )
+						return false;
+					pPos[c] = UnZigZag( (XnUInt32)nValue ) + ( pRef ? pRef[c] : 0 );
+				}
+				if( p >= pEnd )
+					return false;
+				rFrame.m_aConfidence[ i * nJoints + j ] = *p++;
+			}
+		}
+		return p == pEnd;
+	}
+
+	/* Unsigned LEB128 */
+	static void PutVarint( XnUInt8*& p, XnUInt64 nValue )
+	{
+		while( nValue >= 0x80 )
+		{
+			*p++ = (XnUInt8)( nValue | 0x80 );
+			nValue >>= 7;
+		}
+		*p++ = (XnUInt8)nValue;
+	}
+
+	static bool GetVarint( const XnUInt8*& p, const XnUInt8* pEnd, XnUInt64& rValue )
+	{
+		rValue = 0;
+		for( unsigned int iShift = 0; p < pEnd && iShift < 7 * MAX_VARINT; iShift += 7 )
+		{
+			XnUInt8 nByte = *p++;
+			rValue |= (XnUInt64)( nByte & 0x7F ) << iShift;
+			if( ( nByte & 0x80 ) == 0 )
+				return true;
+		}
+		return false;
+	}
+
+	/* Small magnitudes of either sign to small unsigned values */
+	static XnUInt32 ZigZag( XnInt32 nValue )
+	{
+		return ( (XnUInt32)nValue << 1 ) ^ (XnUInt32)( nValue >> 31 );
+	}
+
+	static XnInt32 UnZigZag( XnUInt32 nValue )
+	{
+		return (XnInt32)( nValue >> 1 ) ^ -(XnInt32)( nValue & 1 );
+	}
+};
+
+/* Class for writing a skeleton stream */
+class CSkeletonStreamWriter
+{
+public:
+	enum { KEY_INTERVAL = 30 };
+
+	/* Constructor */
+	CSkeletonStreamWriter() : m_pFile( NULL )
+	{}
+
+	/* Destructor */
+	~CSkeletonStreamWriter()
+	{
+		Close();
+	}
+
+	/* Create the file, the joint list is taken from the snapshot */
+	bool Open( const char* sFile, const CSkeletonSnapshot& rSkeleton )
+	{
+		Close();
+		m_pFile = fopen( sFile, "wb" );
+		if( m_pFile == NULL )
+			return false;
+
+		memset( &m_Header, 0, sizeof( m_Header ) );
+		memcpy( m_Header.m_aMagic, "KDSK", 4 );
+		m_Header.m_nVersion = SKELETON_STREAM_VERSION;
+		m_Header.m_nJoints = rSkeleton.GetJointCount();
+		for( unsigned int i = 0; i < rSkeleton.GetJointCount(); ++ i )
+			m_Header.m_aJoint[i] = rSkeleton.GetJointName( i );
+
+		m_nOffset = sizeof( m_Header );
+		m_iPrev = 0;
+		m_aFrame[0].m_nTimestamp = 0;
+		m_aFrame[0].m_nFrameID = 0;
+		m_aFrame[0].m_nUsers = 0;
+		m_vIndex.clear();
+		return fwrite( &m_Header, sizeof( m_Header ), 1, m_pFile ) == 1;
+	}
+
+	/* Append one frame, aAction has one action per user of the snapshot, or is NULL */
+	bool Write( XnUInt64 nTimestamp, XnUInt32 nFrameID, const CSkeletonSnapshot& rSkeleton, const XnUInt8* aAction )
+	{
+		if( m_pFile == NULL || rSkeleton.GetJointCount() != m_Header.m_nJoints )
+			return false;
+
+		const SSkeletonFrame& rPrev = m_aFrame[ m_iPrev ];
+		SSkeletonFrame& rFrame = m_aFrame[ 1 - m_iPrev ];
+		CSkeletonStreamCodec::FromSnapshot( nTimestamp, nFrameID, rSkeleton, aAction, rFrame );
+
+		// differences only go forward, a restarted sensor gets a key frame
+		bool bKey = ( m_Header.m_nFrames % KEY_INTERVAL == 0 )
+			|| nTimestamp < rPrev.m_nTimestamp || nFrameID < rPrev.m_nFrameID;
+		if( bKey )
+		{
+			SSkeletonStreamIndex mEntry = { nTimestamp, m_nOffset };
+			m_vIndex.push_back( mEntry );
+		}
+
+		unsigned int nPayload = CSkeletonStreamCodec::Encode( rFrame, rPrev, bKey, m_aPayload );
+		XnUInt8 aSize[CSkeletonStreamCodec::MAX_VARINT];
+		XnUInt8* pSize = aSize;
+		CSkeletonStreamCodec::PutVarint( pSize, nPayload );
+		size_t nSize = pSize - aSize;
+
+		if( fwrite( aSize, 1, nSize, m_pFile ) != nSize || fwrite( m_aPayload, 1, nPayload, m_pFile ) != nPayload )
+			return false;
+
+		m_nOffset += nSize + nPayload;
+		++m_Header.m_nFrames;
+		m_iPrev = 1 - m_iPrev;
+		return true;
+	}
+
+	/* Write the index and the counts, then close. Return false if they could not be written */
+	bool Close()
+	{
+		if( m_pFile == NULL )
+			return true;
+
+		// the index starts 8 byte aligned, so a mapped reader can use it in place
+		static const XnUInt8 aZero[8] = { 0 };
+		size_t nPad = (size_t)( ( 8 - m_nOffset % 8 ) % 8 );
+		bool bOK = fwrite( aZero, 1, nPad, m_pFile ) == nPad;
+
+		m_Header.m_nIndexOffset = m_nOffset + nPad;
+		m_Header.m_nKeyFrames = (XnUInt32)m_vIndex.size();
+		if( bOK && !m_vIndex.empty() )
+			bOK = fwrite( &m_vIndex[0], sizeof( SSkeletonStreamIndex ), m_vIndex.size(), m_pFile ) == m_vIndex.size();
+		bOK = bOK && fseek( m_pFile, 0, SEEK_SET ) == 0
+			&& fwrite( &m_Header, sizeof( m_Header ), 1, m_pFile ) == 1;
+
+		bOK = ( fclose( m_pFile ) == 0 ) && bOK;
+		m_pFile = NULL;
+		return bOK;
+	}
+
+private:
+	FILE*								m_pFile;
+	SSkeletonStreamHeader				m_Header;
+	XnUInt64							m_nOffset;
+	std::vector<SSkeletonStreamIndex>	m_vIndex;		// one entry per second
+
+	// the previous frame is the reference of the next one
+	SSkeletonFrame						m_aFrame[2];
+	int									m_iPrev;
+	XnUInt8								m_aPayload[CSkeletonStreamCodec::MAX_PAYLOAD];
+};
+
+/* Class for reading a skeleton stream through a memory mapping */
+class CSkeletonStreamReader
+{
+public:
+	/* Constructor */
+	CSkeletonStreamReader() : m_pBegin( NULL ), m_pEnd( NULL ), m_pPos( NULL ), m_pIndex( NULL ), m_iCurrent( 0 ), m_bHasFrame( false )
+	{}
+
+	/* Map the file and check the header */
+	bool Open( const char* sFile )
+	{
+		Close();
+		if( !m_File.Open( sFile ) || m_File.Size() < sizeof( m_Header ) )
+		{
+			Close();
+			return false;
+		}
+
+		memcpy( &m_Header, m_File.Data(), sizeof( m_Header ) );
+		if( memcmp( m_Header.m_aMagic, "KDSK", 4 ) != 0 || m_Header.m_nVersion != SKELETON_STREAM_VERSION
+			|| m_Header.m_nJoints == 0 || m_Header.m_nJoints > SSkeletonFrame::MAX_JOINTS )
+		{
+			Close();
+			return false;
+		}
+
+		m_pBegin = m_File.Data() + sizeof( m_Header );
+		m_pEnd = m_File.Data() + m_File.Size();
+
+		// without index, as after a crash, frames run to the end of the file
+		XnUInt64 nIndexSize = (XnUInt64)m_Header.m_nKeyFrames * sizeof( SSkeletonStreamIndex );
+		if( m_Header.m_nIndexOffset >= sizeof( m_Header ) && m_Header.m_nIndexOffset + nIndexSize <= m_File.Size() )
+		{
+			m_pIndex = reinterpret_cast<const SSkeletonStreamIndex*>( m_File.Data() + m_Header.m_nIndexOffset );
+			m_pEnd = m_File.Data() + m_Header.m_nIndexOffset;
+		}
+		else
+			m_Header.m_nKeyFrames = 0;
+
+		Rewind();
+		return true;
+	}
+
+	/* Unmap the file */
+	void Close()
+	{
+		m_File.Close();
+		m_pBegin = m_pEnd = m_pPos = NULL;
+		m_pIndex = NULL;
+		m_bHasFrame = false;
+	}
+
+	/* File header, valid after Open() */
+	const SSkeletonStreamHeader& GetHeader() const
+	{
+		return m_Header;
+	}
+
+	/* Go back to the first frame */
+	void Rewind()
+	{
+		m_pPos = m_pBegin;
+		m_bHasFrame = false;
+	}
+
+	/* Decode the next frame into GetFrame(), return false at the end or on a broken frame */
+	bool Next()
+	{
+		const XnUInt8* pPayload;
+		const XnUInt8* pPayloadEnd;
+		if( !NextPayload( m_pPos, pPayload, pPayloadEnd ) )
+			return false;
+
+		const SSkeletonFrame& rPrev = m_aFrame[ m_iCurrent ];
+		SSkeletonFrame& rFrame = m_aFrame[ 1 - m_iCurrent ];
+		if( !CSkeletonStreamCodec::Decode( pPayload, pPayloadEnd, m_Header.m_nJoints, rPrev, m_bHasFrame, rFrame ) )
+			return false;
+
+		m_pPos = pPayloadEnd;
+		m_iCurrent = 1 - m_iCurrent;
+		m_bHasFrame = true;
+		return true;
+	}
+
+	/* The frame decoded by the last Next() */
+	const SSkeletonFrame& GetFrame() const
+	{
+		return m_aFrame[ m_iCurrent ];
+	}
+
+	/* Decode the first frame at or after nTimestamp into GetFrame(), return false if there is none */
+	bool Seek( XnUInt64 nTimestamp )
+	{
+		// start at the last key frame before the time, from the index or by skipping frames
+		m_pPos = m_pBegin;
+		m_bHasFrame = false;
+		if( m_pIndex != NULL )
+		{
+			XnUInt32 iLow = 0, iHigh = m_Header.m_nKeyFrames;
+			while( iLow < iHigh )
+			{
+				XnUInt32 iMid = ( iLow + iHigh ) / 2;
+				if( m_pIndex[ iMid ].m_nTimestamp <= nTimestamp )
+					iLow = iMid + 1;
+				else
+					iHigh = iMid;
+			}
+			if( iLow > 0 && m_pIndex[ iLow - 1 ].m_nOffset < (XnUInt64)( m_pEnd - m_File.Data() ) )
+				m_pPos = m_File.Data() + m_pIndex[ iLow - 1 ].m_nOffset;
+		}
+		else
+		{
+			const XnUInt8* pFrame = m_pBegin;
+			const XnUInt8* pPayload;
+			const XnUInt8* pPayloadEnd;
+			while( NextPayload( pFrame, pPayload, pPayloadEnd ) )
+			{
+				if( *pPayload & CSkeletonStreamCodec::FRAME_KEY )
+				{
+					const XnUInt8* p = pPayload + 1;
+					XnUInt64 nKeyTime;
+					if( !CSkeletonStreamCodec::GetVarint( p, pPayloadEnd, nKeyTime ) || nKeyTime > nTimestamp )
+						break;
+					m_pPos = pFrame;
+				}
+				pFrame = pPayloadEnd;
+			}
+		}
+
+		while( Next() )
+		{
+			if( GetFrame().m_nTimestamp >= nTimestamp )
+				return true;
+		}
+		return false;
+	}
+
+private:
+	/* Find the payload of the frame at pFrame */
+	bool NextPayload( const XnUInt8* pFrame, const XnUInt8*& rpPayload, const XnUInt8*& rpPayloadEnd ) const
+	{
+		const XnUInt8* p = pFrame;
+		XnUInt64 nSize;
+		if( p == NULL || !CSkeletonStreamCodec::GetVarint( p, m_pEnd, nSize ) || nSize == 0 || nSize > (XnUInt64)( m_pEnd - p ) )
+			return false;
+		rpPayload = p;
+		rpPayloadEnd = p + nSize;
+		return true;
+	}
+
+private:
+	CMappedFile						m_File;
+	SSkeletonStreamHeader			m_Header;
+	const XnUInt8*					m_pBegin;
+	const XnUInt8*					m_pEnd;
+	const XnUInt8*					m_pPos;
+	const SSkeletonStreamIndex*		m_pIndex;
+
+	// the current frame is the reference of the next one
+	SSkeletonFrame					m_aFrame[2];
+	int								m_iCurrent;
+	bool							m_bHasFrame;
+};
+
+#endif // SKELETONSTREAM_H
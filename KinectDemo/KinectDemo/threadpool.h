@@ -0,0 +1,121 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed set of worker threads for splitting one frame into tiles.
+ *
+ * Run() hands out task indexes 0 .. nTasks - 1 to the workers and the
+ * calling thread, and returns when all of them are done, so a pipeline
+ * stage stays a plain function call. Tasks are taken one by one from a
+ * shared counter, a slow tile doesn't hold up the others. The threads are
+ * created once and sleep between calls.
+ *
+ * Run() must be called from one thread at a time. */
+class CThreadPool
+{
+public:
+	/* Constructor, nThreads counts the calling thread, 0 is one per core */
+	CThreadPool( unsigned int nThreads = 0 ) : m_pTask( NULL ), m_nTasks( 0 ), m_iNext( 0 ), m_nGeneration( 0 ), m_nActive( 0 ), m_bStop( false )
+	{
+		if( nThreads == 0 )
+			nThreads = std::thread::hardware_concurrency();
+		for( unsigned int i = 1; i < nThreads; ++ i )
+			m_vThread.push_back( std::thread( &CThreadPool::Work, this ) );
+	}
+
+	/* Destructor, waits for the workers */
+	~CThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> mLock( m_Mutex );
+			m_bStop = true;
+		}
+		m_Wake.notify_all();
+		for( size_t i = 0; i < m_vThread.size(); ++ i )
+			m_vThread[i].join();
+	}
+
+	/* Threads working on Run(), the caller included */
+	unsigned int GetThreadCount() const
+	{
+		return (unsigned int)m_vThread.size() + 1;
+	}
+
+	/* Call fTask( i ) for every i below nTasks, on any thread, and wait for all */
+	void Run( unsigned int nTasks, const std::function<void( unsigned int )>& fTask )
+	{
+		if( m_vThread.empty() || nTasks <= 1 )
+		{
+			for( unsigned int i = 0; i < nTasks; ++ i )
+				fTask( i );
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> mLock( m_Mutex );
+			m_pTask = &fTask;
+			m_nTasks = nTasks;
+			m_iNext.store( 0, std::memory_order_relaxed );
+			++m_nGeneration;
+		}
+		m_Wake.notify_all();
+
+		RunTasks( fTask, nTasks );
+
+		// the tasks are all taken, wait for those still running. Workers
+		// which didn't wake up in time see no task and sleep on
+		std::unique_lock<std::mutex> mLock( m_Mutex );
+		m_Done.wait( mLock, [this]{ return m_nActive == 0; } );
+		m_pTask = NULL;
+	}
+
+private:
+	void RunTasks( const std::function<void( unsigned int )>& fTask, unsigned int nTasks )
+	{
+		for( unsigned int i = m_iNext.fetch_add( 1, std::memory_order_relaxed ); i < nTasks; i = m_iNext.fetch_add( 1, std::memory_order_relaxed ) )
+			fTask( i );
+	}
+
+	void Work()
+	{
+		unsigned int nSeen = 0;
+		std::unique_lock<std::mutex> mLock( m_Mutex );
+		while( true )
+		{
+			m_Wake.wait( mLock, [&]{ return m_bStop || ( m_nGeneration != nSeen && m_pTask != NULL ); } );
+			if( m_bStop )
+				return;
+			nSeen = m_nGeneration;
+			const std::function<void( unsigned int )>* pTask = m_pTask;
+			unsigned int nTasks = m_nTasks;
+			++m_nActive;
+			mLock.unlock();
+
+			RunTasks( *pTask, nTasks );
+
+			mLock.lock();
+			if( --m_nActive == 0 )
+				m_Done.notify_all();
+		}
+	}
+
+private:
+	std::vector<std::thread>						m_vThread;
+	std::mutex										m_Mutex;
+	std::condition_variable							m_Wake;		// a new call or stop
+	std::condition_variable							m_Done;		// no worker in a call
+	const std::function<void( unsigned int )>*		m_pTask;
+	unsigned int									m_nTasks;
+	std::atomic<unsigned int>						m_iNext;
+	unsigned int									m_nGeneration;
+	unsigned int									m_nActive;	// workers in the current call
+	bool											m_bStop;
+};
+
+#endif // THREADPOOL_H
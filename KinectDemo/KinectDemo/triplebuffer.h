@@ -0,0 +1,89 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+/* Lock-free triple buffer between one producer and one consumer.
+ *
+ * The producer fills Back() and calls Publish(). The consumer calls
+ * Update() and, when it returns true, reads Front(). Neither side ever
+ * waits. The consumer always sees the newest published frame. Frames
+ * that were overwritten before the consumer picked them up are counted
+ * as dropped.
+ *
+ * The three slots are allocated once. T is reused in place, so any
+ * buffers inside T keep their capacity from frame to frame. */
+template< typename T >
+class CTripleBuffer
+{
+public:
+	/* Constructor */
+	CTripleBuffer() : m_iBack( 0 ), m_iFront( 1 ), m_iState( 2 ), m_nPublished( 0 ), m_nDropped( 0 )
+	{}
+
+	/* Producer: slot to fill */
+	T& Back()
+	{
+		return m_aSlot[ m_iBack ];
+	}
+
+	/* Producer: hand the back slot to the consumer */
+	void Publish()
+	{
+		int iOld = m_iState.exchange( m_iBack | FLAG_NEW, std::memory_order_acq_rel );
+		m_iBack = iOld & INDEX_MASK;
+
+		m_nPublished.fetch_add( 1, std::memory_order_relaxed );
+		if( iOld & FLAG_NEW )
+			m_nDropped.fetch_add( 1, std::memory_order_relaxed );
+	}
+
+	/* Consumer: take the newest frame, return false if nothing new was published */
+	bool Update()
+	{
+		if( ( m_iState.load( std::memory_order_relaxed ) & FLAG_NEW ) == 0 )
+			return false;
+
+		int iOld = m_iState.exchange( m_iFront, std::memory_order_acq_rel );
+		m_iFront = iOld & INDEX_MASK;
+		return true;
+	}
+
+	/* Consumer: the frame got by the last Update() */
+	T& Front()
+	{
+		return m_aSlot[ m_iFront ];
+	}
+
+	/* Frames published so far */
+	unsigned int Published() const
+	{
+		return m_nPublished.load( std::memory_order_relaxed );
+	}
+
+	/* Frames overwritten before the consumer read them */
+	unsigned int Dropped() const
+	{
+		return m_nDropped.load( std::memory_order_relaxed );
+	}
+
+private:
+	enum
+	{
+		INDEX_MASK	= 0x3,
+		FLAG_NEW	= 0x4
+	};
+
+	CTripleBuffer( const CTripleBuffer& );
+	CTripleBuffer& operator=( const CTripleBuffer& );
+
+private:
+	T							m_aSlot[3];
+	int							m_iBack;		// owned by producer
+	int							m_iFront;		// owned by consumer
+	std::atomic<int>			m_iState;		// middle slot index | FLAG_NEW
+	std::atomic<unsigned int>	m_nPublished;
+	std::atomic<unsigned int>	m_nDropped;
+};
+
+#endif // TRIPLEBUFFER_H
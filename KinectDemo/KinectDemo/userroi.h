@@ -0,0 +1,301 @@
+#ifndef USERROI_H
+#define USERROI_H
+
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+#include <XnCppWrapper.h>
+
+#include "pixelrect.h"
+#include "skeletonsnapshot.h"
+#include "usersegmentation.h"
+#include "depthcolorizer.h"
+
+/* Class for restricting the pixel stages to the tracked users.
+ *
+ * Every frame the projected joints of each user, and the bounding boxes
+ * of the label map when there is one, grown by a margin, mark the tiles
+ * of TILE x TILE pixels worth processing. The marked tiles of a tile row
+ * are merged into runs, GetRects() lists them from top to bottom and left
+ * to right, for the stages which take rectangles.
+ *
+ * Colorize() converts only the depth inside the rectangles. The rest of
+ * the image comes from a background, a whole colorized frame which is
+ * made again every few frames, and at once when a user is farther than
+ * the largest depth of the background. So the background takes a moment
+ * to follow what moves outside of the users, and colors don't jump
+ * between the users and the rest.
+ *
+ * The output images are expected to be a few buffers used in turn, like
+ * the slots of a CTripleBuffer. For each one the tiles written last time
+ * are remembered, and only the tiles a user has left get the background
+ * again, so pixels outside the users cost nothing most frames. */
+class CUserROI
+{
+public:
+	enum
+	{
+		TILE	= 32,
+		MARGIN	= 24		// default margin in pixels
+	};
+
+	/* Constructor */
+	CUserROI() : m_iMargin( MARGIN ), m_nRefresh( 30 ), m_iXRes( 0 ), m_iYRes( 0 ), m_iTilesX( 0 ), m_iTilesY( 0 ),
+		m_nPixels( 0 ), m_nBackgroundMax( 0 ), m_nSinceRefresh( 0 ), m_nGeneration( 0 ), m_nFrames( 0 ), m_nFullFrames( 0 ), m_nPixelSum( 0 ), m_nFrameSum( 0 )
+	{}
+
+	/* Pixels added around every user */
+	void SetMargin( unsigned int iPixels )
+	{
+		m_iMargin = iPixels;
+	}
+
+	/* Colorize the whole frame again after nFrames frames */
+	void SetRefresh( unsigned int nFrames )
+	{
+		m_nRefresh = nFrames;
+	}
+
+	/* Start the regions of a map of iXRes x iYRes */
+	void Begin( unsigned int iXRes, unsigned int iYRes )
+	{
+		if( iXRes != m_iXRes || iYRes != m_iYRes )
+		{
+			m_iXRes = iXRes;
+			m_iYRes = iYRes;
+			m_iTilesX = ( iXRes + TILE - 1 ) / TILE;
+			m_iTilesY = ( iYRes + TILE - 1 ) / TILE;
+			m_vTile.resize( m_iTilesX * m_iTilesY );
+			m_vBackground.clear();
+			m_vTarget.clear();
+		}
+		if( !m_vTile.empty() )
+			memset( &m_vTile[0], 0, m_vTile.size() );
+		m_vRect.clear();
+		m_nPixels = 0;
+	}
+
+	/* Add a rectangle, grown by the margin */
+	void AddRect( const SPixelRect& rRect )
+	{
+		if( rRect.IsEmpty() )
+			return;
+		int iX0 = (int)rRect.m_iX - (int)m_iMargin, iY0 = (int)rRect.m_iY - (int)m_iMargin;
+		int iX1 = (int)( rRect.m_iX + rRect.m_iWidth + m_iMargin ), iY1 = (int)( rRect.m_iY + rRect.m_iHeight + m_iMargin );
+		iX0 = ( iX0 < 0 ) ? 0 : iX0;
+		iY0 = ( iY0 < 0 ) ? 0 : iY0;
+		iX1 = ( iX1 > (int)m_iXRes ) ? m_iXRes : iX1;
+		iY1 = ( iY1 > (int)m_iYRes ) ? m_iYRes : iY1;
+		if( iX0 >= iX1 || iY0 >= iY1 )
+			return;
+
+		for( int ty = iY0 / TILE; ty <= ( iY1 - 1 ) / TILE; ++ ty )
+			memset( &m_vTile[ ty * m_iTilesX + iX0 / TILE ], 1, ( iX1 - 1 ) / TILE - iX0 / TILE + 1 );
+	}
+
+	/* Add the projected joints of every user */
+	void AddSkeleton( const CSkeletonSnapshot& rSkeleton )
+	{
+		for( unsigned int u = 0; u < rSkeleton.GetUserCount(); ++ u )
+		{
+			const XnPoint3D* pJoint = rSkeleton.GetProjective( u );
+			float fMinX = 1e9f, fMinY = 1e9f, fMaxX = -1e9f, fMaxY = -1e9f;
+			for( unsigned int j = 0; j < rSkeleton.GetJointCount(); ++ j )
+			{
+				// joints without depth were never seen
+				if( pJoint[j].Z == 0 )
+					continue;
+				fMinX = ( pJoint[j].X < fMinX ) ? pJoint[j].X : fMinX;
+				fMinY = ( pJoint[j].Y < fMinY ) ? pJoint[j].Y : fMinY;
+				fMaxX = ( pJoint[j].X > fMaxX ) ? pJoint[j].X : fMaxX;
+				fMaxY = ( pJoint[j].Y > fMaxY ) ? pJoint[j].Y : fMaxY;
+			}
+			if( fMinX > fMaxX || fMaxX < 0 || fMaxY < 0 || fMinX >= m_iXRes || fMinY >= m_iYRes )
+				continue;
+			fMinX = ( fMinX < 0 ) ? 0 : fMinX;
+			fMinY = ( fMinY < 0 ) ? 0 : fMinY;
+			AddRect( SPixelRect::Make( (unsigned int)fMinX, (unsigned int)fMinY,
+				(unsigned int)( fMaxX - fMinX ) + 1, (unsigned int)( fMaxY - fMinY ) + 1 ) );
+		}
+	}
+
+	/* Add the bounding boxes of the label map, of the same resolution */
+	void AddUsers( const CUserSegmentation& rSegmentation )
+	{
+		for( unsigned int u = 0; u < rSegmentation.GetUserCount(); ++ u )
+			AddRect( rSegmentation.GetBoundingBox( u ) );
+	}
+
+	/* Merge the marked tiles into rectangles */
+	void End()
+	{
+		m_vRowRect.resize( m_iTilesY + 1 );
+		for( unsigned int ty = 0; ty < m_iTilesY; ++ ty )
+		{
+			m_vRowRect[ ty ] = (unsigned int)m_vRect.size();
+			const unsigned char* pRow = &m_vTile[ ty * m_iTilesX ];
+			for( unsigned int tx = 0; tx < m_iTilesX; )
+			{
+				if( !pRow[tx] )
+				{
+					++tx;
+					continue;
+				}
+				unsigned int tEnd = tx;
+				while( tEnd < m_iTilesX && pRow[ tEnd ] )
+					++tEnd;
+				SPixelRect mRect = SPixelRect::Make( tx * TILE, ty * TILE, ( tEnd - tx ) * TILE, TILE ).Clip( m_iXRes, m_iYRes );
+				m_vRect.push_back( mRect );
+				m_nPixels += mRect.m_iWidth * mRect.m_iHeight;
+				tx = tEnd;
+			}
+		}
+		m_vRowRect[ m_iTilesY ] = (unsigned int)m_vRect.size();
+		++m_nFrames;
+		m_nPixelSum += m_nPixels;
+		m_nFrameSum += (XnUInt64)m_iXRes * m_iYRes;
+	}
+
+	/* Rectangles of the frame, top to bottom and left to right */
+	const SPixelRect* GetRects() const	{ return m_vRect.empty() ? NULL : &m_vRect[0]; }
+	unsigned int GetRectCount() const	{ return (unsigned int)m_vRect.size(); }
+
+	/* Pixels inside the rectangles */
+	unsigned int GetPixelCount() const	{ return m_nPixels; }
+
+	/* Colorize the regions of the frame on the background, return the max value of the colors */
+	XnDepthPixel Colorize( const CDepthColorizer& rColorizer, const XnDepthPixel* pDepth, unsigned char* pARGB )
+	{
+		size_t nSize = (size_t)m_iXRes * m_iYRes;
+		bool bFull = m_vBackground.size() != 4 * nSize || m_nSinceRefresh >= m_nRefresh;
+		if( !bFull && rColorizer.FindMax( pDepth, m_iXRes, GetRects(), GetRectCount() ) > m_nBackgroundMax )
+			bFull = true;
+		STarget& rTarget = FindTarget( pARGB );
+		if( bFull )
+		{
+			m_nBackgroundMax = rColorizer.Colorize( pDepth, (unsigned int)nSize, pARGB );
+			m_vBackground.assign( pARGB, pARGB + 4 * nSize );
+			m_nSinceRefresh = 0;
+			++m_nFullFrames;
+			++m_nGeneration;
+
+			// the whole image is background now
+			rTarget.m_nGeneration = m_nGeneration;
+			rTarget.m_vTile.assign( m_vTile.size(), 0 );
+			return m_nBackgroundMax;
+		}
+		++m_nSinceRefresh;
+
+		if( rTarget.m_nGeneration == m_nGeneration && rTarget.m_vTile.size() == m_vTile.size() )
+		{
+			// the image has this background, only the tiles of last time without a user now are old
+			for( unsigned int t = 0; t < m_vTile.size(); ++ t )
+			{
+				if( rTarget.m_vTile[t] && !m_vTile[t] )
+					CopyTile( t % m_iTilesX, t / m_iTilesX, pARGB );
+			}
+		}
+		else
+			CopyOutside( pARGB );
+		rTarget.m_nGeneration = m_nGeneration;
+		rTarget.m_vTile = m_vTile;
+		rColorizer.Expand( pDepth, m_iXRes, GetRects(), GetRectCount(), m_nBackgroundMax, pARGB );
+		return m_nBackgroundMax;
+	}
+
+	/* Share of the pixels processed and frames colorized whole */
+	void Report( std::ostream& rOut ) const
+	{
+		rOut << "ROI: " << m_nFrames << " frames, " << ( m_nFrameSum ? 100.0 * m_nPixelSum / m_nFrameSum : 0.0 )
+			<< "% of the pixels in regions, " << m_nFullFrames << " colorized whole" << std::endl;
+	}
+
+private:
+	/* An output image and the tiles of it which aren't background */
+	struct STarget
+	{
+		const unsigned char*		m_pARGB;
+		unsigned int				m_nGeneration;		// of the background, 0 for none
+		std::vector<unsigned char>	m_vTile;
+	};
+
+	STarget& FindTarget( const unsigned char* pARGB )
+	{
+		for( size_t i = 0; i < m_vTarget.size(); ++ i )
+		{
+			if( m_vTarget[i].m_pARGB == pARGB )
+				return m_vTarget[i];
+		}
+		STarget mTarget;
+		mTarget.m_pARGB = pARGB;
+		mTarget.m_nGeneration = 0;
+		m_vTarget.push_back( mTarget );
+		return m_vTarget.back();
+	}
+
+	/* The background of one tile */
+	void CopyTile( unsigned int tx, unsigned int ty, unsigned char* pARGB ) const
+	{
+		unsigned int x0 = tx * TILE, x1 = ( x0 + TILE < m_iXRes ) ? x0 + TILE : m_iXRes;
+		unsigned int y0 = ty * TILE, y1 = ( y0 + TILE < m_iYRes ) ? y0 + TILE : m_iYRes;
+		for( unsigned int y = y0; y < y1; ++ y )
+			CopyBackground( (size_t)y * m_iXRes + x0, (size_t)y * m_iXRes + x1, pARGB );
+	}
+
+	/* The background between the rectangles, a tile row without any in one piece */
+	void CopyOutside( unsigned char* pARGB ) const
+	{
+		for( unsigned int ty = 0; ty < m_iTilesY; ++ ty )
+		{
+			unsigned int y0 = ty * TILE, y1 = ( y0 + TILE < m_iYRes ) ? y0 + TILE : m_iYRes;
+			if( m_vRowRect[ ty ] == m_vRowRect[ ty + 1 ] )
+			{
+				CopyBackground( (size_t)y0 * m_iXRes, (size_t)y1 * m_iXRes, pARGB );
+				continue;
+			}
+			for( unsigned int y = y0; y < y1; ++ y )
+			{
+				size_t iRow = (size_t)y * m_iXRes, iFree = iRow;
+				for( unsigned int i = m_vRowRect[ ty ]; i < m_vRowRect[ ty + 1 ]; ++ i )
+				{
+					CopyBackground( iFree, iRow + m_vRect[i].m_iX, pARGB );
+					iFree = iRow + m_vRect[i].m_iX + m_vRect[i].m_iWidth;
+				}
+				CopyBackground( iFree, iRow + m_iXRes, pARGB );
+			}
+		}
+	}
+
+	void CopyBackground( size_t iBegin, size_t iEnd, unsigned char* pARGB ) const
+	{
+		if( iEnd > iBegin )
+			memcpy( pARGB + 4 * iBegin, &m_vBackground[ 4 * iBegin ], 4 * ( iEnd - iBegin ) );
+	}
+
+private:
+	unsigned int				m_iMargin;
+	unsigned int				m_nRefresh;
+	unsigned int				m_iXRes;
+	unsigned int				m_iYRes;
+	unsigned int				m_iTilesX;
+	unsigned int				m_iTilesY;
+	std::vector<unsigned char>	m_vTile;		// 1 for a tile to process
+	std::vector<SPixelRect>		m_vRect;
+	std::vector<unsigned int>	m_vRowRect;		// first rectangle of every tile row, and the end
+	unsigned int				m_nPixels;
+
+	// whole frame colorized at the last refresh
+	std::vector<unsigned char>	m_vBackground;
+	XnDepthPixel				m_nBackgroundMax;
+	unsigned int				m_nSinceRefresh;
+	unsigned int				m_nGeneration;		// counts the backgrounds
+	std::vector<STarget>		m_vTarget;
+
+	unsigned int				m_nFrames;
+	unsigned int				m_nFullFrames;
+	XnUInt64					m_nPixelSum;
+	XnUInt64					m_nFrameSum;
+};
+
+#endif // USERROI_H
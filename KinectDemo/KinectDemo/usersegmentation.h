@@ -0,0 +1,326 @@
+#ifndef USERSEGMENTATION_H
+#define USERSEGMENTATION_H
+
+#include <XnCppWrapper.h>
+
+#include "simdsupport.h"
+#include "pixelrect.h"
+
+/* Class for the user label map of a UserGenerator.
+ *
+ * Update() reads the label map ( GetUserPixels ) and finds the pixel
+ * count and bounding box of every user in a single pass, skipping
+ * background in blocks of 8 pixels. Blend() tints the pixels of every user
+ * on an RGB24 image with a user color:
+ *     out = rgb + ( color - rgb ) * alpha / 128
+ * which is the same on every kernel. The AVX2 kernel looks colors up with
+ * byte shuffles, 16 pixels at a time, and copies blocks without users.
+ *
+ * Users are told apart by label, labels above MAX_LABELS - 1 are not
+ * counted and take the color of ( label - 1 ) % PALETTE. */
+class CUserSegmentation
+{
+public:
+	enum
+	{
+		MAX_LABELS	= 16,
+		PALETTE		= 8
+	};
+
+	/* Constructor, half transparent colors and the best kernel of this machine */
+	CUserSegmentation() : m_eLevel( CSimdSupport::Best() ), m_nAlpha( 64 ), m_nUsers( 0 )
+	{
+		static const XnUInt8 aDefault[PALETTE][3] = {
+			{ 255, 0, 0 }, { 0, 255, 0 }, { 0, 0, 255 }, { 255, 255, 0 },
+			{ 0, 255, 255 }, { 255, 0, 255 }, { 255, 128, 0 }, { 128, 0, 255 } };
+		for( unsigned int i = 0; i < PALETTE; ++ i )
+			SetColor( i, aDefault[i][0], aDefault[i][1], aDefault[i][2] );
+	}
+
+	/* Force a kernel, return false if the CPU can't run it */
+	bool SetLevel( ESimdLevel eLevel )
+	{
+		if( !CSimdSupport::IsSupported( eLevel ) )
+			return false;
+		m_eLevel = eLevel;
+		return true;
+	}
+
+	/* Get the kernel in use */
+	ESimdLevel GetLevel() const
+	{
+		return m_eLevel;
+	}
+
+	/* Set the opacity of the user colors, 0 - 1 */
+	void SetAlpha( float fAlpha )
+	{
+		m_nAlpha = (unsigned int)( ( fAlpha < 0 ? 0 : ( fAlpha > 1 ? 1 : fAlpha ) ) * 128 + 0.5f );
+	}
+
+	/* Set color iColor of the palette */
+	void SetColor( unsigned int iColor, XnUInt8 r, XnUInt8 g, XnUInt8 b )
+	{
+		m_aColor[ iColor % PALETTE ][0] = r;
+		m_aColor[ iColor % PALETTE ][1] = g;
+		m_aColor[ iColor % PALETTE ][2] = b;
+	}
+
+	/* Read the label map of all users and measure it */
+	XnStatus Update( xn::UserGenerator& rUser )
+	{
+		XnStatus eResult = rUser.GetUserPixels( 0, m_SceneMD );
+		if( eResult != XN_STATUS_OK )
+		{
+			m_nUsers = 0;
+			return eResult;
+		}
+		Analyze( m_SceneMD.Data(), m_SceneMD.XRes(), m_SceneMD.YRes() );
+		return XN_STATUS_OK;
+	}
+
+	/* Measure a label map of iXRes x iYRes */
+	void Analyze( const XnLabel* pLabel, unsigned int iXRes, unsigned int iYRes )
+	{
+		SRegion aRegion[MAX_LABELS];
+		for( unsigned int i = 0; i < MAX_LABELS; ++ i )
+		{
+			aRegion[i].m_nPixels = 0;
+			aRegion[i].m_iMinX = aRegion[i].m_iMinY = ~0u;
+			aRegion[i].m_iMaxX = aRegion[i].m_iMaxY = 0;
+		}
+
+		for( unsigned int y = 0; y < iYRes; ++ y )
+		{
+			const XnLabel* pRow = pLabel + y * iXRes;
+			unsigned int x = 0;
+#if SIMD_X86
+			if( m_eLevel != SIMD_SCALAR )
+			{
+				for( ; x + 8 <= iXRes; x += 8 )
+				{
+					__m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow + x ) );
+					if( _mm_movemask_epi8( _mm_cmpeq_epi16( v, _mm_setzero_si128() ) ) != 0xFFFF )
+						AddPixels( pRow, x, x + 8, y, aRegion );
+				}
+			}
+#endif
+			AddPixels( pRow, x, iXRes, y, aRegion );
+		}
+
+		m_nUsers = 0;
+		for( unsigned int i = 1; i < MAX_LABELS; ++ i )
+		{
+			if( aRegion[i].m_nPixels == 0 )
+				continue;
+			SUser& rUser = m_aUser[ m_nUsers++ ];
+			rUser.m_UserID = i;
+			rUser.m_nPixels = aRegion[i].m_nPixels;
+			rUser.m_Box = SPixelRect::Make( aRegion[i].m_iMinX, aRegion[i].m_iMinY,
+				aRegion[i].m_iMaxX - aRegion[i].m_iMinX + 1, aRegion[i].m_iMaxY - aRegion[i].m_iMinY + 1 );
+		}
+	}
+
+	/* Label map of the last Update(), valid until the next update of the user generator */
+	const xn::SceneMetaData& GetSceneMetaData() const
+	{
+		return m_SceneMD;
+	}
+
+	/* Number of users with pixels */
+	unsigned int GetUserCount() const
+	{
+		return m_nUsers;
+	}
+
+	/* ID of user iUser */
+	XnUserID GetUserID( unsigned int iUser ) const
+	{
+		return m_aUser[ iUser ].m_UserID;
+	}
+
+	/* Pixels of user iUser */
+	unsigned int GetPixelCount( unsigned int iUser ) const
+	{
+		return m_aUser[ iUser ].m_nPixels;
+	}
+
+	/* Bounding box of user iUser */
+	const SPixelRect& GetBoundingBox( unsigned int iUser ) const
+	{
+		return m_aUser[ iUser ].m_Box;
+	}
+
+	/* Index of a user ID, -1 if the user has no pixel */
+	int FindUser( XnUserID uid ) const
+	{
+		for( unsigned int i = 0; i < m_nUsers; ++ i )
+		{
+			if( m_aUser[i].m_UserID == uid )
+				return i;
+		}
+		return -1;
+	}
+
+	/* Tint iSize RGB24 pixels by their labels into pOut, which may be pRGB */
+	void Blend( const XnLabel* pLabel, const XnUInt8* pRGB, unsigned int iSize, XnUInt8* pOut ) const
+	{
+#if SIMD_X86
+		if( m_eLevel == SIMD_AVX2 )
+			return BlendAVX2( pLabel, pRGB, iSize, pOut );
+#endif
+		BlendScalar( pLabel, pRGB, 0, iSize, pOut );
+	}
+
+private:
+	struct SRegion
+	{
+		unsigned int	m_nPixels;
+		unsigned int	m_iMinX, m_iMaxX;
+		unsigned int	m_iMinY, m_iMaxY;
+	};
+
+	struct SUser
+	{
+		XnUserID		m_UserID;
+		unsigned int	m_nPixels;
+		SPixelRect		m_Box;
+	};
+
+	static void AddPixels( const XnLabel* pRow, unsigned int iBegin, unsigned int iEnd, unsigned int y, SRegion* aRegion )
+	{
+		for( unsigned int x = iBegin; x < iEnd; ++ x )
+		{
+			XnLabel nLabel = pRow[x];
+			if( nLabel == 0 || nLabel >= MAX_LABELS )
+				continue;
+			SRegion& rRegion = aRegion[ nLabel ];
+			++rRegion.m_nPixels;
+			rRegion.m_iMinX = ( x < rRegion.m_iMinX ) ? x : rRegion.m_iMinX;
+			rRegion.m_iMaxX = ( x > rRegion.m_iMaxX ) ? x : rRegion.m_iMaxX;
+			rRegion.m_iMinY = ( y < rRegion.m_iMinY ) ? y : rRegion.m_iMinY;
+			rRegion.m_iMaxY = y;
+		}
+	}
+
+	/* Pixels [iBegin, iEnd) */
+	void BlendScalar( const XnLabel* pLabel, const XnUInt8* pRGB, unsigned int iBegin, unsigned int iEnd, XnUInt8* pOut ) const
+	{
+		for( unsigned int i = iBegin; i < iEnd; ++ i )
+		{
+			const XnUInt8* pIn = pRGB + 3 * i;
+			XnUInt8* p = pOut + 3 * i;
+			if( pLabel[i] == 0 )
+			{
+				p[0] = pIn[0];
+				p[1] = pIn[1];
+				p[2] = pIn[2];
+				continue;
+			}
+			const XnUInt8* pColor = m_aColor[ ( pLabel[i] - 1 ) % PALETTE ];
+			for( int c = 0; c < 3; ++ c )
+				p[c] = (XnUInt8)( pIn[c] + ( ( ( pColor[c] - pIn[c] ) * (int)m_nAlpha ) >> 7 ) );
+		}
+	}
+
+#if SIMD_X86
+	/* Blend 16 bytes of RGB with 16 bytes of color by 16 byte weights */
+	SIMD_TARGET_AVX2 static __m128i BlendSixteen( __m128i vRGB, __m128i vColor, __m128i vAlpha )
+	{
+		const __m128i vZero = _mm_setzero_si128();
+		__m128i vLow = _mm_unpacklo_epi8( vRGB, vZero );
+		__m128i vHigh = _mm_unpackhi_epi8( vRGB, vZero );
+		__m128i vDiffLow = _mm_sub_epi16( _mm_unpacklo_epi8( vColor, vZero ), vLow );
+		__m128i vDiffHigh = _mm_sub_epi16( _mm_unpackhi_epi8( vColor, vZero ), vHigh );
+		vLow = _mm_add_epi16( vLow, _mm_srai_epi16( _mm_mullo_epi16( vDiffLow, _mm_unpacklo_epi8( vAlpha, vZero ) ), 7 ) );
+		vHigh = _mm_add_epi16( vHigh, _mm_srai_epi16( _mm_mullo_epi16( vDiffHigh, _mm_unpackhi_epi8( vAlpha, vZero ) ), 7 ) );
+		return _mm_packus_epi16( vLow, vHigh );
+	}
+
+	/* Palette index of 8 labels, 0 for background */
+	static __m128i PaletteIndex( __m128i vLabel )
+	{
+		__m128i vIndex = _mm_add_epi16( _mm_and_si128( _mm_sub_epi16( vLabel, _mm_set1_epi16( 1 ) ), _mm_set1_epi16( PALETTE - 1 ) ), _mm_set1_epi16( 1 ) );
+		return _mm_andnot_si128( _mm_cmpeq_epi16( vLabel, _mm_setzero_si128() ), vIndex );
+	}
+
+	/* 16 pixels at a time, 48 bytes in 3 blocks. Every byte of a block looks up
+	 * its pixel's palette index, then the color of its channel and the weight */
+	SIMD_TARGET_AVX2 void BlendAVX2( const XnLabel* pLabel, const XnUInt8* pRGB, unsigned int iSize, XnUInt8* pOut ) const
+	{
+		// tables by palette index, entry 0 is the background with no weight
+		XnUInt8 aTable[4][16] = { { 0 } };
+		for( unsigned int i = 0; i < PALETTE; ++ i )
+		{
+			for( int c = 0; c < 3; ++ c )
+				aTable[c][ i + 1 ] = m_aColor[i][c];
+			aTable[3][ i + 1 ] = (XnUInt8)m_nAlpha;
+		}
+		const __m128i vRed = _mm_loadu_si128( reinterpret_cast<const __m128i*>( aTable[0] ) );
+		const __m128i vGreen = _mm_loadu_si128( reinterpret_cast<const __m128i*>( aTable[1] ) );
+		const __m128i vBlue = _mm_loadu_si128( reinterpret_cast<const __m128i*>( aTable[2] ) );
+		const __m128i vWeight = _mm_loadu_si128( reinterpret_cast<const __m128i*>( aTable[3] ) );
+
+		// pixel of every byte of the 3 blocks, and which bytes are red, green or blue
+		__m128i aPixel[3], aIsRed[3], aIsGreen[3], aIsBlue[3];
+		for( int k = 0; k < 3; ++ k )
+		{
+			XnUInt8 aIndex[16], aMask[3][16];
+			for( int j = 0; j < 16; ++ j )
+			{
+				aIndex[j] = (XnUInt8)( ( 16 * k + j ) / 3 );
+				for( int c = 0; c < 3; ++ c )
+					aMask[c][j] = ( ( 16 * k + j ) % 3 == c ) ? 0xFF : 0;
+			}
+			aPixel[k] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( aIndex ) );
+			aIsRed[k] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( aMask[0] ) );
+			aIsGreen[k] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( aMask[1] ) );
+			aIsBlue[k] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( aMask[2] ) );
+		}
+
+		unsigned int i = 0;
+		for( ; i + 16 <= iSize; i += 16 )
+		{
+			__m128i vIndex = _mm_packus_epi16(
+				PaletteIndex( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pLabel + i ) ) ),
+				PaletteIndex( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pLabel + i + 8 ) ) ) );
+			const __m128i* pIn = reinterpret_cast<const __m128i*>( pRGB + 3 * i );
+			__m128i* p = reinterpret_cast<__m128i*>( pOut + 3 * i );
+
+			// no user in these pixels
+			if( _mm_movemask_epi8( _mm_cmpeq_epi8( vIndex, _mm_setzero_si128() ) ) == 0xFFFF )
+			{
+				if( pOut != pRGB )
+				{
+					_mm_storeu_si128( p, _mm_loadu_si128( pIn ) );
+					_mm_storeu_si128( p + 1, _mm_loadu_si128( pIn + 1 ) );
+					_mm_storeu_si128( p + 2, _mm_loadu_si128( pIn + 2 ) );
+				}
+				continue;
+			}
+
+			for( int k = 0; k < 3; ++ k )
+			{
+				__m128i vByteIndex = _mm_shuffle_epi8( vIndex, aPixel[k] );
+				__m128i vColor = _mm_or_si128( _mm_or_si128(
+					_mm_and_si128( _mm_shuffle_epi8( vRed, vByteIndex ), aIsRed[k] ),
+					_mm_and_si128( _mm_shuffle_epi8( vGreen, vByteIndex ), aIsGreen[k] ) ),
+					_mm_and_si128( _mm_shuffle_epi8( vBlue, vByteIndex ), aIsBlue[k] ) );
+				__m128i vAlpha = _mm_shuffle_epi8( vWeight, vByteIndex );
+				_mm_storeu_si128( p + k, BlendSixteen( _mm_loadu_si128( pIn + k ), vColor, vAlpha ) );
+			}
+		}
+		BlendScalar( pLabel, pRGB, i, iSize, pOut );
+	}
+#endif
+
+private:
+	ESimdLevel			m_eLevel;
+	unsigned int		m_nAlpha;		// 0 - 128
+	XnUInt8				m_aColor[PALETTE][3];
+	xn::SceneMetaData	m_SceneMD;
+	unsigned int		m_nUsers;
+	SUser				m_aUser[MAX_LABELS];
+};
+
+#endif // USERSEGMENTATION_H
@@ -8,7 +8,10 @@ QT       += core gui
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
-CONFIG   += console
+CONFIG   += console c++11
+
+# per-stage timers and the profiler overlay: qmake CONFIG+=profile
+profile: DEFINES += KINECT_PROFILE=1
 
 TARGET = KinectDemo
 TEMPLATE = app
@@ -17,11 +20,35 @@ TEMPLATE = app
 SOURCES += main.cpp\
         widget.cpp
 
-HEADERS  += widget.h
+HEADERS  += widget.h\
+        ../../KinectDemo/simdsupport.h\
+        ../../KinectDemo/depthcolorizer.h\
+        ../../KinectDemo/triplebuffer.h\
+        ../../KinectDemo/framestats.h\
+        ../../KinectDemo/framesync.h\
+        ../../KinectDemo/skeletonsnapshot.h\
+        ../../KinectDemo/rawframefile.h\
+        ../../KinectDemo/captureprofile.h\
+        ../../KinectDemo/sensorsource.h\
+        ../../KinectDemo/gesturetracker.h\
+        ../../KinectDemo/profiler.h\
+        ../../KinectDemo/skeletonstream.h\
+        ../../KinectDemo/mappedfile.h\
+        ../../KinectDemo/pixelrect.h\
+        ../../KinectDemo/usersegmentation.h\
+        ../../KinectDemo/userroi.h\
+        ../../KinectDemo/threadpool.h\
+        ../../KinectDemo/depthfilter.h\
+        ../../KinectDemo/depthregistration.h\
+        ../../KinectDemo/jointfilter.h\
+        ../../KinectDemo/jointpredictor.h\
+        ../../KinectDemo/dtwrecognizer.h\
+        ../../KinectDemo/logger.h
 
 FORMS    += widget.ui
 
 INCLUDEPATH += $$(OPEN_NI_INCLUDE)
+INCLUDEPATH += ../../KinectDemo
 
 LIBS += -L$$(OPEN_NI_LIB) -lopenNI
 
@@ -1,7 +1,12 @@
 // Standard C++ header
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include <iostream>
 #include <vector>
+#include <atomic>
+#include <memory>
+#include <sstream>
 
 // Qt Header
 #include <QApplication>
@@ -9,157 +14,59 @@
 #include <QGraphicsScene>
 #include <QGraphicsPixmapItem>
 #include <QGraphicsTextItem>
+#include <QThread>
+#include <QEvent>
 
 // OpenNI Header
 #include <XnCppWrapper.h>
 
+// Kinect Demo Header
+#include "depthcolorizer.h"
+#include "triplebuffer.h"
+#include "framestats.h"
+#include "framesync.h"
+#include "skeletonsnapshot.h"
+#include "sensorsource.h"
+#include "gesturetracker.h"
+#include "profiler.h"
+#include "skeletonstream.h"
+#include "usersegmentation.h"
+#include "userroi.h"
+#include "depthfilter.h"
+#include "jointfilter.h"
+#include "jointpredictor.h"
+#include "dtwrecognizer.h"
+#include "logger.h"
+
 // namespace
 using namespace std;
 
-/* Class for control OpenNI device */
-class COpenNI
+/* One processed frame, handed from the capture thread to the GUI */
+struct SKinectFrame
 {
-public:
-	/* Destructor */
-	~COpenNI()
-	{
-		m_Context.Release();
-	}
-
-	/* Initial OpenNI context and create nodes. */
-	bool Initial()
-	{
-		// Initial OpenNI Context
-		m_eResult = m_Context.Init();
-		if( CheckError( "Context Initial failed" ) )
-			return false;
-
-        m_eResult = m_Context.SetGlobalMirror(true);
-        if(CheckError( "Set Global Mirror Error" ))
-            return false;
+	XnUInt32			m_nFrameID;
+	XnUInt64			m_nTimestamp;
+	XnUInt64			m_nReadyTime;		// CFrameStats::Now() when OpenNI returned the data
 
-		// create image node
-		m_eResult = m_Image.Create( m_Context );
-		if( CheckError( "Create Image Generator Error" ) )
-			return false;
-
-		// create depth node
-		m_eResult = m_Depth.Create( m_Context );
-		if( CheckError( "Create Depth Generator Error" ) )
-			return false;
-
-		// create user node
-		m_eResult = m_User.Create( m_Context );
-		if( CheckError( "Create User Generator Error" ) )
-			return false;
+	int					m_iDepthXRes;
+	int					m_iDepthYRes;
+	vector<uchar>		m_vDepthARGB;
 
-		// set nodes
-		m_eResult = m_Depth.GetAlternativeViewPointCap().SetViewPoint( m_Image );
-		CheckError( "Can't set the alternative view point on depth generator" );
+	int					m_iImageXRes;
+	int					m_iImageYRes;
+	vector<uchar>		m_vImageRGB;
+	shared_ptr<const CFrameSync::SBuffer>	m_pSyncImage;	// image of the synchronized pair, shared instead of m_vImageRGB
+	vector<uchar>		m_vUserRGB;			// image with colored users, empty if not shown
 
-		XnCallbackHandle hUserCB;
-		m_User.RegisterUserCallbacks( CB_NewUser, NULL, NULL, hUserCB );
+	CSkeletonSnapshot	m_Skeleton;
 
-        m_User.GetSkeletonCap().SetSkeletonProfile( XN_SKEL_PROFILE_ALL );
-        //m_User.GetSkeletonCap().SetSkeletonProfile( XN_SKEL_PROFILE_UPPER );
-		XnCallbackHandle hCalibCB;
-		m_User.GetSkeletonCap().RegisterToCalibrationComplete( CB_CalibrationComplete, &m_User, hCalibCB );
-
-		XnCallbackHandle hPoseCB;
-		m_User.GetPoseDetectionCap().RegisterToPoseDetected( CB_PoseDetected, &m_User, hPoseCB );
-
-		return true;
-	}
-
-	/* Start to get the data from device */
-	bool Start()
-	{
-		m_eResult = m_Context.StartGeneratingAll();
-		return !CheckError( "Start Generating" );
-	}
-
-	/* Update / Get new data */
-	bool UpdateData()
+	/* RGB pixels of the image, NULL if there is none */
+	const uchar* ImageData() const
 	{
-		// update
-		m_eResult = m_Context.WaitNoneUpdateAll();
-		if( CheckError( "Update Data" ) )
-			return false;
-
-		// get new data
-		m_Depth.GetMetaData( m_DepthMD );
-		m_Image.GetMetaData( m_ImageMD );
-
-		return true;
+		if( m_pSyncImage )
+			return m_pSyncImage->Image();
+		return m_vImageRGB.empty() ? NULL : &m_vImageRGB[0];
 	}
-
-	/* Get User generator */
-	xn::UserGenerator& GetUserGenerator()
-	{
-		return m_User;
-	}
-
-	/* Get Depth generator */
-	xn::DepthGenerator& GetDepthGenerator()
-	{
-		return m_Depth;
-	}
-
-public:
-	xn::DepthMetaData		m_DepthMD;
-	xn::ImageMetaData		m_ImageMD;
-
-private:
-	/* Check return status m_eResult.
-	 * return false if the value is XN_STATUS_OK, true for error */
-	bool CheckError( const char* sError )
-	{
-		if( m_eResult != XN_STATUS_OK )
-		{
-			cerr << sError << ": " << xnGetStatusString( m_eResult ) << endl;
-			return true;
-		}
-		return false;
-	}
-
-private:
-	static void XN_CALLBACK_TYPE CB_NewUser( xn::UserGenerator& generator, XnUserID user, void* pCookie )
-	{
-        pCookie;
-		cout << "New user identified: " << user << endl;
-		generator.GetPoseDetectionCap().StartPoseDetection("Psi", user);
-	}
-
-	static void XN_CALLBACK_TYPE CB_CalibrationComplete( xn::SkeletonCapability& skeleton, XnUserID user, XnCalibrationStatus calibrationError, void* pCookie )
-	{
-		cout << "Calibration complete for user " <<  user << ", ";
-		if( calibrationError == XN_CALIBRATION_STATUS_OK )
-		{
-			cout << "Success" << endl;
-			skeleton.StartTracking( user );
-		}
-		else
-		{
-			cout << "Failure" << endl;
-			xn::UserGenerator* pUser = (xn::UserGenerator*)pCookie;
-			pUser->GetPoseDetectionCap().StartPoseDetection( "Psi", user );
-		}
-	}
-
-	static void XN_CALLBACK_TYPE CB_PoseDetected( xn::PoseDetectionCapability& poseDetection, const XnChar* strPose, XnUserID user, void* pCookie)
-	{
-		cout << "Pose " << strPose << " detected for user " <<  user << endl;
-		xn::UserGenerator* pUser = (xn::UserGenerator*)pCookie;
-		pUser->GetSkeletonCap().RequestCalibration( user, FALSE );
-		poseDetection.StopPoseDetection( user );
-	}
-	
-private:
-	XnStatus			m_eResult;
-	xn::Context			m_Context;
-	xn::DepthGenerator	m_Depth;
-	xn::ImageGenerator	m_Image;
-	xn::UserGenerator	m_User;
 };
 
 /* Class for draw skeleton */
@@ -167,7 +74,7 @@ class CSkelItem : public QGraphicsItem
 {
 public:
 	/* Constructor */
-	CSkelItem( XnUserID& uid, COpenNI& rOpenNI ) : QGraphicsItem(), m_UserID( uid ), m_OpenNI( rOpenNI )
+	CSkelItem( XnUserID uid ) : QGraphicsItem(), m_UserID( uid )
 	{
 		// build lines connection table
 		// body and head
@@ -227,36 +134,15 @@ public:
 		}
 	}
 
-	/* update skeleton data */
-    void UpdateSkeleton(XnPoint3D &pos)
-	{
-		// read the position in real world
-		XnPoint3D	JointsReal[15];
-		JointsReal[ 0] = GetSkeletonPos( XN_SKEL_HEAD			);
-		JointsReal[ 1] = GetSkeletonPos( XN_SKEL_NECK			);
-		JointsReal[ 2] = GetSkeletonPos( XN_SKEL_TORSO			);
-		JointsReal[ 3] = GetSkeletonPos( XN_SKEL_LEFT_SHOULDER	);
-		JointsReal[ 4] = GetSkeletonPos( XN_SKEL_LEFT_ELBOW		);
-		JointsReal[ 5] = GetSkeletonPos( XN_SKEL_LEFT_HAND		);
-		JointsReal[ 6] = GetSkeletonPos( XN_SKEL_RIGHT_SHOULDER	);
-		JointsReal[ 7] = GetSkeletonPos( XN_SKEL_RIGHT_ELBOW	);
-		JointsReal[ 8] = GetSkeletonPos( XN_SKEL_RIGHT_HAND		);
-		JointsReal[ 9] = GetSkeletonPos( XN_SKEL_LEFT_HIP		);
-		JointsReal[10] = GetSkeletonPos( XN_SKEL_LEFT_KNEE		);
-		JointsReal[11] = GetSkeletonPos( XN_SKEL_LEFT_FOOT		);
-		JointsReal[12] = GetSkeletonPos( XN_SKEL_RIGHT_HIP		);
-		JointsReal[13] = GetSkeletonPos( XN_SKEL_RIGHT_KNEE		);
-		JointsReal[14] = GetSkeletonPos( XN_SKEL_RIGHT_FOOT		);
-
-		// convert form real world to projective
-		m_OpenNI.GetDepthGenerator().ConvertRealWorldToProjective( 15, JointsReal, m_aJoints );
-        //qDebug("Left hand: (%f, %f)", JointsReal[8].X, JointsReal[8].Y);
-        //captureAction(JointsReal[8]);
-        pos = JointsReal[8];
+	/* update skeleton data from a user of the snapshot */
+	void UpdateSkeleton( const CSkeletonSnapshot& rSnapshot, unsigned int iUser )
+	{
+		prepareGeometryChange();
+		m_UserID = rSnapshot.GetUserID( iUser );
+		memcpy( m_aJoints, rSnapshot.GetProjective( iUser ), sizeof( m_aJoints ) );
 	}
 
 public:
-	COpenNI&	m_OpenNI;
 	XnUserID	m_UserID;
 	XnPoint3D	m_aJoints[15];
     //static XnPoint3D m_lastHandJoint;
@@ -303,45 +189,424 @@ private:
 		for( unsigned int i = 0; i < 15; ++ i )
 			painter->drawEllipse( QPointF( m_aJoints[i].X, m_aJoints[i].Y ), 5, 5 );
 	}
+};
+
+/* Event posted to the GUI when a new frame is ready */
+enum { FRAME_READY_EVENT = QEvent::User + 1 };
+
+/* Stages timed by the profiler, the first five run in the capture thread */
+enum EStage
+{
+	STAGE_UPDATE,		// UpdateData(), includes waiting for the sensor
+	STAGE_FILTER,		// hole filling, smoothing and temporal average of the depth
+	STAGE_COLORIZE,
+	STAGE_SKELETON,
+	STAGE_SEGMENT,		// label map of the users blended on the image
+	STAGE_PIXMAP,		// QPixmap::fromImage of depth and image
+	STAGE_GESTURE,
+	STAGE_LATENCY,		// data ready in the capture thread to the frame shown by the GUI
+	STAGE_COUNT
+};
+static const char* g_aStageName[STAGE_COUNT] = { "UpdateData", "Filter", "Colorize", "Skeleton", "Segment", "Pixmap", "Gesture", "Latency" };
+
+/* Thread to read data from OpenNI and prepare frames for the GUI */
+class CCaptureThread : public QThread
+{
+public:
+	/* Constructor */
+	CCaptureThread( COpenNI& rOpenNI, CProfiler& rProfiler )
+		: m_OpenNI( rOpenNI ), m_Profiler( rProfiler ), m_pReceiver( NULL ), m_bEventPending( false ), m_bShowUsers( false ), m_bLabels( false ), m_bROI( false ),
+		  m_JointFilter( CJointFilter::FILTER_NONE ), m_Stats( "Sensor" ), m_bSync( false )
+	{}
+
+	/* Show only depth and image taken within nTolerance microseconds, set before start() */
+	void SyncFrames( XnUInt64 nTolerance )
+	{
+		m_bSync = true;
+		m_Sync.SetTolerance( nTolerance );
+	}
+
+	/* Colorize the depth only around the tracked users, set before start() */
+	void UseROI( bool bROI )
+	{
+		m_bROI = bROI;
+	}
+
+	/* Share of the depth colorized, valid after Stop() */
+	const CUserROI* GetROI() const
+	{
+		return m_bROI ? &m_ROI : NULL;
+	}
+
+	/* Pairs and unmatched frames, valid after Stop() */
+	const CFrameSync* GetSync() const
+	{
+		return m_bSync ? &m_Sync : NULL;
+	}
+
+	/* Smooth the skeleton joints, FILTER_NONE shows them raw. Set before start() */
+	void SmoothJoints( CJointFilter::EMode eMode )
+	{
+		m_JointFilter.SetMode( eMode );
+	}
 
-	XnPoint3D GetSkeletonPos( XnSkeletonJoint eJointName )
+	/* Jitter and lag of the joint filter, valid after Stop() */
+	const CJointFilter& GetJointFilter() const
 	{
-		// get position
-		XnSkeletonJointPosition mPos;
-		m_OpenNI.GetUserGenerator().GetSkeletonCap().GetSkeletonJointPosition( m_UserID, eJointName, mPos );
+		return m_JointFilter;
+	}
+
+	/* Filter the depth map before it is colorized, set before start(). The
+	 * filter and its pool thread only exist while it is on */
+	void FilterDepth( bool bFilter )
+	{
+		if( !bFilter )
+			m_pFilter.reset();
+		else if( !m_pFilter )
+			m_pFilter.reset( new CDepthFilter( 2 ) );
+	}
 
-		// convert to XnPoint3D
-		return xnCreatePoint3D( mPos.position.X, mPos.position.Y, mPos.position.Z );
+	/* Blend the users on the image of each frame, set before start() */
+	void ShowUsers( bool bShow )
+	{
+		m_bShowUsers = bShow;
+	}
+
+	/* Set the object which gets FRAME_READY_EVENT for each new frame */
+	void SetReceiver( QObject* pReceiver )
+	{
+		m_pReceiver = pReceiver;
+	}
+
+	/* The receiver handled the event, the next frame may post again */
+	void FrameHandled()
+	{
+		m_bEventPending = false;
+	}
+
+	/* Frames read from the sensor, valid after Stop() */
+	const CFrameStats& GetStats() const
+	{
+		return m_Stats;
+	}
+
+	/* Destructor */
+	~CCaptureThread()
+	{
+		Stop();
+	}
+
+	/* Ask the thread to leave and wait for it */
+	void Stop()
+	{
+		requestInterruption();
+		wait();
 	}
+
+	/* Frames for the GUI */
+	CTripleBuffer<SKinectFrame>& GetFrames()
+	{
+		return m_Frames;
+	}
+
+protected:
+	void run()
+	{
+		while( !isInterruptionRequested() )
+		{
+			// wait for new data, a recording stops at its end and a lost sensor after a few retries
+			{
+				PROFILE_SCOPE( m_Profiler, STAGE_UPDATE );
+				if( !m_OpenNI.UpdateData( true ) )
+				{
+					if( !m_OpenNI.RetryUpdate() )
+						break;
+					continue;
+				}
+			}
+
+			// wait until a depth frame has its image
+			if( m_bSync )
+			{
+				m_Sync.PushDepth( m_OpenNI.m_DepthMD );
+				m_Sync.PushImage( m_OpenNI.m_ImageMD );
+				if( !m_Sync.GetPair( m_Pair ) )
+					continue;
+			}
+
+			SKinectFrame& rFrame = m_Frames.Back();
+			rFrame.m_nFrameID = m_bSync ? m_Pair.m_pDepth->m_nFrameID : m_OpenNI.m_DepthMD.FrameID();
+			rFrame.m_nTimestamp = m_bSync ? m_Pair.m_pDepth->m_nTimestamp : m_OpenNI.m_DepthMD.Timestamp();
+			rFrame.m_nReadyTime = CFrameStats::Now();
+			m_Stats.OnFrame( rFrame.m_nFrameID );
+
+			// skeleton and users are always of the newest depth, a pair may be a frame older;
+			// then the users are left out (see ReadUsers). The depth comes last, its regions
+			// of interest are made from the users
+			ReadImage( rFrame );
+			ReadSkeleton( rFrame );
+			ReadUsers( rFrame );
+			ReadDepth( rFrame );
+			m_Frames.Publish();
+
+			// wake up the GUI, once until it has handled the event
+			if( m_pReceiver != NULL && !m_bEventPending.exchange( true ) )
+				QCoreApplication::postEvent( m_pReceiver, new QEvent( QEvent::Type( FRAME_READY_EVENT ) ) );
+		}
+	}
+
+private:
+	/* convert depth to ARGB */
+	void ReadDepth( SKinectFrame& rFrame )
+	{
+		const xn::DepthMetaData& rMD = m_OpenNI.m_DepthMD;
+		int iXRes = m_bSync ? m_Pair.m_pDepth->m_iXRes : rMD.XRes();
+		int iYRes = m_bSync ? m_Pair.m_pDepth->m_iYRes : rMD.YRes();
+		unsigned int iSize = iXRes * iYRes;
+		const XnDepthPixel* pDepth = m_bSync ? m_Pair.m_pDepth->Depth() : rMD.Data();
+		if( m_pFilter )
+		{
+			PROFILE_SCOPE( m_Profiler, STAGE_FILTER );
+			pDepth = m_pFilter->Process( pDepth, iXRes, iYRes );
+		}
+
+		PROFILE_SCOPE( m_Profiler, STAGE_COLORIZE );
+		rFrame.m_iDepthXRes = iXRes;
+		rFrame.m_iDepthYRes = iYRes;
+		rFrame.m_vDepthARGB.resize( 4 * iSize );
+		if( !m_bROI )
+		{
+			m_Colorizer.Colorize( pDepth, iSize, &rFrame.m_vDepthARGB[0] );
+			return;
+		}
+
+		// only around the users, on the background elsewhere. The joints and labels are in
+		// the depth view of the newest frame: a registered depth is moved to the image by
+		// up to about 30 px at VGA, a synchronized pair may be a frame older
+		unsigned int iShift = ( m_OpenNI.IsDepthRegistered() ? 32 : 0 ) + ( m_bSync ? 32 : 0 );
+		m_ROI.SetMargin( CUserROI::MARGIN + iShift * iXRes / 640 );
+		const xn::SceneMetaData& rSceneMD = m_Segmentation.GetSceneMetaData();
+		m_ROI.Begin( iXRes, iYRes );
+		m_ROI.AddSkeleton( rFrame.m_Skeleton );
+		if( m_bLabels && (int)rSceneMD.XRes() == iXRes && (int)rSceneMD.YRes() == iYRes )
+			m_ROI.AddUsers( m_Segmentation );
+		m_ROI.End();
+		m_ROI.Colorize( m_Colorizer, pDepth, &rFrame.m_vDepthARGB[0] );
+	}
+
+	/* copy RGB image, OpenNI reuses its buffer on next update */
+	void ReadImage( SKinectFrame& rFrame )
+	{
+		// the synchronizer already holds a copy, the frame shares it
+		if( m_bSync )
+		{
+			rFrame.m_iImageXRes = m_Pair.m_pImage->m_iXRes;
+			rFrame.m_iImageYRes = m_Pair.m_pImage->m_iYRes;
+			rFrame.m_vImageRGB.clear();
+			rFrame.m_pSyncImage = m_Pair.m_pImage;
+			return;
+		}
+
+		const xn::ImageMetaData& rMD = m_OpenNI.m_ImageMD;
+		unsigned int iSize = 3 * rMD.XRes() * rMD.YRes();
+
+		rFrame.m_iImageXRes = rMD.XRes();
+		rFrame.m_iImageYRes = rMD.YRes();
+
+		// a raw dump without image, ImageData() is NULL
+		if( iSize == 0 || rMD.Data() == NULL )
+		{
+			rFrame.m_vImageRGB.clear();
+			return;
+		}
+		rFrame.m_vImageRGB.resize( iSize );
+		memcpy( &rFrame.m_vImageRGB[0], rMD.Data(), iSize );
+	}
+
+	/* read skeleton of tracked users, straight into the frame */
+	void ReadSkeleton( SKinectFrame& rFrame )
+	{
+		if( !m_OpenNI.HasUserGenerator() )
+			return;
+		PROFILE_SCOPE( m_Profiler, STAGE_SKELETON );
+		if( m_JointFilter.GetMode() == CJointFilter::FILTER_NONE )
+		{
+			rFrame.m_Skeleton.Update( m_OpenNI.GetUserGenerator(), m_OpenNI.GetDepthGenerator() );
+			return;
+		}
+
+		// smooth the real world positions before they are projected
+		if( rFrame.m_Skeleton.Read( m_OpenNI.GetUserGenerator() ) != XN_STATUS_OK )
+			return;
+		m_JointFilter.Filter( rFrame.m_Skeleton, rFrame.m_nTimestamp );
+		rFrame.m_Skeleton.Project( m_OpenNI.GetDepthGenerator() );
+	}
+
+	/* color the pixels of every user on a copy of the image */
+	void ReadUsers( SKinectFrame& rFrame )
+	{
+		rFrame.m_vUserRGB.clear();
+		m_bLabels = false;
+		if( !m_bShowUsers || !m_OpenNI.HasUserGenerator() || rFrame.ImageData() == NULL )
+			return;
+
+		// the label map is of the newest depth, over the image of an older pair it would tear
+		if( m_bSync && m_Pair.m_pDepth->m_nFrameID != m_OpenNI.m_DepthMD.FrameID() )
+			return;
+		PROFILE_SCOPE( m_Profiler, STAGE_SEGMENT );
+		if( m_Segmentation.Update( m_OpenNI.GetUserGenerator() ) != XN_STATUS_OK )
+			return;
+		m_bLabels = true;
+
+		// the label map is at depth resolution, without registration only a same size image fits
+		const xn::SceneMetaData& rSceneMD = m_Segmentation.GetSceneMetaData();
+		if( (int)rSceneMD.XRes() != rFrame.m_iImageXRes || (int)rSceneMD.YRes() != rFrame.m_iImageYRes )
+			return;
+		rFrame.m_vUserRGB.resize( 3 * rFrame.m_iImageXRes * rFrame.m_iImageYRes );
+		m_Segmentation.Blend( rSceneMD.Data(), rFrame.ImageData(), rSceneMD.XRes() * rSceneMD.YRes(), &rFrame.m_vUserRGB[0] );
+	}
+
+private:
+	COpenNI&					m_OpenNI;
+	CProfiler&					m_Profiler;
+	QObject*					m_pReceiver;
+	std::atomic<bool>			m_bEventPending;
+	bool						m_bShowUsers;
+	CUserSegmentation			m_Segmentation;
+	bool						m_bLabels;			// m_Segmentation has the label map of this frame
+	bool						m_bROI;
+	CUserROI					m_ROI;
+	std::unique_ptr<CDepthFilter>	m_pFilter;		// NULL without --filter
+	CJointFilter				m_JointFilter;
+	CFrameStats					m_Stats;
+	CDepthColorizer				m_Colorizer;
+	CTripleBuffer<SKinectFrame>	m_Frames;
+	bool						m_bSync;
+	CFrameSync					m_Sync;
+	CFrameSync::SPair			m_Pair;
 };
 
-/* Timer to update image in scene from OpenNI */
+/* Update image in scene when the capture thread has a new frame */
 class CKinectReader: public QObject
 {
 public:
 	/* Constructor */
 	CKinectReader( COpenNI& rOpenNI, QGraphicsScene& rScene )
-		: m_OpenNI( rOpenNI ), m_Scene( rScene )
-	{}
+		: m_OpenNI( rOpenNI ), m_Scene( rScene ), m_pItemProfile( NULL ),
+		  m_Profiler( g_aStageName, STAGE_COUNT ), m_Capture( rOpenNI, m_Profiler ), m_ShowStats( "Display" ),
+		  m_nOverlayEvery( 30 ), m_bPredict( false ), m_nExtraDelay( 0 ), m_bRecognize( false ), m_nRecordStart( 0 )
+	{
+		m_FOV.fHFOV = m_FOV.fVFOV = 0;
+	}
+
+	/* Draw the skeleton where it will be when it is seen. nExtraDelay in microseconds is
+	 * the time not measured by the reader, from the exposure to the data and from the
+	 * event to the screen. Call before Start() */
+	void PredictJoints( XnUInt64 nExtraDelay )
+	{
+		m_bPredict = true;
+		m_nExtraDelay = nExtraDelay;
+	}
+
+	/* Show the recorded gestures found in sTemplates. With sRecord, record the first
+	 * tracked user as a new gesture of that name and add it to sTemplates. Call before Start() */
+	bool RecognizeGestures( const char* sTemplates, const char* sRecord )
+	{
+		m_sTemplates = sTemplates;
+		m_sRecord = sRecord ? sRecord : "";
+		m_bRecognize = true;
+
+		// a new file is created by the first recording
+		if( !m_Recognizer.Load( sTemplates ) && m_sRecord.empty() )
+		{
+			cerr << "Can't read gestures from " << sTemplates << endl;
+			m_bRecognize = false;
+		}
+		return m_bRecognize;
+	}
+
+	/* Filter the depth before it is shown, call before Start() */
+	void FilterDepth( bool bFilter )
+	{
+		m_Capture.FilterDepth( bFilter );
+	}
+
+	/* Pair depth and image frames taken within nTolerance microseconds, call before Start() */
+	void SyncFrames( XnUInt64 nTolerance )
+	{
+		m_Capture.SyncFrames( nTolerance );
+	}
+
+	/* Colorize the depth only around the tracked users, call before Start() */
+	void UseROI( bool bROI )
+	{
+		m_Capture.UseROI( bROI );
+	}
+
+	/* Show the users colored over the image, call before Start() */
+	void ShowUsers( bool bShow )
+	{
+		m_Capture.ShowUsers( bShow );
+	}
+
+	/* Smooth the skeleton joints, call before Start() */
+	void SmoothJoints( CJointFilter::EMode eMode )
+	{
+		m_Capture.SmoothJoints( eMode );
+	}
+
+	/* Profiler of the capture and display stages, empty unless built with KINECT_PROFILE */
+	const CProfiler& GetProfiler() const
+	{
+		return m_Profiler;
+	}
 
 	/* Destructor */
 	~CKinectReader()
 	{
 		m_Scene.removeItem( m_pItemImage );
+		m_Scene.removeItem( m_pItemUsers );
 		m_Scene.removeItem( m_pItemDepth );
-		delete [] m_pDepthARGB;
+		m_Capture.Stop();
+
+		m_Capture.GetStats().Report( cout );
+		if( m_Capture.GetSync() != NULL )
+			m_Capture.GetSync()->Report( cout );
+		if( m_Capture.GetROI() != NULL )
+			m_Capture.GetROI()->Report( cout );
+		if( m_Capture.GetJointFilter().GetMode() != CJointFilter::FILTER_NONE )
+			m_Capture.GetJointFilter().Report( cout );
+		m_ShowStats.Report( cout );
+		if( m_bPredict )
+			m_Predictor.Report( cout );
+		CLogger::Get().Flush();
+		CLogger::Get().Report( cout );
+#if KINECT_PROFILE
+		m_Profiler.Report( cout );
+#endif
 	}
 
 	/* Start to update Qt Scene from OpenNI device */
-    bool Start( int iInterval = 33 )
-    //bool Start( int iInterval = 1000 )
+	bool Start()
 	{
 		m_OpenNI.Start();
 
+		// the overlay follows the frame rate of the profile, raw dumps don't know theirs
+		if( m_OpenNI.GetFPS() > 0 )
+			m_nOverlayEvery = m_OpenNI.GetFPS();
+
+		// predicted joints are projected in this thread, without the depth generator
+		if( m_bPredict && !m_OpenNI.GetFieldOfView( m_FOV ) )
+			m_bPredict = false;
+
 		// add an empty Image to scene
 		m_pItemImage = m_Scene.addPixmap( QPixmap() );
 		m_pItemImage->setZValue( 1 );
 
+		// add an empty user layer, over the image and under the depth
+		m_pItemUsers = m_Scene.addPixmap( QPixmap() );
+		m_pItemUsers->setZValue( 1.5 );
+
 		// add an empty Depth to scene
 		m_pItemDepth = m_Scene.addPixmap( QPixmap() );
 		m_pItemDepth->setZValue( 2 );
@@ -350,11 +615,18 @@ public:
         m_pItemAction->setZValue(3);
         m_pItemAction->setFont(QFont("MS Shell Dlg 2", 30));
 
-		// update first to get the depth map size
-		m_OpenNI.UpdateData();
-		m_pDepthARGB = new uchar[4*m_OpenNI.m_DepthMD.XRes()*m_OpenNI.m_DepthMD.YRes()];
+#if KINECT_PROFILE
+		// profiler overlay under the action
+		m_pItemProfile = m_Scene.addText( "" );
+		m_pItemProfile->setZValue( 4 );
+		m_pItemProfile->setPos( 0, 50 );
+		m_pItemProfile->setDefaultTextColor( Qt::yellow );
+		m_pItemProfile->setFont( QFont( "Courier New", 9 ) );
+#endif
 
-		startTimer( iInterval );
+		// read OpenNI in its own thread, it posts an event for each new frame
+		m_Capture.SetReceiver( this );
+		m_Capture.start();
 		return true;
 	}
 
@@ -363,179 +635,337 @@ private:
 	QGraphicsScene&			m_Scene;
 	QGraphicsPixmapItem*	m_pItemDepth;
 	QGraphicsPixmapItem*	m_pItemImage;
+	QGraphicsPixmapItem*	m_pItemUsers;
     QGraphicsTextItem*      m_pItemAction;
-	uchar*					m_pDepthARGB;
+	QGraphicsTextItem*		m_pItemProfile;
+	CProfiler				m_Profiler;
+	CCaptureThread			m_Capture;
+	CFrameStats				m_ShowStats;
+	unsigned int			m_nOverlayEvery;	// frames between overlay refreshes
 	vector<CSkelItem*>		m_vSkeleton;
-    XnPoint3D m_lastHandJoint;
-    enum {D = 20};
-    QString m_Action;
+	CGestureTracker			m_Gesture;
+	QString					m_sAction;
+	bool					m_bPredict;
+	XnUInt64				m_nExtraDelay;		// microseconds
+	XnFieldOfView			m_FOV;
+	CJointPredictor			m_Predictor;
+	CSkeletonSnapshot		m_Predicted;
+	bool					m_bRecognize;
+	CDtwRecognizer			m_Recognizer;
+	string					m_sTemplates;
+	string					m_sRecord;			// name of the gesture to record, empty when done
+	XnUInt64				m_nRecordStart;		// sensor time the first user was tracked
 
 private:
-    void captureAction(XnPoint3D &pos)
-    {
-        double diffX = pos.X - m_lastHandJoint.X;
-        double diffY = pos.Y - m_lastHandJoint.Y;
-        double diffZ = pos.Z - m_lastHandJoint.Z;
-
-        m_lastHandJoint.X = pos.X;
-        m_lastHandJoint.Y = pos.Y;
-        m_lastHandJoint.Z = pos.Z;
-
-        if((pos.X == diffX) &&
-                (pos.Y == diffY) && (pos.Z == diffZ))
-            return ;
-
-#if 0
-        if(diffZ > D)
-        {
-            cout << "Back: " << diffZ << endl;
-            return;
-        }
-#endif
+	/* Recorded gestures of every user, or the recording of a new one */
+	void FindGestures( const CSkeletonSnapshot& rSkeleton, XnUInt64 nTime )
+	{
+		m_Recognizer.Update( rSkeleton, nTime );
+		for( unsigned int i = 0; m_sRecord.empty() && i < rSkeleton.GetUserCount(); ++ i )
+		{
+			int iMatch = m_Recognizer.GetMatch( rSkeleton.GetUserID( i ) );
+			if( iMatch < 0 )
+				continue;
+			CLogger::Get().Log( "User %u: %s (%g)", rSkeleton.GetUserID( i ), m_Recognizer.GetTemplateName( iMatch ), m_Recognizer.GetMatchDistance( rSkeleton.GetUserID( i ) ) );
+			m_sAction = QString( "%1 (user %2)" ).arg( m_Recognizer.GetTemplateName( iMatch ) ).arg( rSkeleton.GetUserID( i ) );
+		}
+		if( m_sRecord.empty() || rSkeleton.GetUserCount() == 0 )
+			return;
+
+		// two seconds to get ready, then one window of the gesture
+		const XnUInt64 nReady = 2000000;
+		if( m_nRecordStart == 0 )
+			m_nRecordStart = nTime;
+		if( nTime < m_nRecordStart + nReady )
+		{
+			m_sAction = QString( "%1 in %2" ).arg( m_sRecord.c_str() ).arg( ( m_nRecordStart + nReady - nTime ) / 1000000 + 1 );
+			return;
+		}
+		m_sAction = QString( "recording %1" ).arg( m_sRecord.c_str() );
+		if( nTime < m_nRecordStart + nReady + m_Recognizer.GetWindow() )
+			return;
 
-        if(diffZ < -D)
-        {
-            cout << "Stop: " << diffZ << endl;
-            m_Action = "Stop";
-            return ;
-        }
-
-        if(diffX > D)
-        {
-            qDebug("(%f,%f) - (%f,%f)", pos.X, pos.Y,
-                   m_lastHandJoint.X, m_lastHandJoint.Y);
-            cout << "Right: " << diffX << endl;
-            m_Action = "Right";
-            return ;
-        }
-
-        if(diffX < -D)
-        {
-            cout << "Left" << endl;
-            m_Action = "Left";
-            return ;
-        }
-
-        if(diffY > D)
-        {
-            cout << "Up" << endl;
-            m_Action = "Up";
-            return ;
-        }
-
-        if(diffY < -D)
-        {
-            cout << "Down" << endl;
-            m_Action = "Down";
-            return ;
-        }
-
-    }
-
-	void timerEvent( QTimerEvent *event )
-	{
-        event->ignore();
-        QApplication::processEvents();
-		// Read OpenNI data
-		m_OpenNI.UpdateData();
+		if( m_Recognizer.RecordTemplate( rSkeleton.GetUserID( 0 ), m_sRecord.c_str() ) < 0 )
+		{
+			// the user was lost in the window, start over
+			m_nRecordStart = 0;
+			return;
+		}
+		if( m_Recognizer.Save( m_sTemplates.c_str() ) )
+			m_sAction = QString( "recorded %1" ).arg( m_sRecord.c_str() );
+		else
+			cerr << "Can't write gestures to " << m_sTemplates << endl;
+		m_sRecord.clear();
+	}
+
+	void customEvent( QEvent *event )
+	{
+		if( event->type() != FRAME_READY_EVENT )
+			return;
+
+		// take the newest frame, it may already be shown by an earlier event
+		m_Capture.FrameHandled();
+		CTripleBuffer<SKinectFrame>& rFrames = m_Capture.GetFrames();
+		if( !rFrames.Update() )
+			return;
+		const SKinectFrame& rFrame = rFrames.Front();
 
 		// Read Image
 		{
-			// convert to RGBA format
-			const XnDepthPixel*  pDepth = m_OpenNI.m_DepthMD.Data();
-            unsigned int iSize = m_OpenNI.m_DepthMD.XRes()*m_OpenNI.m_DepthMD.YRes();
+			PROFILE_SCOPE( m_Profiler, STAGE_PIXMAP );
+
+			// Update Depth data
+			m_pItemDepth->setPixmap( QPixmap::fromImage( QImage( &rFrame.m_vDepthARGB[0], rFrame.m_iDepthXRes, rFrame.m_iDepthYRes, QImage::Format_ARGB32 ) ) );
+
+			// Update Image data
+			m_pItemImage->setPixmap( QPixmap::fromImage( QImage( rFrame.ImageData(), rFrame.m_iImageXRes, rFrame.m_iImageYRes, QImage::Format_RGB888 ) ) );
+
+			// Update user layer, hidden in frames without label map
+			m_pItemUsers->setVisible( !rFrame.m_vUserRGB.empty() );
+			if( !rFrame.m_vUserRGB.empty() )
+				m_pItemUsers->setPixmap( QPixmap::fromImage( QImage( &rFrame.m_vUserRGB[0], rFrame.m_iImageXRes, rFrame.m_iImageYRes, QImage::Format_RGB888 ) ) );
+		}
 
-			// fin the max value
-			XnDepthPixel tMax = *pDepth;
-			for( unsigned int i = 1; i < iSize; ++ i )
+		// Read Skeleton
+		const CSkeletonSnapshot& rSkeleton = rFrame.m_Skeleton;
+		const CSkeletonSnapshot* pShown = &rSkeleton;
+		if( m_bPredict )
+		{
+			// from the sensor time to now, plus what happens before and after
+			m_Predictor.Update( rSkeleton, rFrame.m_nTimestamp );
+			m_Predicted = rSkeleton;
+			m_Predictor.Predict( m_Predicted, CFrameStats::Now() - rFrame.m_nReadyTime + m_nExtraDelay );
+			m_Predicted.Project( m_FOV, rFrame.m_iDepthXRes, rFrame.m_iDepthYRes );
+			pShown = &m_Predicted;
+		}
+		for( unsigned int i = 0; i < rSkeleton.GetUserCount(); ++ i )
+		{
+			if( i >= m_vSkeleton.size() )
 			{
-				if( pDepth[i] > tMax )
-					tMax = pDepth[i];
+				// create new skeleton item
+				CSkelItem* pSkeleton = new CSkelItem( rSkeleton.GetUserID( i ) );
+				m_Scene.addItem( pSkeleton );
+				m_vSkeleton.push_back( pSkeleton );
+				pSkeleton->setZValue( 10 );
 			}
 
-			// redistribute data to 0-255
-			int idx = 0;
-			for( unsigned int i = 1; i < iSize; ++ i )
+			// update skeleton item data
+			m_vSkeleton[i]->UpdateSkeleton( *pShown, i );
+			m_vSkeleton[i]->setVisible( true );
+		}
+
+		// swipes of the right hand, every user separately, timed by the sensor clock
+		{
+			PROFILE_SCOPE( m_Profiler, STAGE_GESTURE );
+			m_Gesture.Update( rSkeleton, XN_SKEL_RIGHT_HAND, rFrame.m_nTimestamp );
+			for( unsigned int i = 0; i < rSkeleton.GetUserCount(); ++ i )
 			{
-				if( (*pDepth) != 0 )
-				{
-					m_pDepthARGB[ idx++ ] = 0;									// Blue
-					m_pDepthARGB[ idx++ ] = 255 * ( tMax - *pDepth ) / tMax;		// Green
-					m_pDepthARGB[ idx++ ] = 255 * *pDepth / tMax;				// Red
-					m_pDepthARGB[ idx++ ] = 255 * ( tMax - *pDepth ) / tMax;		// Alpha
-				}
-				else
-				{
-					m_pDepthARGB[ idx++ ] = 0;
-					m_pDepthARGB[ idx++ ] = 0;
-					m_pDepthARGB[ idx++ ] = 0;
-					m_pDepthARGB[ idx++ ] = 0;
-				}
-				++pDepth;
+				CGestureTracker::EAction eAction = m_Gesture.GetNewAction( rSkeleton.GetUserID( i ) );
+				if( eAction == CGestureTracker::ACTION_NONE )
+					continue;
+				CLogger::Get().Log( "User %u: %s", rSkeleton.GetUserID( i ), CGestureTracker::GetActionName( eAction ) );
+				m_sAction = QString( "%1 (user %2)" ).arg( CGestureTracker::GetActionName( eAction ) ).arg( rSkeleton.GetUserID( i ) );
 			}
+			if( m_bRecognize )
+				FindGestures( rSkeleton, rFrame.m_nTimestamp );
+		}
+		m_pItemAction->setPlainText( "Action: " + m_sAction );
 
-			// Update Depth data
-			m_pItemDepth->setPixmap( QPixmap::fromImage( QImage( m_pDepthARGB, m_OpenNI.m_DepthMD.XRes(), m_OpenNI.m_DepthMD.YRes(), QImage::Format_ARGB32 ) ) );
+		// hide un-used skeleton items
+		for( unsigned int i = rSkeleton.GetUserCount(); i < m_vSkeleton.size(); ++ i )
+			m_vSkeleton[i]->setVisible( false );
 
-			// Update Image data
-			m_pItemImage->setPixmap( QPixmap::fromImage( QImage( m_OpenNI.m_ImageMD.Data(), m_OpenNI.m_ImageMD.XRes(), m_OpenNI.m_ImageMD.YRes(), QImage::Format_RGB888 ) ) );
+		// count shown frames and the time since OpenNI returned the data
+		m_ShowStats.OnFrame( rFrame.m_nFrameID, rFrame.m_nReadyTime );
+
+#if KINECT_PROFILE
+		m_Profiler.Add( STAGE_LATENCY, CFrameStats::Now() - rFrame.m_nReadyTime );
+
+		// refresh the overlay once a second, the text layout costs more than all timers
+		if( m_ShowStats.Frames() % m_nOverlayEvery == 0 )
+		{
+			ostringstream sOut;
+			sOut.precision( 2 );
+			sOut << fixed;
+			m_Profiler.Report( sOut );
+			m_pItemProfile->setPlainText( QString::fromStdString( sOut.str() ) );
+		}
+#endif
+	}
+};
+
+/* Track skeletons and gestures without GUI, the results go to a skeleton stream */
+class CHeadlessTracker
+{
+public:
+	/* Constructor */
+	CHeadlessTracker( COpenNI& rOpenNI ) : m_OpenNI( rOpenNI ), m_Stats( "Sensor" )
+	{}
+
+	/* Run until the end of a recording or Ctrl-C */
+	bool Run( const char* sOutput )
+	{
+		if( !m_Writer.Open( sOutput, m_Skeleton ) )
+		{
+			cerr << "Can't create " << sOutput << endl;
+			return false;
 		}
+		if( !m_OpenNI.Start() )
+			return false;
 
-		// Read Skeleton
-		xn::UserGenerator& rUser = m_OpenNI.GetUserGenerator();
-		XnUInt16 nUsers = rUser.GetNumberOfUsers();
-		if( nUsers > 0 )
+		s_bInterrupted = 0;
+		signal( SIGINT, CB_Interrupt );
+		while( !s_bInterrupted )
 		{
-			// get user id
-			XnUserID* aUserID = new XnUserID[nUsers];
-			rUser.GetUsers( aUserID, nUsers );
-
-			// get skeleton for each user
-			unsigned int counter = 0;
-			xn::SkeletonCapability& rSC = rUser.GetSkeletonCap();
-			for( int i = 0; i < nUsers; ++i )
+			// wait for new data, a recording stops at its end and a lost sensor after a few retries
+			if( !m_OpenNI.UpdateData( true ) )
 			{
-				// if is tracking skeleton
-				if( rSC.IsTracking( aUserID[i] ) )
-				{
-					++counter;
-					if( counter > m_vSkeleton.size() )
-					{
-						// create new skeleton item
-						CSkelItem* pSkeleton = new CSkelItem( aUserID[i], m_OpenNI );
-						m_Scene.addItem( pSkeleton );
-						m_vSkeleton.push_back( pSkeleton );
-						pSkeleton->setZValue( 10 );
-					}
-					else
-						m_vSkeleton[ counter-1 ]->m_UserID = aUserID[i];
-
-					// update skeleton item data
-                    XnPoint3D pos;
-                    m_vSkeleton[ counter-1 ]->UpdateSkeleton(pos);
-                    captureAction(pos);
-                    m_pItemAction->setPlainText("Action: " + m_Action);
-					m_vSkeleton[ counter-1 ]->setVisible( true );
-				}
+				if( !m_OpenNI.RetryUpdate() )
+					break;
+				continue;
 			}
-			// hide un-used skeleton items
-			for( unsigned int i = counter; i < m_vSkeleton.size(); ++ i )
-				m_vSkeleton[i]->setVisible( false );
+			XnUInt64 nTimestamp = m_OpenNI.m_DepthMD.Timestamp();
+			XnUInt32 nFrameID = m_OpenNI.m_DepthMD.FrameID();
+			m_Stats.OnFrame( nFrameID );
+
+			if( m_OpenNI.HasUserGenerator() )
+				m_Skeleton.Update( m_OpenNI.GetUserGenerator(), m_OpenNI.GetDepthGenerator() );
 
-			// release user id area
-			delete [] aUserID;
+			// swipes of the right hand, every user separately
+			XnUInt8 aAction[CSkeletonSnapshot::MAX_USERS];
+			m_Gesture.Update( m_Skeleton, XN_SKEL_RIGHT_HAND, nTimestamp );
+			for( unsigned int i = 0; i < m_Skeleton.GetUserCount(); ++ i )
+				aAction[i] = (XnUInt8)m_Gesture.GetNewAction( m_Skeleton.GetUserID( i ) );
+
+			if( !m_Writer.Write( nTimestamp, nFrameID, m_Skeleton, aAction ) )
+			{
+				cerr << "Write Error: " << sOutput << endl;
+				return false;
+			}
 		}
+		m_Stats.Report( cout );
+		if( !m_Writer.Close() )
+		{
+			cerr << "Write Error: " << sOutput << endl;
+			return false;
+		}
+		return true;
 	}
-};
 
-/* Main function */
+private:
+	static void CB_Interrupt( int )
+	{
+		s_bInterrupted = 1;
+	}
+
+private:
+	COpenNI&				m_OpenNI;
+	CFrameStats				m_Stats;
+	CSkeletonSnapshot		m_Skeleton;
+	CGestureTracker			m_Gesture;
+	CSkeletonStreamWriter	m_Writer;
+
+	static volatile sig_atomic_t	s_bInterrupted;
+};
+volatile sig_atomic_t CHeadlessTracker::s_bInterrupted = 0;
+
+/* Main function
+ * "KinectDemo [--headless output] [--users] [--filter] [--joints euro|holt] [--predict ms] [--gestures file [--record name]] [--sync ms] [--register calibration|kinect] [--roi] [--profile qvga60|vga30|sxga15] [recording.oni|dump.raw]"
+ * replays a file instead of the sensor, and with "--headless" writes skeletons
+ * and gestures to output without GUI, no image node and no depth colorization.
+ * "--users" colors the pixels of every user on the image, "--filter" fills holes
+ * and smoothes the depth before it is shown, "--joints" smoothes the skeleton
+ * with a One Euro or a Holt filter. "--predict" draws the skeleton where it is
+ * predicted to be when shown, ms is the latency before the data is ready and
+ * after the frame is handled. "--gestures" shows the recorded gestures of file
+ * done by any user, "--record" first records one more, two seconds after a
+ * user is tracked. "--sync" only shows depth and image taken at most ms apart;
+ * the skeleton is not synchronized, it is of the newest depth and may be a
+ * frame ahead, and the users are left out of a pair older than the newest depth.
+ * "--register" aligns the depth to the image in software, with the calibration
+ * file or "kinect" for a typical Kinect, also on recordings and raw dumps.
+ * "--roi" colorizes the depth only around the tracked users. "--profile" sets
+ * the resolution and frame rate of the sensor, qvga60 for the lowest latency */
 int main( int argc, char** argv )
 {
+	const char* sHeadless = NULL;
+	const char* sRecording = NULL;
+	bool bShowUsers = false;
+	bool bFilter = false;
+	CJointFilter::EMode eJoints = CJointFilter::FILTER_NONE;
+	int iPredict = -1;
+	const char* sGestures = NULL;
+	const char* sRecord = NULL;
+	int iSync = -1;
+	const char* sRegister = NULL;
+	bool bROI = false;
+	const char* sProfile = NULL;
+	for( int i = 1; i < argc; ++ i )
+	{
+		if( strcmp( argv[i], "--headless" ) == 0 && i + 1 < argc )
+			sHeadless = argv[++i];
+		else if( strcmp( argv[i], "--users" ) == 0 )
+			bShowUsers = true;
+		else if( strcmp( argv[i], "--filter" ) == 0 )
+			bFilter = true;
+		else if( strcmp( argv[i], "--joints" ) == 0 && i + 1 < argc )
+		{
+			++i;
+			if( strcmp( argv[i], "euro" ) == 0 )
+				eJoints = CJointFilter::FILTER_ONE_EURO;
+			else if( strcmp( argv[i], "holt" ) == 0 )
+				eJoints = CJointFilter::FILTER_HOLT;
+		}
+		else if( strcmp( argv[i], "--predict" ) == 0 && i + 1 < argc )
+			iPredict = atoi( argv[++i] );
+		else if( strcmp( argv[i], "--gestures" ) == 0 && i + 1 < argc )
+			sGestures = argv[++i];
+		else if( strcmp( argv[i], "--record" ) == 0 && i + 1 < argc )
+			sRecord = argv[++i];
+		else if( strcmp( argv[i], "--sync" ) == 0 && i + 1 < argc )
+			iSync = atoi( argv[++i] );
+		else if( strcmp( argv[i], "--register" ) == 0 && i + 1 < argc )
+			sRegister = argv[++i];
+		else if( strcmp( argv[i], "--roi" ) == 0 )
+			bROI = true;
+		else if( strcmp( argv[i], "--profile" ) == 0 && i + 1 < argc )
+			sProfile = argv[++i];
+		else
+			sRecording = argv[i];
+	}
+
+	// a gesture is recorded into the templates file
+	if( sRecord != NULL && sGestures == NULL )
+	{
+		cerr << "--record needs --gestures file" << endl;
+		return 1;
+	}
+
 	// initial OpenNI
 	COpenNI mOpenNI;
     //bool bStatus = true;
-	if( !mOpenNI.Initial() )
+	mOpenNI.EnableImage( sHeadless == NULL );
+	if( sProfile != NULL )
+	{
+		const SCaptureProfile* pProfile = SCaptureProfile::Find( sProfile );
+		if( pProfile == NULL )
+		{
+			cerr << "Unknown profile " << sProfile << endl;
+			return 1;
+		}
+		mOpenNI.SetProfile( pProfile );
+	}
+	if( sRegister != NULL && !mOpenNI.RegisterDepth( strcmp( sRegister, "kinect" ) == 0 ? NULL : sRegister ) )
 		return 1;
+	if( !( sRecording ? mOpenNI.Initial( sRecording ) : mOpenNI.Initial() ) )
+		return 1;
+
+	// no QApplication, no scene, no pixmaps
+	if( sHeadless != NULL )
+	{
+		CHeadlessTracker mTracker( mOpenNI );
+		return mTracker.Run( sHeadless ) ? 0 : 1;
+	}
 
 	// Qt Application
 	QApplication App( argc, argv );
@@ -548,6 +978,16 @@ int main( int argc, char** argv )
 
 	// Timer to update image
 	CKinectReader KReader( mOpenNI, qScene );
+	KReader.ShowUsers( bShowUsers );
+	KReader.FilterDepth( bFilter );
+	KReader.UseROI( bROI );
+	KReader.SmoothJoints( eJoints );
+	if( iPredict >= 0 )
+		KReader.PredictJoints( iPredict * 1000 );
+	if( sGestures != NULL )
+		KReader.RecognizeGestures( sGestures, sRecord );
+	if( iSync >= 0 )
+		KReader.SyncFrames( iSync * 1000 );
 
 	// start!
 	KReader.Start();